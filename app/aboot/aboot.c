@@ -33,6 +33,7 @@
 #include <app.h>
 #include <array.h>
 #include <debug.h>
+#include <stdlib.h>
 #include <platform.h>
 #include <string.h>
 #include <target.h>
@@ -42,17 +43,25 @@
 #include <dev/keys.h>
 #include <dev/fbcon.h>
 #include <dev/udc.h>
+#include <dev/udc_acm.h>
+#include <dev/udc_msc.h>
 #include <dev/usb.h>
 #include <kernel/thread.h>
 #include <lib/ptable.h>
 
 #include "recovery.h"
 #include "bootimg.h"
+#include "sparse_format.h"
 #include "fastboot.h"
 
 #define EXPAND(NAME) #NAME
 #define TARGET(NAME) EXPAND(NAME)
 
+/* partitions a WITH_USB_MSC build exposes as USB mass storage */
+#ifndef USB_MSC_PARTITIONS
+#define USB_MSC_PARTITIONS "cache,userdata,backup"
+#endif
+
 struct atag_ptbl_entry {
 	char name[16];
 	unsigned offset;
@@ -150,10 +159,110 @@ void boot_linux(void *kernel, unsigned *tags,
 unsigned page_size = 0;
 unsigned page_mask = 0;
 
+/* scratch area bytes for fastboot, less what the mass storage function
+** has at the top */
+static unsigned scratch_size;
+
 #define ROUND_TO_PAGE(x,y) (((x) + (y)) & (~(y)))
 
 static unsigned char buf[4096];	//Equal to max-supported pagesize
 
+/* Flash access from here goes through the flash worker thread, which
+** also runs the mass storage gadget's, so the two never drive the NAND
+** controller at the same time.  Its cache of a partition is written
+** back and dropped before the partition is erased or written.
+*/
+static void fb_msc_invalidate(struct ptentry *ptn)
+{
+#if WITH_USB_MSC
+	udc_msc_invalidate(ptn);
+#endif
+}
+
+static int fb_flash_read(struct ptentry *ptn, unsigned offset, void *data,
+			 unsigned bytes)
+{
+	struct flash_op op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = FLASH_OP_READ;
+	op.ptn = ptn;
+	op.offset = offset;
+	op.data = data;
+	op.bytes = bytes;
+	return flash_op_call(&op);
+}
+
+static int fb_flash_write(struct ptentry *ptn, unsigned extra_per_page,
+			  void *data, unsigned bytes, unsigned flags)
+{
+	struct flash_op op;
+
+	fb_msc_invalidate(ptn);
+	memset(&op, 0, sizeof(op));
+	op.type = FLASH_OP_WRITE;
+	op.ptn = ptn;
+	op.extra_per_page = extra_per_page;
+	op.data = data;
+	op.bytes = bytes;
+	op.flags = flags;
+	return flash_op_call(&op);
+}
+
+static int fb_flash_erase(struct ptentry *ptn)
+{
+	struct flash_op op;
+
+	fb_msc_invalidate(ptn);
+	memset(&op, 0, sizeof(op));
+	op.type = FLASH_OP_ERASE;
+	op.ptn = ptn;
+	return flash_op_call(&op);
+}
+
+static unsigned fb_flash_good_blocks(struct ptentry *ptn)
+{
+	struct flash_op op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = FLASH_OP_GOOD;
+	op.ptn = ptn;
+	if (flash_op_call(&op) < 0)
+		return 0;
+	return op.result;
+}
+
+static int fb_stream_open(struct flash_stream *s, struct ptentry *ptn,
+			  unsigned extra_per_page, unsigned flags)
+{
+	struct flash_op op;
+
+	fb_msc_invalidate(ptn);
+	memset(&op, 0, sizeof(op));
+	op.type = FLASH_OP_OPEN;
+	op.stream = s;
+	op.ptn = ptn;
+	op.extra_per_page = extra_per_page;
+	op.flags = flags;
+	return flash_op_call(&op);
+}
+
+/* FLASH_OP_STREAM, FLASH_OP_FILL (with 'value'), FLASH_OP_SKIP and
+** FLASH_OP_CLOSE */
+static int fb_stream(struct flash_stream *s, unsigned type, void *data,
+		     unsigned bytes, unsigned value)
+{
+	struct flash_op op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = type;
+	op.stream = s;
+	op.data = data;
+	op.bytes = bytes;
+	op.offset = value;
+	return flash_op_call(&op);
+}
+
 int boot_linux_from_flash(void)
 {
 	struct boot_img_hdr *hdr = (void *)buf;
@@ -162,6 +271,7 @@ int boot_linux_from_flash(void)
 	struct ptable *ptable;
 	unsigned offset = 0;
 	const char *cmdline;
+	struct flash_read_stats stats;
 
 	ptable = flash_get_ptable();
 	if (ptable == NULL) {
@@ -184,7 +294,8 @@ int boot_linux_from_flash(void)
 		}
 	}
 
-	if (flash_read(ptn, offset, buf, page_size)) {
+	flash_reset_read_stats();
+	if (fb_flash_read(ptn, offset, buf, page_size)) {
 		dprintf(CRITICAL, "ERROR: Cannot read boot image header\n");
 		return -1;
 	}
@@ -208,19 +319,26 @@ int boot_linux_from_flash(void)
 	}
 
 	n = ROUND_TO_PAGE(hdr->kernel_size, page_mask);
-	if (flash_read(ptn, offset, (void *)hdr->kernel_addr, n)) {
+	if (fb_flash_read(ptn, offset, (void *)hdr->kernel_addr, n)) {
 		dprintf(CRITICAL, "ERROR: Cannot read kernel image\n");
 		return -1;
 	}
 	offset += n;
 
 	n = ROUND_TO_PAGE(hdr->ramdisk_size, page_mask);
-	if (flash_read(ptn, offset, (void *)hdr->ramdisk_addr, n)) {
+	if (fb_flash_read(ptn, offset, (void *)hdr->ramdisk_addr, n)) {
 		dprintf(CRITICAL, "ERROR: Cannot read ramdisk image\n");
 		return -1;
 	}
 	offset += n;
 
+	flash_get_read_stats(&stats);
+	dprintf(INFO, "flash: %d pages in %d chains, wait %d us, check %d us, "
+		"controller idle %d us (%d stalls)\n", stats.pages,
+		stats.chains, (unsigned)stats.wait_time,
+		(unsigned)stats.check_time, (unsigned)stats.idle_time,
+		stats.stalls);
+
 	dprintf(INFO, "\nkernel  @ %x (%d bytes)\n", hdr->kernel_addr,
 		hdr->kernel_size);
 	dprintf(INFO, "ramdisk @ %x (%d bytes)\n", hdr->ramdisk_addr,
@@ -302,18 +420,930 @@ void cmd_erase(const char *arg, void *data, unsigned sz)
 		return;
 	}
 
-	if (flash_erase(ptn)) {
+	if (fb_flash_erase(ptn)) {
 		fastboot_fail("failed to erase partition");
 		return;
 	}
 	fastboot_okay("");
 }
 
+/* flash_write_ext() flags for "flash:", set with "oem diff-flash:on|off" */
+static unsigned flash_write_flags;
+static char diff_flash_var[4] = "off";
+
+void cmd_oem_diff_flash(const char *arg, void *data, unsigned sz)
+{
+	if (!strcmp(arg, "on")) {
+		flash_write_flags |= FLASH_WRITE_DIFF;
+	} else if (!strcmp(arg, "off")) {
+		flash_write_flags &= ~FLASH_WRITE_DIFF;
+	} else {
+		fastboot_fail("expected on or off");
+		return;
+	}
+	strcpy(diff_flash_var, arg);
+	fastboot_okay("");
+}
+
+/* Expand an Android sparse image into 'ptn' as it is parsed: raw chunks
+** are programmed straight from the download buffer, fill chunks from one
+** pattern page, and don't care chunks leave their blocks erased.
+*/
+static int flash_sparse_image(struct ptentry *ptn, void *data, unsigned sz)
+{
+	sparse_header_t *header = data;
+	chunk_header_t *chunk;
+	struct flash_stream *s;
+	unsigned char *p = data;
+	unsigned char *end = p + sz;
+	unsigned blocks = 0;
+	unsigned bytes, fill, n;
+	int r = 0;
+
+	if (sz < sizeof(*header) || header->major_version !=
+	    SPARSE_HEADER_MAJOR_VER || header->file_hdr_sz < sizeof(*header)
+	    || header->chunk_hdr_sz < sizeof(*chunk)) {
+		fastboot_fail("bad sparse image header");
+		return -1;
+	}
+	if (!header->blk_sz || header->blk_sz % page_size) {
+		fastboot_fail("sparse block size is not a multiple of the page");
+		return -1;
+	}
+
+	dprintf(INFO, "sparse image: %d blocks of %d bytes in %d chunks\n",
+		header->total_blks, header->blk_sz, header->total_chunks);
+
+	s = malloc(sizeof(*s));
+	if (!s) {
+		fastboot_fail("out of memory");
+		return -1;
+	}
+	if (fb_stream_open(s, ptn, 0, flash_write_flags)) {
+		fb_stream(s, FLASH_OP_CLOSE, NULL, 0, 0);
+		free(s);
+		fastboot_fail("flash write failure");
+		return -1;
+	}
+
+	p += header->file_hdr_sz;
+	for (n = 0; n < header->total_chunks; n++) {
+		chunk = (chunk_header_t *) p;
+		if (p > end || (unsigned)(end - p) < header->chunk_hdr_sz ||
+		    chunk->total_sz < header->chunk_hdr_sz ||
+		    chunk->total_sz > (unsigned)(end - p) ||
+		    chunk->chunk_sz > ~0U / header->blk_sz) {
+			fastboot_fail("sparse chunk out of bounds");
+			r = -1;
+			break;
+		}
+		bytes = chunk->chunk_sz * header->blk_sz;
+		p += header->chunk_hdr_sz;
+
+		switch (chunk->chunk_type) {
+		case CHUNK_TYPE_RAW:
+			if (chunk->total_sz - header->chunk_hdr_sz != bytes) {
+				fastboot_fail("bogus raw chunk size");
+				r = -1;
+				break;
+			}
+			r = fb_stream(s, FLASH_OP_STREAM, p, bytes, 0);
+			break;
+		case CHUNK_TYPE_FILL:
+			if (chunk->total_sz - header->chunk_hdr_sz != 4) {
+				fastboot_fail("bogus fill chunk size");
+				r = -1;
+				break;
+			}
+			memcpy(&fill, p, 4);
+			r = fb_stream(s, FLASH_OP_FILL, NULL, bytes, fill);
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			r = fb_stream(s, FLASH_OP_SKIP, NULL, bytes, 0);
+			break;
+		case CHUNK_TYPE_CRC32:
+			/* the output is only checked by reading it back */
+			bytes = 0;
+			break;
+		default:
+			fastboot_fail("unknown sparse chunk type");
+			r = -1;
+			break;
+		}
+		if (r) {
+			if (s->error)
+				fastboot_fail("flash write failure");
+			break;
+		}
+
+		blocks += chunk->chunk_sz;
+		p += chunk->total_sz - header->chunk_hdr_sz;
+	}
+
+	if (!r && blocks != header->total_blks) {
+		fastboot_fail("sparse image block count mismatch");
+		r = -1;
+	}
+	if (r)
+		s->error = 1;	/* leave the rest of the partition alone */
+	if (fb_stream(s, FLASH_OP_CLOSE, NULL, 0, 0) && !r) {
+		fastboot_fail("flash write failure");
+		r = -1;
+	}
+	free(s);
+	return r;
+}
+
+/* Spare bytes per page carried by images of 'ptn' */
+static unsigned ptn_extra_per_page(struct ptentry *ptn)
+{
+	if (!strcmp(ptn->name, "system") || !strcmp(ptn->name, "userdata")
+	    || !strcmp(ptn->name, "persist"))
+		return (page_size >> 9) * 16;
+	return 0;
+}
+
+/* Streaming flash: after "oem stream-flash:<partition>" the next download
+** is programmed into the partition while it is still arriving.  Chunks
+** of one block are received into a ring of buffers in the scratch area
+** and handed to the flash worker thread, so USB and NAND run side by
+** side and the image may be larger than the download buffer.  The
+** "flash:" command that follows only reports the result.  Sparse images
+** are collected and flashed as usual.
+*/
+#define STREAM_RING	4
+
+static struct stream_flash {
+	struct fastboot_sink sink;
+	struct ptentry *ptn;
+	struct flash_stream stream;
+	struct flash_op op[STREAM_RING];
+	unsigned busy;		/* ops submitted and not yet waited for */
+	unsigned char *ring;
+	unsigned chunk;		/* bytes per ring buffer, one block */
+	unsigned extra;
+	unsigned size;		/* announced download size */
+	unsigned received;
+	unsigned next;		/* ring buffer get() hands out next */
+	int opened;
+	int error;
+	int done;		/* last download went into 'ptn' */
+} sflash;
+
+static void stream_flash_wait(struct stream_flash *sf, unsigned k)
+{
+	if (!(sf->busy & (1U << k)))
+		return;
+	if (flash_op_wait(&sf->op[k]))
+		sf->error = 1;
+	sf->busy &= ~(1U << k);
+}
+
+static int stream_flash_start(struct fastboot_sink *sink, unsigned size)
+{
+	struct stream_flash *sf = (struct stream_flash *)sink;
+	unsigned wsize;
+
+	sf->extra = ptn_extra_per_page(sf->ptn);
+	wsize = page_size + sf->extra;
+	if (size != FASTBOOT_SINK_UNKNOWN &&
+	    size > sf->ptn->length * 64 * wsize) {
+		sink->reason = "image too large for partition";
+		return -1;
+	}
+
+	sf->chunk = 64 * wsize;
+	sf->ring = target_get_scratch_address();
+	if (STREAM_RING * sf->chunk > scratch_size) {
+		sink->reason = "scratch area too small";
+		return -1;
+	}
+	sf->size = size;
+	sf->received = 0;
+	sf->next = 0;
+	sf->busy = 0;
+	sf->opened = 0;
+	sf->error = 0;
+	sf->done = 0;
+	return 0;
+}
+
+static void *stream_flash_get(struct fastboot_sink *sink, unsigned *size)
+{
+	struct stream_flash *sf = (struct stream_flash *)sink;
+	unsigned k = sf->next++ % STREAM_RING;
+
+	stream_flash_wait(sf, k);
+	*size = sf->chunk;
+	return sf->ring + k * sf->chunk;
+}
+
+static int stream_flash_put(struct fastboot_sink *sink, void *buf,
+			    unsigned len)
+{
+	struct stream_flash *sf = (struct stream_flash *)sink;
+	unsigned k = ((unsigned char *)buf - sf->ring) / sf->chunk;
+	unsigned wsize = page_size + sf->extra;
+	unsigned pad;
+
+	if (!sf->received) {
+		if (len >= sizeof(sparse_header_t) &&
+		    ((sparse_header_t *) buf)->magic == SPARSE_HEADER_MAGIC)
+			return FASTBOOT_SINK_COLLECT;
+		if ((!strcmp(sf->ptn->name, "boot")
+		     || !strcmp(sf->ptn->name, "recovery"))
+		    && (len < BOOT_MAGIC_SIZE
+			|| memcmp(buf, BOOT_MAGIC, BOOT_MAGIC_SIZE))) {
+			sink->reason = "image is not a boot image";
+			return -1;
+		}
+		if (sf->size == FASTBOOT_SINK_UNKNOWN)
+			dprintf(INFO, "streaming to '%s'\n", sf->ptn->name);
+		else
+			dprintf(INFO, "streaming %d bytes to '%s'\n", sf->size,
+				sf->ptn->name);
+		sf->opened = 1;
+		if (fb_stream_open(&sf->stream, sf->ptn, sf->extra,
+				   flash_write_flags))
+			return -1;
+	}
+	sf->received += len;
+	if (sf->error)
+		return -1;
+
+	/* only the end of an image without spare bytes may be a partial
+	 ** page (only the last chunk can be short); it is padded like
+	 ** flash: pads it */
+	pad = len % wsize;
+	if (pad) {
+		if (sf->extra) {
+			sink->reason = "image is not a whole number of pages";
+			return -1;
+		}
+		memset((unsigned char *)buf + len, 0xff, wsize - pad);
+		len += wsize - pad;
+	}
+
+	sf->op[k].type = FLASH_OP_STREAM;
+	sf->op[k].stream = &sf->stream;
+	sf->op[k].data = buf;
+	sf->op[k].bytes = len;
+	sf->op[k].complete = NULL;
+	if (flash_submit(&sf->op[k]))
+		return -1;
+	sf->busy |= 1U << k;
+	return 0;
+}
+
+static int stream_flash_finish(struct fastboot_sink *sink, int complete)
+{
+	struct stream_flash *sf = (struct stream_flash *)sink;
+	unsigned k;
+
+	for (k = 0; k < STREAM_RING; k++)
+		stream_flash_wait(sf, k);
+	if (!sf->opened)
+		return 0;
+
+	if (sf->error || !complete)
+		sf->stream.error = 1;	/* leave the rest of the partition */
+	if (fb_stream(&sf->stream, FLASH_OP_CLOSE, NULL, 0, 0))
+		return -1;
+
+	dprintf(INFO, "partition '%s' updated\n", sf->ptn->name);
+	sf->done = 1;
+	return 0;
+}
+
+void cmd_oem_stream_flash(const char *arg, void *data, unsigned sz)
+{
+	struct ptable *ptable;
+	struct ptentry *ptn;
+
+	ptable = flash_get_ptable();
+	if (ptable == NULL) {
+		fastboot_fail("partition table doesn't exist");
+		return;
+	}
+
+	ptn = ptable_find(ptable, arg);
+	if (ptn == NULL) {
+		fastboot_fail("unknown partition name");
+		return;
+	}
+
+	sflash.sink.start = stream_flash_start;
+	sflash.sink.get = stream_flash_get;
+	sflash.sink.put = stream_flash_put;
+	sflash.sink.finish = stream_flash_finish;
+	sflash.ptn = ptn;
+	sflash.done = 0;
+	fastboot_stream(&sflash.sink);
+	fastboot_okay("");
+}
+
+/* Flash bundles: after "oem bundle" the next download is a tar archive
+** whose first member, "manifest", names the partition for each image
+** with lines of "<partition> <file>".  The images are streamed into
+** their partitions as the archive arrives, so a whole device is flashed
+** in one download, and "flash:bundle" then reports each partition in
+** INFO lines.  Member data is copied from the receive buffer into a ring
+** of block sized buffers for the flash worker thread, which also opens
+** and closes the partition streams, so the end of one partition is
+** programmed and the rest of it erased while the next one comes in.
+** Sparse images can't be bundled.
+*/
+#define BUNDLE_MAX	16
+#define BUNDLE_MANIFEST	2048
+#define BUNDLE_PROGRESS	(4 * 1024 * 1024)
+#define TAR_BLOCK	512
+
+#define BUNDLE_HEADER	0	/* expecting a tar header */
+#define BUNDLE_MANIFEST_DATA	1
+#define BUNDLE_IMAGE	2
+#define BUNDLE_SKIP	3	/* member that is not a regular file */
+#define BUNDLE_END	4	/* end of archive seen */
+
+struct bundle_entry {
+	char file[32];
+	struct ptentry *ptn;
+	unsigned extra;
+	unsigned bytes;
+	unsigned received;
+	int state;		/* 0 listed, 1 flashing, 2 closed */
+	int result;
+	time_t start;
+	time_t end;		/* set by the flash worker */
+};
+
+static struct bundle {
+	struct fastboot_sink sink;
+	struct bundle_entry entry[BUNDLE_MAX];
+	unsigned count;
+	char manifest[BUNDLE_MANIFEST + 1];
+	unsigned manifest_len;
+	unsigned char header[TAR_BLOCK];
+	unsigned header_fill;
+	int mode;
+	unsigned left;		/* bytes of the current member to come */
+	unsigned pad;		/* tar padding behind it */
+	struct bundle_entry *cur;
+	unsigned progress;	/* member bytes at the next progress line */
+	struct flash_stream stream[2];	/* current and closing partition */
+	struct flash_op ctl[2][2];	/* open and close for each stream */
+	unsigned ctl_busy;
+	unsigned hold[2];	/* ring buffers each close still needs */
+	unsigned slot;		/* stream of the current member */
+	unsigned opened;	/* streams opened so far */
+	struct flash_op op[STREAM_RING];
+	unsigned busy;
+	unsigned char *ring;
+	unsigned chunk;		/* bytes per ring buffer */
+	unsigned next;		/* ring buffer being filled */
+	unsigned fill;		/* bytes in it */
+	unsigned char *rx;
+	unsigned received;
+	time_t start;
+	time_t end;
+	int error;
+	int done;		/* last download was a complete bundle */
+	char why[64];
+} bundle;
+
+static void bundle_ctl_wait(struct bundle *b, unsigned slot)
+{
+	unsigned k;
+
+	for (k = 0; k < 2; k++) {
+		if (!(b->ctl_busy & (1U << (slot * 2 + k))))
+			continue;
+		if (flash_op_wait(&b->ctl[slot][k]))
+			b->error = 1;
+		b->ctl_busy &= ~(1U << (slot * 2 + k));
+	}
+	b->hold[slot] = 0;
+}
+
+/* A stream keeps the pages of a partial block until it is closed, so
+** the ring buffer with the end of an image is free only after that */
+static void bundle_wait(struct bundle *b, unsigned k)
+{
+	unsigned slot;
+
+	if (b->busy & (1U << k)) {
+		if (flash_op_wait(&b->op[k]))
+			b->error = 1;
+		b->busy &= ~(1U << k);
+	}
+	for (slot = 0; slot < 2; slot++)
+		if (b->hold[slot] & (1U << k))
+			bundle_ctl_wait(b, slot);
+}
+
+static int bundle_fail(struct bundle *b, const char *why, const char *name)
+{
+	if (name)
+		snprintf(b->why, sizeof(b->why), "%s: %s", name, why);
+	else
+		snprintf(b->why, sizeof(b->why), "%s", why);
+	b->sink.reason = b->why;
+	b->error = 1;
+	return -1;
+}
+
+/* Runs in the flash worker once a partition's stream is closed */
+static void bundle_closed(struct flash_op *op)
+{
+	struct bundle_entry *e = op->arg;
+	unsigned ms;
+
+	e->end = current_time();
+	e->result = op->result;
+	e->state = 2;
+	ms = e->end - e->start;
+	if (e->result)
+		dprintf(CRITICAL, "bundle: '%s' failed\n", e->ptn->name);
+	else
+		dprintf(INFO, "bundle: '%s' %d KB in %d ms\n", e->ptn->name,
+			e->bytes / 1024, ms);
+}
+
+static int bundle_submit(struct bundle *b, struct flash_op *op, unsigned type,
+			 void (*complete) (struct flash_op * op))
+{
+	op->type = type;
+	op->stream = &b->stream[b->slot];
+	op->ptn = b->cur->ptn;
+	op->extra_per_page = b->cur->extra;
+	op->flags = flash_write_flags;
+	op->complete = complete;
+	op->arg = b->cur;
+	if (flash_submit(op))
+		return bundle_fail(b, "flash write failure", b->cur->ptn->name);
+	return 0;
+}
+
+static unsigned tar_number(const unsigned char *p, unsigned len)
+{
+	unsigned n = 0;
+
+	while (len > 0 && *p == ' ') {
+		p++;
+		len--;
+	}
+	while (len > 0 && *p >= '0' && *p <= '7') {
+		if (n > (~0U >> 3))
+			return ~0U;
+		n = (n << 3) | (*p++ - '0');
+		len--;
+	}
+	if (len > 0 && *p != ' ' && *p != 0)
+		return ~0U;
+	return n;
+}
+
+static int bundle_parse_manifest(struct bundle *b)
+{
+	struct ptable *ptable = flash_get_ptable();
+	struct bundle_entry *e;
+	char *line, *next, *name, *file;
+	unsigned n;
+
+	b->manifest[b->manifest_len] = 0;
+	for (line = b->manifest; line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+		name = line;
+		while (*name == ' ' || *name == '\t')
+			name++;
+		if (!*name || *name == '#' || *name == '\r')
+			continue;
+		file = name;
+		while (*file && *file != ' ' && *file != '\t')
+			file++;
+		if (*file)
+			*file++ = 0;
+		while (*file == ' ' || *file == '\t')
+			file++;
+		n = strlen(file);
+		while (n > 0 && (file[n - 1] == ' ' || file[n - 1] == '\t'
+				 || file[n - 1] == '\r'))
+			file[--n] = 0;
+		if (!n)
+			return bundle_fail(b, "no file in manifest", name);
+		if (n >= sizeof(e->file))
+			return bundle_fail(b, "file name too long", name);
+		if (b->count == BUNDLE_MAX)
+			return bundle_fail(b, "too many images", NULL);
+
+		e = &b->entry[b->count];
+		memset(e, 0, sizeof(*e));
+		e->ptn = ptable_find(ptable, name);
+		if (!e->ptn)
+			return bundle_fail(b, "unknown partition", name);
+		for (n = 0; n < b->count; n++)
+			if (b->entry[n].ptn == e->ptn)
+				return bundle_fail(b, "listed twice", name);
+		strcpy(e->file, file);
+		e->extra = ptn_extra_per_page(e->ptn);
+		b->count++;
+	}
+	if (!b->count)
+		return bundle_fail(b, "empty manifest", NULL);
+
+	dprintf(INFO, "bundle: %d images\n", b->count);
+	return 0;
+}
+
+/* Hand what is collected in the current ring buffer to the stream */
+static int bundle_flush(struct bundle *b)
+{
+	unsigned k = b->next % STREAM_RING;
+	unsigned wsize = page_size + b->cur->extra;
+	unsigned pad = b->fill % wsize;
+
+	if (!b->fill)
+		return 0;
+	if (pad) {
+		/* end of an image without spare bytes */
+		memset(b->ring + k * b->chunk + b->fill, 0xff, wsize - pad);
+		b->fill += wsize - pad;
+	}
+	b->op[k].data = b->ring + k * b->chunk;
+	b->op[k].bytes = b->fill;
+	if (bundle_submit(b, &b->op[k], FLASH_OP_STREAM, NULL))
+		return -1;
+	b->busy |= 1U << k;
+	if (b->fill < 64 * wsize)
+		b->hold[b->slot] |= 1U << k;
+	b->next++;
+	b->fill = 0;
+	return 0;
+}
+
+static int bundle_image_start(struct bundle *b, const char *name,
+			      unsigned size)
+{
+	struct bundle_entry *e;
+	unsigned n, wsize;
+
+	for (n = 0; n < b->count; n++)
+		if (!strcmp(b->entry[n].file, name))
+			break;
+	if (n == b->count)
+		return bundle_fail(b, "not in manifest", name);
+	e = &b->entry[n];
+	if (e->state)
+		return bundle_fail(b, "appears twice", name);
+
+	wsize = page_size + e->extra;
+	if (size > e->ptn->length * 64 * wsize)
+		return bundle_fail(b, "image too large for partition", name);
+	if (e->extra && size % wsize)
+		return bundle_fail(b, "image is not a whole number of pages",
+				   name);
+
+	/* the stream used two images ago must be closed */
+	b->slot = b->opened++ & 1;
+	bundle_ctl_wait(b, b->slot);
+	if (b->error)
+		return bundle_fail(b, "flash write failure", NULL);
+
+	b->cur = e;
+	e->bytes = size;
+	e->state = 1;
+	e->start = current_time();
+	b->progress = BUNDLE_PROGRESS;
+	dprintf(INFO, "bundle: %s -> '%s', %d bytes\n", name, e->ptn->name,
+		size);
+	fb_msc_invalidate(e->ptn);
+	if (bundle_submit(b, &b->ctl[b->slot][0], FLASH_OP_OPEN, NULL)) {
+		b->cur = NULL;
+		return -1;
+	}
+	b->ctl_busy |= 1U << (b->slot * 2);
+	return 0;
+}
+
+static int bundle_image_end(struct bundle *b)
+{
+	struct flash_op *op = &b->ctl[b->slot][1];
+
+	if (bundle_flush(b))
+		return -1;
+	if (bundle_submit(b, op, FLASH_OP_CLOSE, bundle_closed))
+		return -1;
+	b->ctl_busy |= 1U << (b->slot * 2 + 1);
+	b->cur = NULL;
+	return 0;
+}
+
+static int bundle_header(struct bundle *b)
+{
+	unsigned char *h = b->header;
+	char name[101];
+	unsigned sum, size, n;
+	char *p;
+
+	for (n = 0; n < TAR_BLOCK; n++)
+		if (h[n])
+			break;
+	if (n == TAR_BLOCK) {
+		b->mode = BUNDLE_END;
+		return 0;
+	}
+
+	for (sum = 0, n = 0; n < TAR_BLOCK; n++)
+		sum += (n >= 148 && n < 156) ? ' ' : h[n];
+	if (memcmp(h + 257, "ustar", 5) || sum != tar_number(h + 148, 8))
+		return bundle_fail(b, "bundle is not a tar archive", NULL);
+	size = tar_number(h + 124, 12);
+	if (size == ~0U)
+		return bundle_fail(b, "bad tar member size", NULL);
+
+	memcpy(name, h, 100);
+	name[100] = 0;
+	p = name;
+	while (p[0] == '.' && p[1] == '/')
+		p += 2;
+
+	b->left = size;
+	b->pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+	if (h[156] != '0' && h[156] != 0) {
+		b->mode = BUNDLE_SKIP;	/* directories, pax headers */
+		return 0;
+	}
+
+	if (!b->manifest_len && !b->count) {
+		if (strcmp(p, "manifest"))
+			return bundle_fail(b, "bundle must start with manifest",
+					   NULL);
+		if (!size || size > BUNDLE_MANIFEST)
+			return bundle_fail(b, "bad manifest size", NULL);
+		b->mode = BUNDLE_MANIFEST_DATA;
+		return 0;
+	}
+
+	if (bundle_image_start(b, p, size))
+		return -1;
+	b->mode = BUNDLE_IMAGE;
+	if (!size)
+		return bundle_image_end(b);
+	return 0;
+}
+
+static int bundle_image_data(struct bundle *b, unsigned char *p, unsigned len)
+{
+	struct bundle_entry *e = b->cur;
+	unsigned block = 64 * (page_size + e->extra);
+	unsigned k, n;
+
+	if (!e->received) {
+		if (len >= sizeof(sparse_header_t) &&
+		    ((sparse_header_t *) p)->magic == SPARSE_HEADER_MAGIC)
+			return bundle_fail(b, "sparse image in bundle",
+					   e->file);
+		if ((!strcmp(e->ptn->name, "boot")
+		     || !strcmp(e->ptn->name, "recovery"))
+		    && (len < BOOT_MAGIC_SIZE
+			|| memcmp(p, BOOT_MAGIC, BOOT_MAGIC_SIZE)))
+			return bundle_fail(b, "not a boot image", e->file);
+	}
+	e->received += len;
+
+	while (len > 0) {
+		k = b->next % STREAM_RING;
+		if (!b->fill) {
+			bundle_wait(b, k);
+			if (b->error)
+				return bundle_fail(b, "flash write failure",
+						   e->ptn->name);
+		}
+		n = block - b->fill;
+		if (n > len)
+			n = len;
+		memcpy(b->ring + k * b->chunk + b->fill, p, n);
+		b->fill += n;
+		p += n;
+		len -= n;
+		if (b->fill == block && bundle_flush(b))
+			return -1;
+	}
+
+	if (e->received >= b->progress) {
+		dprintf(INFO, "bundle: '%s' %d/%d KB\n", e->ptn->name,
+			e->received / 1024, e->bytes / 1024);
+		b->progress += BUNDLE_PROGRESS;
+	}
+	if (e->received == e->bytes)
+		return bundle_image_end(b);
+	return 0;
+}
+
+static int bundle_start(struct fastboot_sink *sink, unsigned size)
+{
+	struct bundle *b = (struct bundle *)sink;
+
+	/* every ring buffer holds a block of the partition with the most
+	 ** spare bytes; the receive buffer goes behind them */
+	b->chunk = 64 * (page_size + (page_size >> 9) * 16);
+	b->ring = target_get_scratch_address();
+	b->rx = b->ring + STREAM_RING * b->chunk;
+	if ((STREAM_RING + 1) * b->chunk > scratch_size) {
+		sink->reason = "scratch area too small";
+		return -1;
+	}
+
+	b->count = 0;
+	b->manifest_len = 0;
+	b->header_fill = 0;
+	b->mode = BUNDLE_HEADER;
+	b->left = 0;
+	b->pad = 0;
+	b->cur = NULL;
+	b->ctl_busy = 0;
+	b->hold[0] = b->hold[1] = 0;
+	b->opened = 0;
+	b->busy = 0;
+	b->next = 0;
+	b->fill = 0;
+	b->received = 0;
+	b->error = 0;
+	b->done = 0;
+	b->start = current_time();
+	return 0;
+}
+
+static void *bundle_get(struct fastboot_sink *sink, unsigned *size)
+{
+	struct bundle *b = (struct bundle *)sink;
+
+	*size = b->chunk;
+	return b->rx;
+}
+
+static int bundle_put(struct fastboot_sink *sink, void *buf, unsigned len)
+{
+	struct bundle *b = (struct bundle *)sink;
+	unsigned char *p = buf;
+	unsigned n;
+
+	b->received += len;
+	while (len > 0) {
+		if (b->error)
+			return -1;
+		if (b->mode == BUNDLE_END)
+			return 0;	/* zero blocks up to the record size */
+
+		if (b->mode == BUNDLE_HEADER) {
+			n = TAR_BLOCK - b->header_fill;
+			if (n > len)
+				n = len;
+			memcpy(b->header + b->header_fill, p, n);
+			b->header_fill += n;
+			p += n;
+			len -= n;
+			if (b->header_fill == TAR_BLOCK) {
+				b->header_fill = 0;
+				if (bundle_header(b))
+					return -1;
+			}
+			continue;
+		}
+
+		if (!b->left) {
+			/* padding to the next header */
+			n = (b->pad > len) ? len : b->pad;
+			b->pad -= n;
+			p += n;
+			len -= n;
+			if (!b->pad)
+				b->mode = BUNDLE_HEADER;
+			continue;
+		}
+
+		n = (b->left > len) ? len : b->left;
+		b->left -= n;
+		if (b->mode == BUNDLE_MANIFEST_DATA) {
+			memcpy(b->manifest + b->manifest_len, p, n);
+			b->manifest_len += n;
+			if (!b->left && bundle_parse_manifest(b))
+				return -1;
+		} else if (b->mode == BUNDLE_IMAGE) {
+			if (bundle_image_data(b, p, n))
+				return -1;
+		}
+		p += n;
+		len -= n;
+		if (!b->left && !b->pad)
+			b->mode = BUNDLE_HEADER;
+	}
+	return 0;
+}
+
+static int bundle_finish(struct fastboot_sink *sink, int complete)
+{
+	struct bundle *b = (struct bundle *)sink;
+	unsigned k;
+
+	for (k = 0; k < STREAM_RING; k++)
+		bundle_wait(b, k);
+	for (k = 0; k < 2; k++)
+		bundle_ctl_wait(b, k);
+
+	if (b->cur) {
+		/* cut off in the middle of an image: leave the rest of
+		 ** its partition alone */
+		b->stream[b->slot].error = 1;
+		fb_stream(&b->stream[b->slot], FLASH_OP_CLOSE, NULL, 0, 0);
+		b->cur->state = 2;
+		b->cur->result = -1;
+		b->cur = NULL;
+		if (!b->error)
+			bundle_fail(b, "bundle is truncated", NULL);
+	}
+	b->end = current_time();
+	if (b->error || !complete)
+		return -1;
+
+	for (k = 0; k < b->count; k++) {
+		if (b->entry[k].result)
+			return bundle_fail(b, "flash write failure",
+					   b->entry[k].ptn->name);
+		if (b->entry[k].state != 2)
+			return bundle_fail(b, "missing from bundle",
+					   b->entry[k].file);
+	}
+	if (!b->count)
+		return bundle_fail(b, "bundle is truncated", NULL);
+
+	dprintf(INFO, "bundle: %d images, %d KB in %d ms\n", b->count,
+		b->received / 1024, (unsigned)(b->end - b->start));
+	b->done = 1;
+	return 0;
+}
+
+void cmd_oem_bundle(const char *arg, void *data, unsigned sz)
+{
+	if (flash_get_ptable() == NULL) {
+		fastboot_fail("partition table doesn't exist");
+		return;
+	}
+
+	bundle.sink.start = bundle_start;
+	bundle.sink.get = bundle_get;
+	bundle.sink.put = bundle_put;
+	bundle.sink.finish = bundle_finish;
+	bundle.done = 0;
+	fastboot_stream(&bundle.sink);
+	fastboot_okay("");
+}
+
+static unsigned bundle_rate(unsigned bytes, unsigned ms)
+{
+	return ms ? (bytes / 1024) * 1000 / ms : 0;
+}
+
+/* "flash:bundle" after the download: one INFO line per image */
+static void cmd_flash_bundle(void)
+{
+	struct bundle_entry *e;
+	char line[60];
+	unsigned k, ms;
+
+	if (!bundle.done) {
+		fastboot_fail("no bundle downloaded");
+		return;
+	}
+	bundle.done = 0;
+
+	for (k = 0; k < bundle.count; k++) {
+		e = &bundle.entry[k];
+		ms = e->end - e->start;
+		snprintf(line, sizeof(line), "%s: %d KB in %d ms, %d KB/s",
+			 e->ptn->name, e->bytes / 1024, ms,
+			 bundle_rate(e->bytes, ms));
+		fastboot_info(line);
+	}
+	ms = bundle.end - bundle.start;
+	snprintf(line, sizeof(line), "bundle: %d KB in %d ms, %d KB/s",
+		 bundle.received / 1024, ms, bundle_rate(bundle.received, ms));
+	fastboot_info(line);
+	fastboot_okay("");
+}
+
 void cmd_flash(const char *arg, void *data, unsigned sz)
 {
 	struct ptentry *ptn;
 	struct ptable *ptable;
 	unsigned extra = 0;
+	int streamed;
+
+	if (!strcmp(arg, "bundle")) {
+		cmd_flash_bundle();
+		return;
+	}
 
 	ptable = flash_get_ptable();
 	if (ptable == NULL) {
@@ -327,6 +1357,18 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
 		return;
 	}
 
+	streamed = sflash.done;
+	sflash.done = 0;
+	if (streamed && !sz) {
+		/* the download already went to flash */
+		if (ptn != sflash.ptn) {
+			fastboot_fail("image was streamed to another partition");
+			return;
+		}
+		fastboot_okay("");
+		return;
+	}
+
 	if (!strcmp(ptn->name, "boot") || !strcmp(ptn->name, "recovery")) {
 		if (memcmp((void *)data, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
 			fastboot_fail("image is not a boot image");
@@ -334,14 +1376,22 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
 		}
 	}
 
-	if (!strcmp(ptn->name, "system") || !strcmp(ptn->name, "userdata")
-	    || !strcmp(ptn->name, "persist"))
-		extra = ((page_size >> 9) * 16);
-	else
+	if (sz >= sizeof(sparse_header_t) &&
+	    ((sparse_header_t *) data)->magic == SPARSE_HEADER_MAGIC) {
+		/* plain block device data, written without spare bytes */
+		if (flash_sparse_image(ptn, data, sz))
+			return;
+		dprintf(INFO, "partition '%s' updated\n", ptn->name);
+		fastboot_okay("");
+		return;
+	}
+
+	extra = ptn_extra_per_page(ptn);
+	if (!extra)
 		sz = ROUND_TO_PAGE(sz, page_mask);
 
 	dprintf(INFO, "writing %d bytes to '%s'\n", sz, ptn->name);
-	if (flash_write(ptn, extra, data, sz)) {
+	if (fb_flash_write(ptn, extra, data, sz, flash_write_flags)) {
 		fastboot_fail("flash write failure");
 		return;
 	}
@@ -349,6 +1399,184 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
 	fastboot_okay("");
 }
 
+/* Partition dumps: "oem dump:<partition>[:<offset>:<length>][:oob]"
+** stages partition data for the "upload" command (fastboot get_staged).
+** Offset and length count page data bytes and must be page aligned; the
+** default is everything from the offset on.  With "oob" each page is
+** followed by the spare bytes the driver keeps for it.  Blocks are read
+** by the flash worker thread into two buffers in the scratch area, one
+** filling while the other goes out over USB.  The download buffer is
+** clobbered.
+*/
+#define DUMP_BUFS	2
+
+static struct dump_flash {
+	struct fastboot_source src;
+	struct ptentry *ptn;
+	struct flash_op op[DUMP_BUFS];
+	unsigned len[DUMP_BUFS];
+	unsigned busy;		/* ops submitted and not yet waited for */
+	unsigned char *bufs;
+	unsigned chunk;		/* bytes per buffer, one block */
+	unsigned extra;
+	unsigned offset;	/* partition offset of the next read */
+	unsigned left;		/* bytes not yet submitted */
+	unsigned next;		/* buffer get() hands out next */
+	int error;
+} dflash;
+
+static void dump_flash_read(struct dump_flash *df, unsigned k)
+{
+	struct flash_op *op = &df->op[k];
+	unsigned bytes = df->left > df->chunk ? df->chunk : df->left;
+
+	if (!bytes || df->error)
+		return;
+
+	op->type = FLASH_OP_READ;
+	op->ptn = df->ptn;
+	op->extra_per_page = df->extra;
+	op->offset = df->offset;
+	op->data = df->bufs + k * df->chunk;
+	op->bytes = bytes;
+	op->complete = NULL;
+	if (flash_submit(op)) {
+		df->error = 1;
+		return;
+	}
+	df->busy |= 1U << k;
+	df->len[k] = bytes;
+	df->offset += bytes / (page_size + df->extra) * page_size;
+	df->left -= bytes;
+}
+
+static int dump_flash_wait(struct dump_flash *df, unsigned k)
+{
+	if (!(df->busy & (1U << k)))
+		return -1;
+	df->busy &= ~(1U << k);
+	if (flash_op_wait(&df->op[k])) {
+		df->error = 1;
+		return -1;
+	}
+	return 0;
+}
+
+static void *dump_flash_get(struct fastboot_source *src, unsigned *len)
+{
+	struct dump_flash *df = (struct dump_flash *)src;
+	unsigned k;
+
+	if (!df->next)
+		for (k = 0; k < DUMP_BUFS; k++)
+			dump_flash_read(df, k);
+
+	k = df->next++ % DUMP_BUFS;
+	if (dump_flash_wait(df, k)) {
+		src->reason = "flash read failure";
+		return NULL;
+	}
+	*len = df->len[k];
+	return df->bufs + k * df->chunk;
+}
+
+static void dump_flash_put(struct fastboot_source *src, void *buf)
+{
+	struct dump_flash *df = (struct dump_flash *)src;
+
+	dump_flash_read(df, ((unsigned char *)buf - df->bufs) / df->chunk);
+}
+
+static int dump_flash_finish(struct fastboot_source *src)
+{
+	struct dump_flash *df = (struct dump_flash *)src;
+	unsigned k;
+
+	for (k = 0; k < DUMP_BUFS; k++)
+		if (df->busy & (1U << k))
+			dump_flash_wait(df, k);
+	return df->error;
+}
+
+void cmd_oem_dump(const char *arg, void *data, unsigned sz)
+{
+	struct dump_flash *df = &dflash;
+	struct ptable *ptable;
+	struct ptentry *ptn;
+	char name[64];
+	char *field[4];
+	unsigned n = 0, total, offset = 0, len;
+	int oob = 0;
+	char *p;
+
+	strncpy(name, arg, sizeof(name) - 1);
+	name[sizeof(name) - 1] = 0;
+	for (p = name; p && n < 4; n++) {
+		field[n] = p;
+		p = strchr(p, ':');
+		if (p)
+			*p++ = 0;
+	}
+	if (n > 1 && !strcmp(field[n - 1], "oob")) {
+		oob = 1;
+		n--;
+	}
+	if (n != 1 && n != 3) {
+		fastboot_fail("usage: oem dump:<partition>[:<offset>:<length>][:oob]");
+		return;
+	}
+
+	ptable = flash_get_ptable();
+	if (ptable == NULL) {
+		fastboot_fail("partition table doesn't exist");
+		return;
+	}
+
+	ptn = ptable_find(ptable, field[0]);
+	if (ptn == NULL) {
+		fastboot_fail("unknown partition name");
+		return;
+	}
+	if (ptn->type != TYPE_APPS_PARTITION) {
+		fastboot_fail("partition can't be read");
+		return;
+	}
+
+	/* flash_read_ext() offsets skip the bad blocks */
+	total = fb_flash_good_blocks(ptn) * 64 * page_size;
+	if (n == 3)
+		offset = atoul(field[1]);
+	len = n == 3 ? atoul(field[2]) : total - offset;
+	if ((offset | len) & page_mask) {
+		fastboot_fail("offset and length must be page aligned");
+		return;
+	}
+	if (offset > total || len > total - offset) {
+		fastboot_fail("beyond end of partition");
+		return;
+	}
+
+	df->ptn = ptn;
+	df->extra = oob ? (page_size >> 9) * 4 : 0;
+	df->chunk = 64 * (page_size + df->extra);
+	df->bufs = target_get_scratch_address();
+	if (DUMP_BUFS * df->chunk > scratch_size) {
+		fastboot_fail("scratch area too small");
+		return;
+	}
+	df->offset = offset;
+	df->left = len / page_size * (page_size + df->extra);
+	df->next = 0;
+	df->busy = 0;
+	df->error = 0;
+	df->src.size = df->left;
+	df->src.get = dump_flash_get;
+	df->src.put = dump_flash_put;
+	df->src.finish = dump_flash_finish;
+	fastboot_upload(&df->src);
+	fastboot_okay("");
+}
+
 void cmd_continue(const char *arg, void *data, unsigned sz)
 {
 	fastboot_okay("");
@@ -371,10 +1599,19 @@ void cmd_reboot_bootloader(const char *arg, void *data, unsigned sz)
 }
 
 static void enter_fastboot(void) {
+#if WITH_USB_MSC
+	unsigned char *msc_mem = NULL;
+	unsigned msc_size;
+#endif
+
 	printf("ENTERING FASTBOOT MODE\n");
 	
 	fastboot_register("flash:", cmd_flash);
 	fastboot_register("erase:", cmd_erase);
+	fastboot_register("oem diff-flash:", cmd_oem_diff_flash);
+	fastboot_register("oem stream-flash:", cmd_oem_stream_flash);
+	fastboot_register("oem bundle", cmd_oem_bundle);
+	fastboot_register("oem dump:", cmd_oem_dump);
 
 	fastboot_register("boot", cmd_boot);
 	fastboot_register("continue", cmd_continue);
@@ -382,8 +1619,26 @@ static void enter_fastboot(void) {
 	fastboot_register("reboot-bootloader", cmd_reboot_bootloader);
 	fastboot_publish("product", TARGET(BOARD));
 	fastboot_publish("kernel", "lk");
+	fastboot_publish("diff-flash", diff_flash_var);
+
+	scratch_size = target_get_scratch_size();
+#if WITH_USB_MSC
+	msc_size = udc_msc_mem_size();
+	if (msc_size < scratch_size / 2) {
+		scratch_size = (scratch_size - msc_size) & ~4095;
+		msc_mem = (unsigned char *)target_get_scratch_address() +
+		    scratch_size;
+	}
+#endif
 
-	fastboot_init(target_get_scratch_address(), target_get_scratch_size());
+	fastboot_init(target_get_scratch_address(), scratch_size);
+#if WITH_DEBUG_USB
+	udc_acm_init();
+#endif
+#if WITH_USB_MSC
+	if (!msc_mem || udc_msc_init(USB_MSC_PARTITIONS, msc_mem, msc_size))
+		dprintf(CRITICAL, "usb mass storage not available\n");
+#endif
 	dprintf(INFO, "starting usb\n");
 	udc_start();
 }
@@ -32,6 +32,9 @@
 #include <kernel/thread.h>
 #include <kernel/event.h>
 #include <dev/udc.h>
+#include <lib/decompress.h>
+
+#include "fastboot.h"
 
 void boot_linux(void *bootimg, unsigned sz);
 
@@ -124,6 +127,8 @@ void fastboot_publish(const char *name, const char *value)
 }
 
 #define BUF_SIZE 4096
+#define USB_XFER_MAX (256 * 1024)	/* bytes moved per IN request */
+#define RX_REQS 8			/* OUT requests kept in flight */
 static unsigned char *buffer = NULL;
 
 static event_t usb_online;
@@ -132,6 +137,13 @@ static struct udc_endpoint *in, *out;
 static struct udc_request *req;
 int txn_status;
 
+static struct rx_slot {
+	struct udc_request *req;
+	event_t done;
+	unsigned xfer;
+	int status;
+} rx_slot[RX_REQS];
+
 static void *download_base;
 static unsigned download_max;
 static unsigned download_size;
@@ -150,41 +162,72 @@ static void req_complete(struct udc_request *req, unsigned actual, int status)
 	event_signal(&txn_done, 0);
 }
 
+static void rx_complete(struct udc_request *req, unsigned actual, int status)
+{
+	struct rx_slot *slot = req->context;
+
+	slot->status = status;
+	req->length = actual;
+	event_signal(&slot->done, 0);
+}
+
+/* OUT transfers keep RX_REQS requests queued, so the next one is already
+ * primed when the controller finishes the current one.
+ */
 static int usb_read(void *_buf, unsigned len)
 {
-	int r;
-	unsigned xfer;
+	struct rx_slot *slot;
 	unsigned char *buf = _buf;
+	unsigned queued = 0;
+	unsigned head = 0, busy = 0;
+	unsigned xfer;
 	int count = 0;
+	int stop = 0;
 
 	if (fastboot_state == STATE_ERROR
 		|| fastboot_state == STATE_OFFLINE)
 		goto oops;
 
-	while (len > 0) {
-		xfer = (len > BUF_SIZE) ? BUF_SIZE : len;
-		req->buf = buf;
-		req->length = xfer;
-		req->complete = req_complete;
-		r = udc_request_queue(out, req);
-		if (r < 0) {
-			dprintf(INFO, "usb_read() queue failed\n");
-			goto oops;
+	for (;;) {
+		while (!stop && busy < RX_REQS && queued < len) {
+			slot = &rx_slot[(head + busy) % RX_REQS];
+			xfer = len - queued;
+			if (xfer > UDC_OUT_MAX)
+				xfer = UDC_OUT_MAX;
+			slot->xfer = xfer;
+			slot->req->buf = buf + queued;
+			slot->req->length = xfer;
+			slot->req->complete = rx_complete;
+			slot->req->context = slot;
+			if (udc_request_queue(out, slot->req) < 0) {
+				dprintf(INFO, "usb_read() queue failed\n");
+				goto oops;
+			}
+			queued += xfer;
+			busy++;
 		}
-		event_wait(&txn_done);
+		if (!busy)
+			break;
 
-		if (txn_status < 0) {
+		slot = &rx_slot[head];
+		event_wait(&slot->done);
+		head = (head + 1) % RX_REQS;
+		busy--;
+
+		if (slot->status < 0) {
 			dprintf(INFO, "usb_read() transaction failed\n");
 			goto oops;
 		}
+		count += slot->req->length;
 
-		count += req->length;
-		buf += req->length;
-		len -= req->length;
-		
 		/* short transfer? */
-		if (req->length != xfer) {
-			break;
+		if (slot->req->length != slot->xfer && !stop) {
+			stop = 1;
+			while (busy) {
+				slot = &rx_slot[(head + --busy) % RX_REQS];
+				if (udc_request_cancel(out, slot->req))
+					event_wait(&slot->done);	/* done already */
+			}
 		}
 	}
 
@@ -196,28 +239,38 @@ oops:
 	return -1;
 }
 
-static int usb_write(void *buf, unsigned len)
+static int usb_write(void *_buf, unsigned len)
 {
 	int r;
+	unsigned xfer;
+	unsigned char *buf = _buf;
+	int count = 0;
 
 	if (fastboot_state == STATE_ERROR
 		|| fastboot_state == STATE_OFFLINE)
 		goto oops;
 
-	req->buf = buf;
-	req->length = len;
-	req->complete = req_complete;
-	r = udc_request_queue(in, req);
-	if (r < 0) {
-		dprintf(INFO, "usb_write() queue failed\n");
-		goto oops;
-	}
-	event_wait(&txn_done);
-	if (txn_status < 0) {
-		dprintf(INFO, "usb_write() transaction failed\n");
-		goto oops;
+	while (len > 0) {
+		xfer = (len > USB_XFER_MAX) ? USB_XFER_MAX : len;
+		req->buf = buf;
+		req->length = xfer;
+		req->complete = req_complete;
+		r = udc_request_queue(in, req);
+		if (r < 0) {
+			dprintf(INFO, "usb_write() queue failed\n");
+			goto oops;
+		}
+		event_wait(&txn_done);
+		if (txn_status < 0) {
+			dprintf(INFO, "usb_write() transaction failed\n");
+			goto oops;
+		}
+
+		count += req->length;
+		buf += req->length;
+		len -= req->length;
 	}
-	return req->length;
+	return count;
 
  oops:
 	dprintf(INFO, "[fastboot] %s: oops\n", __func__);
@@ -252,6 +305,14 @@ void fastboot_okay(const char *info)
 	fastboot_ack("OKAY", info);
 }
 
+void fastboot_info(const char *info)
+{
+	char response[64];
+
+	snprintf(response, 64, "INFO%s", info);
+	usb_write(response, strlen(response));
+}
+
 static void cmd_getvar(const char *arg, void *data, unsigned sz)
 {
 	struct fastboot_var *var;
@@ -265,21 +326,319 @@ static void cmd_getvar(const char *arg, void *data, unsigned sz)
 	fastboot_okay("");
 }
 
+static struct fastboot_sink *download_sink;
+
+void fastboot_stream(struct fastboot_sink *sink)
+{
+	download_sink = sink;
+}
+
+/* Hand the download to 'sink' as it arrives.  Returns 1 if the sink had
+ * it collected into the download buffer, 0 if it took the data, -1 if it
+ * failed and -2 on a USB error.
+ */
+static int download_stream(struct fastboot_sink *sink, unsigned len)
+{
+	unsigned char *buf;
+	unsigned size, xfer;
+	int failed = 0;
+	int r;
+
+	while (len > 0) {
+		if (failed) {
+			/* drop what the host still sends */
+			buf = download_base;
+			size = download_max;
+		} else {
+			buf = sink->get(sink, &size);
+		}
+		xfer = (len > size) ? size : len;
+		r = usb_read(buf, xfer);
+		if ((r < 0) || ((unsigned)r != xfer))
+			return -2;
+		len -= xfer;
+		if (failed)
+			continue;
+
+		r = sink->put(sink, buf, xfer);
+		if (r < 0) {
+			failed = 1;
+		} else if (r == FASTBOOT_SINK_COLLECT) {
+			if (xfer + len > download_max) {
+				sink->reason = "data too large";
+				failed = 1;
+				continue;
+			}
+			memmove(download_base, buf, xfer);
+			r = usb_read((unsigned char *)download_base + xfer, len);
+			if ((r < 0) || ((unsigned)r != len))
+				return -2;
+			return 1;
+		}
+	}
+
+	return failed ? -1 : 0;
+}
+
+/* Compressed downloads: after "oem decompress" the next download may be
+ * gzip or LZ4 compressed.  It is decompressed as it arrives, into the
+ * sink if one is armed or else into the download buffer, so only the
+ * decompressed image has to fit.  Data without a known magic is taken
+ * as is.
+ */
+#define UNZIP_INBUF	(64 * 1024)
+
+static int decompress_next;
+
+static struct unzip {
+	struct decompress dc;
+	struct fastboot_sink *sink;
+	unsigned char *inbuf;
+	unsigned inlen;		/* first piece, read to find the format */
+	unsigned left;		/* compressed bytes still on the wire */
+	int usb_error;
+	int sink_error;
+	unsigned char *cur;	/* sink chunk being filled */
+	unsigned cur_size;
+	unsigned cur_fill;
+	int collect;		/* output goes to the download buffer */
+	unsigned out;		/* bytes in the download buffer */
+	const char *reason;
+} unzip;
+
+static int unzip_fill(struct decompress *dc, const unsigned char **buf)
+{
+	struct unzip *u = dc->arg;
+	unsigned xfer;
+	int r;
+
+	*buf = u->inbuf;
+	if (u->usb_error)
+		return -1;
+	if (u->inlen) {
+		xfer = u->inlen;
+		u->inlen = 0;
+		return xfer;
+	}
+	if (!u->left)
+		return 0;
+
+	xfer = (u->left > UNZIP_INBUF) ? UNZIP_INBUF : u->left;
+	r = usb_read(u->inbuf, xfer);
+	if ((r < 0) || ((unsigned)r != xfer)) {
+		u->usb_error = 1;
+		return -1;
+	}
+	u->left -= xfer;
+	return xfer;
+}
+
+static int unzip_put(struct unzip *u)
+{
+	unsigned char *buf = u->cur;
+	unsigned len = u->cur_fill;
+	int r;
+
+	u->cur = NULL;
+	r = u->sink->put(u->sink, buf, len);
+	if (r == FASTBOOT_SINK_COLLECT) {
+		memmove(download_base, buf, len);
+		u->out = len;
+		u->collect = 1;
+		return 0;
+	}
+	if (r < 0)
+		u->sink_error = 1;
+	return r;
+}
+
+static int unzip_flush(struct decompress *dc, const unsigned char *data,
+		       unsigned len)
+{
+	struct unzip *u = dc->arg;
+	unsigned n;
+
+	while (len > 0) {
+		if (u->collect || !u->sink) {
+			if (len > download_max - u->out) {
+				u->reason = "data too large";
+				return -1;
+			}
+			memcpy((unsigned char *)download_base + u->out, data,
+			       len);
+			u->out += len;
+			return 0;
+		}
+
+		if (!u->cur) {
+			u->cur = u->sink->get(u->sink, &u->cur_size);
+			u->cur_fill = 0;
+		}
+		n = u->cur_size - u->cur_fill;
+		if (n > len)
+			n = len;
+		memcpy(u->cur + u->cur_fill, data, n);
+		u->cur_fill += n;
+		data += n;
+		len -= n;
+		if (u->cur_fill == u->cur_size && unzip_put(u))
+			return -1;
+	}
+	return 0;
+}
+
+/* Same results as download_stream(), with the decompressed size in *size
+ * when the data ended up in the download buffer and the reason for a
+ * failure of the decompression itself in *reason.
+ */
+static int download_unzip(struct fastboot_sink *sink, unsigned len,
+			  unsigned *size, const char **reason)
+{
+	struct unzip *u = &unzip;
+	unsigned char *inbuf = u->inbuf;
+	const unsigned char *p;
+	int format, n, r;
+
+	memset(u, 0, sizeof(*u));
+	u->inbuf = inbuf;
+	u->sink = sink;
+	u->left = len;
+	u->dc.fill = unzip_fill;
+	u->dc.flush = unzip_flush;
+	u->dc.arg = u;
+
+	n = unzip_fill(&u->dc, &p);
+	if (n < 0)
+		return -2;
+
+	format = decompress_detect(p, n);
+	if (format == DECOMPRESS_NONE) {
+		/* plain data: pass it on as it comes */
+		r = 0;
+		while (!r && n > 0) {
+			r = unzip_flush(&u->dc, p, n);
+			if (!r)
+				n = unzip_fill(&u->dc, &p);
+		}
+		if (n < 0)
+			r = -1;
+	} else {
+		dprintf(INFO, "decompressing %s download\n",
+			format == DECOMPRESS_GZIP ? "gzip" : "lz4");
+		u->inlen = n;
+		r = decompress_run(&u->dc, format);
+		if (r >= 0)
+			dprintf(INFO, "%d bytes from %d compressed\n", r, len);
+		r = (r < 0) ? -1 : 0;
+		if (!r && u->left) {
+			u->reason = "data after compressed image";
+			r = -1;
+		}
+		if (r && !u->reason && !u->usb_error && !u->sink_error)
+			u->reason = "decompression failed";
+	}
+	if (!r && u->cur && u->cur_fill)
+		r = unzip_put(u);	/* last, short chunk */
+
+	/* drop what the host still sends */
+	while (u->left && unzip_fill(&u->dc, &p) > 0) ;
+	if (u->usb_error)
+		return -2;
+
+	*reason = u->reason;
+	if (r)
+		return -1;
+	if (u->collect || !sink) {
+		*size = u->out;
+		return 1;
+	}
+	return 0;
+}
+
+static void cmd_oem_decompress(const char *arg, void *data, unsigned sz)
+{
+	if (!unzip.inbuf)
+		unzip.inbuf = malloc(UNZIP_INBUF);
+	if (!unzip.inbuf) {
+		fastboot_fail("out of memory");
+		return;
+	}
+	decompress_next = 1;
+	fastboot_okay("");
+}
+
 static void cmd_download(const char *arg, void *data, unsigned sz)
 {
 	char response[64];
 	unsigned len = hex2unsigned(arg);
+	struct fastboot_sink *sink = download_sink;
+	int unzip = decompress_next;
+	const char *reason = NULL;
+	unsigned size = 0;
 	int r;
 
 	download_size = 0;
-	if (len > download_max) {
+	download_sink = NULL;
+	decompress_next = 0;
+	if (sink) {
+		sink->reason = NULL;
+		if (sink->start(sink, unzip ? FASTBOOT_SINK_UNKNOWN : len)) {
+			fastboot_fail(sink->reason ? sink->reason :
+				      "data too large");
+			return;
+		}
+	} else if (!unzip && len > download_max) {
 		fastboot_fail("data too large");
 		return;
 	}
 
 	sprintf(response, "DATA%08x", len);
-	if (usb_write(response, strlen(response)) < 0)
+	if (usb_write(response, strlen(response)) < 0) {
+		if (sink)
+			sink->finish(sink, 0);
+		return;
+	}
+
+	if (unzip) {
+		r = download_unzip(sink, len, &size, &reason);
+		if (sink && sink->finish(sink, r >= 0) && r >= 0)
+			r = -1;
+		if (r == -2) {
+			dprintf(INFO, "%s: read error\n", __func__);
+			fastboot_state = STATE_ERROR;
+			return;
+		}
+		if (r < 0) {
+			if (!reason && sink)
+				reason = sink->reason;
+			fastboot_fail(reason ? reason : "flash write failure");
+			return;
+		}
+		if (r == 1)
+			download_size = size;
+		fastboot_okay("");
+		return;
+	}
+
+	if (sink) {
+		r = download_stream(sink, len);
+		if (sink->finish(sink, r >= 0) && r >= 0)
+			r = -1;
+		if (r == -2) {
+			dprintf(INFO, "%s: read error\n", __func__);
+			fastboot_state = STATE_ERROR;
+			return;
+		}
+		if (r < 0) {
+			fastboot_fail(sink->reason ? sink->reason :
+				      "flash write failure");
+			return;
+		}
+		if (r == 1)
+			download_size = len;
+		fastboot_okay("");
 		return;
+	}
 
 	r = usb_read(download_base, len);
 	if ((r < 0) || ((unsigned)r != len)) {
@@ -291,6 +650,62 @@ static void cmd_download(const char *arg, void *data, unsigned sz)
 	fastboot_okay("");
 }
 
+static struct fastboot_source *upload_source;
+
+void fastboot_upload(struct fastboot_source *src)
+{
+	upload_source = src;
+}
+
+static void cmd_upload(const char *arg, void *data, unsigned sz)
+{
+	struct fastboot_source *src = upload_source;
+	char response[64];
+	unsigned left, len;
+	void *buf;
+	int failed = 0;
+
+	upload_source = NULL;
+	if (!src) {
+		fastboot_fail("nothing staged");
+		return;
+	}
+
+	src->reason = NULL;
+	sprintf(response, "DATA%08x", src->size);
+	if (usb_write(response, strlen(response)) < 0) {
+		src->finish(src);
+		return;
+	}
+
+	for (left = src->size; left > 0; left -= len) {
+		buf = failed ? NULL : src->get(src, &len);
+		if (!buf) {
+			/* the host still expects the announced size */
+			if (!failed)
+				memset(buffer, 0, BUF_SIZE);
+			failed = 1;
+			buf = buffer;
+			len = BUF_SIZE;
+		}
+		if (len > left)
+			len = left;
+		if (usb_write(buf, len) < 0) {
+			src->finish(src);
+			return;
+		}
+		if (!failed)
+			src->put(src, buf);
+	}
+
+	if (src->finish(src))
+		failed = 1;
+	if (failed)
+		fastboot_fail(src->reason ? src->reason : "read failure");
+	else
+		fastboot_okay("");
+}
+
 static void fastboot_command_loop(void)
 {
 	struct fastboot_cmd *cmd;
@@ -359,6 +774,7 @@ static struct udc_gadget fastboot_gadget = {
 int fastboot_init(void *base, unsigned size)
 {
 	thread_t *thr;
+	unsigned n;
 	dprintf(INFO, "fastboot_init()\n");
 
 	download_base = base;
@@ -387,12 +803,20 @@ int fastboot_init(void *base, unsigned size)
 	req = udc_request_alloc();
 	if (!req)
 		goto fail_alloc_req;
+	for (n = 0; n < RX_REQS; n++) {
+		event_init(&rx_slot[n].done, 0, EVENT_FLAG_AUTOUNSIGNAL);
+		rx_slot[n].req = udc_request_alloc();
+		if (!rx_slot[n].req)
+			goto fail_alloc_rx;
+	}
 
 	if (udc_register_gadget(&fastboot_gadget))
 		goto fail_udc_register;
 
 	fastboot_register("getvar:", cmd_getvar);
 	fastboot_register("download:", cmd_download);
+	fastboot_register("upload", cmd_upload);
+	fastboot_register("oem decompress", cmd_oem_decompress);
 	fastboot_publish("version", "0.5");
 
 	thr =
@@ -402,6 +826,10 @@ int fastboot_init(void *base, unsigned size)
 	return 0;
 
  fail_udc_register:
+ fail_alloc_rx:
+	for (n = 0; n < RX_REQS; n++)
+		if (rx_slot[n].req)
+			udc_request_free(rx_slot[n].req);
 	udc_request_free(req);
  fail_alloc_req:
 	udc_endpoint_free(out);
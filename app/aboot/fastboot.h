@@ -43,7 +43,57 @@ void fastboot_register(const char *prefix,
 /* publish a variable readable by the built-in getvar command */
 void fastboot_publish(const char *name, const char *value);
 
-/* only callable from within a command handler */
+/* streaming downloads
+ * - fastboot_stream() arms 'sink' for the next "download:" command; its
+ *   data is handed to the sink chunk by chunk as it arrives instead of
+ *   being collected in the download buffer, so it may be larger
+ * - start() may refuse the announced size, which is
+ *   FASTBOOT_SINK_UNKNOWN for compressed downloads
+ * - get() returns a buffer for the next chunk and its size, waiting for
+ *   one to become free; put() takes the filled chunk and returns 0,
+ *   FASTBOOT_SINK_COLLECT to receive the image into the download buffer
+ *   after all, or -1 on error (the rest of the data is then dropped);
+ *   only the last chunk may be short
+ * - finish() is called once the data is in, also after errors, with
+ *   'complete' set if the sink got the whole image, and returns nonzero
+ *   if the sink failed; 'reason' is reported to the host
+ */
+#define FASTBOOT_SINK_COLLECT	1
+#define FASTBOOT_SINK_UNKNOWN	0xffffffff
+
+struct fastboot_sink {
+	int (*start) (struct fastboot_sink * sink, unsigned size);
+	void *(*get) (struct fastboot_sink * sink, unsigned *size);
+	int (*put) (struct fastboot_sink * sink, void *buf, unsigned len);
+	int (*finish) (struct fastboot_sink * sink, int complete);
+	const char *reason;
+};
+
+void fastboot_stream(struct fastboot_sink *sink);
+
+/* uploads
+ * - fastboot_upload() stages 'source' for the next "upload" command,
+ *   which sends its 'size' bytes to the host
+ * - get() returns the next chunk and its length, waiting for it if need
+ *   be, or NULL on error (the rest is then sent as zeros); put() hands a
+ *   chunk back once it is sent
+ * - finish() is called when the upload is over, also after errors, and
+ *   returns nonzero if the data could not be read; 'reason' is reported
+ *   to the host
+ */
+struct fastboot_source {
+	unsigned size;
+	void *(*get) (struct fastboot_source * src, unsigned *len);
+	void (*put) (struct fastboot_source * src, void *buf);
+	int (*finish) (struct fastboot_source * src);
+	const char *reason;
+};
+
+void fastboot_upload(struct fastboot_source *src);
+
+/* only callable from within a command handler; any number of INFO
+ * lines may go ahead of the one OKAY or FAIL */
+void fastboot_info(const char *info);
 void fastboot_okay(const char *result);
 void fastboot_fail(const char *reason);
 
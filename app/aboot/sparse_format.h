@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2009, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SPARSE_FORMAT_H_
+#define _SPARSE_FORMAT_H_
+
+/* Android sparse image, as produced by img2simg / make_ext4fs -s.
+ *
+ * A file header is followed by total_chunks chunks, each a chunk header
+ * plus its payload.  Chunks describe chunk_sz output blocks of blk_sz
+ * bytes: raw data, a repeated 32-bit fill pattern, a region whose
+ * contents do not matter, or a CRC32 of the output so far.
+ */
+#define SPARSE_HEADER_MAGIC	0xed26ff3a
+#define SPARSE_HEADER_MAJOR_VER	1
+
+#define CHUNK_TYPE_RAW		0xCAC1
+#define CHUNK_TYPE_FILL		0xCAC2
+#define CHUNK_TYPE_DONT_CARE	0xCAC3
+#define CHUNK_TYPE_CRC32	0xCAC4
+
+typedef struct sparse_header {
+	unsigned magic;
+	unsigned short major_version;
+	unsigned short minor_version;
+	unsigned short file_hdr_sz;	/* 28 bytes for version 1.0 */
+	unsigned short chunk_hdr_sz;	/* 12 bytes for version 1.0 */
+	unsigned blk_sz;	/* output block size, a multiple of 4 */
+	unsigned total_blks;	/* output blocks in the image */
+	unsigned total_chunks;
+	unsigned image_checksum;	/* CRC32 of the output, usually 0 */
+} sparse_header_t;
+
+typedef struct chunk_header {
+	unsigned short chunk_type;
+	unsigned short reserved1;
+	unsigned chunk_sz;	/* output blocks */
+	unsigned total_sz;	/* bytes, chunk header and payload */
+} chunk_header_t;
+
+#endif
@@ -87,7 +87,8 @@ void verify_flash(struct ptentry *p, void *addr, unsigned len, int extra)
 	jtag_okay("verify done");
 }
 
-void handle_flash(const char *name, unsigned addr, unsigned sz)
+void handle_flash(const char *name, unsigned addr, unsigned sz,
+		  unsigned flags)
 {
 	struct ptentry *ptn;
 	struct ptable *ptable;
@@ -122,7 +123,7 @@ void handle_flash(const char *name, unsigned addr, unsigned sz)
 	data = (void *)target_get_scratch_address();
 
 	dprintf(INFO, "writing %d bytes to '%s'\n", sz, ptn->name);
-	if (flash_write(ptn, extra, data, sz)) {
+	if (flash_write_ext(ptn, extra, data, sz, flags)) {
 		jtag_fail("flash write failure");
 		return;
 	}
@@ -136,13 +137,14 @@ void handle_flash(const char *name, unsigned addr, unsigned sz)
 
 static unsigned char *tmpbuf = 0;
 
- /*XXX*/ void handle_dump(const char *name, unsigned offset)
+void handle_dump(const char *name, unsigned offset)
 {
 	struct ptentry *p;
 	struct ptable *ptable;
+	unsigned extra = (page_size >> 9) * 4;
 
 	if (tmpbuf == 0) {
-		tmpbuf = malloc(4096);
+		tmpbuf = memalign(32, page_size + extra);
 	}
 
 	dprintf(INFO, "dump '%s' partition\n", name);
@@ -159,19 +161,20 @@ static unsigned char *tmpbuf = 0;
 	if (p == 0) {
 		jtag_fail("partition not found");
 		return;
+	} else if (p->type != TYPE_APPS_PARTITION) {
+		jtag_fail("partition can't be read");
+		return;
 	} else {
-
-#if 0
-		/* XXX reimpl */
-		if (flash_read_page(p->start * 64, tmpbuf, tmpbuf + 2048)) {
+		/* one page at 'offset' into the partition, with its spare */
+		offset &= ~page_mask;
+		if (flash_read_ext(p, extra, offset, tmpbuf, page_size + extra)) {
 			jtag_fail("flash_read() failed");
 			return;
 		}
-#endif
-		dprintf(INFO, "page %d data:\n", p->start * 64);
+		dprintf(INFO, "offset 0x%x data:\n", offset);
 		hexdump(tmpbuf, 256);
-		dprintf(INFO, "page %d extra:\n", p->start * 64);
-		hexdump(tmpbuf, 16);
+		dprintf(INFO, "offset 0x%x extra:\n", offset);
+		hexdump(tmpbuf + page_size, extra);
 		jtag_okay("done");
 		enter_critical_section();
 		platform_uninit_timer();
@@ -193,7 +196,13 @@ void handle_query_load_address(unsigned addr)
 void handle_command(const char *cmd, unsigned a0, unsigned a1, unsigned a2)
 {
 	if (startswith(cmd, "flash:")) {
-		handle_flash(cmd + 6, a0, a1);
+		handle_flash(cmd + 6, a0, a1, 0);
+		return;
+	}
+
+	/* like flash:, leaving blocks that already hold the image alone */
+	if (startswith(cmd, "flashdiff:")) {
+		handle_flash(cmd + 10, a0, a1, FLASH_WRITE_DIFF);
 		return;
 	}
 
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <string.h>
+#include <stdlib.h>
+#include <platform.h>
+#include <kernel/thread.h>
+#include <dev/udc.h>
+
+#include "usbtest.h"
+
+struct usbtest_req {
+	struct udc_request *req;
+	struct usbtest_ept *ept;
+	struct usbtest_req *pair;	/* loopback: request sharing the buffer */
+	bigtime_t queued;
+	int busy;
+};
+
+struct usbtest_ept {
+	const char *name;
+	struct udc_endpoint *ept;
+	struct usbtest_req req[USBTEST_MAX_DEPTH];
+	struct usbtest_ept_stats stats;
+};
+
+static struct usbtest_ept epts[USBTEST_EPTS] = {
+	[USBTEST_SOURCE] = {.name = "src"},
+	[USBTEST_SINK] = {.name = "sink"},
+	[USBTEST_LOOP_OUT] = {.name = "lpout"},
+	[USBTEST_LOOP_IN] = {.name = "lpin"},
+};
+
+static struct usbtest_config config;
+static struct udc_endpoint *gadget_epts[USBTEST_EPTS];
+
+static void usbtest_queue(struct usbtest_req *r, unsigned length)
+{
+	if ((r->ept == &epts[USBTEST_SINK] || r->ept == &epts[USBTEST_LOOP_OUT])
+	    && length > UDC_OUT_MAX)
+		length = UDC_OUT_MAX;
+	r->req->length = length;
+	r->queued = current_time_hires();
+	r->busy = 1;
+	if (udc_request_queue(r->ept->ept, r->req)) {
+		r->busy = 0;
+		r->ept->stats.errors++;
+	}
+}
+
+static void usbtest_complete(struct udc_request *req, unsigned actual,
+			     int status)
+{
+	struct usbtest_req *r = req->context;
+	struct usbtest_ept *e = r->ept;
+	bigtime_t latency = current_time_hires() - r->queued;
+
+	enter_critical_section();
+	r->busy = 0;
+	if (status) {
+		/* reset or disconnect; queued again when back online */
+		e->stats.errors++;
+		exit_critical_section();
+		return;
+	}
+
+	e->stats.bytes += actual;
+	e->stats.xfers++;
+	e->stats.latency += latency;
+	if (latency > e->stats.latency_max)
+		e->stats.latency_max = latency;
+	if (actual < req->length && e != &epts[USBTEST_SOURCE]
+	    && e != &epts[USBTEST_LOOP_IN])
+		e->stats.shorts++;
+
+	if (e == &epts[USBTEST_LOOP_OUT] && actual)
+		usbtest_queue(r->pair, actual);
+	else if (e == &epts[USBTEST_LOOP_IN])
+		usbtest_queue(r->pair, config.size);
+	else
+		usbtest_queue(r, config.size);
+	exit_critical_section();
+}
+
+static void usbtest_start(void)
+{
+	unsigned n;
+
+	for (n = 0; n < config.depth; n++) {
+		if (!epts[USBTEST_SOURCE].req[n].busy)
+			usbtest_queue(&epts[USBTEST_SOURCE].req[n], config.size);
+		if (!epts[USBTEST_SINK].req[n].busy)
+			usbtest_queue(&epts[USBTEST_SINK].req[n], config.size);
+		if (!epts[USBTEST_LOOP_OUT].req[n].busy
+		    && !epts[USBTEST_LOOP_IN].req[n].busy)
+			usbtest_queue(&epts[USBTEST_LOOP_OUT].req[n],
+				      config.size);
+	}
+}
+
+static void usbtest_notify(struct udc_gadget *gadget, unsigned event)
+{
+	if (event == UDC_EVENT_ONLINE) {
+		enter_critical_section();
+		usbtest_start();
+		exit_critical_section();
+	}
+}
+
+static struct udc_gadget usbtest_gadget = {
+	.notify = usbtest_notify,
+	.ifc_class = 0xff,
+	.ifc_subclass = 0xff,
+	.ifc_protocol = 0xff,
+	.ifc_endpoints = USBTEST_EPTS,
+	.ifc_string = "usbtest",
+	.ept = gadget_epts,
+};
+
+/* the source and the sink each share one buffer between all their
+ * requests, loopback requests need one each
+ */
+unsigned usbtest_buf_size(unsigned size, unsigned depth)
+{
+	return (2 + depth) * size;
+}
+
+int usbtest_init(const struct usbtest_config *cfg)
+{
+	struct usbtest_ept *e;
+	struct usbtest_req *r;
+	unsigned char *buf;
+	unsigned n, i;
+
+	if (!cfg->size || !cfg->depth || cfg->depth > USBTEST_MAX_DEPTH) {
+		dprintf(CRITICAL, "usbtest: bad queue depth %d\n", cfg->depth);
+		return -1;
+	}
+	config = *cfg;
+
+	epts[USBTEST_SOURCE].ept = udc_endpoint_alloc(UDC_TYPE_BULK_IN, 512);
+	epts[USBTEST_SINK].ept = udc_endpoint_alloc(UDC_TYPE_BULK_OUT, 512);
+	epts[USBTEST_LOOP_OUT].ept = udc_endpoint_alloc(UDC_TYPE_BULK_OUT, 512);
+	epts[USBTEST_LOOP_IN].ept = udc_endpoint_alloc(UDC_TYPE_BULK_IN, 512);
+
+	buf = cfg->buf;
+	for (i = 0; i < cfg->size; i++)
+		buf[i] = i % 251;
+
+	for (n = 0; n < USBTEST_EPTS; n++) {
+		e = &epts[n];
+		if (!e->ept)
+			goto fail;
+		gadget_epts[n] = e->ept;
+		memset(&e->stats, 0, sizeof(e->stats));
+
+		for (i = 0; i < cfg->depth; i++) {
+			r = &e->req[i];
+			r->req = udc_request_alloc();
+			if (!r->req)
+				goto fail;
+			r->ept = e;
+			r->busy = 0;
+			r->req->complete = usbtest_complete;
+			r->req->context = r;
+			if (n == USBTEST_SOURCE)
+				r->req->buf = buf;
+			else if (n == USBTEST_SINK)
+				r->req->buf = buf + cfg->size;
+			else
+				r->req->buf = buf + (2 + i) * cfg->size;
+		}
+	}
+
+	for (i = 0; i < cfg->depth; i++) {
+		epts[USBTEST_LOOP_OUT].req[i].pair = &epts[USBTEST_LOOP_IN].req[i];
+		epts[USBTEST_LOOP_IN].req[i].pair = &epts[USBTEST_LOOP_OUT].req[i];
+	}
+
+	return udc_register_gadget(&usbtest_gadget);
+
+ fail:
+	dprintf(CRITICAL, "usbtest: cannot allocate endpoints\n");
+	return -1;
+}
+
+void usbtest_get_stats(struct usbtest_stats *stats)
+{
+	unsigned n;
+
+	enter_critical_section();
+	stats->time = current_time_hires();
+	for (n = 0; n < USBTEST_EPTS; n++)
+		stats->ept[n] = epts[n].stats;
+	exit_critical_section();
+	udc_get_stats(&stats->udc);
+}
+
+void usbtest_report(const struct usbtest_stats *prev,
+		    const struct usbtest_stats *cur)
+{
+	const struct usbtest_ept_stats *a, *b;
+	bigtime_t usecs = cur->time - prev->time;
+	unsigned long long bytes;
+	unsigned n, xfers;
+
+	if (!usecs)
+		return;
+
+	dprintf(ALWAYS, "usbtest %u ms, %u x %u\n",
+		(unsigned)(usecs / 1000), config.depth, config.size);
+	for (n = 0; n < USBTEST_EPTS; n++) {
+		a = &prev->ept[n];
+		b = &cur->ept[n];
+		bytes = b->bytes - a->bytes;
+		xfers = b->xfers - a->xfers;
+		dprintf(ALWAYS, "%-5s %6u KB/s %5u/s lat %5u/%5u us",
+			epts[n].name,
+			(unsigned)(bytes * 1000000 / usecs / 1024),
+			(unsigned)(xfers * 1000000ULL / usecs),
+			xfers ? (unsigned)((b->latency - a->latency) / xfers) : 0,
+			(unsigned)b->latency_max);
+		if (b->shorts != a->shorts)
+			dprintf(ALWAYS, " %u short", b->shorts - a->shorts);
+		if (b->errors != a->errors)
+			dprintf(ALWAYS, " %u err", b->errors - a->errors);
+		dprintf(ALWAYS, "\n");
+	}
+	dprintf(ALWAYS, "irq %u/s %u/%u us, bh %u/s, %u primes %u appends "
+		"%u reprimes %u flushes\n",
+		(unsigned)((cur->udc.irqs - prev->udc.irqs) * 1000000ULL / usecs),
+		cur->udc.irqs != prev->udc.irqs ?
+		(cur->udc.irq_time - prev->udc.irq_time) /
+		(cur->udc.irqs - prev->udc.irqs) : 0,
+		cur->udc.irq_time_max,
+		(unsigned)((cur->udc.bh_runs - prev->udc.bh_runs) * 1000000ULL
+			   / usecs),
+		cur->udc.primes - prev->udc.primes,
+		cur->udc.appends - prev->udc.appends,
+		cur->udc.reprimes - prev->udc.reprimes,
+		cur->udc.flushes - prev->udc.flushes);
+}
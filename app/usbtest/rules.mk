@@ -0,0 +1,14 @@
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+# request size and queue depth per endpoint, e.g.
+#   make USBTEST_SIZE=262144 USBTEST_DEPTH=4
+USBTEST_SIZE ?= 65536
+USBTEST_DEPTH ?= 2
+
+DEFINES += \
+	USBTEST_SIZE=$(USBTEST_SIZE) \
+	USBTEST_DEPTH=$(USBTEST_DEPTH)
+
+OBJS += \
+	$(LOCAL_DIR)/gadget.o \
+	$(LOCAL_DIR)/usbtest.o
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* USB throughput benchmark: runs the bulk source, sink and loopback
+** endpoints of the usbtest gadget and prints their rates once a second
+** (dprintf, so on the console and, with WITH_DEBUG_FBCON, on fbcon).
+** It takes the controller for itself, so build it instead of app/aboot.
+*/
+
+#include <app.h>
+#include <debug.h>
+#include <target.h>
+#include <kernel/thread.h>
+#include <dev/udc.h>
+
+#include "usbtest.h"
+
+#ifndef USBTEST_SIZE
+#define USBTEST_SIZE	(64 * 1024)
+#endif
+#ifndef USBTEST_DEPTH
+#define USBTEST_DEPTH	2
+#endif
+#define USBTEST_PERIOD	1000	/* msecs between reports */
+
+static int usbtest_ok;
+
+static void usbtest_app_init(const struct app_descriptor *app)
+{
+	struct usbtest_config cfg;
+
+	cfg.size = USBTEST_SIZE;
+	cfg.depth = USBTEST_DEPTH;
+	cfg.buf = target_get_scratch_address();
+	if (usbtest_buf_size(cfg.size, cfg.depth) > target_get_scratch_size()) {
+		dprintf(CRITICAL, "usbtest: buffers do not fit the scratch "
+			"area\n");
+		return;
+	}
+
+	if (usbtest_init(&cfg))
+		return;
+	udc_start();
+	usbtest_ok = 1;
+}
+
+static void usbtest_app_entry(const struct app_descriptor *app, void *args)
+{
+	struct usbtest_stats prev, cur;
+
+	if (!usbtest_ok)
+		return;
+
+	usbtest_get_stats(&prev);
+	for (;;) {
+		thread_sleep(USBTEST_PERIOD);
+		usbtest_get_stats(&cur);
+		usbtest_report(&prev, &cur);
+		prev = cur;
+	}
+}
+
+APP_START(usbtest)
+	.init = usbtest_app_init,
+	.entry = usbtest_app_entry,
+APP_END
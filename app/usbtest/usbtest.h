@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __APP_USBTEST_H
+#define __APP_USBTEST_H
+
+#include <sys/types.h>
+#include <dev/udc.h>
+
+/* bulk benchmark gadget
+ * - source: an IN endpoint sending the same buffer over and over
+ * - sink: an OUT endpoint throwing away what it receives
+ * - loopback: an OUT endpoint whose data goes back out on an IN endpoint
+ * - each endpoint keeps 'depth' requests of 'size' bytes queued; requests
+ *   are queued again from their completion callbacks
+ * - buffers are carved from 'buf', which must hold usbtest_buf_size()
+ */
+#define USBTEST_SOURCE		0
+#define USBTEST_SINK		1
+#define USBTEST_LOOP_OUT	2
+#define USBTEST_LOOP_IN		3
+#define USBTEST_EPTS		4
+
+#define USBTEST_MAX_DEPTH	16
+
+struct usbtest_config {
+	unsigned size;		/* bytes per request */
+	unsigned depth;		/* requests queued per endpoint */
+	void *buf;
+};
+
+struct usbtest_ept_stats {
+	unsigned long long bytes;
+	unsigned xfers;		/* requests completed */
+	unsigned shorts;	/* OUT requests ended by a short packet */
+	unsigned errors;
+	bigtime_t latency;	/* queued to completed, summed; usecs */
+	bigtime_t latency_max;	/* since usbtest_init() */
+};
+
+struct usbtest_stats {
+	bigtime_t time;		/* when the snapshot was taken */
+	struct usbtest_ept_stats ept[USBTEST_EPTS];
+	struct udc_stats udc;
+};
+
+unsigned usbtest_buf_size(unsigned size, unsigned depth);
+
+/* allocate endpoints and requests and register the gadget; the caller
+ * starts the controller
+ */
+int usbtest_init(const struct usbtest_config *cfg);
+
+void usbtest_get_stats(struct usbtest_stats *stats);
+
+/* print rates between two snapshots */
+void usbtest_report(const struct usbtest_stats *prev,
+		    const struct usbtest_stats *cur);
+
+#endif
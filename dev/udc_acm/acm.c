@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <string.h>
+#include <stdlib.h>
+#include <kernel/thread.h>
+#include <dev/udc.h>
+#include <dev/udc_acm.h>
+
+#define ACM_RING	16384	/* output kept for the host; power of 2 */
+#define ACM_TX_SIZE	4096
+#define ACM_RX_RING	256	/* power of 2 */
+#define ACM_RX_SIZE	512
+
+/* CDC */
+#define CDC_CLASS_COMM		0x02
+#define CDC_SUBCLASS_ACM	0x02
+#define CDC_PROTOCOL_AT		0x01
+#define CDC_CLASS_DATA		0x0a
+#define CDC_CS_INTERFACE	0x24
+
+#define CDC_SET_LINE_CODING		0x20
+#define CDC_GET_LINE_CODING		0x21
+#define CDC_SET_CONTROL_LINE_STATE	0x22
+
+static char ring[ACM_RING];
+static unsigned ring_head, ring_tail;	/* free running */
+static unsigned char rx_ring[ACM_RX_RING];
+static unsigned rx_head, rx_tail;
+
+static struct udc_endpoint *notify_ept, *in, *out;
+static struct udc_request *tx_req, *rx_req;
+static int online, tx_busy, rx_busy;
+
+/* 115200 8N1; only reported back to the host */
+static unsigned char line_coding[7] = { 0x00, 0xc2, 0x01, 0x00, 0, 0, 8 };
+
+/* send what the ring holds unless a transfer is already running; the
+ * bytes written meanwhile go out together when it completes
+ */
+static void acm_tx_kick(void)
+{
+	unsigned char *buf;
+	unsigned n, i;
+
+	if (!online || tx_busy || ring_head == ring_tail)
+		return;
+
+	n = ring_head - ring_tail;
+	if (n > ACM_TX_SIZE)
+		n = ACM_TX_SIZE;
+	buf = tx_req->buf;
+	for (i = 0; i < n; i++)
+		buf[i] = ring[(ring_tail + i) & (ACM_RING - 1)];
+	ring_tail += n;
+
+	/* the controller driver may log through us */
+	tx_busy = 1;
+	tx_req->length = n;
+	if (udc_request_queue(in, tx_req))
+		tx_busy = 0;
+}
+
+static void acm_tx_complete(struct udc_request *req, unsigned actual,
+			    int status)
+{
+	enter_critical_section();
+	tx_busy = 0;
+	if (status == 0)
+		acm_tx_kick();
+	exit_critical_section();
+}
+
+static void acm_rx_queue(void)
+{
+	rx_req->length = ACM_RX_SIZE;
+	rx_busy = !udc_request_queue(out, rx_req);
+}
+
+static void acm_rx_complete(struct udc_request *req, unsigned actual,
+			    int status)
+{
+	unsigned char *buf = req->buf;
+	unsigned n;
+
+	enter_critical_section();
+	rx_busy = 0;
+	if (status == 0) {
+		/* input that does not fit is dropped */
+		for (n = 0; n < actual && rx_head - rx_tail < ACM_RX_RING;
+		     n++)
+			rx_ring[rx_head++ & (ACM_RX_RING - 1)] = buf[n];
+		acm_rx_queue();
+	}
+	exit_critical_section();
+}
+
+static void acm_put(char c)
+{
+	ring[ring_head++ & (ACM_RING - 1)] = c;
+	if (ring_head - ring_tail > ACM_RING)
+		ring_tail = ring_head - ACM_RING;
+}
+
+void udc_acm_putc(char c)
+{
+	enter_critical_section();
+	if (c == '\n')
+		acm_put('\r');
+	acm_put(c);
+	acm_tx_kick();
+	exit_critical_section();
+}
+
+int udc_acm_getc(char *c)
+{
+	int ret = -1;
+
+	enter_critical_section();
+	if (rx_head != rx_tail) {
+		*c = rx_ring[rx_tail++ & (ACM_RX_RING - 1)];
+		ret = 0;
+	}
+	exit_critical_section();
+	return ret;
+}
+
+static void acm_notify(struct udc_gadget *gadget, unsigned event)
+{
+	enter_critical_section();
+	if (event == UDC_EVENT_ONLINE) {
+		online = 1;
+		if (!rx_busy)
+			acm_rx_queue();
+		acm_tx_kick();
+	} else {
+		online = 0;
+	}
+	exit_critical_section();
+}
+
+static int acm_setup(struct udc_gadget *gadget,
+		     const struct setup_packet *s, void *buf)
+{
+	switch (s->request) {
+	case CDC_SET_LINE_CODING:
+		if (s->length != sizeof(line_coding))
+			return -1;
+		memcpy(line_coding, buf, sizeof(line_coding));
+		return 0;
+	case CDC_GET_LINE_CODING:
+		memcpy(buf, line_coding, sizeof(line_coding));
+		return sizeof(line_coding);
+	case CDC_SET_CONTROL_LINE_STATE:
+		return 0;
+	}
+	return -1;
+}
+
+/* interface association, communication interface with the class
+ * descriptors and the notification endpoint, data interface
+ */
+static unsigned acm_desc_fill(struct udc_gadget *gadget, unsigned char *data)
+{
+	unsigned ifc = gadget->ifc_number;
+	unsigned char desc[] = {
+		/* interface association */
+		8, 0x0b, ifc, 2, CDC_CLASS_COMM, CDC_SUBCLASS_ACM,
+		CDC_PROTOCOL_AT, 0,
+		/* communication interface */
+		9, TYPE_INTERFACE, ifc, 0, 1, CDC_CLASS_COMM,
+		CDC_SUBCLASS_ACM, CDC_PROTOCOL_AT, 0,
+		/* header, CDC 1.10 */
+		5, CDC_CS_INTERFACE, 0x00, 0x10, 0x01,
+		/* call management: none, data interface */
+		5, CDC_CS_INTERFACE, 0x01, 0x00, ifc + 1,
+		/* abstract control management: line coding and state */
+		4, CDC_CS_INTERFACE, 0x02, 0x02,
+		/* union: communication, data interface */
+		5, CDC_CS_INTERFACE, 0x06, ifc, ifc + 1,
+		/* notification endpoint */
+		0, 0, 0, 0, 0, 0, 0,
+		/* data interface */
+		9, TYPE_INTERFACE, ifc + 1, 0, 2, CDC_CLASS_DATA, 0, 0, 0,
+		/* bulk endpoints */
+		0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0,
+	};
+
+	if (data) {
+		udc_ept_desc_fill(notify_ept, desc + 36);
+		udc_ept_desc_fill(out, desc + 52);
+		udc_ept_desc_fill(in, desc + 59);
+		memcpy(data, desc, sizeof(desc));
+	}
+	return sizeof(desc);
+}
+
+static struct udc_gadget acm_gadget = {
+	.notify = acm_notify,
+	.ifc_count = 2,
+	.desc_fill = acm_desc_fill,
+	.setup = acm_setup,
+};
+
+int udc_acm_init(void)
+{
+	notify_ept = udc_endpoint_alloc(UDC_TYPE_INTR_IN, 16);
+	in = udc_endpoint_alloc(UDC_TYPE_BULK_IN, 512);
+	out = udc_endpoint_alloc(UDC_TYPE_BULK_OUT, 512);
+	tx_req = udc_request_alloc();
+	rx_req = udc_request_alloc();
+	if (!notify_ept || !in || !out || !tx_req || !rx_req)
+		goto fail;
+
+	tx_req->buf = malloc(ACM_TX_SIZE);
+	rx_req->buf = malloc(ACM_RX_SIZE);
+	if (!tx_req->buf || !rx_req->buf)
+		goto fail;
+	tx_req->complete = acm_tx_complete;
+	rx_req->complete = acm_rx_complete;
+
+	return udc_register_gadget(&acm_gadget);
+
+ fail:
+	dprintf(CRITICAL, "acm: cannot allocate endpoints\n");
+	return -1;
+}
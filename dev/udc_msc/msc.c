@@ -0,0 +1,1123 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <err.h>
+#include <string.h>
+#include <stdlib.h>
+#include <kernel/thread.h>
+#include <kernel/event.h>
+#include <lib/ptable.h>
+#include <dev/flash.h>
+#include <dev/udc.h>
+#include <dev/udc_msc.h>
+
+#ifndef UDC_MSC_CACHE
+#define UDC_MSC_CACHE	4
+#endif
+/* two blocks being sent, one read ahead and one to write to */
+#define MSC_MIN_CACHE	4
+#if UDC_MSC_CACHE < MSC_MIN_CACHE
+#error "UDC_MSC_CACHE is below the blocks in use at once"
+#endif
+
+#define MSC_MAX_LUNS	4
+#define MSC_SECTOR	512
+#define MSC_MAX_SPB	512	/* sectors per erase block, 4k pages */
+#define MSC_BUF_SIZE	UDC_OUT_MAX	/* OUT transfer chunk */
+#define MSC_PAD_SIZE	4096
+#define MSC_RESP_SIZE	512	/* responses, a packet */
+#define MSC_IDLE_FLUSH	1000	/* msecs */
+
+/* Bulk-Only Transport */
+#define MSC_GET_MAX_LUN	0xfe
+#define MSC_RESET	0xff
+
+#define CBW_SIGNATURE	0x43425355
+#define CBW_SIZE	31
+#define CBW_DATA_IN	0x80
+#define CSW_SIGNATURE	0x53425355
+#define CSW_SIZE	13
+#define CSW_GOOD	0
+#define CSW_FAILED	1
+#define CSW_PHASE_ERROR	2
+
+struct cbw {
+	unsigned signature;
+	unsigned tag;
+	unsigned length;
+	unsigned char flags;
+	unsigned char lun;
+	unsigned char cb_length;
+	unsigned char cb[16];
+} __attribute__ ((packed));
+
+struct csw {
+	unsigned signature;
+	unsigned tag;
+	unsigned residue;
+	unsigned char status;
+} __attribute__ ((packed));
+
+/* SCSI */
+#define SCSI_TEST_UNIT_READY		0x00
+#define SCSI_REQUEST_SENSE		0x03
+#define SCSI_READ_6			0x08
+#define SCSI_WRITE_6			0x0a
+#define SCSI_INQUIRY			0x12
+#define SCSI_MODE_SENSE_6		0x1a
+#define SCSI_START_STOP_UNIT		0x1b
+#define SCSI_PREVENT_ALLOW		0x1e
+#define SCSI_READ_FORMAT_CAPACITIES	0x23
+#define SCSI_READ_CAPACITY_10		0x25
+#define SCSI_READ_10			0x28
+#define SCSI_WRITE_10			0x2a
+#define SCSI_VERIFY_10			0x2f
+#define SCSI_SYNCHRONIZE_CACHE_10	0x35
+#define SCSI_MODE_SENSE_10		0x5a
+
+/* (key << 16) | (asc << 8) | ascq */
+#define SENSE_NONE		0x000000
+#define SENSE_NO_MEDIUM		0x023a00
+#define SENSE_MEDIUM_CHANGED	0x062800
+#define SENSE_WRITE_ERROR	0x030c00
+#define SENSE_READ_ERROR	0x031100
+#define SENSE_INVALID_OPCODE	0x052000
+#define SENSE_LBA_RANGE		0x052100
+#define SENSE_INVALID_FIELD	0x052400
+#define SENSE_WRITE_PROTECTED	0x072700
+
+struct msc_lun {
+	struct ptentry *ptn;
+	unsigned blocks;	/* good erase blocks */
+	unsigned sectors;
+	int readonly;
+	unsigned sense;		/* for the next REQUEST SENSE */
+	int write_error;	/* a write back failed since the last sync */
+	unsigned next_lba;	/* where a sequential read goes on */
+	int changed;		/* rewritten over fastboot since last seen */
+};
+
+/* an erase block of a LUN held in RAM */
+struct msc_cache {
+	struct msc_lun *lun;	/* NULL if unused */
+	unsigned block;
+	unsigned char *data;
+	unsigned valid[MSC_MAX_SPB / 32];	/* sectors holding data */
+	int dirty;
+	int busy;		/* op in flight, read ahead or write back */
+	int pins;		/* IN transfers sending from data */
+	unsigned used;		/* LRU stamp */
+	struct flash_op op;
+};
+
+struct msc_req {
+	struct udc_request *req;
+	struct udc_endpoint *ept;
+	int busy;
+	int status;
+	unsigned actual;
+	struct msc_cache *pin;
+};
+
+static struct msc_lun luns[MSC_MAX_LUNS];
+static unsigned num_luns;
+static struct msc_cache cache[UDC_MSC_CACHE];
+static unsigned cache_blocks;	/* entries the memory given holds */
+static unsigned cache_stamp;
+static unsigned block_size;	/* bytes */
+static unsigned spb;		/* sectors per block */
+static unsigned char *scratch;	/* a block read behind partial writes */
+
+static struct udc_endpoint *in, *out;
+static struct msc_req tx[2], rx[2];
+static unsigned tx_next;
+static unsigned char *cbw_buf, *csw_buf, *resp, *zero;
+static unsigned char *rx_buf[2];
+static event_t msc_event;
+static volatile int online, reset_pending;
+static int running;
+
+/* udc_msc_invalidate() hands the partition to the msc thread, which owns
+ * the cache, and waits for it to be dropped */
+static struct ptentry *volatile invalidate_ptn;
+static event_t invalidate_done;
+
+static struct {
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	unsigned blocks_read;
+	unsigned blocks_written;
+	unsigned hits;
+} msc_stats, msc_reported;
+
+static unsigned get_be16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned get_be32(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, unsigned v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* block cache */
+
+static int flash_read_block(struct msc_lun *lun, unsigned block, void *buf)
+{
+	struct flash_op op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = FLASH_OP_READ;
+	op.ptn = lun->ptn;
+	op.offset = block * block_size;
+	op.data = buf;
+	op.bytes = block_size;
+	if (flash_submit(&op))
+		return -1;
+	msc_stats.blocks_read++;
+	return flash_op_wait(&op) ? -1 : 0;
+}
+
+static int cache_full(struct msc_cache *e)
+{
+	unsigned n;
+
+	for (n = 0; n < spb / 32; n++)
+		if (e->valid[n] != 0xffffffff)
+			return 0;
+	return 1;
+}
+
+static int cache_sector_valid(struct msc_cache *e, unsigned n)
+{
+	return (e->valid[n / 32] >> (n % 32)) & 1;
+}
+
+static void cache_set_valid(struct msc_cache *e, unsigned first, unsigned n)
+{
+	for (; n; first++, n--)
+		e->valid[first / 32] |= 1U << (first % 32);
+}
+
+static void cache_assign(struct msc_cache *e, struct msc_lun *lun,
+			 unsigned block)
+{
+	e->lun = lun;
+	e->block = block;
+	e->dirty = 0;
+	e->used = ++cache_stamp;
+	memset(e->valid, 0, sizeof(e->valid));
+}
+
+/* wait for a read ahead or write back of the block to finish */
+static void cache_settle(struct msc_cache *e)
+{
+	int r;
+
+	if (!e->busy)
+		return;
+	r = flash_op_wait(&e->op);
+	e->busy = 0;
+	if (e->op.type == FLASH_OP_READ) {
+		if (r)
+			e->lun = NULL;	/* read again when needed */
+		else
+			cache_set_valid(e, 0, spb);
+	} else if (r) {
+		dprintf(CRITICAL, "msc: %s block %u not written\n",
+			e->lun->ptn->name, e->block);
+		e->lun->write_error = 1;
+	}
+}
+
+static struct msc_cache *cache_lookup(struct msc_lun *lun, unsigned block)
+{
+	struct msc_cache *e;
+
+	for (e = cache; e < cache + cache_blocks; e++)
+		if (e->lun == lun && e->block == block)
+			return e;
+	return NULL;
+}
+
+/* read in the sectors of the block the host has not written */
+static int cache_fill(struct msc_cache *e)
+{
+	unsigned n;
+	int r;
+
+	if (cache_full(e))
+		return 0;
+	if (!e->dirty) {
+		r = flash_read_block(e->lun, e->block, e->data);
+		if (!r)
+			cache_set_valid(e, 0, spb);
+		return r;
+	}
+
+	r = flash_read_block(e->lun, e->block, scratch);
+	for (n = 0; n < spb; n++) {
+		if (!cache_sector_valid(e, n))
+			memcpy(e->data + n * MSC_SECTOR,
+			       scratch + n * MSC_SECTOR, MSC_SECTOR);
+	}
+	cache_set_valid(e, 0, spb);
+	return r;
+}
+
+/* start writing a dirty block back; the flash worker programs it while
+ * we go on with USB
+ */
+static void cache_writeback(struct msc_cache *e)
+{
+	if (!e->dirty || e->busy)
+		return;
+	if (cache_fill(e))
+		dprintf(CRITICAL, "msc: %s block %u read failed, "
+			"writing it anyway\n", e->lun->ptn->name, e->block);
+
+	memset(&e->op, 0, sizeof(e->op));
+	e->op.type = FLASH_OP_BLOCK;
+	e->op.ptn = e->lun->ptn;
+	e->op.offset = e->block;
+	e->op.data = e->data;
+	if (flash_submit(&e->op)) {
+		e->lun->write_error = 1;
+		return;
+	}
+	e->busy = 1;
+	e->dirty = 0;
+	msc_stats.blocks_written++;
+}
+
+/* an unused entry, else the least recently used one not being sent;
+ * with 'clean' set only entries that are free without a write back
+ */
+static struct msc_cache *cache_pick(int clean)
+{
+	struct msc_cache *e, *best = NULL;
+
+	for (e = cache; e < cache + cache_blocks; e++) {
+		if (e->pins)
+			continue;
+		if (!e->lun && !e->busy)
+			return e;
+		if (clean && (e->dirty || e->busy))
+			continue;
+		if (!best || e->used < best->used)
+			best = e;
+	}
+	return best;
+}
+
+static struct msc_cache *cache_victim(void)
+{
+	struct msc_cache *e;
+
+	e = cache_pick(1);
+	if (!e)
+		e = cache_pick(0);
+	if (!e)
+		return NULL;
+	cache_settle(e);
+	if (e->lun && e->dirty) {
+		cache_writeback(e);
+		cache_settle(e);
+	}
+	e->lun = NULL;
+	return e;
+}
+
+/* the cached block, its sectors all read in if 'fill' is set */
+static struct msc_cache *cache_get(struct msc_lun *lun, unsigned block,
+				   int fill)
+{
+	struct msc_cache *e;
+
+	e = cache_lookup(lun, block);
+	if (e) {
+		cache_settle(e);
+		if (e->lun)
+			msc_stats.hits++;
+	}
+	if (!e || !e->lun) {
+		e = cache_victim();
+		if (!e)
+			return NULL;
+		cache_assign(e, lun, block);
+	}
+	e->used = ++cache_stamp;
+
+	if (fill && cache_fill(e)) {
+		if (!e->dirty)
+			e->lun = NULL;
+		return NULL;
+	}
+	return e;
+}
+
+/* read the block into a free or clean entry in the background */
+static void cache_prefetch(struct msc_lun *lun, unsigned block)
+{
+	struct msc_cache *e;
+
+	if (block >= lun->blocks || cache_lookup(lun, block))
+		return;
+	e = cache_pick(1);
+	if (!e)
+		return;
+	cache_assign(e, lun, block);
+
+	memset(&e->op, 0, sizeof(e->op));
+	e->op.type = FLASH_OP_READ;
+	e->op.ptn = lun->ptn;
+	e->op.offset = block * block_size;
+	e->op.data = e->data;
+	e->op.bytes = block_size;
+	if (flash_submit(&e->op)) {
+		e->lun = NULL;
+		return;
+	}
+	e->busy = 1;
+	msc_stats.blocks_read++;
+}
+
+/* write back the dirty blocks of a LUN, or all of them */
+static void cache_sync(struct msc_lun *lun)
+{
+	struct msc_cache *e;
+
+	for (e = cache; e < cache + cache_blocks; e++)
+		if (e->lun && (!lun || e->lun == lun))
+			cache_writeback(e);
+	for (e = cache; e < cache + cache_blocks; e++)
+		cache_settle(e);
+}
+
+/* copy received sectors into the cache */
+static int cache_write(struct msc_lun *lun, unsigned sector,
+		       const unsigned char *buf, unsigned count)
+{
+	struct msc_cache *e;
+	unsigned first, n;
+
+	while (count) {
+		first = sector % spb;
+		n = MIN(count, spb - first);
+		e = cache_get(lun, sector / spb, 0);
+		if (!e)
+			return -1;
+		memcpy(e->data + first * MSC_SECTOR, buf, n * MSC_SECTOR);
+		cache_set_valid(e, first, n);
+		e->dirty = 1;
+
+		/* the host writes on past the block; program it while the
+		 * next one comes in */
+		if (first + n == spb)
+			cache_writeback(e);
+
+		sector += n;
+		buf += n * MSC_SECTOR;
+		count -= n;
+	}
+	return 0;
+}
+
+/* write back and forget the blocks of a partition about to be rewritten
+ * over fastboot; the host is told the medium changed
+ */
+static void msc_invalidate(void)
+{
+	struct ptentry *ptn = invalidate_ptn;
+	struct msc_cache *e;
+	struct msc_lun *lun;
+
+	if (!ptn)
+		return;
+	for (lun = luns; lun < luns + num_luns; lun++) {
+		if (lun->ptn != ptn)
+			continue;
+		cache_sync(lun);
+		for (e = cache; e < cache + cache_blocks; e++)
+			if (e->lun == lun)
+				e->lun = NULL;	/* pinned ones stay until sent */
+		lun->write_error = 0;
+		lun->next_lba = 0;
+		lun->changed = 1;
+	}
+	invalidate_ptn = NULL;
+	event_signal(&invalidate_done, false);
+}
+
+static void msc_idle(void)
+{
+	cache_sync(NULL);
+	if (msc_stats.bytes_read == msc_reported.bytes_read &&
+	    msc_stats.bytes_written == msc_reported.bytes_written)
+		return;
+	dprintf(INFO, "msc: %u KB read, %u KB written, %u blocks read, "
+		"%u programmed, %u cache hits\n",
+		(unsigned)((msc_stats.bytes_read -
+			    msc_reported.bytes_read) >> 10),
+		(unsigned)((msc_stats.bytes_written -
+			    msc_reported.bytes_written) >> 10),
+		msc_stats.blocks_read - msc_reported.blocks_read,
+		msc_stats.blocks_written - msc_reported.blocks_written,
+		msc_stats.hits - msc_reported.hits);
+	msc_reported = msc_stats;
+}
+
+/* USB transfers */
+
+static void msc_complete(struct udc_request *req, unsigned actual,
+			 int status)
+{
+	struct msc_req *r = req->context;
+
+	r->actual = actual;
+	r->status = status;
+	r->busy = 0;
+	event_signal(&msc_event, false);
+}
+
+static int msc_queue(struct msc_req *r, void *buf, unsigned len)
+{
+	r->req->buf = buf;
+	r->req->length = len;
+	r->busy = 1;
+	if (udc_request_queue(r->ept, r->req)) {
+		r->busy = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void msc_unpin(struct msc_req *r)
+{
+	if (r->pin) {
+		r->pin->pins--;
+		r->pin = NULL;
+	}
+}
+
+/* wait for a transfer; with 'idle' set the cache is written back once
+ * the host has been quiet for a while
+ */
+static int msc_wait(struct msc_req *r, int idle)
+{
+	msc_invalidate();
+	while (r->busy) {
+		msc_invalidate();
+		if (reset_pending || !online)
+			return -1;
+		if (!idle)
+			event_wait(&msc_event);
+		else if (event_wait_timeout(&msc_event, MSC_IDLE_FLUSH) ==
+			 ERR_TIMED_OUT)
+			msc_idle();
+	}
+	msc_unpin(r);
+	if (r->status) {
+		r->status = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static void msc_cancel(struct msc_req *r)
+{
+	if (r->busy && !udc_request_cancel(r->ept, r->req))
+		r->busy = 0;
+	/* already retired, the completion is on its way */
+	while (r->busy)
+		event_wait(&msc_event);
+	msc_unpin(r);
+	r->status = 0;
+}
+
+/* drop the transfers in flight after a reset or disconnect */
+static void msc_abort(void)
+{
+	msc_cancel(&tx[0]);
+	msc_cancel(&tx[1]);
+	msc_cancel(&rx[0]);
+	msc_cancel(&rx[1]);
+	tx_next = 0;
+}
+
+/* send from buf, keeping up to two IN transfers queued; a cache entry
+ * sent from stays in place until its transfer is done
+ */
+static int msc_send(void *buf, unsigned len, struct msc_cache *pin)
+{
+	struct msc_req *r = &tx[tx_next];
+
+	if (msc_wait(r, 0))
+		return -1;
+	tx_next ^= 1;
+	r->pin = pin;
+	if (pin)
+		pin->pins++;
+	if (msc_queue(r, buf, len)) {
+		msc_unpin(r);
+		return -1;
+	}
+	return 0;
+}
+
+static int msc_send_done(void)
+{
+	if (msc_wait(&tx[tx_next], 0) || msc_wait(&tx[tx_next ^ 1], 0))
+		return -1;
+	return 0;
+}
+
+/* the host asked for more than the command has; zeros make up the rest */
+static int msc_pad(unsigned len)
+{
+	unsigned n;
+
+	for (; len; len -= n) {
+		n = MIN(len, MSC_PAD_SIZE);
+		if (msc_send(zero, n, NULL))
+			return -1;
+	}
+	return 0;
+}
+
+/* the host sends more than the command takes */
+static int msc_drain(unsigned len)
+{
+	unsigned n;
+
+	for (; len; len -= n) {
+		n = MIN(len, MSC_BUF_SIZE);
+		if (msc_queue(&rx[0], rx_buf[0], n) || msc_wait(&rx[0], 0))
+			return -1;
+		if (rx[0].actual < n)
+			break;
+	}
+	return 0;
+}
+
+/* The data phase, with the host's idea of its length and direction
+ * winning: there is no endpoint halt to cut it short, so missing IN data
+ * is padded and surplus OUT data dropped, as Bulk-Only Transport allows.
+ */
+static int msc_reply(struct cbw *cbw, unsigned len, struct csw *csw)
+{
+	unsigned n;
+
+	if (!cbw->length) {
+		if (len)
+			csw->status = CSW_PHASE_ERROR;
+		return 0;
+	}
+	if (!(cbw->flags & CBW_DATA_IN)) {
+		if (len)
+			csw->status = CSW_PHASE_ERROR;
+		csw->residue = cbw->length;
+		return msc_drain(cbw->length);
+	}
+	if (len > cbw->length) {
+		len = cbw->length;
+		csw->status = CSW_PHASE_ERROR;
+	}
+	csw->residue = cbw->length - len;
+
+	/* a short packet would end the transfer: the padding starts in the
+	 * same one, up to a packet boundary */
+	n = MIN(cbw->length, MSC_RESP_SIZE);
+	if (n > len)
+		memset(resp + len, 0, n - len);
+	if (msc_send(resp, n, NULL))
+		return -1;
+	return msc_pad(cbw->length - n);
+}
+
+/* commands */
+
+static int msc_range(struct msc_lun *lun, unsigned lba, unsigned count,
+		     struct csw *csw)
+{
+	if (lba <= lun->sectors && count <= lun->sectors - lba)
+		return 0;
+	lun->sense = SENSE_LBA_RANGE;
+	csw->status = CSW_FAILED;
+	return -1;
+}
+
+/* Sent straight from the cache, one block at a time, with the following
+ * block read in the background while the current one goes out.
+ */
+static int msc_read(struct msc_lun *lun, struct cbw *cbw, unsigned lba,
+		    unsigned count, struct csw *csw)
+{
+	int seq = (lba == lun->next_lba);
+	struct msc_cache *e;
+	unsigned sector, first, n, sent = 0;
+
+	if (cbw->length && !(cbw->flags & CBW_DATA_IN)) {
+		csw->status = CSW_PHASE_ERROR;
+		return msc_reply(cbw, 0, csw);
+	}
+	if (msc_range(lun, lba, count, csw))
+		return msc_reply(cbw, 0, csw);
+	if (count * MSC_SECTOR > cbw->length) {
+		csw->status = CSW_PHASE_ERROR;
+		count = cbw->length / MSC_SECTOR;
+	}
+
+	for (sector = lba; count; sector += n, count -= n) {
+		first = sector % spb;
+		n = MIN(count, spb - first);
+		e = cache_get(lun, sector / spb, 1);
+		if (!e) {
+			dprintf(INFO, "msc: %s read error @ %u\n",
+				lun->ptn->name, sector);
+			lun->sense = SENSE_READ_ERROR;
+			csw->status = CSW_FAILED;
+			break;
+		}
+		if (msc_send(e->data + first * MSC_SECTOR, n * MSC_SECTOR, e))
+			return -1;
+		sent += n * MSC_SECTOR;
+		if (n < count || seq)
+			cache_prefetch(lun, sector / spb + 1);
+	}
+	lun->next_lba = sector;
+	msc_stats.bytes_read += sent;
+
+	csw->residue = cbw->length - sent;
+	return msc_pad(csw->residue);
+}
+
+/* Received in chunks, each copied into the cache while the next one
+ * arrives.
+ */
+static int msc_write(struct msc_lun *lun, struct cbw *cbw, unsigned lba,
+		     unsigned count, struct csw *csw)
+{
+	struct msc_req *r;
+	unsigned bytes = count * MSC_SECTOR;
+	unsigned queued = 0, got = 0, n, i;
+	int failed = 0;
+
+	if (cbw->length && (cbw->flags & CBW_DATA_IN)) {
+		csw->status = CSW_PHASE_ERROR;
+		return msc_reply(cbw, 0, csw);
+	}
+	if (msc_range(lun, lba, count, csw))
+		return msc_reply(cbw, 0, csw);
+	if (lun->readonly) {
+		lun->sense = SENSE_WRITE_PROTECTED;
+		csw->status = CSW_FAILED;
+		return msc_reply(cbw, 0, csw);
+	}
+	if (bytes > cbw->length) {
+		csw->status = CSW_PHASE_ERROR;
+		bytes = cbw->length & ~(MSC_SECTOR - 1);
+	}
+
+	for (i = 0; i < 2 && queued < bytes; i++, queued += n) {
+		n = MIN(bytes - queued, MSC_BUF_SIZE);
+		if (msc_queue(&rx[i], rx_buf[i], n))
+			return -1;
+	}
+	for (i = 0; got < bytes; i ^= 1) {
+		r = &rx[i];
+		if (msc_wait(r, 0))
+			return -1;
+		n = r->actual / MSC_SECTOR;
+		if (!failed && cache_write(lun, lba, rx_buf[i], n)) {
+			lun->sense = SENSE_WRITE_ERROR;
+			csw->status = CSW_FAILED;
+			failed = 1;
+		}
+		lba += n;
+		got += r->actual;
+		if (r->actual < r->req->length) {
+			/* the host ended the data early */
+			msc_cancel(&rx[i ^ 1]);
+			csw->status = CSW_PHASE_ERROR;
+			csw->residue = cbw->length - got;
+			return 0;
+		}
+		if (queued < bytes) {
+			n = MIN(bytes - queued, MSC_BUF_SIZE);
+			if (msc_queue(r, rx_buf[i], n))
+				return -1;
+			queued += n;
+		}
+	}
+	msc_stats.bytes_written += got;
+
+	csw->residue = cbw->length - got;
+	return msc_drain(csw->residue);
+}
+
+static int msc_command(struct cbw *cbw, struct csw *csw)
+{
+	struct msc_lun *lun;
+	unsigned char *cb = cbw->cb;
+	unsigned len = 0;
+	unsigned n;
+
+	csw->status = CSW_GOOD;
+	csw->residue = 0;
+	if (cbw->lun >= num_luns) {
+		csw->status = CSW_FAILED;
+		return msc_reply(cbw, 0, csw);
+	}
+	lun = &luns[cbw->lun];
+	if (cb[0] != SCSI_REQUEST_SENSE)
+		lun->sense = SENSE_NONE;
+	if (lun->changed && cb[0] != SCSI_INQUIRY &&
+	    cb[0] != SCSI_REQUEST_SENSE) {
+		/* unit attention, once: the host drops what it has cached */
+		lun->changed = 0;
+		lun->sense = SENSE_MEDIUM_CHANGED;
+		csw->status = CSW_FAILED;
+		return msc_reply(cbw, 0, csw);
+	}
+
+	switch (cb[0]) {
+	case SCSI_READ_10:
+		return msc_read(lun, cbw, get_be32(cb + 2), get_be16(cb + 7),
+				csw);
+	case SCSI_READ_6:
+		return msc_read(lun, cbw, ((cb[1] & 0x1f) << 16) |
+				get_be16(cb + 2), cb[4] ? cb[4] : 256, csw);
+	case SCSI_WRITE_10:
+		return msc_write(lun, cbw, get_be32(cb + 2), get_be16(cb + 7),
+				 csw);
+	case SCSI_WRITE_6:
+		return msc_write(lun, cbw, ((cb[1] & 0x1f) << 16) |
+				 get_be16(cb + 2), cb[4] ? cb[4] : 256, csw);
+	case SCSI_TEST_UNIT_READY:
+		if (!lun->sectors) {
+			lun->sense = SENSE_NO_MEDIUM;
+			csw->status = CSW_FAILED;
+		}
+		break;
+	case SCSI_PREVENT_ALLOW:
+	case SCSI_VERIFY_10:
+		break;
+	case SCSI_START_STOP_UNIT:
+	case SCSI_SYNCHRONIZE_CACHE_10:
+		cache_sync(lun);
+		if (lun->write_error) {
+			lun->write_error = 0;
+			lun->sense = SENSE_WRITE_ERROR;
+			csw->status = CSW_FAILED;
+		}
+		break;
+	case SCSI_REQUEST_SENSE:
+		memset(resp, 0, 18);
+		resp[0] = 0x70;	/* current, fixed format */
+		resp[2] = lun->sense >> 16;
+		resp[7] = 10;
+		resp[12] = lun->sense >> 8;
+		resp[13] = lun->sense;
+		lun->sense = SENSE_NONE;
+		len = MIN(18, cb[4]);
+		break;
+	case SCSI_INQUIRY:
+		if (cb[1] & 1) {
+			/* no vital product data */
+			lun->sense = SENSE_INVALID_FIELD;
+			csw->status = CSW_FAILED;
+			break;
+		}
+		memset(resp, 0, 36);
+		resp[1] = 0x80;	/* removable */
+		resp[2] = 0x02;	/* SCSI-2 */
+		resp[3] = 0x02;	/* response data format */
+		resp[4] = 31;	/* additional length */
+		memcpy(resp + 8, "Android ", 8);
+		memset(resp + 16, ' ', 16);
+		n = strlen(lun->ptn->name);
+		memcpy(resp + 16, lun->ptn->name, MIN(n, 16));
+		memcpy(resp + 32, "0100", 4);
+		len = MIN(36, get_be16(cb + 3));
+		break;
+	case SCSI_MODE_SENSE_6:
+		memset(resp, 0, 4);
+		resp[0] = 3;
+		resp[2] = lun->readonly ? 0x80 : 0;
+		len = MIN(4, cb[4]);
+		break;
+	case SCSI_MODE_SENSE_10:
+		memset(resp, 0, 8);
+		resp[1] = 6;
+		resp[3] = lun->readonly ? 0x80 : 0;
+		len = MIN(8, get_be16(cb + 7));
+		break;
+	case SCSI_READ_CAPACITY_10:
+		if (!lun->sectors) {
+			/* no good blocks: there is no last sector */
+			lun->sense = SENSE_NO_MEDIUM;
+			csw->status = CSW_FAILED;
+			break;
+		}
+		put_be32(resp, lun->sectors - 1);
+		put_be32(resp + 4, MSC_SECTOR);
+		len = 8;
+		break;
+	case SCSI_READ_FORMAT_CAPACITIES:
+		memset(resp, 0, 12);
+		resp[3] = 8;	/* one capacity descriptor */
+		put_be32(resp + 4, lun->sectors);
+		put_be32(resp + 8, MSC_SECTOR);
+		resp[8] = lun->sectors ? 0x02 : 0x03;	/* formatted, none */
+		len = MIN(12, get_be16(cb + 7));
+		break;
+	default:
+		lun->sense = SENSE_INVALID_OPCODE;
+		csw->status = CSW_FAILED;
+		break;
+	}
+	return msc_reply(cbw, len, csw);
+}
+
+static int msc_thread(void *arg)
+{
+	struct cbw *cbw = (struct cbw *)cbw_buf;
+	struct csw *csw = (struct csw *)csw_buf;
+
+	for (;;) {
+		if (!online || reset_pending) {
+			msc_abort();
+			reset_pending = 0;
+			if (!online)
+				msc_idle();
+			while (!online) {
+				msc_invalidate();
+				event_wait(&msc_event);
+			}
+		}
+
+		if (msc_queue(&rx[0], cbw_buf, CBW_SIZE) || msc_wait(&rx[0], 1))
+			continue;
+		if (rx[0].actual != CBW_SIZE || cbw->signature != CBW_SIGNATURE) {
+			/* without an endpoint halt to report it, wait for the
+			 * host to give up and reset */
+			dprintf(INFO, "msc: invalid CBW\n");
+			continue;
+		}
+
+		if (msc_command(cbw, csw) || msc_send_done()) {
+			msc_abort();
+			continue;
+		}
+		csw->signature = CSW_SIGNATURE;
+		csw->tag = cbw->tag;
+		if (msc_send(csw_buf, CSW_SIZE, NULL) || msc_send_done())
+			msc_abort();
+	}
+	return 0;
+}
+
+/* gadget */
+
+static int msc_setup(struct udc_gadget *gadget, const struct setup_packet *s,
+		     void *buf)
+{
+	switch (s->request) {
+	case MSC_GET_MAX_LUN:
+		*(unsigned char *)buf = num_luns - 1;
+		return 1;
+	case MSC_RESET:
+		reset_pending = 1;
+		event_signal(&msc_event, false);
+		return 0;
+	}
+	return -1;
+}
+
+static void msc_notify(struct udc_gadget *gadget, unsigned event)
+{
+	online = (event == UDC_EVENT_ONLINE);
+	event_signal(&msc_event, false);
+}
+
+static struct udc_endpoint *msc_epts[2];
+
+static struct udc_gadget msc_gadget = {
+	.notify = msc_notify,
+	.ifc_class = 0x08,	/* mass storage */
+	.ifc_subclass = 0x06,	/* SCSI transparent */
+	.ifc_protocol = 0x50,	/* bulk only */
+	.ifc_endpoints = 2,
+	.ifc_string = "mass storage",
+	.ept = msc_epts,
+	.setup = msc_setup,
+};
+
+static int msc_add_lun(const char *name)
+{
+	struct ptable *ptable = flash_get_ptable();
+	struct ptentry *ptn;
+	struct msc_lun *lun;
+
+	ptn = ptable ? ptable_find(ptable, name) : NULL;
+	if (!ptn || ptn->type != TYPE_APPS_PARTITION) {
+		dprintf(INFO, "msc: no partition %s\n", name);
+		return -1;
+	}
+
+	lun = &luns[num_luns++];
+	lun->ptn = ptn;
+	lun->blocks = flash_good_blocks(ptn);
+	lun->sectors = lun->blocks * spb;
+	lun->readonly = (ptn->perm != PERM_WRITEABLE);
+	dprintf(INFO, "msc: lun %u %s, %u KB%s\n", num_luns - 1, name,
+		lun->blocks * (block_size >> 10),
+		lun->readonly ? ", read only" : "");
+	return 0;
+}
+
+void udc_msc_invalidate(struct ptentry *ptn)
+{
+	unsigned n;
+
+	if (!running)
+		return;
+	for (n = 0; n < num_luns; n++)
+		if (luns[n].ptn == ptn)
+			break;
+	if (n == num_luns)
+		return;
+
+	invalidate_ptn = ptn;
+	event_signal(&msc_event, false);
+	event_wait(&invalidate_done);
+}
+
+unsigned udc_msc_mem_size(void)
+{
+	return (UDC_MSC_CACHE + 1) * flash_page_size() * 64;
+}
+
+int udc_msc_init(const char *partitions, void *mem, unsigned size)
+{
+	char name[MAX_PTENTRY_NAME];
+	const char *p, *end;
+	thread_t *thr;
+	unsigned n;
+
+	block_size = flash_page_size() * 64;
+	spb = block_size / MSC_SECTOR;
+	if (!block_size || spb > MSC_MAX_SPB) {
+		dprintf(CRITICAL, "msc: unsupported flash\n");
+		return -1;
+	}
+
+	/* a block read behind partial writes, the rest for the cache */
+	cache_blocks = size / block_size;
+	if (cache_blocks)
+		cache_blocks--;
+	if (cache_blocks > UDC_MSC_CACHE)
+		cache_blocks = UDC_MSC_CACHE;
+	if (cache_blocks < MSC_MIN_CACHE) {
+		dprintf(CRITICAL, "msc: %u KB is too little for the cache\n",
+			size >> 10);
+		return -1;
+	}
+	scratch = mem;
+	for (n = 0; n < cache_blocks; n++)
+		cache[n].data = (unsigned char *)mem + (n + 1) * block_size;
+
+	for (p = partitions; *p && num_luns < MSC_MAX_LUNS; p = end) {
+		end = strchr(p, ',');
+		if (!end)
+			end = p + strlen(p);
+		n = end - p;
+		if (*end)
+			end++;
+		if (!n || n >= sizeof(name))
+			continue;
+		memcpy(name, p, n);
+		name[n] = 0;
+		msc_add_lun(name);
+	}
+	if (!num_luns)
+		return -1;
+
+	in = udc_endpoint_alloc(UDC_TYPE_BULK_IN, 512);
+	out = udc_endpoint_alloc(UDC_TYPE_BULK_OUT, 512);
+	if (!in || !out)
+		goto fail;
+	for (n = 0; n < 2; n++) {
+		tx[n].ept = in;
+		rx[n].ept = out;
+		tx[n].req = udc_request_alloc();
+		rx[n].req = udc_request_alloc();
+		if (!tx[n].req || !rx[n].req)
+			goto fail;
+		tx[n].req->complete = rx[n].req->complete = msc_complete;
+		tx[n].req->context = &tx[n];
+		rx[n].req->context = &rx[n];
+		rx_buf[n] = memalign(32, MSC_BUF_SIZE);
+		if (!rx_buf[n])
+			goto fail;
+	}
+
+	cbw_buf = memalign(32, 512);
+	csw_buf = memalign(32, 32);
+	resp = memalign(32, MSC_RESP_SIZE);
+	zero = memalign(32, MSC_PAD_SIZE);
+	if (!cbw_buf || !csw_buf || !resp || !zero)
+		goto fail;
+	memset(zero, 0, MSC_PAD_SIZE);
+
+	event_init(&msc_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+	event_init(&invalidate_done, false, EVENT_FLAG_AUTOUNSIGNAL);
+	thr = thread_create("msc", msc_thread, 0, DEFAULT_PRIORITY, 8192);
+	if (!thr)
+		goto fail;
+	thread_resume(thr);
+	running = 1;
+
+	msc_epts[0] = in;
+	msc_epts[1] = out;
+	return udc_register_gadget(&msc_gadget);
+
+ fail:
+	dprintf(CRITICAL, "msc: out of memory\n");
+	return -1;
+}
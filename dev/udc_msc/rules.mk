@@ -0,0 +1,11 @@
+LOCAL_DIR := $(GET_LOCAL_DIR)
+
+# erase blocks cached in RAM, at least 4; the memory comes from the
+# caller of udc_msc_init(), aboot takes it off the top of the scratch area
+UDC_MSC_CACHE ?= 4
+
+DEFINES += \
+	UDC_MSC_CACHE=$(UDC_MSC_CACHE)
+
+OBJS += \
+	$(LOCAL_DIR)/msc.o
@@ -51,6 +51,7 @@ extern "C" {
 
 	void arch_clean_cache_range(addr_t start, size_t len);
 	void arch_clean_invalidate_cache_range(addr_t start, size_t len);
+	void arch_invalidate_cache_range(addr_t start, size_t len);
 
 	void arch_idle(void);
 
@@ -30,6 +30,7 @@
 #define __DEV_FLASH_H
 
 #include <lib/ptable.h>
+#include <kernel/event.h>
 
 struct flash_info {
 	unsigned id;
@@ -51,8 +52,18 @@ struct flash_info *flash_get_info(void);
 int flash_erase(struct ptentry *ptn);
 int flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 		   unsigned offset, void *data, unsigned bytes);
-int flash_write(struct ptentry *ptn, unsigned extra_per_page,
-		const void *data, unsigned bytes);
+int flash_write_ext(struct ptentry *ptn, unsigned extra_per_page,
+		    const void *data, unsigned bytes, unsigned flags);
+
+/* flash_write_ext() flags */
+#define FLASH_WRITE_DIFF	(1U << 0)	/* skip blocks holding the data */
+
+static inline int
+flash_write(struct ptentry *ptn, unsigned extra_per_page, const void *data,
+	    unsigned bytes)
+{
+	return flash_write_ext(ptn, extra_per_page, data, bytes, 0);
+}
 
 static inline int
 flash_read(struct ptentry *ptn, unsigned offset, void *data, unsigned bytes)
@@ -60,6 +71,123 @@ flash_read(struct ptentry *ptn, unsigned offset, void *data, unsigned bytes)
 	return flash_read_ext(ptn, 0, offset, data, bytes);
 }
 
+/* incremental partition writes
+ * - the partition is filled front to back like flash_write_ext(), with
+ *   pages handed in as data, a repeated 32-bit pattern, or left erased
+ * - byte counts are whole pages of flash_page_size() + extra_per_page
+ * - pages are collected a block at a time and programmed once the block
+ *   is complete, so data passed to flash_stream_write() must stay valid
+ *   until the stream has moved past its block (flash_stream_close() at
+ *   the latest)
+ * - flash_stream_close() erases what is left of the partition; it must
+ *   be called even after an error to release the stream
+ */
+struct flash_stream_page {
+	const unsigned char *data;	/* NULL for fill and skip pages */
+	unsigned fill;
+	unsigned type;
+};
+
+struct flash_stream {
+	const void *ops;
+	struct ptentry *ptn;
+	unsigned pagesize;
+	unsigned extra_per_page;
+	unsigned flags;
+	unsigned page;		/* block the collected pages go to */
+	unsigned lastpage;
+	unsigned count;		/* pages collected for that block */
+	int error;
+	struct flash_stream_page pages[64];
+	unsigned char *bounce;	/* realigned copy of a data page */
+	unsigned char *fill_page;
+	unsigned fill_value;
+	unsigned char *erased_spare;
+	unsigned unchanged;	/* FLASH_WRITE_DIFF statistics */
+	unsigned erases_skipped;
+};
+
+int flash_stream_open(struct flash_stream *s, struct ptentry *ptn,
+		      unsigned extra_per_page, unsigned flags);
+int flash_stream_write(struct flash_stream *s, const void *data,
+		       unsigned bytes);
+int flash_stream_fill(struct flash_stream *s, unsigned value, unsigned bytes);
+int flash_stream_skip(struct flash_stream *s, unsigned bytes);
+int flash_stream_close(struct flash_stream *s);
+
 unsigned flash_page_size(void);
 
+/* block access for the USB mass storage function
+ * - blocks count the good blocks of the partition, the way
+ *   flash_read_ext() offsets do; a block is 64 pages of
+ *   flash_page_size() bytes
+ * - flash_write_block() erases one block and programs 'data' (no spare,
+ *   aligned for DMA) into it in place.  A block that fails to program is
+ *   erased again but not retired, since moving on to the next good block
+ *   would shift every block behind it.
+ */
+unsigned flash_good_blocks(struct ptentry *ptn);
+int flash_write_block(struct ptentry *ptn, unsigned block, const void *data);
+
+/* drive a second NAND chip interleaved with the first */
+void enable_interleave_mode(int status);
+
+/* counters of the pipelined sequential read engine; times in usecs */
+struct flash_read_stats {
+	unsigned reads;		/* pipelined flash_read_ext() calls */
+	unsigned chains;	/* command lists handed to the data mover */
+	unsigned pages;		/* pages read successfully */
+	unsigned flushes;	/* pipeline restarts behind a failed page */
+	unsigned stalls;	/* submissions that found the controller idle */
+	bigtime_t prepare_time;	/* building and queueing command lists */
+	bigtime_t wait_time;	/* CPU blocked on the data mover */
+	bigtime_t check_time;	/* validating status, copying spare */
+	bigtime_t idle_time;	/* controller idle between command lists */
+};
+
+void flash_get_read_stats(struct flash_read_stats *stats);
+void flash_reset_read_stats(void);
+
+/* asynchronous flash operations
+ * - operations are queued and run in order by a flash worker thread
+ * - the data mover sleeps on its completion interrupt, so other threads
+ *   keep running while an operation is in progress
+ * - op->done is signalled and op->complete (if set) called from the
+ *   worker thread once op->result is valid
+ * - do not mix with synchronous calls while operations are pending: the
+ *   driver's command lists and buffers are not shared safely, so once
+ *   several threads use the flash all of them go through the worker,
+ *   flash_op_call() for a call that waits
+ */
+#define FLASH_OP_READ	0
+#define FLASH_OP_WRITE	1
+#define FLASH_OP_ERASE	2
+#define FLASH_OP_STREAM	3	/* flash_stream_write(op->stream, ...) */
+#define FLASH_OP_BLOCK	4	/* flash_write_block(), op->offset is the block */
+#define FLASH_OP_OPEN	5	/* flash_stream_open(op->stream, ...) */
+#define FLASH_OP_CLOSE	6	/* flash_stream_close(op->stream) */
+#define FLASH_OP_FILL	7	/* flash_stream_fill(), op->offset is the value */
+#define FLASH_OP_SKIP	8	/* flash_stream_skip(op->stream, op->bytes) */
+#define FLASH_OP_GOOD	9	/* flash_good_blocks(op->ptn) as the result */
+
+struct flash_op {
+	struct flash_op *next;
+	unsigned type;
+	struct ptentry *ptn;
+	unsigned extra_per_page;
+	unsigned offset;	/* FLASH_OP_READ and FLASH_OP_BLOCK only */
+	unsigned flags;		/* FLASH_OP_WRITE and FLASH_OP_OPEN only */
+	struct flash_stream *stream;	/* stream operations only */
+	void *data;
+	unsigned bytes;
+	int result;
+	void (*complete) (struct flash_op * op);
+	void *arg;
+	event_t done;
+};
+
+int flash_submit(struct flash_op *op);
+int flash_op_wait(struct flash_op *op);
+int flash_op_call(struct flash_op *op);	/* submit and wait */
+
 #endif				/* __DEV_FLASH_H */
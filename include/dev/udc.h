@@ -29,6 +29,8 @@
 #ifndef __DEV_UDC_H
 #define __DEV_UDC_H
 
+struct setup_packet;
+
 /* USB Device Controller Transfer Request */
 struct udc_request {
 	void *buf;
@@ -46,8 +48,16 @@ void udc_request_free(struct udc_request *req);
 int udc_request_queue(struct udc_endpoint *ept, struct udc_request *req);
 int udc_request_cancel(struct udc_endpoint *ept, struct udc_request *req);
 
+/* OUT requests are limited to UDC_OUT_MAX bytes: the controller ends a
+ * transfer descriptor at a short packet and goes on with the next one,
+ * so a request that needed several would take in the host's following
+ * transfer.  Queue more requests instead of longer ones.
+ */
+#define UDC_OUT_MAX		16384
+
 #define UDC_TYPE_BULK_IN	1
 #define UDC_TYPE_BULK_OUT	2
+#define UDC_TYPE_INTR_IN	3
 
 struct udc_endpoint *udc_endpoint_alloc(unsigned type, unsigned maxpkt);
 void udc_endpoint_free(struct udc_endpoint *ept);
@@ -67,8 +77,33 @@ struct udc_gadget {
 	unsigned flags;
 
 	struct udc_endpoint **ept;
+
+	/* Functions spanning several interfaces (CDC) set ifc_count and
+	 * write their own descriptors, interface association first:
+	 * desc_fill() returns their size and fills data unless it is 0.
+	 * The ifc_* fields and ept above are unused then.
+	 */
+	unsigned ifc_count;
+	unsigned (*desc_fill) (struct udc_gadget * gadget,
+			       unsigned char *data);
+
+	/* Class and vendor requests to the gadget's interfaces, called from
+	 * the controller's thread.  buf holds the data of host to device
+	 * requests and takes up to s->length bytes for device to host
+	 * ones.  Returns the length of data to send or 0, -1 to stall.
+	 */
+	int (*setup) (struct udc_gadget * gadget,
+		      const struct setup_packet * s, void *buf);
+
+	/* set by udc_register_gadget() */
+	unsigned ifc_number;	/* first interface */
+	struct udc_gadget *next;
 };
 
+/* for desc_fill(): a 7 byte endpoint descriptor, and a string index */
+void udc_ept_desc_fill(struct udc_endpoint *ept, unsigned char *data);
+unsigned udc_string_desc_alloc(const char *str);
+
 struct udc_device {
 	unsigned short vendor_id;
 	unsigned short product_id;
@@ -84,6 +119,22 @@ int udc_register_gadget(struct udc_gadget *gadget);
 int udc_start(void);
 int udc_stop(void);
 
+/* controller counters, kept since udc_init() or the last reset */
+struct udc_stats {
+	unsigned irqs;		/* interrupts with work to do */
+	unsigned irq_time;	/* usecs spent in the interrupt handler */
+	unsigned irq_time_max;	/* longest single interrupt, usecs */
+	unsigned bh_runs;	/* passes of the usb thread over latched work */
+	unsigned completions;	/* requests retired */
+	unsigned primes;	/* endpoint (re)starts */
+	unsigned appends;	/* requests linked behind a queued one */
+	unsigned reprimes;	/* appends that found the endpoint stopped */
+	unsigned flushes;	/* endpoint flushes */
+};
+
+void udc_get_stats(struct udc_stats *stats);
+void udc_reset_stats(void);
+
 /* these should probably go elsewhere */
 #define GET_STATUS           0
 #define CLEAR_FEATURE        1
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __DEV_UDC_MSC_H
+#define __DEV_UDC_MSC_H
+
+/* USB mass storage (Bulk-Only Transport, SCSI) function for flash
+ * partitions
+ * - 'partitions' is a comma separated list of partition names, each
+ *   exposed as one LUN of 512 byte sectors; names missing from the
+ *   partition table are skipped
+ * - registers a gadget next to any others; call after flash_init() and
+ *   before udc_start()
+ * - commands are served by their own thread; flash is read and written
+ *   whole erase blocks at a time through a small write-back cache, with
+ *   the next block read ahead on sequential reads.  Dirty blocks go out
+ *   when the host moves past them, on SYNCHRONIZE CACHE or eject, after
+ *   a second without commands and when the host goes away.
+ * - all flash access goes through the flash worker (flash_submit()),
+ *   and so does that of fastboot, so the two never drive the controller
+ *   at once.  The cache is not coherent with fastboot's writes, though:
+ *   call udc_msc_invalidate() before erasing or writing a partition.
+ */
+int udc_msc_init(const char *partitions, void *mem, unsigned size);
+
+struct ptentry;
+
+/* Write back the cached blocks of a partition about to be erased or
+ * written by someone else and drop all of them, so no dirty block lands
+ * on the new image and no stale one is served after it.  Waits for the
+ * mass storage thread; does nothing for a partition not exposed.  The
+ * next command on the LUN fails with a medium change (unit attention),
+ * so the host drops its own cache; what it reads while the partition is
+ * being rewritten is whatever the flash holds at the time.
+ */
+void udc_msc_invalidate(struct ptentry *ptn);
+
+/* memory udc_msc_init() can use: UDC_MSC_CACHE erase blocks for the
+ * cache and one more; 'mem' must be cache line aligned and stay
+ * reserved, and may be smaller down to five erase blocks
+ */
+unsigned udc_msc_mem_size(void);
+
+#endif
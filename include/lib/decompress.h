@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __LIB_DECOMPRESS_H
+#define __LIB_DECOMPRESS_H
+
+/* streaming decompression of gzip and LZ4 (frame and legacy) data
+ * - input is pulled with fill(), which points *buf at the next piece
+ *   and returns its length, 0 at the end of the input or -1 on error
+ * - output is pushed in order with flush(); a nonzero return stops
+ *   decompression, the data must be copied before returning
+ * - back references are resolved in a DECOMPRESS_WINDOW byte ring
+ *   allocated for the duration of decompress_run(), so neither side
+ *   needs the whole image in memory
+ */
+#define DECOMPRESS_NONE		0
+#define DECOMPRESS_GZIP		1
+#define DECOMPRESS_LZ4		2	/* frame format */
+#define DECOMPRESS_LZ4_LEGACY	3	/* lz4 -l, as used for kernels */
+
+#define DECOMPRESS_WINDOW	(128 * 1024)
+
+struct decompress {
+	int (*fill) (struct decompress * d, const unsigned char **buf);
+	int (*flush) (struct decompress * d, const unsigned char *data,
+		      unsigned len);
+	void *arg;
+
+	/* private */
+	const unsigned char *in;
+	unsigned in_len;
+	int eof;
+	int error;
+	unsigned char *window;
+	unsigned pos;		/* bytes produced */
+	unsigned flushed;	/* bytes handed to flush() */
+	int check_crc;
+	unsigned crc;
+	unsigned crc_pos;	/* bytes covered by crc */
+};
+
+/* format of data starting with 'data', DECOMPRESS_NONE if unknown */
+int decompress_detect(const void *data, unsigned len);
+
+/* decompress all of the input; returns the output size or -1 */
+int decompress_run(struct decompress *d, int format);
+
+#endif
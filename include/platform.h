@@ -42,4 +42,7 @@ void platform_exit(void);
 
 void platform_uninit_timer(void);
 
+/* memory shared with bus masters that is never cached, for descriptors */
+void *platform_alloc_uncached(size_t size, size_t align);
+
 #endif
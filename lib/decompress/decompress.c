@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <malloc.h>
+
+#include "decompress.h"
+
+static unsigned crc_table[256];
+
+static void crc_init(void)
+{
+	unsigned n, k, c;
+
+	if (crc_table[1])
+		return;
+	for (n = 0; n < 256; n++) {
+		c = n;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[n] = c;
+	}
+}
+
+/* extend the CRC-32 of the output to everything produced so far */
+void decompress_crc_update(struct decompress *d)
+{
+	unsigned c = ~d->crc;
+
+	for (; d->crc_pos != d->pos; d->crc_pos++)
+		c = crc_table[(c ^ d->window[d->crc_pos & WINDOW_MASK]) & 0xff]
+		    ^ (c >> 8);
+	d->crc = ~c;
+}
+
+int decompress_refill(struct decompress *d)
+{
+	int r;
+
+	while (!d->in_len) {
+		if (d->eof || d->error)
+			return -1;
+		r = d->fill(d, &d->in);
+		if (r < 0) {
+			d->error = 1;
+			return -1;
+		}
+		if (r == 0) {
+			d->eof = 1;
+			return -1;
+		}
+		d->in_len = r;
+	}
+	return 0;
+}
+
+static void flush_out(struct decompress *d, unsigned len)
+{
+	if (!len || d->error)
+		return;
+	if (d->check_crc)
+		decompress_crc_update(d);
+	if (d->flush(d, d->window + (d->flushed & WINDOW_MASK), len))
+		d->error = 1;
+	d->flushed += len;
+}
+
+/* called by putbyte() whenever a half of the ring is complete */
+void decompress_flush_half(struct decompress *d)
+{
+	flush_out(d, d->pos - d->flushed);
+}
+
+int decompress_detect(const void *data, unsigned len)
+{
+	const unsigned char *p = data;
+
+	if (len >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8)
+		return DECOMPRESS_GZIP;
+	if (len >= 4 && p[0] == 0x04 && p[1] == 0x22 && p[2] == 0x4d
+	    && p[3] == 0x18)
+		return DECOMPRESS_LZ4;
+	if (len >= 4 && p[0] == 0x02 && p[1] == 0x21 && p[2] == 0x4c
+	    && p[3] == 0x18)
+		return DECOMPRESS_LZ4_LEGACY;
+	return DECOMPRESS_NONE;
+}
+
+int decompress_run(struct decompress *d, int format)
+{
+	int r;
+
+	d->in_len = 0;
+	d->eof = 0;
+	d->error = 0;
+	d->pos = 0;
+	d->flushed = 0;
+	d->check_crc = 0;
+	d->crc = 0;
+	d->crc_pos = 0;
+	d->window = malloc(DECOMPRESS_WINDOW);
+	if (!d->window)
+		return -1;
+	crc_init();
+
+	switch (format) {
+	case DECOMPRESS_GZIP:
+		r = inflate_gzip(d);
+		break;
+	case DECOMPRESS_LZ4:
+		r = lz4_frame(d);
+		break;
+	case DECOMPRESS_LZ4_LEGACY:
+		r = lz4_legacy(d);
+		break;
+	default:
+		r = -1;
+		break;
+	}
+	if (!r)
+		flush_out(d, d->pos - d->flushed);
+
+	free(d->window);
+	d->window = NULL;
+	if (r || d->error)
+		return -1;
+	return d->pos;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __DECOMPRESS_PRIV_H
+#define __DECOMPRESS_PRIV_H
+
+#include <lib/decompress.h>
+
+#define WINDOW_MASK	(DECOMPRESS_WINDOW - 1)
+#define WINDOW_HALF	(DECOMPRESS_WINDOW / 2)
+
+int decompress_refill(struct decompress *d);
+void decompress_flush_half(struct decompress *d);
+void decompress_crc_update(struct decompress *d);
+
+/* next input byte; 0 with d->error set past the end of the input */
+static inline unsigned getbyte(struct decompress *d)
+{
+	if (!d->in_len && decompress_refill(d)) {
+		d->error = 1;
+		return 0;
+	}
+	d->in_len--;
+	return *d->in++;
+}
+
+/* nonzero if the input is used up */
+static inline int at_eof(struct decompress *d)
+{
+	if (d->in_len)
+		return 0;
+	decompress_refill(d);
+	return d->eof;
+}
+
+static inline void putbyte(struct decompress *d, unsigned char c)
+{
+	d->window[d->pos++ & WINDOW_MASK] = c;
+	if (!(d->pos & (WINDOW_HALF - 1)))
+		decompress_flush_half(d);
+}
+
+/* repeat 'len' bytes from 'dist' bytes back; the ring holds at least
+ * WINDOW_HALF bytes of history */
+static inline int copymatch(struct decompress *d, unsigned dist, unsigned len)
+{
+	if (!dist || dist > d->pos || dist > WINDOW_HALF) {
+		d->error = 1;
+		return -1;
+	}
+	while (len--)
+		putbyte(d, d->window[(d->pos - dist) & WINDOW_MASK]);
+	return 0;
+}
+
+int inflate_gzip(struct decompress *d);
+int lz4_frame(struct decompress *d);
+int lz4_legacy(struct decompress *d);
+
+#endif
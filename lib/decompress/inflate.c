@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Deflate decoder after Mark Adler's puff: canonical Huffman codes are
+ * decoded a bit at a time from per-length code counts, which needs no
+ * lookup tables beyond the symbol lists.  Input comes one byte at a
+ * time from getbyte(), output goes through the decompress window.
+ */
+
+#include <string.h>
+#include <malloc.h>
+
+#include "decompress.h"
+
+#define MAXBITS		15	/* longest code */
+#define MAXLCODES	286	/* literal/length codes */
+#define MAXDCODES	30	/* distance codes */
+#define MAXCODES	(MAXLCODES + MAXDCODES)
+#define FIXLCODES	288	/* literal/length codes in the fixed block */
+
+struct huffman {
+	short count[MAXBITS + 1];	/* codes of each length */
+	short symbol[FIXLCODES];	/* symbols ordered by code */
+};
+
+struct inflate {
+	struct decompress *d;
+	unsigned bitbuf;
+	unsigned bitcnt;
+	struct huffman lencode;
+	struct huffman distcode;
+	short lengths[MAXCODES];
+};
+
+static int bits(struct inflate *s, unsigned need)
+{
+	unsigned val = s->bitbuf;
+
+	while (s->bitcnt < need) {
+		val |= getbyte(s->d) << s->bitcnt;
+		s->bitcnt += 8;
+	}
+	s->bitbuf = val >> need;
+	s->bitcnt -= need;
+	return val & ((1U << need) - 1);
+}
+
+static int decode(struct inflate *s, const struct huffman *h)
+{
+	int code = 0, first = 0, index = 0, count;
+	unsigned len;
+
+	for (len = 1; len <= MAXBITS; len++) {
+		if (!s->bitcnt) {
+			s->bitbuf = getbyte(s->d);
+			s->bitcnt = 8;
+		}
+		code |= s->bitbuf & 1;
+		s->bitbuf >>= 1;
+		s->bitcnt--;
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;		/* ran out of codes */
+}
+
+/* build a decoding table from code lengths; returns 0 for a complete
+ * code, > 0 for an incomplete one and < 0 for an over-subscribed one */
+static int construct(struct huffman *h, const short *length, int n)
+{
+	short offs[MAXBITS + 1];
+	int symbol, len, left;
+
+	for (len = 0; len <= MAXBITS; len++)
+		h->count[len] = 0;
+	for (symbol = 0; symbol < n; symbol++)
+		h->count[length[symbol]]++;
+	if (h->count[0] == n)
+		return 0;
+
+	left = 1;
+	for (len = 1; len <= MAXBITS; len++) {
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return left;
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < MAXBITS; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (symbol = 0; symbol < n; symbol++)
+		if (length[symbol] != 0)
+			h->symbol[offs[length[symbol]]++] = symbol;
+
+	return left;
+}
+
+static int stored(struct inflate *s)
+{
+	struct decompress *d = s->d;
+	unsigned len;
+
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+
+	len = getbyte(d);
+	len |= getbyte(d) << 8;
+	if (getbyte(d) != (~len & 0xff) || getbyte(d) != ((~len >> 8) & 0xff))
+		return -1;
+
+	while (len-- && !d->error)
+		putbyte(d, getbyte(d));
+	return 0;
+}
+
+static const short lbase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const short lext[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const short dbase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const short dext[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 13, 13
+};
+
+static int codes(struct inflate *s)
+{
+	struct decompress *d = s->d;
+	int symbol;
+	unsigned len, dist;
+
+	for (;;) {
+		if (d->error)
+			return -1;
+		symbol = decode(s, &s->lencode);
+		if (symbol < 0)
+			return -1;
+		if (symbol < 256) {
+			putbyte(d, symbol);
+			continue;
+		}
+		if (symbol == 256)
+			return 0;
+
+		symbol -= 257;
+		if (symbol >= 29)
+			return -1;
+		len = lbase[symbol] + bits(s, lext[symbol]);
+
+		symbol = decode(s, &s->distcode);
+		if (symbol < 0 || symbol >= 30)
+			return -1;
+		dist = dbase[symbol] + bits(s, dext[symbol]);
+		if (copymatch(d, dist, len))
+			return -1;
+	}
+}
+
+static int fixed(struct inflate *s)
+{
+	int symbol;
+
+	for (symbol = 0; symbol < 144; symbol++)
+		s->lengths[symbol] = 8;
+	for (; symbol < 256; symbol++)
+		s->lengths[symbol] = 9;
+	for (; symbol < 280; symbol++)
+		s->lengths[symbol] = 7;
+	for (; symbol < FIXLCODES; symbol++)
+		s->lengths[symbol] = 8;
+	construct(&s->lencode, s->lengths, FIXLCODES);
+
+	for (symbol = 0; symbol < MAXDCODES; symbol++)
+		s->lengths[symbol] = 5;
+	construct(&s->distcode, s->lengths, MAXDCODES);
+
+	return codes(s);
+}
+
+static int dynamic(struct inflate *s)
+{
+	static const short order[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+	};
+	int nlen, ndist, ncode, index, err, symbol, len;
+
+	nlen = bits(s, 5) + 257;
+	ndist = bits(s, 5) + 1;
+	ncode = bits(s, 4) + 4;
+	if (nlen > MAXLCODES || ndist > MAXDCODES)
+		return -1;
+
+	for (index = 0; index < ncode; index++)
+		s->lengths[order[index]] = bits(s, 3);
+	for (; index < 19; index++)
+		s->lengths[order[index]] = 0;
+	if (construct(&s->lencode, s->lengths, 19) != 0)
+		return -1;
+
+	index = 0;
+	while (index < nlen + ndist) {
+		if (s->d->error)
+			return -1;
+		symbol = decode(s, &s->lencode);
+		if (symbol < 0)
+			return -1;
+		if (symbol < 16) {
+			s->lengths[index++] = symbol;
+			continue;
+		}
+		len = 0;
+		if (symbol == 16) {
+			if (index == 0)
+				return -1;
+			len = s->lengths[index - 1];
+			symbol = 3 + bits(s, 2);
+		} else if (symbol == 17) {
+			symbol = 3 + bits(s, 3);
+		} else {
+			symbol = 11 + bits(s, 7);
+		}
+		if (index + symbol > nlen + ndist)
+			return -1;
+		while (symbol--)
+			s->lengths[index++] = len;
+	}
+
+	if (s->lengths[256] == 0)
+		return -1;
+
+	/* incomplete codes are only allowed for a single length 1 code */
+	err = construct(&s->lencode, s->lengths, nlen);
+	if (err && (err < 0 || nlen != s->lencode.count[0] + s->lencode.count[1]))
+		return -1;
+	err = construct(&s->distcode, s->lengths + nlen, ndist);
+	if (err && (err < 0 || ndist != s->distcode.count[0] + s->distcode.count[1]))
+		return -1;
+
+	return codes(s);
+}
+
+static int inflate_blocks(struct inflate *s)
+{
+	int last, type, err;
+
+	do {
+		last = bits(s, 1);
+		type = bits(s, 2);
+		if (type == 0)
+			err = stored(s);
+		else if (type == 1)
+			err = fixed(s);
+		else if (type == 2)
+			err = dynamic(s);
+		else
+			err = -1;
+		if (err || s->d->error)
+			return -1;
+	} while (!last);
+
+	/* the trailer starts on a byte boundary */
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+	return 0;
+}
+
+static unsigned get32le(struct decompress *d)
+{
+	unsigned v;
+
+	v = getbyte(d);
+	v |= getbyte(d) << 8;
+	v |= getbyte(d) << 16;
+	v |= getbyte(d) << 24;
+	return v;
+}
+
+static int gzip_header(struct decompress *d)
+{
+	unsigned flags, n;
+
+	if (getbyte(d) != 0x1f || getbyte(d) != 0x8b || getbyte(d) != 8)
+		return -1;
+	flags = getbyte(d);
+	for (n = 0; n < 6; n++)	/* mtime, xfl, os */
+		getbyte(d);
+	if (flags & 0x04) {	/* FEXTRA */
+		n = getbyte(d);
+		n |= getbyte(d) << 8;
+		while (n-- && !d->error)
+			getbyte(d);
+	}
+	if (flags & 0x08)	/* FNAME */
+		while (getbyte(d) && !d->error) ;
+	if (flags & 0x10)	/* FCOMMENT */
+		while (getbyte(d) && !d->error) ;
+	if (flags & 0x02) {	/* FHCRC */
+		getbyte(d);
+		getbyte(d);
+	}
+	return d->error ? -1 : 0;
+}
+
+/* one or more concatenated gzip members */
+int inflate_gzip(struct decompress *d)
+{
+	struct inflate *s;
+	unsigned start, crc, size;
+	int r = 0;
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -1;
+	s->d = d;
+	d->check_crc = 1;
+
+	do {
+		if (gzip_header(d)) {
+			r = -1;
+			break;
+		}
+		start = d->pos;
+		d->crc = 0;
+		d->crc_pos = d->pos;
+		s->bitbuf = 0;
+		s->bitcnt = 0;
+		if (inflate_blocks(s)) {
+			r = -1;
+			break;
+		}
+
+		crc = get32le(d);
+		size = get32le(d);
+		decompress_crc_update(d);
+		if (d->error || crc != d->crc || size != d->pos - start) {
+			r = -1;
+			break;
+		}
+	} while (!at_eof(d));
+
+	free(s);
+	return r;
+}
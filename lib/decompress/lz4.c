@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* LZ4 decoder.  Sequences are decoded straight from the input stream
+ * into the decompress window, so blocks of any size (up to the 4M and
+ * 8M maximums of the frame and legacy formats) need no block buffer.
+ * Block and content checksums are skipped, not verified.
+ */
+
+#include <string.h>
+
+#include "decompress.h"
+
+#define LZ4_MAGIC		0x184d2204
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_SKIP_MAGIC		0x184d2a50	/* low 4 bits ignored */
+
+static unsigned get32le(struct decompress *d)
+{
+	unsigned v;
+
+	v = getbyte(d);
+	v |= getbyte(d) << 8;
+	v |= getbyte(d) << 16;
+	v |= getbyte(d) << 24;
+	return v;
+}
+
+static void skip(struct decompress *d, unsigned n)
+{
+	while (n-- && !d->error)
+		getbyte(d);
+}
+
+/* next byte of a block with 'left' bytes remaining */
+static unsigned blockbyte(struct decompress *d, unsigned *left)
+{
+	if (!*left) {
+		d->error = 1;
+		return 0;
+	}
+	(*left)--;
+	return getbyte(d);
+}
+
+static unsigned blocklen(struct decompress *d, unsigned *left, unsigned len)
+{
+	unsigned b;
+
+	if (len == 15) {
+		do {
+			b = blockbyte(d, left);
+			len += b;
+		} while (b == 255 && !d->error);
+	}
+	return len;
+}
+
+static int lz4_block(struct decompress *d, unsigned left)
+{
+	unsigned token, lit, off, mlen;
+
+	while (left) {
+		token = blockbyte(d, &left);
+		lit = blocklen(d, &left, token >> 4);
+		if (lit > left)
+			return -1;
+		while (lit--)
+			putbyte(d, blockbyte(d, &left));
+		if (d->error)
+			return -1;
+		if (!left)
+			break;	/* the last sequence has no match */
+
+		off = blockbyte(d, &left);
+		off |= blockbyte(d, &left) << 8;
+		mlen = blocklen(d, &left, token & 15) + 4;
+		if (d->error || copymatch(d, off, mlen))
+			return -1;
+	}
+	return d->error ? -1 : 0;
+}
+
+static int lz4_one_frame(struct decompress *d)
+{
+	unsigned flg, size;
+
+	flg = getbyte(d);
+	getbyte(d);		/* BD: block size limit, no need to know */
+	if ((flg & 0xc2) != 0x40)
+		return -1;	/* version 1, reserved bit clear */
+	if (flg & 0x08)
+		skip(d, 8);	/* content size */
+	if (flg & 0x01)
+		return -1;	/* needs a dictionary */
+	getbyte(d);		/* header checksum */
+
+	for (;;) {
+		size = get32le(d);
+		if (d->error)
+			return -1;
+		if (!size)
+			break;
+		if (size & 0x80000000) {
+			size &= 0x7fffffff;
+			while (size-- && !d->error)
+				putbyte(d, getbyte(d));
+		} else if (lz4_block(d, size)) {
+			return -1;
+		}
+		if (flg & 0x10)
+			skip(d, 4);	/* block checksum */
+	}
+	if (flg & 0x04)
+		skip(d, 4);	/* content checksum */
+	return d->error ? -1 : 0;
+}
+
+/* one or more frames, skippable frames in between are ignored */
+int lz4_frame(struct decompress *d)
+{
+	unsigned magic;
+
+	do {
+		magic = get32le(d);
+		if ((magic & ~0xfU) == LZ4_SKIP_MAGIC) {
+			skip(d, get32le(d));
+		} else if (magic != LZ4_MAGIC || lz4_one_frame(d)) {
+			return -1;
+		}
+		if (d->error)
+			return -1;
+	} while (!at_eof(d));
+	return 0;
+}
+
+/* independent blocks behind a magic number, which may repeat */
+int lz4_legacy(struct decompress *d)
+{
+	unsigned size;
+
+	if (get32le(d) != LZ4_LEGACY_MAGIC)
+		return -1;
+	while (!at_eof(d)) {
+		size = get32le(d);
+		if (d->error)
+			return -1;
+		if (size == LZ4_LEGACY_MAGIC)
+			continue;
+		if (lz4_block(d, size))
+			return -1;
+	}
+	return 0;
+}
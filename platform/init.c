@@ -23,6 +23,8 @@
 #include <err.h>
 #include <debug.h>
 #include <platform.h>
+#include <malloc.h>
+#include <arch/ops.h>
 
 /*
  * default implementations of these routines, if the platform code
@@ -48,6 +50,20 @@ __WEAK void platform_exit(void)
 
 }*/
 
+/*
+ * arm_mmu_init() maps all memory strongly ordered, so heap memory is
+ * uncached unless the platform maps RAM cacheable; such a platform has to
+ * provide its own allocator.
+ */
+__WEAK void *platform_alloc_uncached(size_t size, size_t align)
+{
+	void *p = memalign(align, size);
+
+	if (p)
+		arch_clean_invalidate_cache_range((addr_t) p, size);
+	return p;
+}
+
 __WEAK void platform_config_interleaved_mode_gpios(void)
 {
 }
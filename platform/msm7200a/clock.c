@@ -766,6 +766,14 @@ int clk_set_rate(unsigned id, unsigned freq)
 	return rc;
 }
 
+/* The Md/Ns registers of EBI2 and most other clocks are not known
+ * here, so no rate can be read back.
+ */
+int clk_get_rate(unsigned id)
+{
+	return -1;
+}
+
 void msm_clock_init(void)
 {
 	mutex_init(&clk_mutex);
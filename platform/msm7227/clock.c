@@ -47,6 +47,15 @@ int clk_set_rate(unsigned id, unsigned freq)
 	return rc;
 }
 
+int clk_get_rate(unsigned id)
+{
+	int rc;
+	mutex_acquire(&clk_mutex);
+	rc = pcom_clock_get_rate(id);
+	mutex_release(&clk_mutex);
+	return rc;
+}
+
 void msm_clock_init(void)
 {
 	mutex_init(&clk_mutex);
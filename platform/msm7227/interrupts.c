@@ -143,6 +143,13 @@ status_t unmask_interrupt(unsigned int vector)
 	return 0;
 }
 
+int interrupt_pending(unsigned int vector)
+{
+	unsigned reg = (vector > 31) ? VIC_RAW_STATUS1 : VIC_RAW_STATUS0;
+	unsigned bit = 1 << (vector & 31);
+	return (readl(reg) & bit) != 0;
+}
+
 void register_int_handler(unsigned int vector, int_handler func, void *arg)
 {
 	if (vector >= NR_IRQS)
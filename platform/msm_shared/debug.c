@@ -35,6 +35,7 @@
 #include <arch/arm/dcc.h>
 #include <dev/fbcon.h>
 #include <dev/uart.h>
+#include <dev/udc_acm.h>
 
 void _dputc(char c)
 {
@@ -52,6 +53,9 @@ void _dputc(char c)
 #if WITH_DEBUG_FBCON && WITH_DEV_FBCON
 	fbcon_putc(c);
 #endif
+#if WITH_DEBUG_USB
+	udc_acm_putc(c);
+#endif
 #if WITH_DEBUG_JTAG
 #error
 	jtag_dputc(c);
@@ -65,6 +69,9 @@ int dgetc(char *c)
 	n = dcc_getc();
 #elif WITH_DEBUG_UART
 	n = uart_getc(0, 0);
+#elif WITH_DEBUG_USB
+	char ch;
+	n = udc_acm_getc(&ch) ? -1 : (unsigned char)ch;
 #else
 	n = -1;
 #endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <reg.h>
+#include <platform/irqs.h>
+#include <platform/interrupts.h>
+#include <kernel/thread.h>
+#include <kernel/event.h>
+
+#include "dmov.h"
+
+#define DMOV_NUM_CHANS 16
+
+#define paddr(n) ((unsigned) (n))
+
+/* requests handed to the hardware, oldest first, per channel */
+static struct dmov_req *dmov_queue[DMOV_NUM_CHANS];
+static struct dmov_req *dmov_queue_tail[DMOV_NUM_CHANS];
+
+static int dmov_irq_enabled = 0;
+
+/* Pop results off a channel and complete the matching requests.
+ * Must be called with interrupts disabled.  Returns nonzero if a
+ * waiting thread was signalled.
+ */
+static int dmov_service(unsigned id)
+{
+	struct dmov_req *req;
+	unsigned n;
+	int woken = 0;
+
+	n = readl(DMOV_STATUS(id));
+	while (DMOV_STATUS_RSLT_COUNT(n)) {
+		n = readl(DMOV_RSLT(id));
+
+		req = dmov_queue[id];
+		if (!req) {
+			dprintf(CRITICAL, "ERROR: stray result %x on dmov %d\n",
+				n, id);
+			n = readl(DMOV_STATUS(id));
+			continue;
+		}
+		dmov_queue[id] = req->next;
+		if (!dmov_queue[id])
+			dmov_queue_tail[id] = NULL;
+
+		req->result = 0;
+		if (n != (DMOV_RSLT_VALID | DMOV_RSLT_DONE)) {
+			dprintf(CRITICAL, "ERROR: result: %x\n", n);
+			dprintf(CRITICAL, "ERROR:  flush: %x %x %x %x\n",
+				readl(DMOV_FLUSH0(id)),
+				readl(DMOV_FLUSH1(id)),
+				readl(DMOV_FLUSH2(id)),
+				readl(DMOV_FLUSH3(id)));
+			req->result = -1;
+		}
+		req->finished = 1;
+		if (req->complete)
+			req->complete(req);
+		event_signal(&req->done, false);
+		woken = 1;
+
+		n = readl(DMOV_STATUS(id));
+	}
+
+	return woken;
+}
+
+static enum handler_return dmov_irq(void *arg)
+{
+	unsigned id;
+	unsigned isr = readl(DMOV_ISR);
+	int woken = 0;
+
+	/* results nobody waits for, say left behind by polling before
+	 * dmov_init(), are still popped so they don't keep the line up */
+	for (id = 0; id < DMOV_NUM_CHANS; id++) {
+		if (isr & (1U << id))
+			woken |= dmov_service(id);
+	}
+
+	return woken ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
+
+void dmov_init(void)
+{
+	if (dmov_irq_enabled)
+		return;
+
+	enter_critical_section();
+	register_int_handler(INT_ADM_AARM, dmov_irq, NULL);
+	unmask_interrupt(INT_ADM_AARM);
+	dmov_irq_enabled = 1;
+	exit_critical_section();
+}
+
+int dmov_submit(unsigned id, struct dmov_req *req)
+{
+	ASSERT(id < DMOV_NUM_CHANS);
+
+	req->id = id;
+	req->next = NULL;
+	req->result = 0;
+	req->finished = 0;
+	event_init(&req->done, false, 0);
+
+	enter_critical_section();
+	if (dmov_irq_enabled)
+		writel(DMOV_CONFIG_IRQ_EN | DMOV_CONFIG_FORCE_TOP_PTR_RSLT,
+		       DMOV_CONFIG(id));
+
+	if (dmov_queue_tail[id])
+		dmov_queue_tail[id]->next = req;
+	else
+		dmov_queue[id] = req;
+	dmov_queue_tail[id] = req;
+
+	while (!(readl(DMOV_STATUS(id)) & DMOV_STATUS_CMD_PTR_RDY)) ;
+	writel(DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(paddr(req->ptrlist)),
+	       DMOV_CMD_PTR(id));
+	exit_critical_section();
+
+	return 0;
+}
+
+int dmov_wait(struct dmov_req *req)
+{
+	/* nobody will deliver the interrupt, so poll for the result */
+	if (!dmov_irq_enabled || in_critical_section()) {
+		enter_critical_section();
+		while (!req->finished)
+			dmov_service(req->id);
+		exit_critical_section();
+		return req->result;
+	}
+
+	event_wait(&req->done);
+	return req->result;
+}
+
+int dmov_exec_cmdptr(unsigned id, unsigned *ptr)
+{
+	struct dmov_req req;
+
+	req.ptrlist = ptr;
+	req.complete = NULL;
+	req.arg = NULL;
+
+	dmov_submit(id, &req);
+	return dmov_wait(&req);
+}
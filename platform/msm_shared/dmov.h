@@ -29,6 +29,8 @@
 #ifndef __PLATFORM_MSM_SHARED_DMOV_H
 #define __PLATFORM_MSM_SHARED_DMOV_H
 
+#include <kernel/event.h>
+
 #ifdef PLATFORM_MSM7X30
 #define MSM_DMOV_BASE 0xAC400000
 #else
@@ -160,6 +162,30 @@ typedef struct {
 #define CMD_DST_CRCI(n)     (((n) & 15) << 7)
 #define CMD_SRC_CRCI(n)     (((n) & 15) << 3)
 
+/* Requests are queued per channel and completed in submission order
+** from the ADM interrupt; until dmov_init() has run, or when called
+** with interrupts disabled, dmov_wait() polls the result register.
+**
+** The completion callback runs in interrupt context.
+*/
+struct dmov_req {
+	struct dmov_req *next;
+	unsigned id;
+	unsigned *ptrlist;	/* command pointer list, 8 byte aligned */
+	int result;		/* 0 on success, -1 on a data mover error */
+	volatile int finished;
+	void (*complete) (struct dmov_req * req);
+	void *arg;
+	event_t done;
+};
+
+void dmov_init(void);
+int dmov_submit(unsigned id, struct dmov_req *req);
+int dmov_wait(struct dmov_req *req);
+
+/* submit and sleep until the command pointer list has been executed */
+int dmov_exec_cmdptr(unsigned id, unsigned *ptr);
+
 /* NOTES:
 **
 ** Looks like Channels 4, 5, 6, 7, 8, 10, 11 are available to the ARM11
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <kernel/thread.h>
+#include <kernel/event.h>
+#include <dev/flash.h>
+
+static struct flash_op *flash_op_head;
+static struct flash_op *flash_op_tail;
+static event_t flash_op_ready;
+static int flash_worker_started = 0;
+
+static int flash_op_run(struct flash_op *op)
+{
+	switch (op->type) {
+	case FLASH_OP_READ:
+		return flash_read_ext(op->ptn, op->extra_per_page, op->offset,
+				      op->data, op->bytes);
+	case FLASH_OP_WRITE:
+		return flash_write_ext(op->ptn, op->extra_per_page, op->data,
+				       op->bytes, op->flags);
+	case FLASH_OP_ERASE:
+		return flash_erase(op->ptn);
+	case FLASH_OP_STREAM:
+		return flash_stream_write(op->stream, op->data, op->bytes);
+	case FLASH_OP_BLOCK:
+		return flash_write_block(op->ptn, op->offset, op->data);
+	case FLASH_OP_OPEN:
+		return flash_stream_open(op->stream, op->ptn,
+					 op->extra_per_page, op->flags);
+	case FLASH_OP_CLOSE:
+		return flash_stream_close(op->stream);
+	case FLASH_OP_FILL:
+		return flash_stream_fill(op->stream, op->offset, op->bytes);
+	case FLASH_OP_SKIP:
+		return flash_stream_skip(op->stream, op->bytes);
+	case FLASH_OP_GOOD:
+		return flash_good_blocks(op->ptn);
+	default:
+		return -1;
+	}
+}
+
+static int flash_worker(void *arg)
+{
+	struct flash_op *op;
+
+	for (;;) {
+		event_wait(&flash_op_ready);
+
+		for (;;) {
+			enter_critical_section();
+			op = flash_op_head;
+			if (op) {
+				flash_op_head = op->next;
+				if (!flash_op_head)
+					flash_op_tail = NULL;
+			}
+			exit_critical_section();
+			if (!op)
+				break;
+
+			op->result = flash_op_run(op);
+			if (op->complete)
+				op->complete(op);
+			event_signal(&op->done, true);
+		}
+	}
+	return 0;
+}
+
+/* The worker is started by the first submission.  Several threads may
+ * submit, so the first one claims the start with interrupts off; ops
+ * queued by the others meanwhile wait in the list for it.
+ */
+static int flash_worker_start(void)
+{
+	thread_t *thr;
+	int start;
+
+	enter_critical_section();
+	start = !flash_worker_started;
+	if (start) {
+		event_init(&flash_op_ready, 0, EVENT_FLAG_AUTOUNSIGNAL);
+		flash_worker_started = 1;
+	}
+	exit_critical_section();
+	if (!start)
+		return 0;
+
+	thr = thread_create("flash", flash_worker, 0, DEFAULT_PRIORITY, 4096);
+	if (!thr) {
+		dprintf(CRITICAL, "flash: cannot start the worker thread\n");
+		enter_critical_section();
+		flash_worker_started = 0;	/* the next submission tries again */
+		exit_critical_section();
+		return -1;
+	}
+	thread_resume(thr);
+	return 0;
+}
+
+int flash_submit(struct flash_op *op)
+{
+	if (flash_worker_start())
+		return -1;
+
+	op->next = NULL;
+	op->result = -1;
+	event_init(&op->done, 0, 0);
+
+	enter_critical_section();
+	if (flash_op_tail)
+		flash_op_tail->next = op;
+	else
+		flash_op_head = op;
+	flash_op_tail = op;
+	exit_critical_section();
+
+	event_signal(&flash_op_ready, true);
+	return 0;
+}
+
+int flash_op_wait(struct flash_op *op)
+{
+	event_wait(&op->done);
+	return op->result;
+}
+
+int flash_op_call(struct flash_op *op)
+{
+	if (flash_submit(op))
+		return -1;
+	return flash_op_wait(op);
+}
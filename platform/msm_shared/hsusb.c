@@ -37,7 +37,10 @@
 #include <platform/irqs.h>
 #include <platform/interrupts.h>
 #include <kernel/thread.h>
+#include <kernel/event.h>
 #include <reg.h>
+#include <platform.h>
+#include <arch/ops.h>
 
 #include <dev/udc.h>
 
@@ -117,16 +120,80 @@ unsigned udc_string_desc_alloc(const char *str)
 
 struct usb_request {
 	struct udc_request req;
-	struct ept_queue_item *item;
+	struct usb_request *next;	/* queued behind this one */
+	struct ept_queue_item *item;	/* chain of dTDs */
+	unsigned items;		/* dTDs allocated */
+	unsigned count;		/* dTDs used by the queued transfer */
 };
 
+/* A dTD moves up to five 4K pages.  All but the last dTD of a chain end
+** on a packet boundary, so no packet is split between two of them.  Only
+** IN requests are chained: a short packet retires an OUT dTD and the
+** controller fills the next one with what the host sends after it, so
+** an OUT request gets one dTD (UDC_OUT_MAX bytes at any alignment).
+*/
+#define DTD_PAGES	5
+#define DTD_ALIGN	512
+
+static unsigned dtd_bytes(unsigned phys, unsigned len)
+{
+	unsigned max = DTD_PAGES * 4096 - (phys & 0xfff);
+
+	if (len <= max)
+		return len;
+	return max & ~(DTD_ALIGN - 1);
+}
+
+/* dQHs and dTDs live in uncached memory, so neither side needs cache
+** maintenance to see the other's updates.  dTD chains are carved out of
+** a fixed pool, which also keeps malloc out of interrupt context.
+*/
+#define DTD_POOL_SIZE	256
+
+static struct ept_queue_item *dtd_pool;
+static unsigned dtd_used[DTD_POOL_SIZE / 32];
+
+static struct ept_queue_item *dtd_alloc(unsigned n)
+{
+	unsigned start, i;
+
+	for (start = 0; start + n <= DTD_POOL_SIZE; start = i + 1) {
+		for (i = start; i < start + n; i++)
+			if (dtd_used[i / 32] & (1U << (i % 32)))
+				break;
+		if (i == start + n) {
+			for (i = start; i < start + n; i++)
+				dtd_used[i / 32] |= 1U << (i % 32);
+			return dtd_pool + start;
+		}
+	}
+	return 0;
+}
+
+static void dtd_free(struct ept_queue_item *item, unsigned n)
+{
+	unsigned i;
+
+	for (i = item - dtd_pool; n > 0; i++, n--)
+		dtd_used[i / 32] &= ~(1U << (i % 32));
+}
+
+/* Cache maintenance for data buffers: IN data is written back before the
+** controller reads it; OUT buffers are invalidated before the controller
+** fills them, writing back first the lines they share with other data.
+*/
+static void dma_map(struct udc_endpoint *ept, void *buf, unsigned len);
+static void dma_unmap(struct udc_endpoint *ept, void *buf, unsigned len);
+
 struct udc_endpoint {
 	struct udc_endpoint *next;
 	unsigned bit;
 	struct ept_queue_head *head;
-	struct usb_request *req;
+	struct usb_request *req;	/* queue of requests, oldest first */
+	struct usb_request *last;
 	unsigned char num;
 	unsigned char in;
+	unsigned char intr;	/* interrupt rather than bulk */
 	unsigned short maxpkt;
 };
 
@@ -137,10 +204,13 @@ static int usb_online = 0;
 static int usb_highspeed = 0;
 
 static struct udc_device *the_device;
-static struct udc_gadget *the_gadget;
+static struct udc_gadget *gadget_list;
+static unsigned num_interfaces;
 
 static struct msm_hsusb_pdata *pdata = NULL;
 
+static struct udc_stats stats;
+
 bool is_usb_connected(void) {
 	if (!pdata)
 		return false;
@@ -212,7 +282,9 @@ struct udc_endpoint *_udc_endpoint_alloc(unsigned num, unsigned in,
 	ept->maxpkt = max_pkt;
 	ept->num = num;
 	ept->in = ! !in;
+	ept->intr = 0;
 	ept->req = 0;
+	ept->last = 0;
 
 	cfg = CONFIG_MAX_PKT(max_pkt) | CONFIG_ZLT;
 
@@ -230,7 +302,6 @@ struct udc_endpoint *_udc_endpoint_alloc(unsigned num, unsigned in,
 	ept->next = ept_list;
 	ept_list = ept;
 
-	arch_clean_invalidate_cache_range((addr_t)ept->head, 64);
 	DBG("ept%d %s @%p/%p max=%d bit=%x\n",
 	    num, in ? "in" : "out", ept, ept->head, max_pkt, ept->bit);
 
@@ -245,7 +316,7 @@ struct udc_endpoint *udc_endpoint_alloc(unsigned type, unsigned maxpkt)
 	unsigned n;
 	unsigned in;
 
-	if (type == UDC_TYPE_BULK_IN) {
+	if (type == UDC_TYPE_BULK_IN || type == UDC_TYPE_INTR_IN) {
 		in = 1;
 	} else if (type == UDC_TYPE_BULK_OUT) {
 		in = 0;
@@ -258,8 +329,10 @@ struct udc_endpoint *udc_endpoint_alloc(unsigned type, unsigned maxpkt)
 		if (ept_alloc_table & bit)
 			continue;
 		ept = _udc_endpoint_alloc(n, in, maxpkt);
-		if (ept)
+		if (ept) {
+			ept->intr = (type == UDC_TYPE_INTR_IN);
 			ept_alloc_table |= bit;
+		}
 		return ept;
 	}
 	return 0;
@@ -276,12 +349,15 @@ static void endpoint_enable(struct udc_endpoint *ept, unsigned yes)
 
 	if (yes) {
 		if (ept->in) {
-			n |= (CTRL_TXE | CTRL_TXR | CTRL_TXT_BULK);
+			n &= ~CTRL_TXT_INT;
+			n |= (CTRL_TXE | CTRL_TXR |
+			      (ept->intr ? CTRL_TXT_INT : CTRL_TXT_BULK));
 		} else {
 			n |= (CTRL_RXE | CTRL_RXR | CTRL_RXT_BULK);
 		}
 
-		if (ept->num != 0) {
+		/* interrupt endpoints keep their own packet size */
+		if (ept->num != 0 && !ept->intr) {
 			/* XXX should be more dynamic... */
 			if (usb_highspeed) {
 				ept->head->config =
@@ -295,103 +371,309 @@ static void endpoint_enable(struct udc_endpoint *ept, unsigned yes)
 	writel(n, USB_ENDPTCTRL(ept->num));
 }
 
+static void endpoints_disable(void)
+{
+	struct udc_endpoint *ept;
+
+	for (ept = ept_list; ept; ept = ept->next)
+		if (ept->num != 0)
+			writel(0, USB_ENDPTCTRL(ept->num));
+}
+
+static void gadgets_notify(unsigned event)
+{
+	struct udc_gadget *g;
+
+	for (g = gadget_list; g; g = g->next)
+		g->notify(g, event);
+}
+
 struct udc_request *udc_request_alloc(void)
 {
 	struct usb_request *req;
 	req = malloc(sizeof(*req));
+	if (!req)
+		return 0;
 	req->req.buf = 0;
 	req->req.length = 0;
-	req->item = memalign(32, 32);
+	enter_critical_section();
+	req->item = dtd_alloc(1);
+	exit_critical_section();
+	if (!req->item) {
+		free(req);
+		return 0;
+	}
+	req->items = 1;
+	req->count = 0;
 	return &req->req;
 }
 
-void udc_request_free(struct udc_request *req)
+void udc_request_free(struct udc_request *_req)
 {
+	struct usb_request *req = (struct usb_request *)_req;
+
+	enter_critical_section();
+	dtd_free(req->item, req->items);
+	exit_critical_section();
 	free(req);
 }
 
-int udc_request_queue(struct udc_endpoint *ept, struct udc_request *_req)
+static void dma_invalidate(void *buf, unsigned len)
 {
-	struct usb_request *req = (struct usb_request *)_req;
-	struct ept_queue_item *item = req->item;
-	unsigned phys = (unsigned)req->req.buf;
+	addr_t start = (addr_t) buf;
+	addr_t end = start + len;
 
-	item->next = TERMINATE;
-	item->info = INFO_BYTES(req->req.length) | INFO_IOC | INFO_ACTIVE;
-	item->page0 = phys;
-	item->page1 = (phys & 0xfffff000) + 0x1000;
+	if (start & (CACHE_LINE - 1)) {
+		start &= ~(CACHE_LINE - 1);
+		arch_clean_invalidate_cache_range(start, 1);
+		start += CACHE_LINE;
+	}
+	if ((end & (CACHE_LINE - 1)) && end > start) {
+		end &= ~(CACHE_LINE - 1);
+		arch_clean_invalidate_cache_range(end, 1);
+	}
+	if (end > start)
+		arch_invalidate_cache_range(start, end - start);
+}
 
-	enter_critical_section();
+static void dma_map(struct udc_endpoint *ept, void *buf, unsigned len)
+{
+	if (!len)
+		return;
+	if (ept->in)
+		arch_clean_cache_range((addr_t) buf, len);
+	else
+		dma_invalidate(buf, len);
+}
+
+static void dma_unmap(struct udc_endpoint *ept, void *buf, unsigned len)
+{
+	/* drop lines fetched while the controller was writing */
+	if (!ept->in && len)
+		dma_invalidate(buf, len);
+}
+
+static void ept_prime(struct udc_endpoint *ept, struct ept_queue_item *item)
+{
 	ept->head->next = (unsigned)item;
 	ept->head->info = 0;
-	ept->req = req;
-
-	arch_clean_invalidate_cache_range((addr_t) ept,
-					  sizeof(struct udc_endpoint));
-	arch_clean_invalidate_cache_range((addr_t) ept->head,
-					  sizeof(struct ept_queue_head));
-	arch_clean_invalidate_cache_range((addr_t) ept->req,
-					  sizeof(struct usb_request));
-	arch_clean_invalidate_cache_range((addr_t) req->req.buf,
-					  req->req.length);
-	arch_clean_invalidate_cache_range((addr_t) ept->req->item,
-					  sizeof(struct ept_queue_item));
+	writel(ept->bit, USB_ENDPTPRIME);
+	stats.primes++;
+}
+
+int udc_request_queue(struct udc_endpoint *ept, struct udc_request *_req)
+{
+	struct usb_request *req = (struct usb_request *)_req;
+	struct usb_request *last;
+	struct ept_queue_item *item;
+	unsigned phys, left, xfer, n, i, status;
+
+	/* size the chain, growing it if need be */
+	phys = (unsigned)req->req.buf;
+	left = req->req.length;
+	n = 0;
+	do {
+		xfer = dtd_bytes(phys, left);
+		phys += xfer;
+		left -= xfer;
+		n++;
+	} while (left);
+	if (n > 1 && !ept->in) {
+		dprintf(CRITICAL, "ept%d out: request of %d bytes too long\n",
+			ept->num, req->req.length);
+		return -1;
+	}
+
+	if (n > req->items) {
+		enter_critical_section();
+		item = dtd_alloc(n);
+		if (item) {
+			dtd_free(req->item, req->items);
+			req->item = item;
+			req->items = n;
+		}
+		exit_critical_section();
+		if (!item)
+			return -1;
+	}
+
+	phys = (unsigned)req->req.buf;
+	left = req->req.length;
+	for (i = 0; i < n; i++) {
+		item = req->item + i;
+		xfer = dtd_bytes(phys, left);
+		item->next = (i + 1 < n) ? (unsigned)(item + 1) : TERMINATE;
+		item->info = INFO_BYTES(xfer) | INFO_ACTIVE;
+		item->page0 = phys;
+		item->page1 = (phys & 0xfffff000) + 0x1000;
+		item->page2 = (phys & 0xfffff000) + 0x2000;
+		item->page3 = (phys & 0xfffff000) + 0x3000;
+		item->page4 = (phys & 0xfffff000) + 0x4000;
+		phys += xfer;
+		left -= xfer;
+	}
+	item->info |= INFO_IOC;
+	req->count = n;
+	req->next = 0;
+
+	dma_map(ept, req->req.buf, req->req.length);
 
 	DBG("ept%d %s queue req=%p\n", ept->num, ept->in ? "in" : "out", req);
 
-	writel(ept->bit, USB_ENDPTPRIME);
+	enter_critical_section();
+	if (ept->req) {
+		/* link behind the last queued dTD; if the controller already
+		 ** ran off the end of the list (checked with the add dTD
+		 ** tripwire), it has to be primed again */
+		last = ept->last;
+		item = last->item + last->count - 1;
+		item->next = (unsigned)req->item;
+		last->next = req;
+		ept->last = req;
+		stats.appends++;
+
+		if (!(readl(USB_ENDPTPRIME) & ept->bit)) {
+			do {
+				writel(readl(USB_USBCMD) | USBCMD_ATDTW,
+				       USB_USBCMD);
+				status = readl(USB_ENDPTSTAT) & ept->bit;
+			} while (!(readl(USB_USBCMD) & USBCMD_ATDTW));
+			writel(readl(USB_USBCMD) & ~USBCMD_ATDTW, USB_USBCMD);
+			if (!status) {
+				ept_prime(ept, req->item);
+				stats.reprimes++;
+			}
+		}
+	} else {
+		ept->req = req;
+		ept->last = req;
+		ept_prime(ept, req->item);
+	}
 	exit_critical_section();
 	return 0;
 }
 
+/* Start the endpoint at the first dTD of its queue still to be run */
+static void ept_restart(struct udc_endpoint *ept)
+{
+	struct usb_request *req;
+	unsigned i;
+
+	for (req = ept->req; req; req = req->next) {
+		for (i = 0; i < req->count; i++) {
+			if (readl(&req->item[i].info) & INFO_ACTIVE) {
+				ept_prime(ept, req->item + i);
+				return;
+			}
+		}
+	}
+}
+
+static void ept_flush(struct udc_endpoint *ept)
+{
+	writel(ept->bit, USB_ENDPTFLUSH);
+	while (readl(USB_ENDPTFLUSH) & ept->bit) ;
+	stats.flushes++;
+}
+
+int udc_request_cancel(struct udc_endpoint *ept, struct udc_request *_req)
+{
+	struct usb_request *req = (struct usb_request *)_req;
+	struct usb_request *prev = 0;
+	struct usb_request *r;
+	struct ept_queue_item *item;
+
+	enter_critical_section();
+	for (r = ept->req; r && r != req; r = r->next)
+		prev = r;
+	if (!r) {
+		exit_critical_section();
+		return -1;
+	}
+
+	/* stop the endpoint, unlink the request and carry on behind it */
+	ept_flush(ept);
+	if (prev) {
+		prev->next = req->next;
+		item = prev->item + prev->count - 1;
+		item->next = req->next ? (unsigned)req->next->item : TERMINATE;
+	} else {
+		ept->req = req->next;
+	}
+	if (ept->last == req)
+		ept->last = prev;
+	ept_restart(ept);
+	exit_critical_section();
+	return 0;
+}
+
+/* Retire the finished requests at the head of the queue.  The queue is
+** shared with udc_request_queue() and udc_request_cancel() callers, so
+** each request is unlinked with interrupts off; its completion callback
+** runs with them back on.
+*/
 static void handle_ept_complete(struct udc_endpoint *ept)
 {
 	struct ept_queue_item *item;
-	unsigned actual;
+	unsigned actual, phys, left, xfer, remain, i;
 	int status;
 	struct usb_request *req;
 
 	DBG("ept%d %s complete req=%p\n",
 	    ept->num, ept->in ? "in" : "out", ept->req);
 
-	arch_clean_invalidate_cache_range((addr_t) ept,
-					  sizeof(struct udc_endpoint));
-	arch_clean_invalidate_cache_range((addr_t) ept->req,
-					  sizeof(struct usb_request));
+	for (;;) {
+		enter_critical_section();
+		req = ept->req;
+		if (!req) {
+			exit_critical_section();
+			return;
+		}
+		actual = 0;
+		status = 0;
+		remain = 0;
+		phys = (unsigned)req->req.buf;
+		left = req->req.length;
+		for (i = 0; i < req->count; i++) {
+			item = req->item + i;
+			xfer = dtd_bytes(phys, left);
+			phys += xfer;
+			left -= xfer;
+
+			if (readl(&(item->info)) & INFO_ACTIVE) {
+				/* still running */
+				exit_critical_section();
+				return;
+			}
 
-	req = ept->req;
-	if (req) {
-		ept->req = 0;
+			if (item->info & 0xff) {
+				actual = 0;
+				status = -1;
+				dprintf(VDEBUG, "EP%d/%s FAIL nfo=%x pg0=%x\n",
+					ept->num, ept->in ? "in" : "out",
+					item->info, item->page0);
+				break;
+			}
 
-		item = req->item;
+			remain = (item->info >> 16) & 0x7fff;
+			actual += xfer - remain;
+			if (remain)
+				break;	/* short packet */
+		}
 
-		/* For some reason we are getting the notification for
-		 * transfer completion before the active bit has cleared.
-		 * HACK: wait for the ACTIVE bit to clear:
-		 */
-		do {
-			/* Must clean/invalidate cached item data before checking
-			 * the status every time.
-			 */
-			arch_clean_invalidate_cache_range((addr_t) item,
-							  sizeof(struct
-								 ept_queue_item));
-		} while (readl(&(item->info)) & INFO_ACTIVE);
-
-		arch_clean_invalidate_cache_range((addr_t) req->req.buf,
-						  req->req.length);
-
-		if (item->info & 0xff) {
-			actual = 0;
-			status = -1;
-			dprintf(VDEBUG, "EP%d/%s FAIL nfo=%x pg0=%x\n",
-				ept->num, ept->in ? "in" : "out", item->info,
-				item->page0);
-		} else {
-			actual =
-			    req->req.length - ((item->info >> 16) & 0x7fff);
-			status = 0;
+		ept->req = req->next;
+		if (!ept->req)
+			ept->last = 0;
+		if (i + 1 < req->count) {
+			/* a failed IN chain: drop the dTDs the controller
+			 ** did not get to and go on with the next request */
+			ept_flush(ept);
+			ept_restart(ept);
 		}
+		stats.completions++;
+		exit_critical_section();
+
+		dma_unmap(ept, req->req.buf, actual);
 		if (req->req.complete)
 			req->req.complete(&req->req, actual, status);
 	}
@@ -448,12 +730,64 @@ static void ep0in_complete(struct udc_request *req, unsigned actual, int status)
 static void setup_tx(void *buf, unsigned len)
 {
 	DBG("setup_tx %p %d\n", buf, len);
-	memcpy(ep0req->buf, buf, len);
+	if (buf != ep0req->buf)
+		memcpy(ep0req->buf, buf, len);
 	ep0req->complete = ep0in_complete;
 	ep0req->length = len;
 	udc_request_queue(ep0in, ep0req);
 }
 
+/* class and vendor requests for an interface go to the gadget owning
+** it; host to device data is collected before the gadget sees them
+*/
+static struct setup_packet setup_pending;
+static struct udc_gadget *setup_gadget;
+
+static void ep0out_complete(struct udc_request *req, unsigned actual,
+			    int status)
+{
+	DBG("ep0out_complete %p %d %d\n", req, actual, status);
+	if (status)
+		return;
+	if (actual == setup_pending.length &&
+	    setup_gadget->setup(setup_gadget, &setup_pending, req->buf) >= 0)
+		setup_ack();
+	else
+		writel((1 << 16) | (1 << 0), USB_ENDPTCTRL(0));
+}
+
+static int setup_interface(struct setup_packet *s)
+{
+	struct udc_gadget *g;
+	unsigned ifc = s->index & 0xff;
+	int len;
+
+	for (g = gadget_list; g; g = g->next)
+		if (ifc >= g->ifc_number && ifc < g->ifc_number +
+		    (g->ifc_count ? g->ifc_count : 1))
+			break;
+	if (!g || !g->setup || s->length > 4096)
+		return -1;
+
+	if (s->type & 0x80) {
+		len = g->setup(g, s, ep0req->buf);
+		if (len < 0)
+			return -1;
+		setup_tx(ep0req->buf, len < s->length ? len : s->length);
+	} else if (s->length) {
+		setup_pending = *s;
+		setup_gadget = g;
+		ep0req->complete = ep0out_complete;
+		ep0req->length = s->length;
+		udc_request_queue(ep0out, ep0req);
+	} else {
+		if (g->setup(g, s, ep0req->buf) < 0)
+			return -1;
+		setup_ack();
+	}
+	return 0;
+}
+
 static unsigned char usb_config_value = 0;
 
 #define SETUP(type,request) (((type) << 8) | (request))
@@ -462,11 +796,15 @@ static void handle_setup(struct udc_endpoint *ept)
 {
 	struct setup_packet s;
 
-	arch_clean_invalidate_cache_range((addr_t) ept->head->setup_data,
-					  sizeof(struct ept_queue_head));
 	memcpy(&s, ept->head->setup_data, sizeof(s));
 	writel(ept->bit, USB_ENDPTSETUPSTAT);
 
+	/* a new SETUP ends whatever control transfer was in progress */
+	ept_flush(ep0in);
+	ept_flush(ep0out);
+	ep0in->req = ep0in->last = 0;
+	ep0out->req = ep0out->last = 0;
+
 	DBG("handle_setup type=0x%02x req=0x%02x val=%d idx=%d len=%d (%s)\n",
 	    s.type, s.request, s.value, s.index, s.length, reqname(s.request));
 	switch (SETUP(s.type, s.request)) {
@@ -513,11 +851,11 @@ static void handle_setup(struct udc_endpoint *ept)
 			usb_config_value = 1;
 			if (is_usb_connected())
 				set_charger_state(CHG_USB_HIGH);
-			the_gadget->notify(the_gadget, UDC_EVENT_ONLINE);
+			gadgets_notify(UDC_EVENT_ONLINE);
 		} else {
-			writel(0, USB_ENDPTCTRL(1));
+			endpoints_disable();
 			usb_config_value = 0;
-			the_gadget->notify(the_gadget, UDC_EVENT_OFFLINE);
+			gadgets_notify(UDC_EVENT_OFFLINE);
 		}
 		setup_ack();
 		usb_online = s.value ? 1 : 0;
@@ -555,6 +893,12 @@ static void handle_setup(struct udc_endpoint *ept)
 		}
 	}
 
+	if ((s.type & 0x60) && (s.type & 0x1f) == 1) {
+		/* class or vendor request to an interface */
+		if (setup_interface(&s) == 0)
+			return;
+	}
+
 	dprintf(VDEBUG, "STALL %s %d %d %d %d %d\n",
 		reqname(s.request),
 		s.type, s.request, s.value, s.index, s.length);
@@ -648,14 +992,16 @@ static void udc_reset(void) {
 }
 
 int udc_init(struct udc_device *dev) {
-	epts = memalign(4096, 4096);
+	epts = platform_alloc_uncached(4096, 4096);
+	dtd_pool = platform_alloc_uncached(DTD_POOL_SIZE *
+					   sizeof(struct ept_queue_item), 32);
+	if (!epts || !dtd_pool) {
+		dprintf(CRITICAL, "USB cannot allocate descriptors\n");
+		return -1;
+	}
 
 	dprintf(INFO, "USB init ept @ %p\n", epts);
 	memset(epts, 0, 32 * sizeof(struct ept_queue_head));
-#if 0
-	arch_clean_invalidate_cache_range((addr_t) epts,
-		32 * sizeof(struct ept_queue_head));
-#endif
 	
 	udc_reset();
 	dprintf(INFO, "USB ID %08x\n", readl(USB_ID));
@@ -679,40 +1025,60 @@ int udc_init(struct udc_device *dev) {
 	return 0;
 }
 
-enum handler_return udc_interrupt(void *arg)
+/* The interrupt handler only acknowledges the controller and latches
+** what happened; resets, setup packets and completed requests are dealt
+** with by the "usb" thread with interrupts enabled, so completion
+** callbacks and cache maintenance never run in interrupt context.
+*/
+static event_t udc_event;
+static unsigned pending_sts;	/* USBSTS bits not yet handled */
+static unsigned pending_complete;	/* ENDPTCOMPLETE bits not yet handled */
+
+static void handle_reset(void)
 {
 	struct udc_endpoint *ept;
-	unsigned ret = INT_NO_RESCHEDULE;
-	unsigned n = readl(USB_USBSTS);
-	writel(n, USB_USBSTS);
-
-	n &= (STS_SLI | STS_URI | STS_PCI | STS_UI | STS_UEI);
-
-	if (n == 0)
-		return ret;
+	struct usb_request *req, *next;
 
-	if (n & STS_URI) {
-		writel(readl(USB_ENDPTCOMPLETE), USB_ENDPTCOMPLETE);
-		writel(readl(USB_ENDPTSETUPSTAT), USB_ENDPTSETUPSTAT);
-		writel(0xffffffff, USB_ENDPTFLUSH);
-		writel(0, USB_ENDPTCTRL(1));
-		DBG("-- reset --\n");
-		usb_online = 0;
-		usb_config_value = 0;
-		the_gadget->notify(the_gadget, UDC_EVENT_OFFLINE);
+	DBG("-- reset --\n");
+	enter_critical_section();
+	endpoints_disable();
+	usb_online = 0;
+	usb_config_value = 0;
+	exit_critical_section();
+	gadgets_notify(UDC_EVENT_OFFLINE);
 
-		/* error out any pending reqs */
-		for (ept = ept_list; ept; ept = ept->next) {
-			/* ensure that ept_complete considers
-			 * this to be an error state
-			 */
-			if (ept->req) {
-				ept->req->item->info = INFO_HALTED;
-				handle_ept_complete(ept);
-			}
+	/* error out any pending reqs */
+	for (ept = ept_list; ept; ept = ept->next) {
+		enter_critical_section();
+		req = ept->req;
+		ept->req = 0;
+		ept->last = 0;
+		exit_critical_section();
+		while (req) {
+			next = req->next;
+			if (req->req.complete)
+				req->req.complete(&req->req, 0, -1);
+			req = next;
 		}
-		usb_status(0, usb_highspeed);
 	}
+	usb_status(0, usb_highspeed);
+}
+
+static void udc_work(void)
+{
+	struct udc_endpoint *ept;
+	unsigned n, complete;
+
+	enter_critical_section();
+	n = pending_sts;
+	complete = pending_complete;
+	pending_sts = 0;
+	pending_complete = 0;
+	stats.bh_runs++;
+	exit_critical_section();
+
+	if (n & STS_URI)
+		handle_reset();
 	if (n & STS_SLI) {
 		DBG("-- suspend --\n");
 		if (is_usb_connected())
@@ -733,7 +1099,7 @@ enum handler_return udc_interrupt(void *arg)
 		}
 	}
 	if (n & STS_UEI) {
-		dprintf(VDEBUG, "<UEI %x>\n", readl(USB_ENDPTCOMPLETE));
+		dprintf(VDEBUG, "<UEI %x>\n", complete);
 	}
 	DBG("STS: ");
 	if (n & STS_UEI)
@@ -748,50 +1114,109 @@ enum handler_return udc_interrupt(void *arg)
 		DBG("USB ");
 	DBG("\n");
 	if ((n & STS_UI) || (n & STS_UEI)) {
-		n = readl(USB_ENDPTSETUPSTAT);
-		if (n & EPT_RX(0)) {
+		if (readl(USB_ENDPTSETUPSTAT) & EPT_RX(0))
 			handle_setup(ep0out);
-			ret = INT_RESCHEDULE;
-		}
-
-		n = readl(USB_ENDPTCOMPLETE);
-		if (n != 0) {
-			writel(n, USB_ENDPTCOMPLETE);
-		}
 
 		for (ept = ept_list; ept; ept = ept->next) {
-			if (n & ept->bit) {
+			if (complete & ept->bit)
 				handle_ept_complete(ept);
-				ret = INT_RESCHEDULE;
-			}
 		}
 	}
-	return ret;
 }
 
-int udc_register_gadget(struct udc_gadget *gadget)
+static int udc_thread(void *arg)
 {
-	if (the_gadget) {
-		dprintf(CRITICAL, "only one gadget supported\n");
-		return -1;
+	for (;;) {
+		event_wait(&udc_event);
+		udc_work();
 	}
-	the_gadget = gadget;
 	return 0;
 }
 
-static void udc_ept_desc_fill(struct udc_endpoint *ept, unsigned char *data)
+enum handler_return udc_interrupt(void *arg)
+{
+	bigtime_t start = current_time_hires();
+	unsigned t;
+	unsigned n = readl(USB_USBSTS);
+	writel(n, USB_USBSTS);
+
+	n &= (STS_SLI | STS_URI | STS_PCI | STS_UI | STS_UEI);
+
+	if (n == 0)
+		return INT_NO_RESCHEDULE;
+
+	if (n & STS_URI) {
+		/* whatever completed before the reset is errored out */
+		writel(readl(USB_ENDPTCOMPLETE), USB_ENDPTCOMPLETE);
+		writel(readl(USB_ENDPTSETUPSTAT), USB_ENDPTSETUPSTAT);
+		writel(0xffffffff, USB_ENDPTFLUSH);
+		pending_complete = 0;
+	}
+	if ((n & STS_UI) || (n & STS_UEI)) {
+		unsigned complete = readl(USB_ENDPTCOMPLETE);
+		if (complete != 0) {
+			writel(complete, USB_ENDPTCOMPLETE);
+			pending_complete |= complete;
+		}
+	}
+	pending_sts |= n;
+	event_signal(&udc_event, false);
+
+	t = current_time_hires() - start;
+	stats.irqs++;
+	stats.irq_time += t;
+	if (t > stats.irq_time_max)
+		stats.irq_time_max = t;
+	return INT_RESCHEDULE;
+}
+
+void udc_get_stats(struct udc_stats *out)
+{
+	enter_critical_section();
+	*out = stats;
+	exit_critical_section();
+}
+
+void udc_reset_stats(void)
+{
+	enter_critical_section();
+	memset(&stats, 0, sizeof(stats));
+	exit_critical_section();
+}
+
+/* gadgets get their interface numbers in the order they register */
+int udc_register_gadget(struct udc_gadget *gadget)
+{
+	struct udc_gadget **pp;
+
+	for (pp = &gadget_list; *pp; pp = &(*pp)->next)
+		if (*pp == gadget)
+			return -1;
+	gadget->next = 0;
+	gadget->ifc_number = num_interfaces;
+	num_interfaces += gadget->ifc_count ? gadget->ifc_count : 1;
+	*pp = gadget;
+	return 0;
+}
+
+void udc_ept_desc_fill(struct udc_endpoint *ept, unsigned char *data)
 {
 	data[0] = 7;
 	data[1] = TYPE_ENDPOINT;
 	data[2] = ept->num | (ept->in ? 0x80 : 0x00);
-	data[3] = 0x02;		/* bulk -- the only kind we support */
+	data[3] = ept->intr ? 0x03 : 0x02;
 	data[4] = ept->maxpkt;
 	data[5] = ept->maxpkt >> 8;
-	data[6] = ept->in ? 0x00 : 0x01;
+	if (ept->intr)
+		data[6] = 4;	/* 1ms at high speed, 4ms at full speed */
+	else
+		data[6] = ept->in ? 0x00 : 0x01;
 }
 
 static unsigned udc_ifc_desc_size(struct udc_gadget *g)
 {
+	if (g->desc_fill)
+		return g->desc_fill(g, 0);
 	return 9 + g->ifc_endpoints * 7;
 }
 
@@ -799,9 +1224,14 @@ static void udc_ifc_desc_fill(struct udc_gadget *g, unsigned char *data)
 {
 	unsigned n;
 
+	if (g->desc_fill) {
+		g->desc_fill(g, data);
+		return;
+	}
+
 	data[0] = 0x09;
 	data[1] = TYPE_INTERFACE;
-	data[2] = 0x00;		/* ifc number */
+	data[2] = g->ifc_number;
 	data[3] = 0x00;		/* alt number */
 	data[4] = g->ifc_endpoints;
 	data[5] = g->ifc_class;
@@ -819,8 +1249,11 @@ static void udc_ifc_desc_fill(struct udc_gadget *g, unsigned char *data)
 int udc_start(void)
 {
 	struct udc_descriptor *desc;
+	struct udc_gadget *g;
 	unsigned char *data;
 	unsigned size;
+	thread_t *thr;
+	int iad = 0;
 
 	dprintf(ALWAYS, "udc_start()\n");
 
@@ -828,10 +1261,13 @@ int udc_start(void)
 		dprintf(CRITICAL, "udc cannot start before init\n");
 		return -1;
 	}
-	if (!the_gadget) {
+	if (!gadget_list) {
 		dprintf(CRITICAL, "udc has no gadget registered\n");
 		return -1;
 	}
+	for (g = gadget_list; g; g = g->next)
+		if (g->ifc_count > 1)
+			iad = 1;
 
 	//udc_reset();
 
@@ -840,9 +1276,17 @@ int udc_start(void)
 	data = desc->data;
 	data[2] = 0x00;		/* usb spec minor rev */
 	data[3] = 0x02;		/* usb spec major rev */
-	data[4] = 0x00;		/* class */
-	data[5] = 0x00;		/* subclass */
-	data[6] = 0x00;		/* protocol */
+	if (iad) {
+		/* functions with several interfaces come with an
+		 ** interface association descriptor */
+		data[4] = 0xef;	/* miscellaneous */
+		data[5] = 0x02;	/* common class */
+		data[6] = 0x01;	/* interface association */
+	} else {
+		data[4] = 0x00;	/* class */
+		data[5] = 0x00;	/* subclass */
+		data[6] = 0x00;	/* protocol */
+	}
 	data[7] = 0x40;		/* max packet size on ept 0 */
 	memcpy(data + 8, &the_device->vendor_id, sizeof(short));
 	memcpy(data + 10, &the_device->product_id, sizeof(short));
@@ -854,20 +1298,38 @@ int udc_start(void)
 	udc_descriptor_register(desc);
 
 	/* create our configuration descriptor */
-	size = 9 + udc_ifc_desc_size(the_gadget);
+	size = 9;
+	for (g = gadget_list; g; g = g->next)
+		size += udc_ifc_desc_size(g);
 	desc = udc_descriptor_alloc(TYPE_CONFIGURATION, 0, size);
+	if (!desc) {
+		dprintf(CRITICAL, "udc configuration too large\n");
+		return -1;
+	}
 	data = desc->data;
 	data[0] = 0x09;
 	data[2] = size;
 	data[3] = size >> 8;
-	data[4] = 0x01;		/* number of interfaces */
+	data[4] = num_interfaces;
 	data[5] = 0x01;		/* configuration value */
 	data[6] = 0x00;		/* configuration string */
 	data[7] = 0x80;		/* attributes */
 	data[8] = 0x80;		/* max power (250ma) -- todo fix this */
-	udc_ifc_desc_fill(the_gadget, data + 9);
+	data += 9;
+	for (g = gadget_list; g; g = g->next) {
+		udc_ifc_desc_fill(g, data);
+		data += udc_ifc_desc_size(g);
+	}
 	udc_descriptor_register(desc);
 
+	event_init(&udc_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+	thr = thread_create("usb", udc_thread, 0, HIGH_PRIORITY, 4096);
+	if (!thr) {
+		dprintf(CRITICAL, "udc cannot create its thread\n");
+		return -1;
+	}
+	thread_resume(thr);
+
 	register_int_handler(INT_USB_HS, udc_interrupt, (void *)0);
 	writel(STS_URI | STS_SLI | STS_UI | STS_PCI, USB_USBINTR);
 
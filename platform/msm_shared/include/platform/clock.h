@@ -50,5 +50,7 @@ void msm_clock_init(void);
 int clk_enable(unsigned id);
 void clk_disable(unsigned id);
 int clk_set_rate(unsigned id, unsigned freq);
+/* rate in Hz, or negative if the platform cannot tell */
+int clk_get_rate(unsigned id);
 
 #endif //__MSM_SHARED_PLATFORM_CLOCK_H_
@@ -35,14 +35,18 @@
 #define MSM_NAND_BASE 0xA0A00000
 #endif
 
-#define MSM_NAND_NC01_BASE 	0xA0240000
-#define MSM_NAND_NC10_BASE 	0xA0280000
-#define MSM_NAND_NC11_BASE 	0xA02C0000
+/* Aliases of the controller registers reaching NC01 (CS0 side), NC10
+ * (CS1 side) or both (NC11) in dual-controller interleaved mode.  The
+ * macros take the absolute NAND_* register addresses below.
+ */
+#define MSM_NAND_NC01_BASE 	(MSM_NAND_BASE + 0x40000)
+#define MSM_NAND_NC10_BASE 	(MSM_NAND_BASE + 0x80000)
+#define MSM_NAND_NC11_BASE 	(MSM_NAND_BASE + 0xC0000)
 #define EBI2_REG_BASE 		0xA0000000
 
-#define NC01(off) (MSM_NAND_NC01_BASE + (off))
-#define NC10(off) (MSM_NAND_NC10_BASE + (off))
-#define NC11(off) (MSM_NAND_NC11_BASE + (off))
+#define NC01(reg) ((reg) - MSM_NAND_BASE + MSM_NAND_NC01_BASE)
+#define NC10(reg) ((reg) - MSM_NAND_BASE + MSM_NAND_NC10_BASE)
+#define NC11(reg) ((reg) - MSM_NAND_BASE + MSM_NAND_NC11_BASE)
 #define EBI2_REG(off) (EBI2_REG_BASE + (off))
 
 #define NAND_REG(off) (MSM_NAND_BASE + (off))
@@ -112,6 +116,25 @@
 #define NAND_CMD_STATUS             0x0C
 #define NAND_CMD_RESET              0x0D
 
+/* Device opcodes in the DEV_CMD registers used for cache operations.
+ * DEV_CMD0[31:24] is the program confirm: with PROGRAM PAGE CACHE the
+ * device takes the next page while the previous one is still being
+ * programmed.  READ CACHE SEQUENTIAL returns the page loaded by the
+ * previous read and starts loading the next row; READ CACHE END returns
+ * the loaded page without loading another.  Neither takes an address,
+ * so they go out like READ PARAMETER PAGE: the opcode replaces the read
+ * command in DEV_CMD1[7:0], the DEV_CMD1[15:8] confirm is switched off
+ * in DEV_CMD_VLD and the page is read with no address cycles in CFG0.
+ */
+#define NAND_DEV_CMD0_WRITE_START(op)   ((unsigned)(op) << 24)
+#define NAND_DEV_CMD1_READ_ADDR(op)     ((unsigned)(op) << 0)
+#define NAND_DEV_CMD_VLD_READ_START     (1U << 0)
+#define NAND_CFG0_ADDR_CYCLES(n)        ((unsigned)(n) << 27)
+#define NAND_DEVCMD_PROGRAM             0x10
+#define NAND_DEVCMD_PROGRAM_CACHE       0x15
+#define NAND_DEVCMD_READ_CACHE_SEQ      0x31
+#define NAND_DEVCMD_READ_CACHE_END      0x3F
+
 /* Sflash Commands */
 
 #define NAND_SFCMD_DATXS          0x0
@@ -176,9 +199,24 @@
 #define ONENAND_CMDPROG          0x0080
 #define ONENAND_CMDPROGSPARE     0x001A
 #define ONENAND_CMDERAS          0x0094
+#define ONENAND_CMDMULTIERAS     0x0095
+#define ONENAND_CMDERASVERIFY    0x0071
 
 #define ONENAND_SYSCFG1_ECCENA   0x40E0
 #define ONENAND_SYSCFG1_ECCDIS   0x41E0
+
+/* SYSCFG1 read mode, burst read latency (clocks) and burst length; the
+** values above are asynchronous with a latency of 4 and continuous
+** bursts, so synchronous reads only need the read mode bit.
+*/
+#define ONENAND_SYSCFG1_SYNC_READ  (1U << 15)
+#define ONENAND_SYSCFG1_BRL(n)     ((unsigned)(n) << 12)
+#define ONENAND_SYSCFG1_BL(n)      ((unsigned)(n) << 9)
+#define ONENAND_SYSCFG1_BL_CONT    0
+#define ONENAND_SYSCFG1_BURST      (ONENAND_SYSCFG1_SYNC_READ | \
+				    ONENAND_SYSCFG1_BRL(4) | \
+				    ONENAND_SYSCFG1_BL(ONENAND_SYSCFG1_BL_CONT) | \
+				    0x00E0)
 #define ONENAND_CLRINTR          0x0000
 #define ONENAND_STARTADDR1_RES   0x07FF
 #define ONENAND_STARTADDR3_RES   0x07FF
@@ -187,6 +225,10 @@
 #define DEVICE_BUFFERRAM_0       0
 #define DATARAM0_0               0x8
 
+/* MACRO1 addresses of the DataRAM sectors, DataRAM1 following DataRAM0 */
+#define ONENAND_MACRO_DATARAM    0x0200
+#define ONENAND_MACRO_SECTOR     0x0100
+
 /* Flash type */
 #define FLASH_UNKNOWN_DEVICE        0x00
 #define FLASH_NAND_DEVICE           0x01
@@ -36,6 +36,8 @@
 #include <platform/nand.h>
 
 #include "dmov.h"
+#include "nand_pipe.h"
+#include "nand_stream.h"
 
 #define VERBOSE 0
 #define VERIFY_WRITE 0
@@ -44,22 +46,6 @@ static void *flash_spare;
 static void *flash_data;
 void platform_config_interleaved_mode_gpios(void);
 
-typedef struct dmov_ch dmov_ch;
-struct dmov_ch {
-	volatile unsigned cmd;
-	volatile unsigned result;
-	volatile unsigned status;
-	volatile unsigned config;
-};
-
-static void dmov_prep_ch(dmov_ch * ch, unsigned id)
-{
-	ch->cmd = DMOV_CMD_PTR(id);
-	ch->result = DMOV_RSLT(id);
-	ch->status = DMOV_STATUS(id);
-	ch->config = DMOV_CONFIG(id);
-}
-
 #define SRC_CRCI_NAND_CMD  CMD_SRC_CRCI(DMOV_NAND_CRCI_CMD)
 #define DST_CRCI_NAND_CMD  CMD_DST_CRCI(DMOV_NAND_CRCI_CMD)
 #define SRC_CRCI_NAND_DATA CMD_SRC_CRCI(DMOV_NAND_CRCI_DATA)
@@ -76,34 +62,6 @@ static unsigned CFG0_A, CFG1_A;
 
 #define paddr(n) ((unsigned) (n))
 
-static int dmov_exec_cmdptr(unsigned id, unsigned *ptr)
-{
-	dmov_ch ch;
-	unsigned n;
-
-	dmov_prep_ch(&ch, id);
-
-	writel(DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(paddr(ptr)), ch.cmd);
-
-	while (!(readl(ch.status) & DMOV_STATUS_RSLT_VALID)) ;
-
-	n = readl(ch.status);
-	while (DMOV_STATUS_RSLT_COUNT(n)) {
-		n = readl(ch.result);
-		if (n != 0x80000002) {
-			dprintf(CRITICAL, "ERROR: result: %x\n", n);
-			dprintf(CRITICAL, "ERROR:  flush: %x %x %x %x\n",
-				readl(DMOV_FLUSH0(DMOV_NAND_CHAN)),
-				readl(DMOV_FLUSH1(DMOV_NAND_CHAN)),
-				readl(DMOV_FLUSH2(DMOV_NAND_CHAN)),
-				readl(DMOV_FLUSH3(DMOV_NAND_CHAN)));
-		}
-		n = readl(ch.status);
-	}
-
-	return 0;
-}
-
 static struct flash_info flash_info;
 static unsigned flash_pagesize = 0;
 static int interleaved_mode = 0;
@@ -117,32 +75,106 @@ struct flash_identification {
 	unsigned blksize;
 	unsigned oobsize;
 	unsigned onenand;
+	unsigned cache;		/* FLASH_CACHE_* commands the part has */
 };
 
+#define FLASH_CACHE_PROGRAM	(1U << 0)	/* PROGRAM PAGE CACHE */
+#define FLASH_CACHE_READ	(1U << 1)	/* READ CACHE SEQUENTIAL/END */
+
 static struct flash_identification supported_flash[] = {
-	/* Flash ID     ID Mask Density(MB)  Wid Pgsz   Blksz   oobsz onenand   Manuf */
-	{0x00000000, 0xFFFFFFFF, 0, 0, 0, 0, 0, 0}, /*ONFI*/
-	{0x1500aaec, 0xFF00FFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0},	/*Sams */
-	{0x5500baec, 0xFF00FFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0},	/*Sams */
-	{0x5500bcec, 0xFF00FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 0}, /*Sams*/
-	{0x1500aa98, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0},	/*Tosh */
-	{0x5500ba98, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0},	/*Tosh */
-	{0xd580b12c, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0},	/*Micr */
-	{0x5590bc2c, 0xFFFFFFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 0},	/*Micr */
-	{0x1580aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0},	/*Micr */
-	{0x1590aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0},	/*Micr */
-	{0x1590ac2c, 0xFFFFFFFF, (512 << 20), 0, 2048, (2048 << 6), 64, 0},	/*Micr */
-	{0x5580baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0},	/*Hynx */
-	{0x5510baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0},	/*Hynx */
-	{0x004000ec, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1},	/*Sams */
-	{0x005c00ec, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1},	/*Sams */
-	{0x005800ec, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1},	/*Sams */
-	{0x6600bcec, 0xFF00FFFF, (512 << 20), 1, 4096, (4096 << 6), 128, 0},	/*Sams */
+	/* Flash ID     ID Mask Density(MB)  Wid Pgsz   Blksz   oobsz onenand Ca Manuf */
+	{0x00000000, 0xFFFFFFFF, 0, 0, 0, 0, 0, 0, 0}, /*ONFI*/
+	{0x1500aaec, 0xFF00FFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0, 0},	/*Sams */
+	{0x5500baec, 0xFF00FFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0, 0},	/*Sams */
+	{0x5500bcec, 0xFF00FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 0, 0}, /*Sams*/
+	{0x1500aa98, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0, 0},	/*Tosh */
+	{0x5500ba98, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0, 0},	/*Tosh */
+	{0xd580b12c, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0, 3},	/*Micr */
+	{0x5590bc2c, 0xFFFFFFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 0, 3},	/*Micr */
+	{0x1580aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0, 3},	/*Micr */
+	{0x1590aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 0, 3},	/*Micr */
+	{0x1590ac2c, 0xFFFFFFFF, (512 << 20), 0, 2048, (2048 << 6), 64, 0, 3},	/*Micr */
+	{0x5580baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0, 0},	/*Hynx */
+	{0x5510baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 0, 0},	/*Hynx */
+	{0x004000ec, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 0},	/*Sams */
+	{0x005c00ec, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 0},	/*Sams */
+	{0x005800ec, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 0},	/*Sams */
+	{0x6600bcec, 0xFF00FFFF, (512 << 20), 1, 4096, (4096 << 6), 128, 0, 0},	/*Sams */
 	/* Note: Width flag is 0 for 8 bit Flash and 1 for 16 bit flash   */
 	/* Note: Onenand flag is 0 for NAND Flash and 1 for OneNAND flash       */
 	/* Note: The First row will be filled at runtime during ONFI probe      */
+	/* Note: Ca lists the cache commands (FLASH_CACHE_*) the part is
+	 *       known to implement; 0 keeps it on plain reads and programs.
+	 *       They are only used when the target sets NAND_CACHE_OPS */
 };
 
+/* FLASH_CACHE_* commands used with the detected part, and the DEV_CMD
+ * opcodes the cache operations are patched into.  The cache sequences
+ * have only run against tools/nandsim, so a target has to ask for them
+ * with NAND_CACHE_OPS.
+ */
+#ifndef NAND_CACHE_OPS
+#define NAND_CACHE_OPS	0
+#endif
+
+static unsigned flash_cache;
+static unsigned flash_dev_cmd0, flash_dev_cmd1, flash_dev_cmd_vld;
+
+/* OneNAND DataRAM geometry reported by the part, and whether reads run
+ * in synchronous burst mode (set once a burst read has been checked
+ * against an asynchronous one)
+ */
+static unsigned onenand_dataram_size, onenand_datarams;
+static int onenand_burst;
+
+/* In-RAM bad block table, one bit per block.  It is built once by
+ * flash_init() and kept up to date by the erase and write paths, so the
+ * bad block marker does not have to be re-read for every page.
+ */
+static unsigned *flash_bbt;
+static unsigned flash_bbt_words;
+
+static int
+_flash_block_isbad(dmov_s * cmdlist, unsigned *ptrlist, unsigned page);
+static void
+flash_bbt_mark_bad(dmov_s * cmdlist, unsigned *ptrlist, unsigned page);
+
+static int
+flash_bbt_isbad(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_bbt || block >= flash_info.num_blocks)
+		return _flash_block_isbad(cmdlist, ptrlist, page);
+	return (flash_bbt[block >> 5] >> (block & 31)) & 1;
+}
+
+/* Blocks erased since flash_init() and not programmed since, one bit per
+ * block.  Differential writes use it to skip redundant erases.
+ */
+static unsigned *flash_erased;
+
+static void flash_erased_set(unsigned page, int erased)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_erased || block >= flash_info.num_blocks)
+		return;
+	if (erased)
+		flash_erased[block >> 5] |= 1U << (block & 31);
+	else
+		flash_erased[block >> 5] &= ~(1U << (block & 31));
+}
+
+static int flash_block_erased(unsigned page)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_erased || block >= flash_info.num_blocks)
+		return 0;
+	return (flash_erased[block >> 5] >> (block & 31)) & 1;
+}
+
 static void set_nand_configuration(char type)
 {
 	if (type == TYPE_MODEM_PARTITION) {
@@ -487,26 +519,10 @@ flash_nand_block_isbad_interleave(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
-static int
-flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
+/* Command list erasing the block at 'page', status in data[5] */
+static void
+flash_nand_build_erase(dmov_s * cmd, unsigned *data, unsigned page)
 {
-	dmov_s *cmd = cmdlist;
-	unsigned *ptr = ptrlist;
-	unsigned *data = ptrlist + 4;
-	int isbad = 0;
-
-	/* only allow erasing on block boundaries */
-	if (page & 63)
-		return -1;
-
-	/* Check for bad block and erase only if block is not marked bad */
-	isbad = flash_nand_block_isbad(cmdlist, ptrlist, page);
-
-	if (isbad) {
-		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
-		return -1;
-	}
-
 	/* Erase block */
 	data[0] = NAND_CMD_BLOCK_ERASE;
 	data[1] = page;
@@ -548,6 +564,37 @@ flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	cmd[5].src = paddr(&data[9]);
 	cmd[5].dst = NAND_READ_STATUS;
 	cmd[5].len = 4;
+}
+
+static int flash_nand_erase_failed(const unsigned *data)
+{
+	/* we fail if there was an operation error, a mpu error, or the
+	 ** erase success bit was not set.
+	 */
+	return (data[5] & 0x110) || !(data[5] & 0x80);
+}
+
+static int
+flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned *ptr = ptrlist;
+	unsigned *data = ptrlist + 4;
+	int isbad = 0;
+
+	/* only allow erasing on block boundaries */
+	if (page & 63)
+		return -1;
+
+	/* Check for bad block and erase only if block is not marked bad */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+
+	if (isbad) {
+		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
+		return -1;
+	}
+
+	flash_nand_build_erase(cmd, data, page);
 
 	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
 
@@ -557,12 +604,7 @@ flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	dprintf(INFO, "status: %x\n", data[5]);
 #endif
 
-	/* we fail if there was an operation error, a mpu error, or the
-	 ** erase success bit was not set.
-	 */
-	if (data[5] & 0x110)
-		return -1;
-	if (!(data[5] & 0x80))
+	if (flash_nand_erase_failed(data))
 		return -1;
 
 	return 0;
@@ -582,7 +624,7 @@ flash_nand_erase_block_interleave(dmov_s * cmdlist, unsigned *ptrlist,
 		return -1;
 
 	/* Check for bad block and erase only if block is not marked bad */
-	isbad = flash_nand_block_isbad(cmdlist, ptrlist, page);
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
 
 	if (isbad) {
 		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
@@ -730,6 +772,8 @@ struct data_flash_io {
 	unsigned ecc_cfg_save;
 	unsigned clrfstatus;
 	unsigned clrrstatus;
+	unsigned dev_cmd0;	/* program confirm opcode for this page */
+	unsigned dev_cmd0_restore;
 	struct {
 		unsigned flash_status;
 		unsigned buffer_status;
@@ -759,25 +803,43 @@ struct interleave_data_flash_io {
 	} result[16];
 };
 
-static int
-_flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
-		      unsigned page, void *_addr, void *_spareaddr)
+/* Single page command list templates.  The descriptors of a page read or
+ * program only depend on the page geometry and the mode, so flash_init()
+ * builds one list per mode and each operation only patches the page
+ * address, the register values and the buffer pointers.
+ */
+#define PAGE_TMPL_READ		0
+#define PAGE_TMPL_WRITE		1	/* 516 byte codewords + spare */
+#define PAGE_TMPL_WRITE_MODEM	2	/* 512 byte codewords, no spare */
+#define PAGE_TMPL_WRITE_RAW	3
+#define PAGE_TMPL_COUNT		4
+#define PAGE_TMPL_CMDS		64
+
+struct page_tmpl {
+	dmov_s *cmdlist;
+	struct data_flash_io *data;
+	dmov_s *buf[8];		/* data transfer of each codeword */
+	dmov_s *spare;		/* spare transfer, NULL if none */
+	int cache;		/* DEV_CMD0 confirm opcode is written */
+};
+
+static struct page_tmpl page_tmpl[PAGE_TMPL_COUNT];
+
+/* Build the command list that reads one page (data + spare) into the
+ * given buffers.  The list is terminated with CMD_LC; returns the number
+ * of commands used.  If 't' is given the transfers are recorded there so
+ * the list can be reused for other pages.
+ */
+static unsigned
+flash_nand_build_read_page(dmov_s * cmdlist, struct data_flash_io *data,
+			   unsigned page, unsigned addr, unsigned spareaddr,
+			   struct page_tmpl *t)
 {
 	dmov_s *cmd = cmdlist;
-	unsigned *ptr = ptrlist;
-	struct data_flash_io *data = (void *)(ptrlist + 4);
-	unsigned addr = (unsigned)_addr;
-	unsigned spareaddr = (unsigned)_spareaddr;
 	unsigned n;
-	int isbad = 0;
 	unsigned cwperpage;
 	cwperpage = (flash_pagesize >> 9);
 
-	/* Check for bad block and read only from a good block */
-	isbad = flash_nand_block_isbad(cmdlist, ptrlist, page);
-	if (isbad)
-		return -2;
-
 	data->cmd = NAND_CMD_PAGE_READ_ECC;
 	data->addr0 = page << 16;
 	data->addr1 = (page >> 16) & 0xff;
@@ -836,6 +898,8 @@ _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 		cmd++;
 
 		/* read data block */
+		if (t)
+			t->buf[n] = cmd;
 		cmd->cmd = 0;
 		cmd->src = NAND_FLASH_BUFFER;
 		cmd->dst = addr + n * 516;
@@ -846,6 +910,8 @@ _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	}
 
 	/* read extra data */
+	if (t)
+		t->spare = cmd;
 	cmd->cmd = 0;
 	cmd->src = NAND_FLASH_BUFFER + 500;
 	cmd->dst = spareaddr;
@@ -857,8 +923,39 @@ _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	cmd->src = paddr(&data->ecc_cfg_save);
 	cmd->dst = NAND_EBI2_ECC_BUF_CFG;
 	cmd->len = 4;
+	cmd++;
 
-	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+	return cmd - cmdlist;
+}
+
+static int
+_flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
+		      unsigned page, void *_addr, void *_spareaddr)
+{
+	unsigned *ptr = ptrlist;
+	struct page_tmpl *t = &page_tmpl[PAGE_TMPL_READ];
+	struct data_flash_io *data = t->data;
+	unsigned addr = (unsigned)_addr;
+	unsigned spareaddr = (unsigned)_spareaddr;
+	unsigned n;
+	int isbad = 0;
+	unsigned cwperpage;
+	cwperpage = (flash_pagesize >> 9);
+
+	/* Check for bad block and read only from a good block */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+	if (isbad)
+		return -2;
+
+	data->addr0 = page << 16;
+	data->addr1 = (page >> 16) & 0xff;
+	data->cfg0 = CFG0;
+	data->cfg1 = CFG1;
+	for (n = 0; n < cwperpage; n++)
+		t->buf[n]->dst = addr + n * 516;
+	t->spare->dst = spareaddr;
+
+	ptr[0] = (paddr(t->cmdlist) >> 3) | CMD_PTR_LP;
 
 	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
 
@@ -887,6 +984,201 @@ _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
+/* Sequential reads chain up to READ_CHAIN_PAGES page command lists behind
+ * a single DMOV command-pointer list, so the data mover walks a run of
+ * pages without a CPU round trip in between.  Each pipeline slot has its
+ * own set of chain buffers (see nand_pipe.h).
+ */
+#define READ_CHAIN_PAGES	32
+#define READ_CHAIN_CMDS		(5 + 4 * 8)	/* per page, 8 cw for 4k pages */
+#define READ_CHAIN_SPARE	128	/* spare slot per page */
+
+static unsigned *chain_ptrlist[NAND_PIPE_DEPTH];
+static dmov_s *chain_cmdlist[NAND_PIPE_DEPTH];
+static struct data_flash_io *chain_data[NAND_PIPE_DEPTH];
+static unsigned char *chain_spare[NAND_PIPE_DEPTH];
+
+/* Command lists around a cache read chain.  The first page is loaded
+ * with a plain READ PAGE of one raw codeword that is not transferred.
+ * Every page but the last is then read with READ CACHE SEQUENTIAL and
+ * the last with READ CACHE END, each returning the page loaded before
+ * it (see platform/nand.h).  The plain read opcodes are restored after
+ * the chain.
+ */
+#define CHAIN_CACHE_LOAD_CMDS	6
+
+struct chain_cache_io {
+	dmov_s load[CHAIN_CACHE_LOAD_CMDS];	/* first page, then 31h */
+	dmov_s end;		/* 3Fh before the last page */
+	dmov_s restore[2];
+	unsigned cmd;
+	unsigned addr0;
+	unsigned addr1;
+	unsigned chipsel;
+	unsigned cfg0;
+	unsigned cfg1;
+	unsigned exec;
+	struct {
+		unsigned flash_status;
+		unsigned buffer_status;
+	} result;
+	unsigned dev_cmd1[3];	/* 31h, 3Fh, plain */
+	unsigned dev_cmd_vld[2];	/* no confirm, plain */
+	int active;		/* the last chain of the slot used them */
+};
+
+static struct chain_cache_io *chain_cache[NAND_PIPE_DEPTH];
+
+static void flash_nand_chain_cache(unsigned slot, unsigned page)
+{
+	struct chain_cache_io *io = chain_cache[slot];
+	dmov_s *cmd = io->load;
+	unsigned read = flash_dev_cmd1 & ~NAND_DEV_CMD1_READ_ADDR(0xFF);
+
+	io->cmd = NAND_CMD_PAGE_READ;
+	io->addr0 = page << 16;
+	io->addr1 = (page >> 16) & 0xff;
+	io->chipsel = 0 | 4;
+	io->cfg0 = NAND_CFG0_RAW & ~(7U << 6);	/* one codeword */
+	io->cfg1 = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);
+	io->exec = 1;
+	io->result.flash_status = CLEAN_DATA_32;
+	io->result.buffer_status = CLEAN_DATA_32;
+
+	io->dev_cmd1[0] = read |
+	    NAND_DEV_CMD1_READ_ADDR(NAND_DEVCMD_READ_CACHE_SEQ);
+	io->dev_cmd1[1] = read |
+	    NAND_DEV_CMD1_READ_ADDR(NAND_DEVCMD_READ_CACHE_END);
+	io->dev_cmd1[2] = flash_dev_cmd1;
+	io->dev_cmd_vld[0] = flash_dev_cmd_vld & ~NAND_DEV_CMD_VLD_READ_START;
+	io->dev_cmd_vld[1] = flash_dev_cmd_vld;
+
+	/* 00h-address-30h: the page register holds the first page */
+	cmd[0].cmd = DST_CRCI_NAND_CMD | CMD_OCB;
+	cmd[0].src = paddr(&io->cmd);
+	cmd[0].dst = NAND_FLASH_CMD;
+	cmd[0].len = 16;
+
+	cmd[1].cmd = 0;
+	cmd[1].src = paddr(&io->cfg0);
+	cmd[1].dst = NAND_DEV0_CFG0;
+	cmd[1].len = 8;
+
+	cmd[2].cmd = 0;
+	cmd[2].src = paddr(&io->exec);
+	cmd[2].dst = NAND_EXEC_CMD;
+	cmd[2].len = 4;
+
+	cmd[3].cmd = SRC_CRCI_NAND_DATA;
+	cmd[3].src = NAND_FLASH_STATUS;
+	cmd[3].dst = paddr(&io->result);
+	cmd[3].len = 8;
+
+	/* the page reads that follow send a bare 31h */
+	cmd[4].cmd = 0;
+	cmd[4].src = paddr(&io->dev_cmd_vld[0]);
+	cmd[4].dst = NAND_DEV_CMD_VLD;
+	cmd[4].len = 4;
+
+	cmd[5].cmd = CMD_OCU | CMD_LC;
+	cmd[5].src = paddr(&io->dev_cmd1[0]);
+	cmd[5].dst = NAND_DEV_CMD1;
+	cmd[5].len = 4;
+
+	io->end.cmd = CMD_OCB | CMD_OCU | CMD_LC;
+	io->end.src = paddr(&io->dev_cmd1[1]);
+	io->end.dst = NAND_DEV_CMD1;
+	io->end.len = 4;
+
+	io->restore[0].cmd = CMD_OCB;
+	io->restore[0].src = paddr(&io->dev_cmd1[2]);
+	io->restore[0].dst = NAND_DEV_CMD1;
+	io->restore[0].len = 4;
+
+	io->restore[1].cmd = CMD_OCU | CMD_LC;
+	io->restore[1].src = paddr(&io->dev_cmd_vld[1]);
+	io->restore[1].dst = NAND_DEV_CMD_VLD;
+	io->restore[1].len = 4;
+}
+
+/* Build the chained command list reading 'count' consecutive pages of
+ * one block into pipeline slot 'slot'.  Page n lands at data + n * stride,
+ * its spare bytes in the slot's spare buffer.  Bad block checks are left
+ * to the caller.  With cache reads the next page is loaded by the device
+ * while the current one is transferred.
+ */
+static unsigned *
+flash_nand_chain_prepare(unsigned slot, unsigned page, unsigned count,
+			 unsigned char *data, unsigned stride)
+{
+	unsigned *ptr = chain_ptrlist[slot];
+	dmov_s *cmd;
+	unsigned n;
+	int cache;
+
+	ASSERT(count > 0 && count <= READ_CHAIN_PAGES);
+	ASSERT((page & 63) + count <= 64);
+
+	cache = (flash_cache & FLASH_CACHE_READ) && count > 1;
+	chain_cache[slot]->active = cache;
+	if (cache) {
+		flash_nand_chain_cache(slot, page);
+		*ptr++ = paddr(chain_cache[slot]->load) >> 3;
+	}
+
+	for (n = 0; n < count; n++) {
+		cmd = chain_cmdlist[slot] + n * READ_CHAIN_CMDS;
+		flash_nand_build_read_page(cmd, &chain_data[slot][n], page + n,
+					   paddr(data + n * stride),
+					   paddr(chain_spare[slot] +
+						 n * READ_CHAIN_SPARE), NULL);
+		if (cache) {
+			/* 31h and 3Fh take no address */
+			chain_data[slot][n].cfg0 &= ~NAND_CFG0_ADDR_CYCLES(7);
+			if (n == count - 1)
+				*ptr++ = paddr(&chain_cache[slot]->end) >> 3;
+		}
+		*ptr++ = paddr(cmd) >> 3;
+	}
+	if (cache)
+		*ptr++ = paddr(chain_cache[slot]->restore) >> 3;
+	ptr[-1] |= CMD_PTR_LP;
+
+	return chain_ptrlist[slot];
+}
+
+/* Returns the number of pages of a completed chain read before the first
+ * page with a failed codeword.
+ */
+static int flash_nand_chain_check(unsigned slot, unsigned count)
+{
+	unsigned n, cw;
+	unsigned cwperpage;
+	cwperpage = (flash_pagesize >> 9);
+
+	/* the load of the first page behind a cache read failed */
+	if (chain_cache[slot]->active &&
+	    (chain_cache[slot]->result.flash_status & 0x110))
+		return 0;
+
+	/* stop at the first page with an operation error (0x10) or
+	 ** a protection violation (0x100)
+	 */
+	for (n = 0; n < count; n++) {
+		for (cw = 0; cw < cwperpage; cw++) {
+			if (chain_data[slot][n].result[cw].flash_status & 0x110)
+				return n;
+		}
+	}
+
+	return count;
+}
+
+static void *flash_nand_chain_spare(unsigned slot, unsigned n)
+{
+	return chain_spare[slot] + n * READ_CHAIN_SPARE;
+}
+
 static int
 flash_nand_read_page_interleave(dmov_s * cmdlist, unsigned *ptrlist,
 				unsigned page, void *_addr, void *_spareaddr)
@@ -902,7 +1194,7 @@ flash_nand_read_page_interleave(dmov_s * cmdlist, unsigned *ptrlist,
 	cwperpage = (flash_pagesize >> 9);
 
 	/* Check for bad block and read only from a good block */
-	isbad = flash_nand_block_isbad(cmdlist, ptrlist, page);
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
 	if (isbad)
 		return -2;
 
@@ -1253,40 +1545,31 @@ flash_nand_read_page_interleave(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
-static int
-_flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist, unsigned page,
-		       const void *_addr, const void *_spareaddr,
-		       unsigned raw_mode)
+/* With 'cache' set the page is confirmed with PROGRAM PAGE CACHE: the
+ * status comes back once the device has latched the data, and the next
+ * page can be loaded while this one is programmed.  The last page of a
+ * run must go without it.
+ */
+/* Build the program template for 'mode' (PAGE_TMPL_WRITE*).  Templates
+ * of parts with PROGRAM PAGE CACHE always carry the DEV_CMD0 writes; a
+ * plain program just confirms with the default opcode.
+ */
+static void flash_nand_build_write_page(struct page_tmpl *t, unsigned mode)
 {
-	dmov_s *cmd = cmdlist;
-	unsigned *ptr = ptrlist;
-	struct data_flash_io *data = (void *)(ptrlist + 4);
-	unsigned addr = (unsigned)_addr;
-	unsigned spareaddr = (unsigned)_spareaddr;
+	dmov_s *cmd = t->cmdlist;
+	struct data_flash_io *data = t->data;
 	unsigned n;
 	unsigned cwperpage;
 	cwperpage = (flash_pagesize >> 9);
-	unsigned modem_partition = 0;
-	if (CFG0 == CFG0_M) {
-		modem_partition = 1;
-	}
+	unsigned raw_mode = (mode == PAGE_TMPL_WRITE_RAW);
+	unsigned modem_partition = (mode == PAGE_TMPL_WRITE_MODEM);
+	int cache = !raw_mode && (flash_cache & FLASH_CACHE_PROGRAM);
 
 	data->cmd = NAND_CMD_PRG_PAGE;
-	data->addr0 = page << 16;
-	data->addr1 = (page >> 16) & 0xff;
 	data->chipsel = 0 | 4;	/* flash0 + undoc bit */
 	data->clrfstatus = 0x00000020;
 	data->clrrstatus = 0x000000C0;
 
-	if (!raw_mode) {
-		data->cfg0 = CFG0;
-		data->cfg1 = CFG1;
-	} else {
-		data->cfg0 =
-		    (NAND_CFG0_RAW & ~(7 << 6)) | ((cwperpage - 1) << 6);
-		data->cfg1 = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);
-	}
-
 	/* GO bit for the EXEC register */
 	data->exec = 1;
 
@@ -1295,6 +1578,9 @@ _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist, unsigned page,
 	else
 		data->ecc_cfg = 0x203;
 
+	t->cache = cache;
+	t->spare = NULL;
+
 	/* save existing ecc config */
 	cmd->cmd = CMD_OCB;
 	cmd->src = NAND_EBI2_ECC_BUF_CFG;
@@ -1324,17 +1610,26 @@ _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist, unsigned page,
 			cmd->dst = NAND_EBI2_ECC_BUF_CFG;
 			cmd->len = 4;
 			cmd++;
+
+			if (cache) {
+				/* confirm opcode of this page */
+				cmd->cmd = 0;
+				cmd->src = paddr(&data->dev_cmd0);
+				cmd->dst = NAND_DEV_CMD0;
+				cmd->len = 4;
+				cmd++;
+			}
 		}
 
-		/* write data block */
+		/* write data block, source patched per page */
+		t->buf[n] = cmd;
 		cmd->cmd = 0;
+		cmd->src = 0;
 		cmd->dst = NAND_FLASH_BUFFER;
 		if (!raw_mode) {
 			if (modem_partition) {
-				cmd->src = addr + n * 512;
 				cmd->len = 512;
 			} else {
-				cmd->src = addr + n * 516;
 				cmd->len =
 				    ((n <
 				      (cwperpage - 1)) ? 516 : (512 -
@@ -1342,15 +1637,15 @@ _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist, unsigned page,
 								  1) << 2)));
 			}
 		} else {
-			cmd->src = addr;
 			cmd->len = 528;
 		}
 		cmd++;
 
 		if ((n == (cwperpage - 1)) && (!raw_mode) && (!modem_partition)) {
 			/* write extra data */
+			t->spare = cmd;
 			cmd->cmd = 0;
-			cmd->src = spareaddr;
+			cmd->src = 0;
 			cmd->dst =
 			    NAND_FLASH_BUFFER + (512 - ((cwperpage - 1) << 2));
 			cmd->len = (cwperpage << 2);
@@ -1384,25 +1679,93 @@ _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist, unsigned page,
 		cmd++;
 	}
 
+	if (cache) {
+		cmd->cmd = 0;
+		cmd->src = paddr(&data->dev_cmd0_restore);
+		cmd->dst = NAND_DEV_CMD0;
+		cmd->len = 4;
+		cmd++;
+	}
+
 	/* restore saved ecc config */
 	cmd->cmd = CMD_OCU | CMD_LC;
 	cmd->src = paddr(&data->ecc_cfg_save);
 	cmd->dst = NAND_EBI2_ECC_BUF_CFG;
 	cmd->len = 4;
+	cmd++;
 
-	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
-
-	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
-
-#if VERBOSE
-	dprintf(INFO, "write page %d: status: %x %x %x %x\n",
-		page, data[5], data[6], data[7], data[8]);
-#endif
+	ASSERT(cmd - t->cmdlist <= PAGE_TMPL_CMDS);
+}
 
-	/* if any of the writes failed (0x10), or there was a
-	 ** protection violation (0x100), or the program success
-	 ** bit (0x80) is unset, we lose
-	 */
+static int
+_flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist, unsigned page,
+		       const void *_addr, const void *_spareaddr,
+		       unsigned raw_mode, int cache)
+{
+	unsigned *ptr = ptrlist;
+	struct page_tmpl *t;
+	struct data_flash_io *data;
+	unsigned addr = (unsigned)_addr;
+	unsigned spareaddr = (unsigned)_spareaddr;
+	unsigned n;
+	unsigned cwperpage;
+	cwperpage = (flash_pagesize >> 9);
+	unsigned modem_partition = 0;
+	if (CFG0 == CFG0_M) {
+		modem_partition = 1;
+	}
+
+	if (raw_mode)
+		t = &page_tmpl[PAGE_TMPL_WRITE_RAW];
+	else if (modem_partition)
+		t = &page_tmpl[PAGE_TMPL_WRITE_MODEM];
+	else
+		t = &page_tmpl[PAGE_TMPL_WRITE];
+	data = t->data;
+
+	data->addr0 = page << 16;
+	data->addr1 = (page >> 16) & 0xff;
+
+	if (!raw_mode) {
+		data->cfg0 = CFG0;
+		data->cfg1 = CFG1;
+	} else {
+		data->cfg0 =
+		    (NAND_CFG0_RAW & ~(7 << 6)) | ((cwperpage - 1) << 6);
+		data->cfg1 = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);
+	}
+
+	data->dev_cmd0 = flash_dev_cmd0;
+	if (cache && t->cache)
+		data->dev_cmd0 =
+		    (flash_dev_cmd0 & ~NAND_DEV_CMD0_WRITE_START(0xFF))
+		    | NAND_DEV_CMD0_WRITE_START(NAND_DEVCMD_PROGRAM_CACHE);
+	data->dev_cmd0_restore = flash_dev_cmd0;
+
+	for (n = 0; n < cwperpage; n++) {
+		if (raw_mode)
+			t->buf[n]->src = addr;
+		else if (modem_partition)
+			t->buf[n]->src = addr + n * 512;
+		else
+			t->buf[n]->src = addr + n * 516;
+	}
+	if (t->spare)
+		t->spare->src = spareaddr;
+
+	ptr[0] = (paddr(t->cmdlist) >> 3) | CMD_PTR_LP;
+
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+#if VERBOSE
+	dprintf(INFO, "write page %d: status: %x %x %x %x\n",
+		page, data[5], data[6], data[7], data[8]);
+#endif
+
+	/* if any of the writes failed (0x10), or there was a
+	 ** protection violation (0x100), or the program success
+	 ** bit (0x80) is unset, we lose
+	 */
 	for (n = 0; n < cwperpage; n++) {
 		if (data->result[n].flash_status & 0x110)
 			return -1;
@@ -1714,7 +2077,8 @@ flash_nand_mark_badblock(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	/* Going to first page of the block */
 	if (page & 63)
 		page = page - (page & 63);
-	return _flash_nand_write_page(cmdlist, ptrlist, page, empty_buf, 0, 1);
+	return _flash_nand_write_page(cmdlist, ptrlist, page, empty_buf, 0, 1,
+				      0);
 }
 
 unsigned nand_cfg0;
@@ -1722,17 +2086,23 @@ unsigned nand_cfg1;
 
 static int flash_nand_read_config(dmov_s * cmdlist, unsigned *ptrlist)
 {
-	static unsigned CFG0_TMP, CFG1_TMP;
+	static unsigned CFG0_TMP, CFG1_TMP, DEV_CMD_TMP[4];
 	cmdlist[0].cmd = CMD_OCB;
 	cmdlist[0].src = NAND_DEV0_CFG0;
 	cmdlist[0].dst = paddr(&CFG0_TMP);
 	cmdlist[0].len = 4;
 
-	cmdlist[1].cmd = CMD_OCU | CMD_LC;
+	cmdlist[1].cmd = 0;
 	cmdlist[1].src = NAND_DEV0_CFG1;
 	cmdlist[1].dst = paddr(&CFG1_TMP);
 	cmdlist[1].len = 4;
 
+	/* DEV_CMD0-2 and DEV_CMD_VLD, the base of the cache opcodes */
+	cmdlist[2].cmd = CMD_OCU | CMD_LC;
+	cmdlist[2].src = NAND_DEV_CMD0;
+	cmdlist[2].dst = paddr(&DEV_CMD_TMP[0]);
+	cmdlist[2].len = 16;
+
 	*ptrlist = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
 
 	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptrlist);
@@ -1787,6 +2157,16 @@ static int flash_nand_read_config(dmov_s * cmdlist, unsigned *ptrlist)
 	    |(2 << 17)		/* 6 cycle tWB/tRB */
 	    |(nand_cfg1 & CFG1_WIDE_FLASH);	/* preserve wide flash flag */
 	dprintf(INFO, "nandcfg(Modem): %x %x (used)\n", CFG0_M, CFG1_M);
+
+	flash_dev_cmd0 = DEV_CMD_TMP[0];
+	flash_dev_cmd1 = DEV_CMD_TMP[1];
+	flash_dev_cmd_vld = DEV_CMD_TMP[3];
+	if (!NAND_CACHE_OPS)
+		flash_cache = 0;
+	if (flash_cache)
+		dprintf(INFO, "nand: cache%s%s\n",
+			(flash_cache & FLASH_CACHE_READ) ? " read" : "",
+			(flash_cache & FLASH_CACHE_PROGRAM) ? " program" : "");
 	return 0;
 }
 
@@ -1873,6 +2253,8 @@ static void flash_onenand_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 	flash_info.id = data[7];
 	flash_info.vendor = data[7] & CLEAN_DATA_16;
 	flash_info.device = (data[7] >> 16) & CLEAN_DATA_16;
+	onenand_dataram_size = (data[8] >> 16) & CLEAN_DATA_16;
+	onenand_datarams = (data[9] >> 24) & 0xFF;
 	return;
 }
 
@@ -1925,33 +2307,20 @@ flash_onenand_block_isbad(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	return 0;
 }
 
-static int
-flash_onenand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
+/* Append the commands issuing one OneNAND block command ('command' is
+ * ONENAND_CMDERAS, ONENAND_CMDMULTIERAS or ONENAND_CMDERASVERIFY) for the
+ * block at 'page', without the OCB/OCU and LC flags.  Returns the next
+ * free command.
+ */
+static dmov_s *flash_onenand_build_erase(dmov_s * cmd,
+					 struct data_onenand_erase *data,
+					 unsigned page, unsigned command)
 {
-	dmov_s *cmd = cmdlist;
-	unsigned *ptr = ptrlist;
-	struct data_onenand_erase *data = (void *)ptrlist + 4;
-	int isbad = 0;
 	unsigned erasesize = (flash_pagesize << 6);
-	unsigned onenand_startaddr1 =
-	    DEVICE_FLASHCORE_0 | (page * flash_pagesize) / erasesize;
-	unsigned onenand_startaddr8 = 0x0000;
-	unsigned onenand_startaddr2 = DEVICE_BUFFERRAM_0 << 15;
-	unsigned onenand_startbuffer = DATARAM0_0 << 8;
-
-	unsigned controller_status;
-	unsigned interrupt_status;
-	unsigned ecc_status;
-
-	if ((page * flash_pagesize) & (erasesize - 1))
-		return -1;
-
-	/* Check for bad block and erase only if block is not marked bad */
-	isbad = flash_onenand_block_isbad(cmdlist, ptrlist, page);
-	if (isbad) {
-		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
-		return -1;
-	}
+	unsigned onenand_startaddr1;
+	unsigned onenand_startaddr8;
+	unsigned onenand_startaddr2;
+	unsigned onenand_startbuffer;
 
 	/*Erase block */
 	onenand_startaddr1 = DEVICE_FLASHCORE_0 |
@@ -1993,7 +2362,7 @@ flash_onenand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	data->data0 = (ONENAND_CLRINTR << 16) | (ONENAND_SYSCFG1_ECCENA);
 	data->data1 = (onenand_startaddr8 << 16) | (onenand_startaddr1);
 	data->data2 = (onenand_startbuffer << 16) | (onenand_startaddr2);
-	data->data3 = (CLEAN_DATA_16 << 16) | (ONENAND_CMDERAS);
+	data->data3 = (CLEAN_DATA_16 << 16) | (command);
 	data->data4 = (CLEAN_DATA_16 << 16) | (CLEAN_DATA_16);
 	data->data5 = (ONENAND_CLRINTR << 16) | (ONENAND_SYSCFG1_ECCENA);
 	data->data6 = (ONENAND_STARTADDR3_RES << 16) | (ONENAND_STARTADDR1_RES);
@@ -2003,7 +2372,7 @@ flash_onenand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	/***************************************************************/
 
 	/* Enable and configure the SFlash controller */
-	cmd->cmd = 0 | CMD_OCB;
+	cmd->cmd = 0;
 	cmd->src = paddr(&data->sfbcfg);
 	cmd->dst = NAND_SFLASHC_BURST_CFG;
 	cmd->len = 4;
@@ -2148,15 +2517,20 @@ flash_onenand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	cmd++;
 
 	/* Block on data ready, and read the status register */
-	cmd->cmd = SRC_CRCI_NAND_DATA | CMD_OCU | CMD_LC;
+	cmd->cmd = SRC_CRCI_NAND_DATA;
 	cmd->src = NAND_SFLASHC_STATUS;
 	cmd->dst = paddr(&data->sfstat[3]);
 	cmd->len = 4;
 	cmd++;
 
-	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+	return cmd;
+}
 
-	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+static int flash_onenand_erase_failed(struct data_onenand_erase *data)
+{
+	unsigned controller_status;
+	unsigned interrupt_status;
+	unsigned ecc_status;
 
 	ecc_status = (data->data3 >> 16) & 0x0000FFFF;
 	interrupt_status = (data->data4 >> 0) & 0x0000FFFF;
@@ -2179,12 +2553,41 @@ flash_onenand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 	    || (data->sfstat[1] & 0x110)
 	    || (data->sfstat[2] & 0x110) || (data->sfstat[3] & 0x110)) {
 		dprintf(CRITICAL, "%s: ECC/MPU/OP error\n", __func__);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+flash_onenand_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned *ptr = ptrlist;
+	struct data_onenand_erase *data = (void *)ptrlist + 4;
+	dmov_s *end;
+	int isbad = 0;
+
+	if (page & 63)
+		return -1;
+
+	/* Check for bad block and erase only if block is not marked bad */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+	if (isbad) {
+		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
 		return -1;
 	}
 
-#if VERBOSE
-	dprintf(INFO, "status: %x\n", data[5]);
-#endif
+	end = flash_onenand_build_erase(cmd, data, page, ONENAND_CMDERAS);
+	cmd->cmd |= CMD_OCB;
+	end[-1].cmd |= CMD_OCU | CMD_LC;
+
+	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+	if (flash_onenand_erase_failed(data))
+		return -1;
 
 	return 0;
 }
@@ -2234,16 +2637,19 @@ _flash_onenand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	unsigned onenand_startbuffer = DATARAM0_0 << 8;
 	unsigned onenand_sysconfig1 = (raw_mode == 1) ? ONENAND_SYSCFG1_ECCDIS :
 	    ONENAND_SYSCFG1_ECCENA;
+	unsigned mode = onenand_burst ? NAND_SFCMD_BURST : NAND_SFCMD_ASYNC;
 
 	unsigned controller_status;
 	unsigned interrupt_status;
 	unsigned ecc_status;
 	if (raw_mode != 1) {
 		int isbad = 0;
-		isbad = flash_onenand_block_isbad(cmdlist, ptrlist, page);
+		isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
 		if (isbad)
 			return -2;
 	}
+	if (onenand_burst)
+		onenand_sysconfig1 |= ONENAND_SYSCFG1_SYNC_READ;
 	//static int oobfree_offset[8] = {2, 14, 18, 30, 34, 46, 50, 62};
 	//static int oobfree_length[8] = {3, 2, 3, 2, 3, 2, 3, 2};
 
@@ -2256,22 +2662,22 @@ _flash_onenand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 					NAND_SFCMD_ASYNC, NAND_SFCMD_INTHI);
 	data->sfcmd[2] = SFLASH_PREPCMD(3, 7, 0,
 					NAND_SFCMD_DATXS,
-					NAND_SFCMD_ASYNC, NAND_SFCMD_REGRD);
+					mode, NAND_SFCMD_REGRD);
 	data->sfcmd[3] = SFLASH_PREPCMD(256, 0, 0,
 					NAND_SFCMD_DATXS,
-					NAND_SFCMD_ASYNC, NAND_SFCMD_DATRD);
+					mode, NAND_SFCMD_DATRD);
 	data->sfcmd[4] = SFLASH_PREPCMD(256, 0, 0,
 					NAND_SFCMD_DATXS,
-					NAND_SFCMD_ASYNC, NAND_SFCMD_DATRD);
+					mode, NAND_SFCMD_DATRD);
 	data->sfcmd[5] = SFLASH_PREPCMD(256, 0, 0,
 					NAND_SFCMD_DATXS,
-					NAND_SFCMD_ASYNC, NAND_SFCMD_DATRD);
+					mode, NAND_SFCMD_DATRD);
 	data->sfcmd[6] = SFLASH_PREPCMD(256, 0, 0,
 					NAND_SFCMD_DATXS,
-					NAND_SFCMD_ASYNC, NAND_SFCMD_DATRD);
+					mode, NAND_SFCMD_DATRD);
 	data->sfcmd[7] = SFLASH_PREPCMD(32, 0, 0,
 					NAND_SFCMD_DATXS,
-					NAND_SFCMD_ASYNC, NAND_SFCMD_DATRD);
+					mode, NAND_SFCMD_DATRD);
 	data->sfcmd[8] = SFLASH_PREPCMD(4, 10, 0,
 					NAND_SFCMD_CMDXS,
 					NAND_SFCMD_ASYNC, NAND_SFCMD_REGWR);
@@ -2606,6 +3012,330 @@ _flash_onenand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
+/* Chained OneNAND reads.  A chain loads the pages of one block into the
+ * DataRAM and moves them out one after the other behind a single command
+ * list.  On parts with two DataRAMs large enough for a page the buffers
+ * are used ping-pong: the load of page n + 1 into one DataRAM is started
+ * before page n is read out of the other, so the array read overlaps the
+ * transfer.  The register image is written once per chain; each further
+ * load only rewrites the GENP registers.  The command lists reuse the
+ * read chain buffers of the slot.
+ */
+#define ONENAND_CHAIN_PAGES	16
+#define ONENAND_CHAIN_SECTORS	8	/* 512 byte sectors, 4k pages */
+
+#define ONENAND_CHAIN_LOAD	0
+#define ONENAND_CHAIN_INTHI	1
+#define ONENAND_CHAIN_STATUS	2
+#define ONENAND_CHAIN_DATRD	3
+#define ONENAND_CHAIN_RESTORE	4
+
+struct onenand_chain_page {
+	unsigned genp[4];	/* SYSCFG1, START_ADDR1/8, START_BUFFER, CMD */
+	unsigned result[2];	/* GENP3, DEV_CMD4: ECC, INT, CTRL status */
+	unsigned sfstat[3 + ONENAND_CHAIN_SECTORS];
+};
+
+struct onenand_chain {
+	unsigned sfbcfg;
+	unsigned sfcmd[5];
+	unsigned sfexec;
+	unsigned sfstat;	/* restore */
+	unsigned addr[7];
+	unsigned dev_cmd[3];
+	unsigned macro[2 * ONENAND_CHAIN_SECTORS];
+	struct onenand_chain_page page[ONENAND_CHAIN_PAGES];
+};
+
+static int onenand_pingpong;
+
+static unsigned flash_onenand_chain_sectors(void)
+{
+	return flash_pagesize >> 9;
+}
+
+/* Write the SFLASHC command, kick it and wait for its status */
+static dmov_s *flash_onenand_chain_op(dmov_s * cmd, struct onenand_chain *oc,
+				      unsigned op, unsigned *sfstat)
+{
+	cmd->cmd = DST_CRCI_NAND_CMD;
+	cmd->src = paddr(&oc->sfcmd[op]);
+	cmd->dst = NAND_SFLASHC_CMD;
+	cmd->len = 4;
+	cmd++;
+
+	cmd->cmd = 0;
+	cmd->src = paddr(&oc->sfexec);
+	cmd->dst = NAND_SFLASHC_EXEC_CMD;
+	cmd->len = 4;
+	cmd++;
+
+	cmd->cmd = SRC_CRCI_NAND_DATA;
+	cmd->src = NAND_SFLASHC_STATUS;
+	cmd->dst = paddr(sfstat);
+	cmd->len = 4;
+	cmd++;
+
+	return cmd;
+}
+
+/* Start loading a page into the DataRAM; the first load of a chain also
+ * writes the register addresses and the restore values.
+ */
+static dmov_s *flash_onenand_chain_load(dmov_s * cmd, struct onenand_chain *oc,
+					struct onenand_chain_page *io,
+					int first)
+{
+	cmd->cmd = DST_CRCI_NAND_CMD;
+	cmd->src = paddr(&oc->sfcmd[ONENAND_CHAIN_LOAD]);
+	cmd->dst = NAND_SFLASHC_CMD;
+	cmd->len = 4;
+	cmd++;
+
+	if (first) {
+		cmd->cmd = 0;
+		cmd->src = paddr(&oc->addr[0]);
+		cmd->dst = NAND_ADDR0;
+		cmd->len = 8;
+		cmd++;
+
+		cmd->cmd = 0;
+		cmd->src = paddr(&oc->addr[2]);
+		cmd->dst = NAND_ADDR2;
+		cmd->len = 16;
+		cmd++;
+
+		cmd->cmd = 0;
+		cmd->src = paddr(&oc->addr[6]);
+		cmd->dst = NAND_ADDR6;
+		cmd->len = 4;
+		cmd++;
+
+		cmd->cmd = 0;
+		cmd->src = paddr(&oc->dev_cmd[0]);
+		cmd->dst = NAND_DEV_CMD4;
+		cmd->len = 12;
+		cmd++;
+	}
+
+	cmd->cmd = 0;
+	cmd->src = paddr(&io->genp[0]);
+	cmd->dst = NAND_GENP_REG0;
+	cmd->len = 16;
+	cmd++;
+
+	cmd->cmd = 0;
+	cmd->src = paddr(&oc->sfexec);
+	cmd->dst = NAND_SFLASHC_EXEC_CMD;
+	cmd->len = 4;
+	cmd++;
+
+	cmd->cmd = SRC_CRCI_NAND_DATA;
+	cmd->src = NAND_SFLASHC_STATUS;
+	cmd->dst = paddr(&io->sfstat[0]);
+	cmd->len = 4;
+	cmd++;
+
+	return cmd;
+}
+
+static unsigned *
+flash_onenand_chain_prepare(unsigned slot, unsigned page, unsigned count,
+			    unsigned char *data, unsigned stride)
+{
+	struct onenand_chain *oc = (void *)chain_data[slot];
+	struct onenand_chain_page *io, *next;
+	dmov_s *cmd = chain_cmdlist[slot];
+	unsigned sectors = flash_onenand_chain_sectors();
+	unsigned erasesize = flash_pagesize << 6;
+	unsigned mode = onenand_burst ? NAND_SFCMD_BURST : NAND_SFCMD_ASYNC;
+	unsigned sysconfig1 = ONENAND_SYSCFG1_ECCENA;
+	unsigned startaddr1, startaddr8, startbuffer;
+	unsigned addr, ram, n, i;
+
+	ASSERT(count > 0 && count <= ONENAND_CHAIN_PAGES);
+	ASSERT((page & 63) + count <= 64);
+
+	if (onenand_burst)
+		sysconfig1 = ONENAND_SYSCFG1_BURST;
+
+	oc->sfbcfg = SFLASH_BCFG;
+	oc->sfcmd[ONENAND_CHAIN_LOAD] = SFLASH_PREPCMD(7, 0, 0,
+						       NAND_SFCMD_CMDXS,
+						       NAND_SFCMD_ASYNC,
+						       NAND_SFCMD_REGWR);
+	oc->sfcmd[ONENAND_CHAIN_INTHI] = SFLASH_PREPCMD(0, 0, 32,
+							NAND_SFCMD_CMDXS,
+							NAND_SFCMD_ASYNC,
+							NAND_SFCMD_INTHI);
+	oc->sfcmd[ONENAND_CHAIN_STATUS] = SFLASH_PREPCMD(3, 7, 0,
+							 NAND_SFCMD_DATXS,
+							 mode,
+							 NAND_SFCMD_REGRD);
+	oc->sfcmd[ONENAND_CHAIN_DATRD] = SFLASH_PREPCMD(256, 0, 0,
+							NAND_SFCMD_DATXS,
+							mode,
+							NAND_SFCMD_DATRD);
+	oc->sfcmd[ONENAND_CHAIN_RESTORE] = SFLASH_PREPCMD(4, 10, 0,
+							  NAND_SFCMD_CMDXS,
+							  NAND_SFCMD_ASYNC,
+							  NAND_SFCMD_REGWR);
+	oc->sfexec = 1;
+	oc->sfstat = CLEAN_DATA_32;
+
+	oc->addr[0] = (ONENAND_INTERRUPT_STATUS << 16) |
+	    (ONENAND_SYSTEM_CONFIG_1);
+	oc->addr[1] = (ONENAND_START_ADDRESS_8 << 16) |
+	    (ONENAND_START_ADDRESS_1);
+	oc->addr[2] = (ONENAND_START_BUFFER << 16) | (ONENAND_START_ADDRESS_2);
+	oc->addr[3] = (ONENAND_ECC_STATUS << 16) | (ONENAND_COMMAND);
+	oc->addr[4] = (ONENAND_CONTROLLER_STATUS << 16) |
+	    (ONENAND_INTERRUPT_STATUS);
+	oc->addr[5] = (ONENAND_INTERRUPT_STATUS << 16) |
+	    (ONENAND_SYSTEM_CONFIG_1);
+	oc->addr[6] = (ONENAND_START_ADDRESS_3 << 16) |
+	    (ONENAND_START_ADDRESS_1);
+	oc->dev_cmd[0] = (CLEAN_DATA_16 << 16) | (CLEAN_DATA_16);
+	oc->dev_cmd[1] = (ONENAND_CLRINTR << 16) | (ONENAND_SYSCFG1_ECCENA);
+	oc->dev_cmd[2] = (ONENAND_STARTADDR3_RES << 16) |
+	    (ONENAND_STARTADDR1_RES);
+	for (i = 0; i < 2 * sectors; i++)
+		oc->macro[i] = ONENAND_MACRO_DATARAM + i * ONENAND_MACRO_SECTOR;
+
+	for (n = 0; n < count; n++) {
+		io = &oc->page[n];
+		ram = onenand_pingpong ? (n & 1) : 0;
+		addr = (page + n) * flash_pagesize;
+		startaddr1 = DEVICE_FLASHCORE_0 | (addr / erasesize);
+		startaddr8 = ((addr & (erasesize - 1)) / flash_pagesize) << 2;
+		startbuffer = (DATARAM0_0 + ram * sectors) << 8;
+		io->genp[0] = (ONENAND_CLRINTR << 16) | sysconfig1;
+		io->genp[1] = (startaddr8 << 16) | startaddr1;
+		io->genp[2] = (startbuffer << 16) | (DEVICE_BUFFERRAM_0 << 15);
+		io->genp[3] = (CLEAN_DATA_16 << 16) | (ONENAND_CMDLOAD);
+		io->result[0] = CLEAN_DATA_32;
+		io->result[1] = CLEAN_DATA_32;
+		for (i = 0; i < 3 + sectors; i++)
+			io->sfstat[i] = CLEAN_DATA_32;
+	}
+
+	/* Enable and configure the SFlash controller */
+	cmd->cmd = 0 | CMD_OCB;
+	cmd->src = paddr(&oc->sfbcfg);
+	cmd->dst = NAND_SFLASHC_BURST_CFG;
+	cmd->len = 4;
+	cmd++;
+
+	cmd = flash_onenand_chain_load(cmd, oc, &oc->page[0], 1);
+	cmd = flash_onenand_chain_op(cmd, oc, ONENAND_CHAIN_INTHI,
+				     &oc->page[0].sfstat[1]);
+
+	for (n = 0; n < count; n++) {
+		io = &oc->page[n];
+		next = (n + 1 < count) ? &oc->page[n + 1] : NULL;
+		ram = onenand_pingpong ? (n & 1) : 0;
+
+		/* Read the ECC, interrupt and controller status */
+		cmd = flash_onenand_chain_op(cmd, oc, ONENAND_CHAIN_STATUS,
+					     &io->sfstat[2]);
+
+		cmd->cmd = 0;
+		cmd->src = NAND_GENP_REG3;
+		cmd->dst = paddr(&io->result[0]);
+		cmd->len = 4;
+		cmd++;
+
+		cmd->cmd = 0;
+		cmd->src = NAND_DEV_CMD4;
+		cmd->dst = paddr(&io->result[1]);
+		cmd->len = 4;
+		cmd++;
+
+		/* Load the next page into the other DataRAM meanwhile */
+		if (next && onenand_pingpong)
+			cmd = flash_onenand_chain_load(cmd, oc, next, 0);
+
+		addr = paddr(data + n * stride);
+		for (i = 0; i < sectors; i++) {
+			cmd->cmd = DST_CRCI_NAND_CMD;
+			cmd->src = paddr(&oc->sfcmd[ONENAND_CHAIN_DATRD]);
+			cmd->dst = NAND_SFLASHC_CMD;
+			cmd->len = 4;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = paddr(&oc->macro[ram * sectors + i]);
+			cmd->dst = NAND_MACRO1_REG;
+			cmd->len = 4;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = paddr(&oc->sfexec);
+			cmd->dst = NAND_SFLASHC_EXEC_CMD;
+			cmd->len = 4;
+			cmd++;
+
+			cmd->cmd = SRC_CRCI_NAND_DATA;
+			cmd->src = NAND_SFLASHC_STATUS;
+			cmd->dst = paddr(&io->sfstat[3 + i]);
+			cmd->len = 4;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = NAND_FLASH_BUFFER;
+			cmd->dst = addr;
+			cmd->len = 512;
+			addr += 512;
+			cmd++;
+		}
+
+		if (next) {
+			if (!onenand_pingpong)
+				cmd = flash_onenand_chain_load(cmd, oc, next,
+							       0);
+			cmd = flash_onenand_chain_op(cmd, oc,
+						     ONENAND_CHAIN_INTHI,
+						     &next->sfstat[1]);
+		}
+	}
+
+	/* Back to asynchronous reads with ECC on */
+	cmd = flash_onenand_chain_op(cmd, oc, ONENAND_CHAIN_RESTORE,
+				     &oc->sfstat);
+	cmd[-1].cmd |= CMD_OCU | CMD_LC;
+	ASSERT(cmd - chain_cmdlist[slot] <= READ_CHAIN_PAGES * READ_CHAIN_CMDS);
+
+	chain_ptrlist[slot][0] = (paddr(chain_cmdlist[slot]) >> 3) | CMD_PTR_LP;
+	return chain_ptrlist[slot];
+}
+
+static int flash_onenand_chain_check(unsigned slot, unsigned count)
+{
+	struct onenand_chain *oc = (void *)chain_data[slot];
+	struct onenand_chain_page *io;
+	unsigned sectors = flash_onenand_chain_sectors();
+	unsigned n, i;
+
+	for (n = 0; n < count; n++) {
+		io = &oc->page[n];
+		/* controller status: errors, protection violations etc */
+		if ((io->result[1] >> 16) & CLEAN_DATA_16)
+			return n;
+		for (i = 0; i < 3 + sectors; i++) {
+			if (io->sfstat[i] & 0x110)
+				return n;
+		}
+	}
+
+	return count;
+}
+
+/* Chained reads leave the spare area alone, as single page reads do */
+static void *flash_onenand_chain_spare(unsigned slot, unsigned n)
+{
+	return chain_spare[slot];
+}
+
 struct data_onenand_write {
 	unsigned sfbcfg;
 	unsigned sfcmd[9];
@@ -3037,6 +3767,9 @@ flash_onenand_mark_badblock(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 static int
 flash_mark_badblock(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 {
+	flash_bbt_mark_bad(cmdlist, ptrlist, page);
+	flash_erased_set(page, 0);
+
 	switch (flash_info.type) {
 	case FLASH_8BIT_NAND_DEVICE:
 	case FLASH_16BIT_NAND_DEVICE:
@@ -3095,6 +3828,7 @@ static void flash_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 		flash_pagesize = flash_info.page_size;
 		flash_info.block_size = supported_flash[index].blksize;
 		flash_info.spare_size = supported_flash[index].oobsize;
+		flash_cache = supported_flash[index].cache;
 		if (flash_info.block_size && flash_info.page_size) {
 			flash_info.num_blocks = supported_flash[index].density;
 			flash_info.num_blocks /= (flash_info.block_size);
@@ -3120,15 +3854,26 @@ static void flash_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 
 static int flash_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 {
+	int r;
+
 	switch (flash_info.type) {
 	case FLASH_8BIT_NAND_DEVICE:
 	case FLASH_16BIT_NAND_DEVICE:
-		return flash_nand_erase_block(cmdlist, ptrlist, page);
+		r = flash_nand_erase_block(cmdlist, ptrlist, page);
+		break;
 	case FLASH_ONENAND_DEVICE:
-		return flash_onenand_erase_block(cmdlist, ptrlist, page);
+		r = flash_onenand_erase_block(cmdlist, ptrlist, page);
+		break;
 	default:
 		return -1;
 	}
+
+	/* a block that fails to erase is not used again */
+	if (r)
+		flash_bbt_mark_bad(cmdlist, ptrlist, page);
+	else
+		flash_erased_set(page, 1);
+	return r;
 }
 
 static int
@@ -3169,8 +3914,13 @@ _flash_block_isbad(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 
 static int
 _flash_write_page(dmov_s * cmdlist, unsigned *ptrlist,
-		  unsigned page, const void *_addr, const void *_spareaddr)
+		  unsigned page, const void *_addr, const void *_spareaddr,
+		  int more)
 {
+	int cache = more && (flash_cache & FLASH_CACHE_PROGRAM);
+
+	flash_erased_set(page, 0);
+
 	switch (flash_info.type) {
 	case FLASH_8BIT_NAND_DEVICE:
 	case FLASH_16BIT_NAND_DEVICE:
@@ -3181,7 +3931,8 @@ _flash_write_page(dmov_s * cmdlist, unsigned *ptrlist,
 								_spareaddr, 0);
 		else
 			return _flash_nand_write_page(cmdlist, ptrlist, page,
-						      _addr, _spareaddr, 0);
+						      _addr, _spareaddr, 0,
+						      cache);
 	case FLASH_ONENAND_DEVICE:
 		return _flash_onenand_write_page(cmdlist, ptrlist, page, _addr,
 						 _spareaddr, 0);
@@ -3190,13 +3941,223 @@ _flash_write_page(dmov_s * cmdlist, unsigned *ptrlist,
 	}
 }
 
+/* The table can be cached in the second page of the last block of the
+ * device (the first page carries the bad block marker).  That block must
+ * not be part of any partition, so this is off unless the target asks
+ * for it.
+ */
+#ifndef FLASH_BBT_PERSIST
+#define FLASH_BBT_PERSIST 0
+#endif
+
+#define BBT_MAGIC	'BBT!'
+#define BBT_VERSION	1
+#define BBT_BLOCK	(flash_info.num_blocks - 1)
+#define BBT_PAGE	((BBT_BLOCK << 6) + 1)
+
+struct flash_bbt_header {
+	unsigned magic;
+	unsigned version;
+	unsigned num_blocks;
+	unsigned checksum;
+};
+
+static unsigned flash_bbt_checksum(const unsigned *table)
+{
+	unsigned n;
+	unsigned sum = 0;
+
+	for (n = 0; n < flash_bbt_words; n++)
+		sum = (sum << 1 | sum >> 31) ^ table[n];
+	return sum;
+}
+
+static int flash_bbt_fits_page(void)
+{
+	return sizeof(struct flash_bbt_header) +
+	    flash_bbt_words * sizeof(unsigned) <= flash_pagesize;
+}
+
+static void flash_bbt_save(dmov_s * cmdlist, unsigned *ptrlist)
+{
+	struct flash_bbt_header *hdr = flash_data;
+	unsigned *spare = flash_spare;
+	unsigned n;
+
+	if (!FLASH_BBT_PERSIST || !flash_bbt || !flash_bbt_fits_page())
+		return;
+	if (flash_bbt_isbad(cmdlist, ptrlist, BBT_BLOCK << 6))
+		return;
+
+	memset(flash_data, 0xff, flash_pagesize);
+	hdr->magic = BBT_MAGIC;
+	hdr->version = BBT_VERSION;
+	hdr->num_blocks = flash_info.num_blocks;
+	hdr->checksum = flash_bbt_checksum(flash_bbt);
+	memcpy(hdr + 1, flash_bbt, flash_bbt_words * sizeof(unsigned));
+	for (n = 0; n < 16; n++)
+		spare[n] = 0xffffffff;
+
+	if (flash_erase_block(cmdlist, ptrlist, BBT_BLOCK << 6) ||
+	    _flash_write_page(cmdlist, ptrlist, BBT_PAGE, flash_data,
+			      flash_spare, 0)) {
+		dprintf(CRITICAL, "bbt: cannot save table @ %d\n", BBT_BLOCK);
+	}
+}
+
+static int
+flash_bbt_load(dmov_s * cmdlist, unsigned *ptrlist, unsigned *table)
+{
+	struct flash_bbt_header *hdr = flash_data;
+
+	if (!FLASH_BBT_PERSIST || !flash_bbt_fits_page())
+		return -1;
+	if (_flash_read_page(cmdlist, ptrlist, BBT_PAGE, flash_data,
+			     flash_spare))
+		return -1;
+	if (hdr->magic != BBT_MAGIC || hdr->version != BBT_VERSION ||
+	    hdr->num_blocks != flash_info.num_blocks)
+		return -1;
+
+	memcpy(table, hdr + 1, flash_bbt_words * sizeof(unsigned));
+	if (flash_bbt_checksum(table) != hdr->checksum)
+		return -1;
+	return 0;
+}
+
+static void flash_bbt_init(dmov_s * cmdlist, unsigned *ptrlist)
+{
+	unsigned *table;
+	unsigned block;
+	unsigned bad = 0;
+	int isbad;
+
+	if (!flash_info.num_blocks)
+		return;
+
+	flash_bbt_words = (flash_info.num_blocks + 31) >> 5;
+	flash_erased = calloc(flash_bbt_words, sizeof(unsigned));
+	table = calloc(flash_bbt_words, sizeof(unsigned));
+	if (!table)
+		return;
+
+	if (!flash_bbt_load(cmdlist, ptrlist, table)) {
+		flash_bbt = table;
+		dprintf(INFO, "bbt: loaded from block %d\n", BBT_BLOCK);
+		return;
+	}
+
+	for (block = 0; block < flash_info.num_blocks; block++) {
+		isbad = _flash_block_isbad(cmdlist, ptrlist, block << 6);
+		/* retry once on a controller error before giving up */
+		if (isbad < 0)
+			isbad = _flash_block_isbad(cmdlist, ptrlist,
+						   block << 6);
+		if (isbad) {
+			table[block >> 5] |= 1U << (block & 31);
+			bad++;
+		}
+	}
+	flash_bbt = table;
+	dprintf(INFO, "bbt: %d bad blocks of %d\n", bad,
+		flash_info.num_blocks);
+
+	flash_bbt_save(cmdlist, ptrlist);
+}
+
+static void
+flash_bbt_mark_bad(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_bbt || block >= flash_info.num_blocks)
+		return;
+	if (flash_bbt[block >> 5] & (1U << (block & 31)))
+		return;
+
+	flash_bbt[block >> 5] |= 1U << (block & 31);
+	dprintf(INFO, "bbt: block %d is now bad\n", block);
+	flash_bbt_save(cmdlist, ptrlist);
+}
+
 static unsigned *flash_ptrlist;
 static dmov_s *flash_cmdlist;
 
 static struct ptable *flash_ptable = NULL;
 
+static void flash_nand_page_tmpl_init(void)
+{
+	struct page_tmpl *t;
+	unsigned n;
+
+	for (n = 0; n < PAGE_TMPL_COUNT; n++) {
+		t = &page_tmpl[n];
+		t->cmdlist = memalign(32, PAGE_TMPL_CMDS * sizeof(dmov_s));
+		t->data = memalign(32, sizeof(struct data_flash_io));
+		ASSERT(t->cmdlist && t->data);
+		if (n == PAGE_TMPL_READ)
+			flash_nand_build_read_page(t->cmdlist, t->data, 0, 0,
+						   0, t);
+		else
+			flash_nand_build_write_page(t, n);
+	}
+}
+
+/* Pick the OneNAND read mode.  DataRAM ping-pong needs two DataRAMs that
+ * each hold a page, inside the eight sectors START_BUFFER can address.
+ * Synchronous burst reads are only kept if a page read in burst mode
+ * matches the same page read asynchronously.
+ */
+static void flash_onenand_chain_init(void)
+{
+	unsigned sectors = flash_onenand_chain_sectors();
+	unsigned char *buf;
+	unsigned *ptr;
+	unsigned page;
+	unsigned n;
+
+	ASSERT(sectors <= ONENAND_CHAIN_SECTORS);
+	ASSERT(sizeof(struct onenand_chain) <=
+	       READ_CHAIN_PAGES * sizeof(struct data_flash_io));
+
+	for (n = 0; n < NAND_PIPE_DEPTH; n++)
+		memset(chain_spare[n], 0xff, READ_CHAIN_SPARE);
+
+	onenand_pingpong = (onenand_datarams >= 2)
+	    && (onenand_dataram_size >= flash_pagesize)
+	    && (2 * sectors <= 8);
+
+	onenand_burst = 0;
+	buf = memalign(32, flash_pagesize);
+	if (buf) {
+		for (page = 0; page < 8 * 64; page += 64) {
+			if (!_flash_onenand_read_page(flash_cmdlist,
+						      flash_ptrlist, page,
+						      flash_data, flash_spare,
+						      0))
+				break;
+		}
+		if (page < 8 * 64) {
+			onenand_burst = 1;
+			ptr = flash_onenand_chain_prepare(0, page, 1, buf,
+							  flash_pagesize);
+			dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+			if (flash_onenand_chain_check(0, 1) != 1 ||
+			    memcmp(buf, flash_data, flash_pagesize))
+				onenand_burst = 0;
+		}
+		free(buf);
+	}
+
+	dprintf(INFO, "onenand: %s reads, %u x %u byte DataRAM%s\n",
+		onenand_burst ? "burst" : "async", onenand_datarams,
+		onenand_dataram_size, onenand_pingpong ? ", ping-pong" : "");
+}
+
 void flash_init(void)
 {
+	unsigned n;
+
 	ASSERT(flash_ptable == NULL);
 
 	flash_ptrlist = memalign(32, 1024);
@@ -3204,15 +4165,37 @@ void flash_init(void)
 	flash_data = memalign(32, 4096 + 128);
 	flash_spare = memalign(32, 128);
 
+	for (n = 0; n < NAND_PIPE_DEPTH; n++) {
+		chain_ptrlist[n] = memalign(32, (READ_CHAIN_PAGES + 3) *
+					    sizeof(unsigned));
+		chain_cmdlist[n] = memalign(32, READ_CHAIN_PAGES *
+					    READ_CHAIN_CMDS * sizeof(dmov_s));
+		chain_data[n] = memalign(32, READ_CHAIN_PAGES *
+					 sizeof(struct data_flash_io));
+		chain_spare[n] = memalign(32, READ_CHAIN_PAGES *
+					  READ_CHAIN_SPARE);
+		chain_cache[n] = memalign(32, sizeof(struct chain_cache_io));
+	}
+
+	dmov_init();
+
 	flash_read_id(flash_cmdlist, flash_ptrlist);
-	if ((FLASH_8BIT_NAND_DEVICE == flash_info.type)
-	    || (FLASH_16BIT_NAND_DEVICE == flash_info.type)) {
+	/* an unknown part has no geometry to build command lists for */
+	if (((FLASH_8BIT_NAND_DEVICE == flash_info.type)
+	     || (FLASH_16BIT_NAND_DEVICE == flash_info.type))
+	    && flash_info.num_blocks) {
 		if (flash_nand_read_config(flash_cmdlist, flash_ptrlist)) {
 			dprintf(CRITICAL,
 				"ERROR: could not read CFG0/CFG1 state\n");
 			ASSERT(0);
 		}
+		flash_nand_page_tmpl_init();
+		/* the bad block scan needs the bus width from CFG1 */
+		set_nand_configuration(TYPE_APPS_PARTITION);
 	}
+	flash_bbt_init(flash_cmdlist, flash_ptrlist);
+	if (flash_info.type == FLASH_ONENAND_DEVICE)
+		flash_onenand_chain_init();
 }
 
 struct ptable *flash_get_ptable(void)
@@ -3231,22 +4214,164 @@ struct flash_info *flash_get_info(void)
 	return &flash_info;
 }
 
-int flash_erase(struct ptentry *ptn)
+static int flash_nand_chain_isbad(unsigned page)
 {
-	unsigned block = ptn->start;
-	unsigned count = ptn->length;
+	return flash_bbt_isbad(flash_cmdlist, flash_ptrlist, page);
+}
 
-	set_nand_configuration(ptn->type);
-	while (count-- > 0) {
-		if (flash_erase_block(flash_cmdlist, flash_ptrlist, block * 64)) {
-			dprintf(INFO, "cannot erase @ %d (bad block?)\n",
-				block);
+/* Pipelined erases reuse the read chain buffers, one command list and
+ * data slot per block.  OneNAND loads the blocks of a chain with
+ * multi-block erase commands, erases them all with the last one, then
+ * checks each with an erase verify read, so a chain of n blocks takes
+ * 2n command lists.
+ */
+static unsigned erase_chain_count[NAND_PIPE_DEPTH];
+
+static unsigned *flash_erase_prepare(unsigned slot, const unsigned *pages,
+				     unsigned count)
+{
+	struct data_onenand_erase *od;
+	dmov_s *cmd, *end;
+	unsigned lists = count;
+	unsigned n;
+
+	ASSERT(sizeof(struct data_onenand_erase) <=
+	       sizeof(struct data_flash_io));
+
+	if (flash_info.type != FLASH_ONENAND_DEVICE) {
+		ASSERT(count > 0 && count <= READ_CHAIN_PAGES);
+		for (n = 0; n < count; n++) {
+			cmd = chain_cmdlist[slot] + n * READ_CHAIN_CMDS;
+			flash_nand_build_erase(cmd,
+					       (unsigned *)&chain_data[slot][n],
+					       pages[n]);
+			chain_ptrlist[slot][n] = paddr(cmd) >> 3;
+		}
+	} else {
+		ASSERT(count > 0 && 2 * count <= READ_CHAIN_PAGES);
+		lists = 2 * count;
+		for (n = 0; n < lists; n++) {
+			cmd = chain_cmdlist[slot] + n * READ_CHAIN_CMDS;
+			od = (void *)&chain_data[slot][n];
+			if (n >= count)
+				end = flash_onenand_build_erase(cmd, od,
+						pages[n - count],
+						ONENAND_CMDERASVERIFY);
+			else if (n == count - 1)
+				end = flash_onenand_build_erase(cmd, od,
+						pages[n], ONENAND_CMDERAS);
+			else
+				end = flash_onenand_build_erase(cmd, od,
+						pages[n], ONENAND_CMDMULTIERAS);
+			ASSERT(end - cmd <= READ_CHAIN_CMDS);
+			cmd->cmd |= CMD_OCB;
+			end[-1].cmd |= CMD_OCU | CMD_LC;
+			chain_ptrlist[slot][n] = paddr(cmd) >> 3;
 		}
-		block++;
 	}
+	chain_ptrlist[slot][lists - 1] |= CMD_PTR_LP;
+	erase_chain_count[slot] = count;
+
+	return chain_ptrlist[slot];
+}
+
+static int flash_erase_check(unsigned slot, unsigned n)
+{
+	struct data_onenand_erase *load, *verify;
+	unsigned k;
+
+	if (flash_info.type != FLASH_ONENAND_DEVICE)
+		return flash_nand_erase_failed((unsigned *)
+					       &chain_data[slot][n]);
+
+	/* the verify lists follow the load lists */
+	load = (void *)&chain_data[slot][n];
+	verify = (void *)&chain_data[slot][erase_chain_count[slot] + n];
+	for (k = 0; k < 4; k++) {
+		if (load->sfstat[k] & 0x110)
+			return 1;
+	}
+	return flash_onenand_erase_failed(verify);
+}
+
+static void flash_erase_done(unsigned page, int failed)
+{
+	/* a block that fails to erase is not used again */
+	if (failed)
+		flash_bbt_mark_bad(flash_cmdlist, flash_ptrlist, page);
+	else
+		flash_erased_set(page, 1);
+}
+
+static const struct nand_erase_ops flash_erase_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.prepare = flash_erase_prepare,
+	.check = flash_erase_check,
+	.done = flash_erase_done,
+	.max_chain = READ_CHAIN_PAGES / 2,	/* OneNAND takes two lists each */
+};
+
+static void flash_erase_range(unsigned page, unsigned lastpage)
+{
+	unsigned failed;
+
+	if (interleaved_mode) {
+		for (; page < lastpage; page += 64) {
+			if (flash_erase_block(flash_cmdlist, flash_ptrlist,
+					      page)) {
+				dprintf(INFO, "cannot erase @ %d (bad block?)\n",
+					page >> 6);
+			}
+		}
+		return;
+	}
+
+	failed = nand_pipe_erase(&flash_erase_ops, page, lastpage);
+	if (failed)
+		dprintf(INFO, "flash_erase: %d blocks not erased\n", failed);
+}
+
+int flash_erase(struct ptentry *ptn)
+{
+	set_nand_configuration(ptn->type);
+	flash_erase_range(ptn->start * 64, (ptn->start + ptn->length) * 64);
 	return 0;
 }
 
+static const struct nand_pipe_ops flash_pipe_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.prepare = flash_nand_chain_prepare,
+	.check = flash_nand_chain_check,
+	.spare = flash_nand_chain_spare,
+	.max_chain = READ_CHAIN_PAGES,
+};
+
+/* Chained reads are only built for plain, non-interleaved NAND */
+static int flash_read_can_chain(void)
+{
+	if (interleaved_mode)
+		return 0;
+	return (flash_info.type == FLASH_8BIT_NAND_DEVICE)
+	    || (flash_info.type == FLASH_16BIT_NAND_DEVICE);
+}
+
+static const struct nand_pipe_ops flash_onenand_pipe_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.prepare = flash_onenand_chain_prepare,
+	.check = flash_onenand_chain_check,
+	.spare = flash_onenand_chain_spare,
+	.max_chain = ONENAND_CHAIN_PAGES,
+};
+
+static const struct nand_pipe_ops *flash_read_pipe_ops(void)
+{
+	if (flash_read_can_chain())
+		return &flash_pipe_ops;
+	if (flash_info.type == FLASH_ONENAND_DEVICE)
+		return &flash_onenand_pipe_ops;
+	return NULL;
+}
+
 int
 flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 	       unsigned offset, void *data, unsigned bytes)
@@ -3264,6 +4389,7 @@ flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 	int result = 0;
 	int isbad = 0;
 	int start_block_count = 0;
+	const struct nand_pipe_ops *pipe = flash_read_pipe_ops();
 
 	ASSERT(ptn->type == TYPE_APPS_PARTITION);
 	set_nand_configuration(TYPE_APPS_PARTITION);
@@ -3277,8 +4403,8 @@ flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 		while (start_block_count
 		       && (start_block < (ptn->start + ptn->length))) {
 			isbad =
-			    _flash_block_isbad(flash_cmdlist, flash_ptrlist,
-					       start_block * 64);
+			    flash_bbt_isbad(flash_cmdlist, flash_ptrlist,
+					    start_block * 64);
 			if (isbad)
 				page += 64;
 			else
@@ -3287,6 +4413,19 @@ flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 		}
 	}
 
+	if (!start_block_count && pipe) {
+		if (nand_pipe_read(pipe, page, lastpage, count,
+				   image, flash_pagesize, extra_per_page,
+				   &errors) == 0) {
+			dprintf(INFO, "flash_read_image: success (%d errors)\n",
+				errors);
+			return 0;
+		}
+		dprintf(INFO, "flash_read_image: failed (%d errors)\n",
+			errors);
+		return 0xffffffff;
+	}
+
 	while ((page < lastpage) && !start_block_count) {
 		if (count == 0) {
 			dprintf(INFO, "flash_read_image: success (%d errors)\n",
@@ -3322,98 +4461,112 @@ flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 	return 0xffffffff;
 }
 
-int
-flash_write(struct ptentry *ptn, unsigned extra_per_page, const void *data,
-	    unsigned bytes)
+/* Differential writes read a block back DIFF_CHUNK_PAGES pages at a
+ * time and compare it with the image.
+ */
+#define DIFF_CHUNK_PAGES	16
+#define DIFF_SPARE		16	/* spare bytes a chained read returns */
+
+static unsigned char *flash_diff_buf;
+
+/* Returns 0 if the block at 'page' already holds the 64 pages of 'image',
+ * spare bytes included, nonzero if it has to be rewritten.  Only plain
+ * NAND with 16 programmed spare bytes per page (2k pages) can be
+ * compared; anything else is always rewritten.
+ */
+static int
+flash_block_differs(unsigned page, const unsigned char *image,
+		    unsigned extra_per_page)
 {
-	unsigned page = ptn->start * 64;
-	unsigned lastpage = (ptn->start + ptn->length) * 64;
-	unsigned *spare = (unsigned *)flash_spare;
-	const unsigned char *image = data;
 	unsigned wsize = flash_pagesize + extra_per_page;
-	unsigned n;
-	int r;
+	unsigned stride = flash_pagesize + DIFF_SPARE;
+	unsigned char *buf;
+	unsigned errors;
+	unsigned n, i, k;
 
-	if ((flash_info.type == FLASH_ONENAND_DEVICE)
-	    && (ptn->type == TYPE_MODEM_PARTITION)) {
-		dprintf(CRITICAL, "flash_write_image: feature not supported\n");
-		return -1;
-	}
+	if (!flash_read_can_chain() ||
+	    ((flash_pagesize >> 9) << 2) != DIFF_SPARE)
+		return 1;
+	/* a short spare area is padded with whatever follows it */
+	if (extra_per_page && extra_per_page < DIFF_SPARE)
+		return 1;
 
-	set_nand_configuration(ptn->type);
-	for (n = 0; n < 16; n++)
-		spare[n] = 0xffffffff;
+	if (!flash_diff_buf)
+		flash_diff_buf = memalign(32, DIFF_CHUNK_PAGES * stride);
+	if (!flash_diff_buf)
+		return 1;
 
-	while (bytes > 0) {
-		if (bytes < wsize) {
-			dprintf(CRITICAL,
-				"flash_write_image: image undersized (%d < %d)\n",
-				bytes, wsize);
-			return -1;
-		}
-		if (page >= lastpage) {
-			dprintf(CRITICAL, "flash_write_image: out of space\n");
-			return -1;
-		}
+	for (n = 0; n < 64; n += DIFF_CHUNK_PAGES) {
+		/* any bad block or failing page counts as a difference */
+		if (nand_pipe_read(&flash_pipe_ops, page + n,
+				   page + n + DIFF_CHUNK_PAGES,
+				   DIFF_CHUNK_PAGES, flash_diff_buf,
+				   flash_pagesize, DIFF_SPARE, &errors))
+			return 1;
 
-		if ((page & 63) == 0) {
-			if (flash_erase_block
-			    (flash_cmdlist, flash_ptrlist, page)) {
-				dprintf(INFO,
-					"flash_write_image: bad block @ %d\n",
-					page >> 6);
-				page += 64;
+		for (i = 0; i < DIFF_CHUNK_PAGES; i++, image += wsize) {
+			buf = flash_diff_buf + i * stride;
+			if (memcmp(buf, image, flash_pagesize))
+				return 1;
+			buf += flash_pagesize;
+			if (extra_per_page) {
+				if (memcmp(buf, image + flash_pagesize,
+					   DIFF_SPARE))
+					return 1;
 				continue;
 			}
-		}
-
-		if (extra_per_page) {
-			r = _flash_write_page(flash_cmdlist, flash_ptrlist,
-					      page, image,
-					      image + flash_pagesize);
-		} else {
-			r = _flash_write_page(flash_cmdlist, flash_ptrlist,
-					      page, image, spare);
-		}
-		if (r) {
-			dprintf(INFO,
-				"flash_write_image: write failure @ page %d (src %d)\n",
-				page, image - (const unsigned char *)data);
-			image -= (page & 63) * wsize;
-			bytes += (page & 63) * wsize;
-			page &= ~63;
-			if (flash_erase_block
-			    (flash_cmdlist, flash_ptrlist, page)) {
-				dprintf(INFO,
-					"flash_write_image: erase failure @ page %d\n",
-					page);
-			}
-			if (ptn->type != TYPE_MODEM_PARTITION) {
-				flash_mark_badblock(flash_cmdlist,
-						    flash_ptrlist, page);
+			for (k = 0; k < DIFF_SPARE; k++) {
+				if (buf[k] != 0xff)
+					return 1;
 			}
-			dprintf(INFO,
-				"flash_write_image: restart write @ page %d (src %d)\n",
-				page, image - (const unsigned char *)data);
-			page += 64;
-			continue;
 		}
-		page++;
-		image += wsize;
-		bytes -= wsize;
 	}
 
-	/* erase any remaining pages in the partition */
-	page = (page + 63) & (~63);
-	while (page < lastpage) {
-		if (flash_erase_block(flash_cmdlist, flash_ptrlist, page)) {
-			dprintf(INFO, "flash_write_image: bad block @ %d\n",
-				page >> 6);
-		}
-		page += 64;
+	return 0;
+}
+
+static int flash_nand_stream_erase(unsigned page)
+{
+	return flash_erase_block(flash_cmdlist, flash_ptrlist, page);
+}
+
+static int flash_nand_stream_write(unsigned page, const void *data,
+				   const void *spare, int more)
+{
+	return _flash_write_page(flash_cmdlist, flash_ptrlist, page, data,
+				 spare, more);
+}
+
+static int flash_nand_stream_mark_bad(unsigned page)
+{
+	return flash_mark_badblock(flash_cmdlist, flash_ptrlist, page);
+}
+
+static const struct nand_write_ops flash_write_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.erase = flash_nand_stream_erase,
+	.erase_range = flash_erase_range,
+	.write = flash_nand_stream_write,
+	.mark_bad = flash_nand_stream_mark_bad,
+	.erased = flash_block_erased,
+	.differs = flash_block_differs,
+};
+
+int flash_stream_open(struct flash_stream *s, struct ptentry *ptn,
+		      unsigned extra_per_page, unsigned flags)
+{
+	if (nand_stream_open(&flash_write_ops, s, ptn, flash_pagesize,
+			     extra_per_page, flags))
+		return -1;
+
+	if ((flash_info.type == FLASH_ONENAND_DEVICE)
+	    && (ptn->type == TYPE_MODEM_PARTITION)) {
+		dprintf(CRITICAL, "flash_write_image: feature not supported\n");
+		s->error = 1;
+		return -1;
 	}
 
-	dprintf(INFO, "flash_write_image: success\n");
+	set_nand_configuration(ptn->type);
 	return 0;
 }
 
@@ -3425,6 +4578,24 @@ static int flash_read_page(unsigned page, void *data, void *extra)
 }
 #endif
 
+unsigned flash_good_blocks(struct ptentry *ptn)
+{
+	unsigned block, n = 0;
+
+	for (block = ptn->start; block < ptn->start + ptn->length; block++)
+		if (!flash_nand_chain_isbad(block * 64))
+			n++;
+	return n;
+}
+
+int flash_write_block(struct ptentry *ptn, unsigned block, const void *data)
+{
+	if (ptn->type != TYPE_APPS_PARTITION)
+		return -1;
+	set_nand_configuration(ptn->type);
+	return nand_block_write(&flash_write_ops, ptn, flash_pagesize, block, data);
+}
+
 unsigned flash_page_size(void)
 {
 	return flash_pagesize;
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <string.h>
+#include <platform.h>
+#include <dev/flash.h>
+
+#include "dmov.h"
+#include "nand_pipe.h"
+
+struct nand_pipe_slot {
+	struct dmov_req req;
+	unsigned page;
+	unsigned count;
+	unsigned char *data;
+};
+
+struct nand_erase_slot {
+	struct dmov_req req;
+	unsigned pages[NAND_ERASE_MAX_CHAIN];
+	unsigned count;
+};
+
+static struct flash_read_stats stats;
+
+/* time the last queued command list finished, for controller idle time */
+static volatile bigtime_t last_hw_done;
+
+static void nand_pipe_complete(struct dmov_req *req)
+{
+	last_hw_done = current_time_hires();
+}
+
+void flash_get_read_stats(struct flash_read_stats *out)
+{
+	enter_critical_section();
+	memcpy(out, &stats, sizeof(stats));
+	exit_critical_section();
+}
+
+void flash_reset_read_stats(void)
+{
+	enter_critical_section();
+	memset(&stats, 0, sizeof(stats));
+	exit_critical_section();
+}
+
+int nand_pipe_read(const struct nand_pipe_ops *ops, unsigned page,
+		   unsigned lastpage, unsigned count, unsigned char *image,
+		   unsigned pagesize, unsigned extra_per_page,
+		   unsigned *errors)
+{
+	struct nand_pipe_slot slot[NAND_PIPE_DEPTH];
+	struct nand_pipe_slot *s;
+	unsigned stride = pagesize + extra_per_page;
+	unsigned head = 0, tail = 0, queued = 0;
+	unsigned planned = 0, done = 0, submitted = 0;
+	unsigned good_block = ~0U;
+	unsigned max_chain = ops->max_chain;
+	unsigned char *data = image;
+	unsigned n, i;
+	bigtime_t t;
+	int good;
+
+	stats.reads++;
+
+	for (;;) {
+		/* keep the controller fed */
+		while (queued < NAND_PIPE_DEPTH && planned < count
+		       && page < lastpage) {
+			if ((page >> 6) != good_block) {
+				if (ops->isbad(page)) {
+					// bad block, go to next block same offset
+					page += 64;
+					(*errors)++;
+					continue;
+				}
+				good_block = page >> 6;
+			}
+
+			n = 64 - (page & 63);
+			if (n > count - planned)
+				n = count - planned;
+			if (n > max_chain)
+				n = max_chain;
+
+			t = current_time_hires();
+			s = &slot[tail];
+			s->page = page;
+			s->count = n;
+			s->data = data;
+			s->req.ptrlist = ops->prepare(tail, page, n, data, stride);
+			s->req.complete = nand_pipe_complete;
+			s->req.arg = NULL;
+
+			/* controller idle if nothing queued is still running */
+			for (i = 0; i < queued; i++) {
+				if (!slot[(head + i) % NAND_PIPE_DEPTH].req.finished)
+					break;
+			}
+			if (i == queued && submitted) {
+				stats.stalls++;
+				stats.idle_time += current_time_hires() -
+				    last_hw_done;
+			}
+
+			dmov_submit(DMOV_NAND_CHAN, &s->req);
+			stats.prepare_time += current_time_hires() - t;
+			stats.chains++;
+			submitted++;
+
+			tail = (tail + 1) % NAND_PIPE_DEPTH;
+			queued++;
+			page += n;
+			data += n * stride;
+			planned += n;
+			max_chain = ops->max_chain;
+		}
+
+		if (!queued)
+			break;
+
+		/* retire the oldest slot */
+		s = &slot[head];
+		t = current_time_hires();
+		good = dmov_wait(&s->req);
+		stats.wait_time += current_time_hires() - t;
+
+		t = current_time_hires();
+		good = (good < 0) ? -1 : ops->check(head, s->count);
+		for (i = 0; i < (unsigned)good; i++) {
+			memcpy(s->data + i * stride + pagesize,
+			       ops->spare(head, i), extra_per_page);
+		}
+		stats.check_time += current_time_hires() - t;
+
+		head = (head + 1) % NAND_PIPE_DEPTH;
+		queued--;
+
+		if (good == (int)s->count) {
+			done += good;
+			stats.pages += good;
+			continue;
+		}
+
+		/* a page failed: drain what was queued behind it and restart
+		 ** the pipeline right after it
+		 */
+		while (queued) {
+			dmov_wait(&slot[head].req);
+			head = (head + 1) % NAND_PIPE_DEPTH;
+			queued--;
+		}
+		head = tail = 0;
+		stats.flushes++;
+
+		if (good < 0 && s->count > 1) {
+			// data mover error, retry the first page on its own
+			good = 0;
+			page = s->page;
+			max_chain = 1;
+		} else {
+			// bad page, go to next page
+			if (good < 0)
+				good = 0;
+			page = s->page + good + 1;
+			(*errors)++;
+		}
+		done += good;
+		stats.pages += good;
+		planned = done;
+		data = s->data + good * stride;
+	}
+
+	return (done == count) ? 0 : -1;
+}
+
+int nand_pipe_erase(const struct nand_erase_ops *ops, unsigned page,
+		    unsigned lastpage)
+{
+	struct nand_erase_slot slot[NAND_PIPE_DEPTH];
+	struct nand_erase_slot *s;
+	unsigned head = 0, tail = 0, queued = 0;
+	unsigned max_chain = ops->max_chain;
+	unsigned failed = 0;
+	unsigned n;
+	int r, bad;
+
+	if (max_chain > NAND_ERASE_MAX_CHAIN)
+		max_chain = NAND_ERASE_MAX_CHAIN;
+
+	for (;;) {
+		/* queue the next run while the controller erases */
+		while (queued < NAND_PIPE_DEPTH && page < lastpage) {
+			s = &slot[tail];
+			s->count = 0;
+			while (s->count < max_chain && page < lastpage) {
+				if (ops->isbad(page)) {
+					dprintf(INFO, "skipping @ %d (bad block)\n",
+						page >> 6);
+					failed++;
+				} else {
+					s->pages[s->count++] = page;
+				}
+				page += 64;
+			}
+			if (!s->count)
+				continue;
+
+			s->req.ptrlist = ops->prepare(tail, s->pages, s->count);
+			s->req.complete = NULL;
+			s->req.arg = NULL;
+			dmov_submit(DMOV_NAND_CHAN, &s->req);
+
+			tail = (tail + 1) % NAND_PIPE_DEPTH;
+			queued++;
+		}
+
+		if (!queued)
+			break;
+
+		s = &slot[head];
+		r = dmov_wait(&s->req);
+		for (n = 0; n < s->count; n++) {
+			if (r < 0) {
+				/* state unknown, leave the block alone */
+				dprintf(INFO, "cannot erase @ %d (dmov error)\n",
+					s->pages[n] >> 6);
+				failed++;
+				continue;
+			}
+			bad = ops->check(head, n);
+			if (bad) {
+				dprintf(INFO, "cannot erase @ %d (bad block?)\n",
+					s->pages[n] >> 6);
+				failed++;
+			}
+			ops->done(s->pages[n], bad);
+		}
+
+		head = (head + 1) % NAND_PIPE_DEPTH;
+		queued--;
+	}
+
+	return failed;
+}
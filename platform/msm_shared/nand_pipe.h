@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __PLATFORM_MSM_SHARED_NAND_PIPE_H
+#define __PLATFORM_MSM_SHARED_NAND_PIPE_H
+
+/* Pipelined sequential reads.
+ *
+ * The engine keeps NAND_PIPE_DEPTH chained command lists queued on the
+ * data mover, so the controller is already reading the next run of pages
+ * while the CPU validates and post-processes the previous one.  The NAND
+ * driver supplies the command lists through the hooks below; each slot
+ * owns its own command, status and spare buffers.
+ */
+#define NAND_PIPE_DEPTH 2
+
+struct nand_pipe_ops {
+	/* nonzero if the block holding 'page' must be skipped */
+	int (*isbad) (unsigned page);
+
+	/* build the command pointer list reading 'count' pages of one block
+	 * into slot 'slot', page n landing at data + n * stride */
+	unsigned *(*prepare) (unsigned slot, unsigned page, unsigned count,
+			      unsigned char *data, unsigned stride);
+
+	/* pages of a completed slot read before the first failing one */
+	int (*check) (unsigned slot, unsigned count);
+
+	/* spare bytes gathered for page n of a slot */
+	void *(*spare) (unsigned slot, unsigned n);
+
+	unsigned max_chain;
+};
+
+/* Read 'count' pages starting at 'page', skipping bad blocks and failing
+ * pages like flash_read_ext().  Returns 0 once all pages are read, -1 if
+ * 'lastpage' is reached first.
+ */
+int nand_pipe_read(const struct nand_pipe_ops *ops, unsigned page,
+		   unsigned lastpage, unsigned count, unsigned char *image,
+		   unsigned pagesize, unsigned extra_per_page,
+		   unsigned *errors);
+
+/* Pipelined erases.
+ *
+ * Runs of good blocks are erased by one chained command list each, with
+ * NAND_PIPE_DEPTH lists queued so the next one is built and waiting while
+ * the controller is busy erasing.
+ */
+#define NAND_ERASE_MAX_CHAIN 32
+
+struct nand_erase_ops {
+	/* nonzero if the block holding 'page' must be skipped */
+	int (*isbad) (unsigned page);
+
+	/* build the command pointer list erasing the 'count' blocks
+	 * starting at pages[0..count-1] into slot 'slot' */
+	unsigned *(*prepare) (unsigned slot, const unsigned *pages,
+			      unsigned count);
+
+	/* nonzero if block n of a completed slot failed to erase */
+	int (*check) (unsigned slot, unsigned n);
+
+	/* record the outcome for the block at 'page' in the bad block and
+	 * erased block state */
+	void (*done) (unsigned page, int failed);
+
+	unsigned max_chain;
+};
+
+/* Erase the blocks from 'page' up to 'lastpage'.  Returns the number of
+ * blocks left unerased, bad ones included.
+ */
+int nand_pipe_erase(const struct nand_erase_ops *ops, unsigned page,
+		    unsigned lastpage);
+
+#endif				/* __PLATFORM_MSM_SHARED_NAND_PIPE_H */
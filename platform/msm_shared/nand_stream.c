@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <debug.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dev/flash.h>
+#include <lib/ptable.h>
+
+#include "nand_stream.h"
+
+#define paddr(n) ((unsigned) (n))
+
+#define STREAM_DMA_ALIGN	8	/* sources the data mover can read */
+
+#define PAGE_DATA	0
+#define PAGE_FILL	1
+#define PAGE_SKIP	2	/* left erased */
+
+int nand_stream_open(const struct nand_write_ops *ops,
+		     struct flash_stream *s, struct ptentry *ptn,
+		     unsigned pagesize, unsigned extra_per_page,
+		     unsigned flags)
+{
+	unsigned wsize = pagesize + extra_per_page;
+
+	memset(s, 0, sizeof(*s));
+	s->ops = ops;
+	s->ptn = ptn;
+	s->pagesize = pagesize;
+	s->extra_per_page = extra_per_page;
+	s->flags = flags;
+	s->page = ptn->start * 64;
+	s->lastpage = (ptn->start + ptn->length) * 64;
+
+	s->bounce = memalign(32, wsize);
+	s->fill_page = memalign(32, wsize);
+	s->erased_spare = memalign(32, 128);
+	if (!s->bounce || !s->fill_page || !s->erased_spare) {
+		dprintf(CRITICAL, "flash_write_image: out of memory\n");
+		s->error = 1;
+		return -1;
+	}
+	memset(s->erased_spare, 0xff, 128);
+	s->fill_value = 0xffffffff;
+	memset(s->fill_page, 0xff, wsize);
+	return 0;
+}
+
+/* Collected pages that are one run of the caller's data can be compared
+ * with what the block already holds.
+ */
+static const unsigned char *nand_stream_image(struct flash_stream *s)
+{
+	unsigned wsize = s->pagesize + s->extra_per_page;
+	const unsigned char *image = s->pages[0].data;
+	unsigned n;
+
+	if (s->count != 64)
+		return NULL;
+	for (n = 0; n < 64; n++) {
+		if (s->pages[n].type != PAGE_DATA ||
+		    s->pages[n].data != image + n * wsize)
+			return NULL;
+	}
+	return image;
+}
+
+static int nand_stream_write_page(struct flash_stream *s, unsigned n,
+				  int more)
+{
+	const struct nand_write_ops *ops = s->ops;
+	struct flash_stream_page *p = &s->pages[n];
+	unsigned wsize = s->pagesize + s->extra_per_page;
+	const unsigned char *src;
+	unsigned *fill;
+	unsigned i;
+
+	switch (p->type) {
+	case PAGE_SKIP:
+		return 0;
+	case PAGE_FILL:
+		if (p->fill != s->fill_value) {
+			fill = (unsigned *)s->fill_page;
+			for (i = 0; i < wsize / 4; i++)
+				fill[i] = p->fill;
+			s->fill_value = p->fill;
+		}
+		src = s->fill_page;
+		break;
+	default:
+		src = p->data;
+		if (paddr(src) & (STREAM_DMA_ALIGN - 1)) {
+			memcpy(s->bounce, src, wsize);
+			src = s->bounce;
+		}
+		break;
+	}
+
+	return ops->write(s->page + n, src, s->extra_per_page ?
+			  src + s->pagesize : s->erased_spare, more);
+}
+
+/* Erase the next good block and program the collected pages into it */
+static int nand_stream_flush(struct flash_stream *s)
+{
+	const struct nand_write_ops *ops = s->ops;
+	unsigned diff = s->flags & FLASH_WRITE_DIFF;
+	const unsigned char *image;
+	unsigned n, last;
+
+	if (!s->count)
+		return 0;
+
+	/* the last page actually programmed ends the run */
+	for (last = s->count - 1; last && s->pages[last].type == PAGE_SKIP;
+	     last--) ;
+
+	for (;;) {
+		if (s->page >= s->lastpage) {
+			dprintf(CRITICAL, "flash_write_image: out of space\n");
+			return -1;
+		}
+		if (ops->isbad(s->page)) {
+			dprintf(INFO, "flash_write_image: bad block @ %d\n",
+				s->page >> 6);
+			s->page += 64;
+			continue;
+		}
+
+		image = diff ? nand_stream_image(s) : NULL;
+		if (image && !ops->differs(s->page, image, s->extra_per_page)) {
+			/* block already holds this part of the image */
+			s->unchanged++;
+			break;
+		}
+		if (diff && ops->erased(s->page)) {
+			s->erases_skipped++;
+		} else if (ops->erase(s->page)) {
+			dprintf(INFO, "flash_write_image: bad block @ %d\n",
+				s->page >> 6);
+			s->page += 64;
+			continue;
+		}
+
+		for (n = 0; n < s->count; n++) {
+			if (nand_stream_write_page(s, n, n < last))
+				break;
+		}
+		if (n == s->count)
+			break;
+
+		dprintf(INFO, "flash_write_image: write failure @ page %d\n",
+			s->page + n);
+		if (ops->erase(s->page)) {
+			dprintf(INFO,
+				"flash_write_image: erase failure @ page %d\n",
+				s->page);
+		}
+		if (s->ptn->type != TYPE_MODEM_PARTITION)
+			ops->mark_bad(s->page);
+		dprintf(INFO, "flash_write_image: restart write @ page %d\n",
+			s->page + 64);
+		s->page += 64;
+	}
+
+	s->page += 64;
+	s->count = 0;
+	return 0;
+}
+
+static int nand_stream_add(struct flash_stream *s, unsigned type,
+			   const unsigned char *data, unsigned fill,
+			   unsigned bytes)
+{
+	unsigned wsize = s->pagesize + s->extra_per_page;
+	struct flash_stream_page *p;
+
+	if (s->error)
+		return -1;
+
+	while (bytes >= wsize) {
+		p = &s->pages[s->count++];
+		p->type = type;
+		p->data = data;
+		p->fill = fill;
+		if (data)
+			data += wsize;
+		bytes -= wsize;
+
+		if (s->count == 64 && nand_stream_flush(s)) {
+			s->error = 1;
+			return -1;
+		}
+	}
+
+	if (bytes) {
+		dprintf(CRITICAL,
+			"flash_write_image: image undersized (%d < %d)\n",
+			bytes, wsize);
+		s->error = 1;
+		return -1;
+	}
+	return 0;
+}
+
+int flash_stream_write(struct flash_stream *s, const void *data,
+		       unsigned bytes)
+{
+	return nand_stream_add(s, PAGE_DATA, data, 0, bytes);
+}
+
+int flash_stream_fill(struct flash_stream *s, unsigned value, unsigned bytes)
+{
+	/* without spare data an all-ones page reads back like erased flash */
+	if (value == 0xffffffff && !s->extra_per_page)
+		return nand_stream_add(s, PAGE_SKIP, NULL, 0, bytes);
+	return nand_stream_add(s, PAGE_FILL, NULL, value, bytes);
+}
+
+int flash_stream_skip(struct flash_stream *s, unsigned bytes)
+{
+	return nand_stream_add(s, PAGE_SKIP, NULL, 0, bytes);
+}
+
+int flash_stream_close(struct flash_stream *s)
+{
+	const struct nand_write_ops *ops = s->ops;
+	unsigned diff = s->flags & FLASH_WRITE_DIFF;
+	int r = -1;
+
+	if (!s->error && !nand_stream_flush(s)) {
+		/* erase any remaining pages in the partition */
+		if (!diff)
+			ops->erase_range(s->page, s->lastpage);
+		while (diff && s->page < s->lastpage) {
+			if (ops->erased(s->page)) {
+				s->erases_skipped++;
+			} else if (ops->erase(s->page)) {
+				dprintf(INFO,
+					"flash_write_image: bad block @ %d\n",
+					s->page >> 6);
+			}
+			s->page += 64;
+		}
+
+		if (diff)
+			dprintf(INFO, "flash_write_image: %d blocks unchanged, "
+				"%d erases skipped\n", s->unchanged,
+				s->erases_skipped);
+		dprintf(INFO, "flash_write_image: success\n");
+		r = 0;
+	}
+
+	free(s->bounce);
+	free(s->fill_page);
+	free(s->erased_spare);
+	s->bounce = s->fill_page = s->erased_spare = NULL;
+	s->error = 1;
+	return r;
+}
+
+int flash_write_ext(struct ptentry *ptn, unsigned extra_per_page,
+		    const void *data, unsigned bytes, unsigned flags)
+{
+	struct flash_stream *s;
+	int r;
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -1;
+
+	r = flash_stream_open(s, ptn, extra_per_page, flags);
+	if (!r)
+		r = flash_stream_write(s, data, bytes);
+	if (flash_stream_close(s))
+		r = -1;
+
+	free(s);
+	return r;
+}
+
+/* Rewrite the 'block'th good block of the partition in place */
+int nand_block_write(const struct nand_write_ops *ops, struct ptentry *ptn,
+		     unsigned pagesize, unsigned block, const void *data)
+{
+	static unsigned char *erased_spare;
+	const unsigned char *src = data;
+	unsigned page = ptn->start * 64;
+	unsigned lastpage = (ptn->start + ptn->length) * 64;
+	unsigned n;
+
+	if (paddr(src) & (STREAM_DMA_ALIGN - 1))
+		return -1;
+	if (!erased_spare) {
+		erased_spare = memalign(32, 128);
+		if (!erased_spare)
+			return -1;
+		memset(erased_spare, 0xff, 128);
+	}
+
+	for (; page < lastpage; page += 64) {
+		if (ops->isbad(page))
+			continue;
+		if (!block--)
+			break;
+	}
+	if (page >= lastpage)
+		return -1;
+
+	if (!ops->erased(page) && ops->erase(page)) {
+		dprintf(INFO, "flash_write_block: erase failure @ %d\n",
+			page >> 6);
+		return -1;
+	}
+	for (n = 0; n < 64; n++) {
+		if (ops->write(page + n, src + n * pagesize, erased_spare,
+			       n < 63)) {
+			dprintf(INFO,
+				"flash_write_block: write failure @ page %d\n",
+				page + n);
+			ops->erase(page);
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __PLATFORM_MSM_SHARED_NAND_STREAM_H
+#define __PLATFORM_MSM_SHARED_NAND_STREAM_H
+
+#include <dev/flash.h>
+
+/* Block writer behind flash_stream_*() and flash_write_ext().
+ *
+ * The NAND driver supplies the per-block primitives below; the stream
+ * collects a block's worth of pages, then erases and programs it,
+ * moving on to the next block on bad blocks and program failures.
+ */
+struct nand_write_ops {
+	/* nonzero if the block holding 'page' must be skipped */
+	int (*isbad) (unsigned page);
+
+	/* erase the block holding 'page', 0 on success */
+	int (*erase) (unsigned page);
+
+	/* erase the good blocks from 'page' up to 'lastpage' */
+	void (*erase_range) (unsigned page, unsigned lastpage);
+
+	/* program one page; 'spare' holds the spare bytes to write.  'more'
+	 * is set while further pages of the same block follow, so the
+	 * driver may return before the page is programmed (cache program) */
+	int (*write) (unsigned page, const void *data, const void *spare,
+		      int more);
+
+	/* retire the block holding 'page' after a program failure */
+	int (*mark_bad) (unsigned page);
+
+	/* nonzero if the block is known erased and unprogrammed since */
+	int (*erased) (unsigned page);
+
+	/* 0 if the block already holds the 64 pages of 'image' */
+	int (*differs) (unsigned page, const unsigned char *image,
+			unsigned extra_per_page);
+};
+
+int nand_stream_open(const struct nand_write_ops *ops,
+		     struct flash_stream *s, struct ptentry *ptn,
+		     unsigned pagesize, unsigned extra_per_page,
+		     unsigned flags);
+
+/* flash_write_block() */
+int nand_block_write(const struct nand_write_ops *ops, struct ptentry *ptn,
+		     unsigned pagesize, unsigned block, const void *data);
+
+#endif				/* __PLATFORM_MSM_SHARED_NAND_STREAM_H */
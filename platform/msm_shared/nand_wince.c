@@ -33,31 +33,19 @@
 #include <string.h>
 #include <dev/flash.h>
 #include <lib/ptable.h>
+#include <platform/clock.h>
 #include <platform/nand.h>
 
 #include "dmov.h"
+#include "nand_pipe.h"
+#include "nand_stream.h"
 
 #define VERBOSE 0
 #define VERIFY_WRITE 0
 
 static void *flash_spare;
 static void *flash_data;
-
-typedef struct dmov_ch dmov_ch;
-struct dmov_ch {
-	volatile unsigned cmd;
-	volatile unsigned result;
-	volatile unsigned status;
-	volatile unsigned config;
-};
-
-static void dmov_prep_ch(dmov_ch * ch, unsigned id)
-{
-	ch->cmd = DMOV_CMD_PTR(id);
-	ch->result = DMOV_RSLT(id);
-	ch->status = DMOV_STATUS(id);
-	ch->config = DMOV_CONFIG(id);
-}
+void platform_config_interleaved_mode_gpios(void);
 
 #define SRC_CRCI_NAND_CMD  CMD_SRC_CRCI(DMOV_NAND_CRCI_CMD)
 #define DST_CRCI_NAND_CMD  CMD_DST_CRCI(DMOV_NAND_CRCI_CMD)
@@ -71,38 +59,64 @@ static unsigned CFG0, CFG1;
 
 #define CFG1_WIDE_FLASH (1U << 1)
 
-#define paddr(n) ((unsigned) (n))
-
-static int dmov_exec_cmdptr(unsigned id, unsigned *ptr)
-{
-	dmov_ch ch;
-	unsigned n;
-
-	dmov_prep_ch(&ch, id);
-
-	writel(DMOV_CMD_PTR_LIST | DMOV_CMD_ADDR(paddr(ptr)), ch.cmd);
+/* CFG1 wait states: recovery cycles after each data strobe (1-8) and
+ * the gap between the last write cycle and sampling busy (2-16, tWB).
+ */
+#define CFG1_RECOVERY(n)	(((n) - 1) << 2)
+#define CFG1_WR_RD_GAP(n)	((((n) - 1) / 2) << 17)
+#define CFG1_TIMING_MASK	((7U << 2) | (7U << 17))
+
+/* NANDc clock period the wait states are counted in.  The clock is
+ * not programmed here: the period comes from NAND_CLK_NS if the target
+ * sets it, else from the EBI2 clock the NANDc runs from, as far as the
+ * platform can report it.  Without either a 10ns clock is assumed, and
+ * the computed wait states then only ever lengthen what the SPL left
+ * in CFG1.
+ */
+#define NAND_CLK_NS_ASSUMED	10
+
+static unsigned flash_clk_ns;	/* 0: not known */
+
+/* ONFI asynchronous timing modes 0-5: cycle time (tRC/tWC) and tWB */
+static const unsigned short onfi_trc[] = { 100, 50, 35, 30, 25, 20 };
+static const unsigned short onfi_twb[] = { 200, 100, 100, 100, 100, 100 };
+
+#define ONFI_SIGNATURE		0x49464E4F	/* "ONFI" */
+#define ONFI_READ_ID_ADDR	0x20
+#define ONFI_CMD_READ_PARAM	0xEC
+#define ONFI_PARAM_SIZE		256
+#define ONFI_PARAM_COPIES	2	/* of the 3 mandatory, one codeword */
+#define ONFI_CRC_INIT		0x4F4E
+
+#define NAND_CFG0_RAW_ONFI_ID		0x88000800
+#define NAND_CFG0_RAW_ONFI_PARAM	0x88040000
+#define NAND_CFG1_RAW_ONFI		0x0005045D
+
+/* timing mode of the detected part, programmed by flash_nand_read_config */
+static unsigned flash_timing_mode;
+
+/* FLASH_CACHE_* commands used with the detected part, and the DEV_CMD
+ * opcodes the cache operations are patched into.  The cache sequences
+ * have only run against tools/nandsim, so a target has to ask for them
+ * with NAND_CACHE_OPS.
+ */
+#ifndef NAND_CACHE_OPS
+#define NAND_CACHE_OPS	0
+#endif
 
-	while (!(readl(ch.status) & DMOV_STATUS_RSLT_VALID)) ;
+static unsigned flash_cache;
+static unsigned flash_dev_cmd0, flash_dev_cmd1, flash_dev_cmd_vld;
 
-	n = readl(ch.status);
-	while (DMOV_STATUS_RSLT_COUNT(n)) {
-		n = readl(ch.result);
-		if (n != 0x80000002) {
-			dprintf(CRITICAL, "ERROR: result: %x\n", n);
-			dprintf(CRITICAL, "ERROR:  flush: %x %x %x %x\n",
-				readl(DMOV_FLUSH0(DMOV_NAND_CHAN)),
-				readl(DMOV_FLUSH1(DMOV_NAND_CHAN)),
-				readl(DMOV_FLUSH2(DMOV_NAND_CHAN)),
-				readl(DMOV_FLUSH3(DMOV_NAND_CHAN)));
-			return -1;
-		}
-		n = readl(ch.status);
-	}
-	return 0;
-}
+#define paddr(n) ((unsigned) (n))
 
 static struct flash_info flash_info;
-static unsigned flash_pagesize = 0;
+static unsigned flash_pagesize = 0;	/* one chip */
+static int interleaved_mode = 0;
+
+/* Page size seen by flash_read_ext() and flash_write().  With two chips
+ * interleaved a page is the same page of both chips, CS0 first.
+ */
+static unsigned flash_io_pagesize = 0;
 
 struct flash_identification {
 	unsigned flash_id;
@@ -112,41 +126,50 @@ struct flash_identification {
 	unsigned pagesize;
 	unsigned blksize;
 	unsigned oobsize;
+	unsigned timing;	/* ONFI async timing mode the part meets */
+	unsigned cache;		/* FLASH_CACHE_* commands the part has */
 };
 
+#define FLASH_CACHE_PROGRAM	(1U << 0)	/* PROGRAM PAGE CACHE */
+#define FLASH_CACHE_READ	(1U << 1)	/* READ CACHE SEQUENTIAL/END */
+
 static struct flash_identification supported_flash[] = {
-	/* Flash ID     ID Mask Density(MB)  Wid Pgsz   Blksz   oobsz   Manuf */
-	{0x00000000, 0xFFFFFFFF, 0, 0, 0, 0, 0}, /*ONFI*/
-	{0x1500aaec, 0xFF00FFFF, (256 << 20), 0, 2048, (2048 << 6), 64},	/*Sams */
-	{0x5500baec, 0xFF00FFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Sams */
-	{0x5500bcec, 0xFF00FFFF, (512 << 20), 1, 2048, (2048 << 6), 64}, /*Sams*/
-	{0x1500aa98, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64},	/*Tosh */
-	{0x5500ba98, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Tosh */
-	{0xd580b12c, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Micr */
-	{0x5590bc2c, 0xFFFFFFFF, (512 << 20), 1, 2048, (2048 << 6), 64},	/*Micr */
-	{0x1580aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64},	/*Micr */
-	{0x1590aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64},	/*Micr */
-	{0x1590ac2c, 0xFFFFFFFF, (512 << 20), 0, 2048, (2048 << 6), 64},	/*Micr */
-	{0x5580baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Hynx */
-	{0x5510baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Hynx */
-	{0x6600bcec, 0xFF00FFFF, (512 << 20), 1, 4096, (4096 << 6), 128},	/*Sams */
+	/* Flash ID     ID Mask Density(MB)  Wid Pgsz   Blksz   oobsz Tm Ca Manuf */
+	{0x00000000, 0xFFFFFFFF, 0, 0, 0, 0, 0, 0, 0}, /*ONFI*/
+	{0x1500aaec, 0xFF00FFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 0},	/*Sams */
+	{0x5500baec, 0xFF00FFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Sams */
+	{0x5500bcec, 0xFF00FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 1, 0}, /*Sams*/
+	{0x1500aa98, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 0},	/*Tosh */
+	{0x5500ba98, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Tosh */
+	{0xd580b12c, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 3},	/*Micr */
+	{0x5590bc2c, 0xFFFFFFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 1, 3},	/*Micr */
+	{0x1580aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 3},	/*Micr */
+	{0x1590aa2c, 0xFFFFFFFF, (256 << 20), 0, 2048, (2048 << 6), 64, 1, 3},	/*Micr */
+	{0x1590ac2c, 0xFFFFFFFF, (512 << 20), 0, 2048, (2048 << 6), 64, 1, 3},	/*Micr */
+	{0x5580baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Hynx */
+	{0x5510baad, 0xFFFFFFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Hynx */
+	{0x6600bcec, 0xFF00FFFF, (512 << 20), 1, 4096, (4096 << 6), 128, 1, 0},	/*Sams */
 
 	/*added from kernel nand */
-	{0x0000aaec, 0x0000FFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Samsung 2Gbit */
-	{0x0000acec, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64},	/*Samsung 4Gbit */
-	{0x0000bcec, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64},	/*Samsung 4Gbit */
-	{0x6601b3ec, 0xFFFFFFFF, (1024 << 20), 1, 4096, (4096 << 6), 128},	/*Samsung 8Gbit 4Kpage */
-	{0x0000b3ec, 0x0000FFFF, (1024 << 20), 1, 2048, (2048 << 6), 64},	/*Samsung 8Gbit */
-	{0x0000ba2c, 0x0000FFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Micron 2Gbit */
-	{0x0000bc2c, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64},	/*Micron 4Gbit */
-	{0x0000b32c, 0x0000FFFF, (1024 << 20), 1, 2048, (2048 << 6), 64},	/*Micron 8Gbit */
-	{0x0000baad, 0x0000FFFF, (256 << 20), 1, 2048, (2048 << 6), 64},	/*Hynix 2Gbit */
-	{0x0000bcad, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64},	/*Hynix 4Gbit */
-	{0x0000b3ad, 0x0000FFFF, (1024 << 20), 1, 2048, (2048 << 6), 64},	/*Hynix 8Gbit */
+	{0x0000aaec, 0x0000FFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Samsung 2Gbit */
+	{0x0000acec, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Samsung 4Gbit */
+	{0x0000bcec, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Samsung 4Gbit */
+	{0x6601b3ec, 0xFFFFFFFF, (1024 << 20), 1, 4096, (4096 << 6), 128, 1, 0},	/*Samsung 8Gbit 4Kpage */
+	{0x0000b3ec, 0x0000FFFF, (1024 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Samsung 8Gbit */
+	{0x0000ba2c, 0x0000FFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 3},	/*Micron 2Gbit */
+	{0x0000bc2c, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 1, 3},	/*Micron 4Gbit */
+	{0x0000b32c, 0x0000FFFF, (1024 << 20), 1, 2048, (2048 << 6), 64, 1, 3},	/*Micron 8Gbit */
+	{0x0000baad, 0x0000FFFF, (256 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Hynix 2Gbit */
+	{0x0000bcad, 0x0000FFFF, (512 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Hynix 4Gbit */
+	{0x0000b3ad, 0x0000FFFF, (1024 << 20), 1, 2048, (2048 << 6), 64, 1, 0},	/*Hynix 8Gbit */
 
 	/* Note: Width flag is 0 for 8 bit Flash and 1 for 16 bit flash   */
 	/* Note: The First row will be filled at runtime during ONFI probe      */
-
+	/* Note: Tm is the fallback ONFI timing mode for parts that cannot
+	 *       report one; these 1.8V parts all meet mode 1 (50ns cycle)  */
+	/* Note: Ca lists the cache commands (FLASH_CACHE_*) the part is
+	 *       known to implement; 0 keeps it on plain reads and programs.
+	 *       They are only used when the target sets NAND_CACHE_OPS */
 };
 
 static void set_nand_configuration(char type)
@@ -229,6 +252,283 @@ static void flash_nand_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 	return;
 }
 
+static unsigned onfi_crc16(const unsigned char *p, unsigned len)
+{
+	unsigned crc = ONFI_CRC_INIT;
+	unsigned n;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (n = 0; n < 8; n++)
+			crc = (crc << 1) ^ ((crc & 0x8000) ? 0x8005 : 0);
+	}
+	return crc & 0xffff;
+}
+
+static unsigned onfi_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned onfi_le32(const unsigned char *p)
+{
+	return onfi_le16(p) | (onfi_le16(p + 2) << 16);
+}
+
+/* Read the ONFI signature and parameter page of CS0.  The parameter
+ * page is read as a raw codeword with the controller's read opcode
+ * temporarily switched to READ PARAMETER PAGE (0xEC, no confirm cycle).
+ * The device config and command registers are restored afterwards.
+ */
+static int flash_nand_onfi_read(dmov_s * cmdlist, unsigned *ptrlist,
+				unsigned char *param)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned *ptr = ptrlist;
+	unsigned *data = ptrlist + 4;
+
+	/* save DEV_CMD1, DEV_CMD_VLD and the device config */
+	cmd[0].cmd = CMD_OCB;
+	cmd[0].src = NAND_DEV_CMD1;
+	cmd[0].dst = paddr(&data[9]);
+	cmd[0].len = 4;
+
+	cmd[1].cmd = 0;
+	cmd[1].src = NAND_DEV_CMD_VLD;
+	cmd[1].dst = paddr(&data[10]);
+	cmd[1].len = 4;
+
+	cmd[2].cmd = CMD_OCU | CMD_LC;
+	cmd[2].src = NAND_DEV0_CFG0;
+	cmd[2].dst = paddr(&data[13]);
+	cmd[2].len = 8;
+
+	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+	data[0] = NAND_CMD_FETCH_ID;
+	data[1] = ONFI_READ_ID_ADDR;
+	data[2] = 0;
+	data[3] = 0 | 4;
+	data[4] = NAND_CFG0_RAW_ONFI_ID;
+	data[5] = NAND_CFG1_RAW_ONFI;
+	data[6] = 1;
+	data[7] = CLEAN_DATA_32;
+	data[8] = CLEAN_DATA_32;
+	data[11] = (data[9] & ~0xffU) | ONFI_CMD_READ_PARAM;
+	data[12] = data[10] & ~NAND_DEV_CMD_VLD_READ_START;
+
+	/* READ ID from address 0x20 returns "ONFI" */
+	cmd[0].cmd = CMD_OCB;
+	cmd[0].src = paddr(&data[4]);
+	cmd[0].dst = NAND_DEV0_CFG0;
+	cmd[0].len = 8;
+
+	cmd[1].cmd = DST_CRCI_NAND_CMD;
+	cmd[1].src = paddr(&data[0]);
+	cmd[1].dst = NAND_FLASH_CMD;
+	cmd[1].len = 16;
+
+	cmd[2].cmd = 0;
+	cmd[2].src = paddr(&data[6]);
+	cmd[2].dst = NAND_EXEC_CMD;
+	cmd[2].len = 4;
+
+	cmd[3].cmd = SRC_CRCI_NAND_DATA;
+	cmd[3].src = NAND_FLASH_STATUS;
+	cmd[3].dst = paddr(&data[7]);
+	cmd[3].len = 4;
+
+	cmd[4].cmd = 0;
+	cmd[4].src = NAND_READ_ID;
+	cmd[4].dst = paddr(&data[8]);
+	cmd[4].len = 4;
+
+	cmd[5].cmd = CMD_OCU | CMD_LC;
+	cmd[5].src = paddr(&data[13]);
+	cmd[5].dst = NAND_DEV0_CFG0;
+	cmd[5].len = 8;
+
+	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+	if ((data[7] & 0x110) || data[8] != ONFI_SIGNATURE)
+		return -1;
+
+	data[0] = NAND_CMD_PAGE_READ_ALL;
+	data[1] = 0;
+	data[4] = NAND_CFG0_RAW_ONFI_PARAM;
+	data[7] = CLEAN_DATA_32;
+	data[8] = CLEAN_DATA_32;
+
+	cmd[0].cmd = CMD_OCB;
+	cmd[0].src = paddr(&data[12]);
+	cmd[0].dst = NAND_DEV_CMD_VLD;
+	cmd[0].len = 4;
+
+	cmd[1].cmd = 0;
+	cmd[1].src = paddr(&data[11]);
+	cmd[1].dst = NAND_DEV_CMD1;
+	cmd[1].len = 4;
+
+	cmd[2].cmd = 0;
+	cmd[2].src = paddr(&data[4]);
+	cmd[2].dst = NAND_DEV0_CFG0;
+	cmd[2].len = 8;
+
+	cmd[3].cmd = DST_CRCI_NAND_CMD;
+	cmd[3].src = paddr(&data[0]);
+	cmd[3].dst = NAND_FLASH_CMD;
+	cmd[3].len = 16;
+
+	cmd[4].cmd = 0;
+	cmd[4].src = paddr(&data[6]);
+	cmd[4].dst = NAND_EXEC_CMD;
+	cmd[4].len = 4;
+
+	cmd[5].cmd = SRC_CRCI_NAND_DATA;
+	cmd[5].src = NAND_FLASH_STATUS;
+	cmd[5].dst = paddr(&data[7]);
+	cmd[5].len = 8;
+
+	cmd[6].cmd = 0;
+	cmd[6].src = NAND_FLASH_BUFFER;
+	cmd[6].dst = paddr(param);
+	cmd[6].len = ONFI_PARAM_SIZE * ONFI_PARAM_COPIES;
+
+	cmd[7].cmd = 0;
+	cmd[7].src = paddr(&data[9]);
+	cmd[7].dst = NAND_DEV_CMD1;
+	cmd[7].len = 4;
+
+	cmd[8].cmd = 0;
+	cmd[8].src = paddr(&data[10]);
+	cmd[8].dst = NAND_DEV_CMD_VLD;
+	cmd[8].len = 4;
+
+	cmd[9].cmd = CMD_OCU | CMD_LC;
+	cmd[9].src = paddr(&data[13]);
+	cmd[9].dst = NAND_DEV0_CFG0;
+	cmd[9].len = 8;
+
+	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+	if (data[7] & 0x110)
+		return -1;
+	return 0;
+}
+
+/* Fill the ONFI row of supported_flash[] from the parameter page.
+ * Returns 0 if the part is ONFI compliant and has a geometry the
+ * driver handles.
+ */
+static int flash_nand_onfi_probe(dmov_s * cmdlist, unsigned *ptrlist)
+{
+	struct flash_identification *onfi = &supported_flash[0];
+	unsigned char *p = flash_data;
+	unsigned n, ppb, blocks, modes;
+
+	if (flash_nand_onfi_read(cmdlist, ptrlist, p))
+		return -1;
+
+	/* use the first intact copy */
+	for (n = 0; n < ONFI_PARAM_COPIES; n++, p += ONFI_PARAM_SIZE) {
+		if (onfi_le32(p) == ONFI_SIGNATURE &&
+		    onfi_crc16(p, 254) == onfi_le16(p + 254))
+			break;
+	}
+	if (n == ONFI_PARAM_COPIES) {
+		dprintf(CRITICAL, "onfi: bad parameter page\n");
+		return -1;
+	}
+
+	ppb = onfi_le32(p + 92);
+	blocks = onfi_le32(p + 96) * p[100];	/* per LUN x LUNs */
+	onfi->pagesize = onfi_le32(p + 80);
+	onfi->oobsize = onfi_le16(p + 84);
+	onfi->blksize = onfi->pagesize * ppb;
+	if ((onfi->pagesize != 2048 && onfi->pagesize != 4096) || ppb != 64
+	    || !blocks || blocks > 0xFFFFFFFFU / onfi->blksize) {
+		dprintf(CRITICAL, "onfi: unsupported geometry %d/%d/%d\n",
+			onfi->pagesize, ppb, blocks);
+		return -1;
+	}
+
+	onfi->flash_id = flash_info.id;
+	onfi->mask = 0xFFFFFFFF;
+	onfi->density = blocks * onfi->blksize;
+	onfi->widebus = onfi_le16(p + 6) & 1;
+
+	/* fastest supported asynchronous mode */
+	modes = onfi_le16(p + 129) & 0x3f;
+	for (onfi->timing = 0; modes >> (onfi->timing + 1); onfi->timing++) ;
+
+	/* optional commands: bit 0 page cache program, bit 1 read cache */
+	onfi->cache = onfi_le16(p + 8) & (FLASH_CACHE_PROGRAM |
+					  FLASH_CACHE_READ);
+
+	dprintf(INFO, "onfi: %d blocks, timing modes %x, cache %x\n", blocks,
+		modes, onfi->cache);
+	return 0;
+}
+
+static void flash_nand_clk_init(void)
+{
+#ifdef NAND_CLK_NS
+	flash_clk_ns = NAND_CLK_NS;
+#else
+	int rate = clk_get_rate(EBI2_CLK);
+
+	/* round the period down: the wait states come out longer */
+	flash_clk_ns = rate > 0 ? 1000000000U / (unsigned)rate : 0;
+#endif
+}
+
+/* CFG1 wait states for an ONFI timing mode */
+static unsigned flash_nand_timing(unsigned mode)
+{
+	unsigned cycles, recovery, gap;
+	unsigned clk = flash_clk_ns ? flash_clk_ns : NAND_CLK_NS_ASSUMED;
+
+	if (mode >= sizeof(onfi_trc) / sizeof(onfi_trc[0]))
+		mode = 0;
+
+	/* a data cycle is two clocks of strobe plus the recovery */
+	cycles = (onfi_trc[mode] + clk - 1) / clk;
+	recovery = cycles > 3 ? cycles - 2 : 1;
+	if (recovery > 8)
+		recovery = 8;
+
+	gap = (onfi_twb[mode] + clk - 1) / clk;
+	if (gap < 2)
+		gap = 2;
+	if (gap > 16)
+		gap = 16;
+
+	return CFG1_RECOVERY(recovery) | CFG1_WR_RD_GAP(gap);
+}
+
+/* Wait states to program: the computed ones for a known clock, else
+ * the larger of those and the SPL's, field by field.
+ */
+static unsigned flash_nand_wait_states(unsigned spl_cfg1, unsigned mode)
+{
+	unsigned timing = flash_nand_timing(mode);
+	unsigned field, i;
+	static const unsigned masks[] = { 7U << 2, 7U << 17 };
+
+	if (flash_clk_ns)
+		return timing;
+
+	for (i = 0; i < sizeof(masks) / sizeof(masks[0]); i++) {
+		field = spl_cfg1 & masks[i];
+		if (field > (timing & masks[i]))
+			timing = (timing & ~masks[i]) | field;
+	}
+	return timing;
+}
+
 static int flash_nand_block_isbad(dmov_s * cmdlist, unsigned *ptrlist,
 				  unsigned page)
 {
@@ -313,26 +613,242 @@ static int flash_nand_block_isbad(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
-static int flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist,
-				  unsigned page)
+/* Interleaved mode: a block is good only if it is good on both chips.
+ * NC01 reads the marker from CS0 while NC10 reads it from CS1.
+ */
+static int flash_nand_block_isbad_interleave(dmov_s * cmdlist,
+					     unsigned *ptrlist, unsigned page)
 {
 	dmov_s *cmd = cmdlist;
 	unsigned *ptr = ptrlist;
 	unsigned *data = ptrlist + 4;
-	int isbad = 0;
+	char buf01[4];
+	char buf10[4];
+	unsigned cwperpage;
 
-	/* only allow erasing on block boundaries */
+	cwperpage = (flash_pagesize >> 9);
+
+	/* Check first page of this block */
 	if (page & 63)
-		return -1;
+		page = page - (page & 63);
 
-	/* Check for bad block and erase only if block is not marked bad */
-	isbad = flash_nand_block_isbad(cmdlist, ptrlist, page);
+	/* Check bad block marker */
+	data[0] = NAND_CMD_PAGE_READ;	/* command */
 
-	if (isbad) {
-		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
+	/* addr0 */
+	if (CFG1 & CFG1_WIDE_FLASH)
+		data[1] = (page << 16) | ((528 * (cwperpage - 1)) >> 1);
+	else
+		data[1] = (page << 16) | (528 * (cwperpage - 1));
+
+	data[2] = (page >> 16) & 0xff;	/* addr1        */
+	data[3] = 0 | 4;	/* chipsel CS0  */
+	data[4] = 0 | 5;	/* chipsel CS1  */
+	data[5] = NAND_CFG0_RAW & ~(7U << 6);	/* cfg0         */
+	data[6] = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);	/* cfg1         */
+	data[7] = 1;
+	data[8] = CLEAN_DATA_32;	/* NC01 flash status */
+	data[9] = CLEAN_DATA_32;	/* NC01 buf01 status   */
+	data[10] = CLEAN_DATA_32;	/* NC10 flash status */
+	data[11] = CLEAN_DATA_32;	/* NC10 buf10 status   */
+	data[12] = 0x00000A3C;	/* adm_mux_data_ack_req_nc01 */
+	data[13] = 0x0000053C;	/* adm_mux_cmd_ack_req_nc01  */
+	data[14] = 0x00000F28;	/* adm_mux_data_ack_req_nc10 */
+	data[15] = 0x00000F14;	/* adm_mux_cmd_ack_req_nc10  */
+	data[16] = 0x00000FC0;	/* adm_default_mux */
+	data[17] = 0x00000805;	/* enable CS1 */
+	data[18] = 0x00000801;	/* disable CS1 */
+
+	/* enable CS1 */
+	cmd[0].cmd = CMD_OCB;
+	cmd[0].src = paddr(&data[17]);
+	cmd[0].dst = EBI2_CHIP_SELECT_CFG0;
+	cmd[0].len = 4;
+
+	/* Reading last code word from NC01 */
+	/* 0xF14 */
+	cmd[1].cmd = 0;
+	cmd[1].src = paddr(&data[15]);
+	cmd[1].dst = EBI2_NAND_ADM_MUX;
+	cmd[1].len = 4;
+
+	cmd[2].cmd = DST_CRCI_NAND_CMD;
+	cmd[2].src = paddr(&data[0]);
+	cmd[2].dst = NC01(NAND_FLASH_CMD);
+	cmd[2].len = 16;
+
+	cmd[3].cmd = 0;
+	cmd[3].src = paddr(&data[5]);
+	cmd[3].dst = NC01(NAND_DEV0_CFG0);
+	cmd[3].len = 8;
+
+	cmd[4].cmd = 0;
+	cmd[4].src = paddr(&data[7]);
+	cmd[4].dst = NC01(NAND_EXEC_CMD);
+	cmd[4].len = 4;
+
+	/* 0xF28 */
+	cmd[5].cmd = 0;
+	cmd[5].src = paddr(&data[14]);
+	cmd[5].dst = EBI2_NAND_ADM_MUX;
+	cmd[5].len = 4;
+
+	cmd[6].cmd = SRC_CRCI_NAND_DATA;
+	cmd[6].src = NC01(NAND_FLASH_STATUS);
+	cmd[6].dst = paddr(&data[8]);
+	cmd[6].len = 8;
+
+	cmd[7].cmd = 0;
+	cmd[7].src =
+	    NC01(NAND_FLASH_BUFFER) + (flash_pagesize -
+				       (528 * (cwperpage - 1)));
+	cmd[7].dst = paddr(&buf01);
+	cmd[7].len = 4;
+
+	/* Reading last code word from NC10 */
+	/* 0x53C */
+	cmd[8].cmd = 0;
+	cmd[8].src = paddr(&data[13]);
+	cmd[8].dst = EBI2_NAND_ADM_MUX;
+	cmd[8].len = 4;
+
+	cmd[9].cmd = DST_CRCI_NAND_CMD;
+	cmd[9].src = paddr(&data[0]);
+	cmd[9].dst = NC10(NAND_FLASH_CMD);
+	cmd[9].len = 12;
+
+	cmd[10].cmd = 0;
+	cmd[10].src = paddr(&data[4]);
+	cmd[10].dst = NC10(NAND_FLASH_CHIP_SELECT);
+	cmd[10].len = 4;
+
+	cmd[11].cmd = 0;
+	cmd[11].src = paddr(&data[5]);
+	cmd[11].dst = NC10(NAND_DEV1_CFG0);
+	cmd[11].len = 8;
+
+	cmd[12].cmd = 0;
+	cmd[12].src = paddr(&data[7]);
+	cmd[12].dst = NC10(NAND_EXEC_CMD);
+	cmd[12].len = 4;
+
+	/* 0xA3C */
+	cmd[13].cmd = 0;
+	cmd[13].src = paddr(&data[12]);
+	cmd[13].dst = EBI2_NAND_ADM_MUX;
+	cmd[13].len = 4;
+
+	cmd[14].cmd = SRC_CRCI_NAND_DATA;
+	cmd[14].src = NC10(NAND_FLASH_STATUS);
+	cmd[14].dst = paddr(&data[10]);
+	cmd[14].len = 8;
+
+	cmd[15].cmd = 0;
+	cmd[15].src =
+	    NC10(NAND_FLASH_BUFFER) + (flash_pagesize -
+				       (528 * (cwperpage - 1)));
+	cmd[15].dst = paddr(&buf10);
+	cmd[15].len = 4;
+
+	/* adm default mux state */
+	cmd[16].cmd = 0;
+	cmd[16].src = paddr(&data[16]);
+	cmd[16].dst = EBI2_NAND_ADM_MUX;
+	cmd[16].len = 4;
+
+	/* disable CS1 */
+	cmd[17].cmd = CMD_OCU | CMD_LC;
+	cmd[17].src = paddr(&data[18]);
+	cmd[17].dst = EBI2_CHIP_SELECT_CFG0;
+	cmd[17].len = 4;
+
+	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
+
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+#if VERBOSE
+	dprintf(INFO, "NC01 status: %x\n", data[8]);
+	dprintf(INFO, "NC10 status: %x\n", data[10]);
+#endif
+
+	/* we fail if there was an operation error, a mpu error, or the
+	 ** erase success bit was not set.
+	 */
+	if ((data[8] & 0x110) || (data[10] & 0x110))
 		return -1;
+
+	/* Check for bad block marker byte on either chip */
+	if (CFG1 & CFG1_WIDE_FLASH) {
+		if ((buf01[0] != 0xFF || buf01[1] != 0xFF) ||
+		    (buf10[0] != 0xFF || buf10[1] != 0xFF))
+			return 1;
+	} else {
+		if (buf01[0] != 0xFF || buf10[0] != 0xFF)
+			return 1;
 	}
 
+	return 0;
+}
+
+/* Read the bad block marker(s) from the flash itself */
+static int flash_block_isbad_marker(dmov_s * cmdlist, unsigned *ptrlist,
+				    unsigned page)
+{
+	if (interleaved_mode)
+		return flash_nand_block_isbad_interleave(cmdlist, ptrlist,
+							 page);
+	return flash_nand_block_isbad(cmdlist, ptrlist, page);
+}
+
+/* In-RAM bad block table, one bit per block.  It is built once by
+ * flash_init() and kept up to date by the erase and write paths, so the
+ * bad block marker does not have to be re-read for every page.
+ */
+static unsigned *flash_bbt;
+static unsigned flash_bbt_words;
+
+static void flash_bbt_mark_bad(dmov_s * cmdlist, unsigned *ptrlist,
+			       unsigned page);
+
+static int flash_bbt_isbad(dmov_s * cmdlist, unsigned *ptrlist,
+			   unsigned page)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_bbt || block >= flash_info.num_blocks)
+		return flash_block_isbad_marker(cmdlist, ptrlist, page);
+	return (flash_bbt[block >> 5] >> (block & 31)) & 1;
+}
+
+/* Blocks erased since flash_init() and not programmed since, one bit per
+ * block.  Differential writes use it to skip redundant erases.
+ */
+static unsigned *flash_erased;
+
+static void flash_erased_set(unsigned page, int erased)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_erased || block >= flash_info.num_blocks)
+		return;
+	if (erased)
+		flash_erased[block >> 5] |= 1U << (block & 31);
+	else
+		flash_erased[block >> 5] &= ~(1U << (block & 31));
+}
+
+static int flash_block_erased(unsigned page)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_erased || block >= flash_info.num_blocks)
+		return 0;
+	return (flash_erased[block >> 5] >> (block & 31)) & 1;
+}
+
+/* Command list erasing the block at 'page', status in data[5] */
+static void flash_nand_build_erase(dmov_s * cmd, unsigned *data, unsigned page)
+{
 	/* Erase block */
 	data[0] = NAND_CMD_BLOCK_ERASE;
 	data[1] = page;
@@ -374,6 +890,37 @@ static int flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist,
 	cmd[5].src = paddr(&data[9]);
 	cmd[5].dst = NAND_READ_STATUS;
 	cmd[5].len = 4;
+}
+
+static int flash_nand_erase_failed(const unsigned *data)
+{
+	/* we fail if there was an operation error, a mpu error, or the
+	 ** erase success bit was not set.
+	 */
+	return (data[5] & 0x110) || !(data[5] & 0x80);
+}
+
+static int flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist,
+				  unsigned page)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned *ptr = ptrlist;
+	unsigned *data = ptrlist + 4;
+	int isbad = 0;
+
+	/* only allow erasing on block boundaries */
+	if (page & 63)
+		return -1;
+
+	/* Check for bad block and erase only if block is not marked bad */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+
+	if (isbad) {
+		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
+		return -1;
+	}
+
+	flash_nand_build_erase(cmd, data, page);
 
 	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
 
@@ -383,14 +930,177 @@ static int flash_nand_erase_block(dmov_s * cmdlist, unsigned *ptrlist,
 	dprintf(INFO, "status: %x\n", data[5]);
 #endif
 
-	/* we fail if there was an operation error, a mpu error, or the
-	 ** erase success bit was not set.
-	 */
-	if (data[5] & 0x110)
-		return -1;
-	if (!(data[5] & 0x80))
+	if (flash_nand_erase_failed(data)) {
+		flash_bbt_mark_bad(cmdlist, ptrlist, page);
 		return -1;
+	}
 
+	flash_erased_set(page, 1);
+	return 0;
+}
+
+/* Interleaved mode: erase the block on both chips at once, NC01 driving
+ * CS0 and NC10 driving CS1.  Statuses land in data[6] and data[7].
+ */
+static void flash_nand_build_erase_interleave(dmov_s * cmd, unsigned *data,
+					      unsigned page)
+{
+	/* Erase block */
+	data[0] = NAND_CMD_BLOCK_ERASE;
+	data[1] = page;
+	data[2] = 0;
+	data[3] = 0 | 4;	/* chipselect CS0 */
+	data[4] = 0 | 5;	/* chipselect CS1 */
+	data[5] = 1;
+	data[6] = 0xeeeeeeee;
+	data[7] = 0xeeeeeeee;
+	data[8] = CFG0 & (~(7 << 6));	/* CW_PER_PAGE = 0 */
+	data[9] = CFG1;
+	data[10] = 0x00000A3C;	/* adm_mux_data_ack_req_nc01 */
+	data[11] = 0x0000053C;	/* adm_mux_cmd_ack_req_nc01  */
+	data[12] = 0x00000F28;	/* adm_mux_data_ack_req_nc10 */
+	data[13] = 0x00000F14;	/* adm_mux_cmd_ack_req_nc10  */
+	data[14] = 0x00000FC0;	/* adm_default_mux */
+	data[15] = 0x00000805;	/* enable CS1 */
+	data[16] = 0x00000801;	/* disable CS1 */
+
+	/* enable CS1 */
+	cmd[0].cmd = CMD_OCB;
+	cmd[0].src = paddr(&data[15]);
+	cmd[0].dst = EBI2_CHIP_SELECT_CFG0;
+	cmd[0].len = 4;
+
+	/* erase command to NC01 */
+	/* 0xF14 */
+	cmd[1].cmd = 0;
+	cmd[1].src = paddr(&data[13]);
+	cmd[1].dst = EBI2_NAND_ADM_MUX;
+	cmd[1].len = 4;
+
+	cmd[2].cmd = DST_CRCI_NAND_CMD;
+	cmd[2].src = paddr(&data[0]);
+	cmd[2].dst = NC01(NAND_FLASH_CMD);
+	cmd[2].len = 16;
+
+	cmd[3].cmd = 0;
+	cmd[3].src = paddr(&data[8]);
+	cmd[3].dst = NC01(NAND_DEV0_CFG0);
+	cmd[3].len = 8;
+
+	cmd[4].cmd = 0;
+	cmd[4].src = paddr(&data[5]);
+	cmd[4].dst = NC01(NAND_EXEC_CMD);
+	cmd[4].len = 4;
+
+	/* erase command to NC10, while NC01 is busy */
+	/* 0x53C */
+	cmd[5].cmd = 0;
+	cmd[5].src = paddr(&data[11]);
+	cmd[5].dst = EBI2_NAND_ADM_MUX;
+	cmd[5].len = 4;
+
+	cmd[6].cmd = DST_CRCI_NAND_CMD;
+	cmd[6].src = paddr(&data[0]);
+	cmd[6].dst = NC10(NAND_FLASH_CMD);
+	cmd[6].len = 12;
+
+	cmd[7].cmd = 0;
+	cmd[7].src = paddr(&data[4]);
+	cmd[7].dst = NC10(NAND_FLASH_CHIP_SELECT);
+	cmd[7].len = 4;
+
+	cmd[8].cmd = 0;
+	cmd[8].src = paddr(&data[8]);
+	cmd[8].dst = NC10(NAND_DEV1_CFG0);
+	cmd[8].len = 8;
+
+	cmd[9].cmd = 0;
+	cmd[9].src = paddr(&data[5]);
+	cmd[9].dst = NC10(NAND_EXEC_CMD);
+	cmd[9].len = 4;
+
+	/* 0xF28 */
+	cmd[10].cmd = 0;
+	cmd[10].src = paddr(&data[12]);
+	cmd[10].dst = EBI2_NAND_ADM_MUX;
+	cmd[10].len = 4;
+
+	cmd[11].cmd = SRC_CRCI_NAND_DATA;
+	cmd[11].src = NC01(NAND_FLASH_STATUS);
+	cmd[11].dst = paddr(&data[6]);
+	cmd[11].len = 4;
+
+	/* 0xA3C */
+	cmd[12].cmd = 0;
+	cmd[12].src = paddr(&data[10]);
+	cmd[12].dst = EBI2_NAND_ADM_MUX;
+	cmd[12].len = 4;
+
+	cmd[13].cmd = SRC_CRCI_NAND_DATA;
+	cmd[13].src = NC10(NAND_FLASH_STATUS);
+	cmd[13].dst = paddr(&data[7]);
+	cmd[13].len = 4;
+
+	/* adm default mux state */
+	/* 0xFC0 */
+	cmd[14].cmd = 0;
+	cmd[14].src = paddr(&data[14]);
+	cmd[14].dst = EBI2_NAND_ADM_MUX;
+	cmd[14].len = 4;
+
+	/* disable CS1 */
+	cmd[15].cmd = CMD_OCU | CMD_LC;
+	cmd[15].src = paddr(&data[16]);
+	cmd[15].dst = EBI2_CHIP_SELECT_CFG0;
+	cmd[15].len = 4;
+}
+
+static int flash_nand_erase_failed_interleave(const unsigned *data)
+{
+	/* we fail if there was an operation error, a mpu error, or the
+	 ** erase success bit was not set, on either chip.
+	 */
+	return (data[6] & 0x110) || !(data[6] & 0x80) ||
+	    (data[7] & 0x110) || !(data[7] & 0x80);
+}
+
+static int flash_nand_erase_block_interleave(dmov_s * cmdlist,
+					     unsigned *ptrlist, unsigned page)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned *ptr = ptrlist;
+	unsigned *data = ptrlist + 4;
+	int isbad = 0;
+
+	/* only allow erasing on block boundaries */
+	if (page & 63)
+		return -1;
+
+	/* Check for bad block and erase only if block is not marked bad */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+
+	if (isbad) {
+		dprintf(INFO, "skipping @ %d (bad block)\n", page >> 6);
+		return -1;
+	}
+
+	flash_nand_build_erase_interleave(cmd, data, page);
+
+	ptr[0] = (paddr(cmd) >> 3) | CMD_PTR_LP;
+
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+#if VERBOSE
+	dprintf(INFO, "NC01 status: %x\n", data[6]);
+	dprintf(INFO, "NC10 status: %x\n", data[7]);
+#endif
+
+	if (flash_nand_erase_failed_interleave(data)) {
+		flash_bbt_mark_bad(cmdlist, ptrlist, page);
+		return -1;
+	}
+
+	flash_erased_set(page, 1);
 	return 0;
 }
 
@@ -406,22 +1116,163 @@ struct data_flash_io {
 	unsigned ecc_cfg_save;
 	unsigned clrfstatus;
 	unsigned clrrstatus;
+	unsigned dev_cmd0;	/* program confirm opcode for this page */
+	unsigned dev_cmd0_restore;
 	struct {
 		unsigned flash_status;
 		unsigned buffer_status;
 	} result[8];
 };
 
-static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
-				 unsigned page, void *_addr, void *_spareaddr)
+/* Interleaved mode: nc[0] is issued to NC01 for CS0, nc[1] to NC10 for
+ * CS1.  Each chip keeps the plain WinCE page layout.
+ */
+struct interleave_data_flash_io {
+	struct data_flash_io nc[2];
+	unsigned ebi2_chip_select_cfg0;
+	unsigned adm_mux_data_ack_req_nc01;
+	unsigned adm_mux_cmd_ack_req_nc01;
+	unsigned adm_mux_data_ack_req_nc10;
+	unsigned adm_mux_cmd_ack_req_nc10;
+	unsigned adm_default_mux;
+	unsigned default_ebi2_chip_select_cfg0;
+};
+
+static void flash_nand_interleave_setup(struct interleave_data_flash_io *data,
+					unsigned cmd, unsigned page,
+					unsigned cfg0, unsigned cfg1)
+{
+	unsigned c;
+
+	for (c = 0; c < 2; c++) {
+		data->nc[c].cmd = cmd;
+		data->nc[c].addr0 = page << 16;
+		data->nc[c].addr1 = (page >> 16) & 0xff;
+		data->nc[c].chipsel = 0 | 4 | c;	/* CS0/CS1 + undoc bit */
+		data->nc[c].cfg0 = cfg0;
+		data->nc[c].cfg1 = cfg1;
+		data->nc[c].exec = 1;
+		data->nc[c].ecc_cfg = 0x1FF;
+		data->nc[c].clrfstatus = 0x00000020;
+		data->nc[c].clrrstatus = 0x000000C0;
+	}
+
+	data->ebi2_chip_select_cfg0 = 0x00000805;	/* enable CS1 */
+	data->adm_mux_data_ack_req_nc01 = 0x00000A3C;
+	data->adm_mux_cmd_ack_req_nc01 = 0x0000053C;
+	data->adm_mux_data_ack_req_nc10 = 0x00000F28;
+	data->adm_mux_cmd_ack_req_nc10 = 0x00000F14;
+	data->adm_default_mux = 0x00000FC0;
+	data->default_ebi2_chip_select_cfg0 = 0x00000801;	/* disable CS1 */
+}
+
+/* Commands shared by the interleaved read and write lists: enable CS1,
+ * save the ecc config and program both controllers.
+ */
+static dmov_s *flash_nand_interleave_prologue(dmov_s * cmd,
+					      struct interleave_data_flash_io
+					      *data)
+{
+	/* enable CS1 */
+	cmd->cmd = CMD_OCB;
+	cmd->src = paddr(&data->ebi2_chip_select_cfg0);
+	cmd->dst = EBI2_CHIP_SELECT_CFG0;
+	cmd->len = 4;
+	cmd++;
+
+	/* save existing ecc config */
+	cmd->cmd = 0;
+	cmd->src = NAND_EBI2_ECC_BUF_CFG;
+	cmd->dst = paddr(&data->nc[0].ecc_cfg_save);
+	cmd->len = 4;
+	cmd++;
+
+	/* config DEV0 for CS0 */
+	cmd->cmd = 0;
+	cmd->src = paddr(&data->nc[0].cfg0);
+	cmd->dst = NC01(NAND_DEV0_CFG0);
+	cmd->len = 8;
+	cmd++;
+
+	/* config DEV1 for CS1 */
+	cmd->cmd = 0;
+	cmd->src = paddr(&data->nc[1].cfg0);
+	cmd->dst = NC10(NAND_DEV1_CFG0);
+	cmd->len = 8;
+	cmd++;
+
+	/* set our ecc config on both controllers */
+	cmd->cmd = 0;
+	cmd->src = paddr(&data->nc[0].ecc_cfg);
+	cmd->dst = NC11(NAND_EBI2_ECC_BUF_CFG);
+	cmd->len = 4;
+	cmd++;
+
+	return cmd;
+}
+
+static dmov_s *flash_nand_interleave_epilogue(dmov_s * cmd,
+					      struct interleave_data_flash_io
+					      *data)
+{
+	/* restore saved ecc config */
+	cmd->cmd = 0;
+	cmd->src = paddr(&data->nc[0].ecc_cfg_save);
+	cmd->dst = NAND_EBI2_ECC_BUF_CFG;
+	cmd->len = 4;
+	cmd++;
+
+	/* ADM --> Default mux state (0xFC0) */
+	cmd->cmd = 0;
+	cmd->src = paddr(&data->adm_default_mux);
+	cmd->dst = EBI2_NAND_ADM_MUX;
+	cmd->len = 4;
+	cmd++;
+
+	/* disable CS1 */
+	cmd->cmd = CMD_OCU | CMD_LC;
+	cmd->src = paddr(&data->default_ebi2_chip_select_cfg0);
+	cmd->dst = EBI2_CHIP_SELECT_CFG0;
+	cmd->len = 4;
+	cmd++;
+
+	return cmd;
+}
+
+/* Single page command list templates.  The descriptors of a page read or
+ * program only depend on the page geometry and the mode, so flash_init()
+ * builds one list per mode and each operation only patches the page
+ * address, the register values and the buffer pointers.
+ */
+#define PAGE_TMPL_READ		0
+#define PAGE_TMPL_WRITE		1
+#define PAGE_TMPL_WRITE_RAW	2
+#define PAGE_TMPL_COUNT		3
+#define PAGE_TMPL_CMDS		64
+
+struct page_tmpl {
+	dmov_s *cmdlist;
+	struct data_flash_io *data;
+	dmov_s *buf[8];		/* data transfer of each codeword */
+	dmov_s *spare[8];	/* spare transfer of each codeword */
+	int cache;		/* DEV_CMD0 confirm opcode is written */
+};
+
+static struct page_tmpl page_tmpl[PAGE_TMPL_COUNT];
+
+/* Build the command list that reads one page (data + spare) into the
+ * given buffers.  The list is terminated with CMD_LC; returns the number
+ * of commands used.  If 't' is given the transfers are recorded there so
+ * the list can be reused for other pages.
+ */
+static unsigned flash_nand_build_read_page(dmov_s * cmdlist,
+					   struct data_flash_io *data,
+					   unsigned page, unsigned addr,
+					   unsigned spareaddr,
+					   struct page_tmpl *t)
 {
 	dmov_s *cmd = cmdlist;
-	unsigned *ptr = ptrlist;
-	struct data_flash_io *data = (void *)(ptrlist + 4);
-	unsigned addr = (unsigned)_addr;
-	unsigned spareaddr = (unsigned)_spareaddr;
 	unsigned n;
-	int isbad = 0;
 	unsigned cwperpage;
 	unsigned cwdatasize;
 	unsigned cwoobsize;
@@ -429,13 +1280,6 @@ static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	cwdatasize = flash_pagesize / cwperpage;
 	cwoobsize = /*oobavail */ 16 / cwperpage;	//spare size - ecc size (64 - 4*10)
 
-	/* Check for bad block and read only from a good block */
-	isbad = flash_nand_block_isbad(cmdlist, ptrlist, page);
-	if (isbad) {
-		dprintf(INFO, "bad block %x:\n", page);
-		return -2;
-	}
-
 	data->cmd = NAND_CMD_PAGE_READ_ALL;
 	data->addr0 = page << 16;
 	data->addr1 = (page >> 16) & 0xff;
@@ -494,6 +1338,8 @@ static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 		cmd++;
 
 		/* read data block */
+		if (t)
+			t->buf[n] = cmd;
 		cmd->cmd = 0;
 		cmd->src = NAND_FLASH_BUFFER;
 		cmd->dst = addr + n * cwdatasize;
@@ -501,6 +1347,8 @@ static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 		cmd++;
 
 		/* read extra data */
+		if (t)
+			t->spare[n] = cmd;
 		cmd->cmd = 0;
 		cmd->src = NAND_FLASH_BUFFER + cwdatasize + 10;	// adter data and 10 bytes of ECC
 		cmd->dst = spareaddr + n * cwoobsize;
@@ -513,8 +1361,141 @@ static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	cmd->src = paddr(&data->ecc_cfg_save);
 	cmd->dst = NAND_EBI2_ECC_BUF_CFG;
 	cmd->len = 4;
+	cmd++;
 
-	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+	return cmd - cmdlist;
+}
+
+/* controller serving chip select c in interleaved mode */
+#define NC(c, reg) ((c) ? NC10(reg) : NC01(reg))
+
+/* Interleaved version of flash_nand_build_read_page: both chips read the
+ * same page, CS0 into addr and CS1 into addr + flash_pagesize.  Each
+ * codeword is started on both controllers before either is drained.
+ * The spare bytes of CS1 follow those of CS0.
+ */
+static unsigned flash_nand_build_read_page_interleave(dmov_s * cmdlist,
+						      struct
+						      interleave_data_flash_io
+						      *data, unsigned page,
+						      unsigned addr,
+						      unsigned spareaddr)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned n, c;
+	unsigned cwperpage;
+	unsigned cwdatasize;
+	unsigned cwoobsize;
+	cwperpage = (flash_pagesize >> 9);
+	cwdatasize = flash_pagesize / cwperpage;
+	cwoobsize = /*oobavail */ 16 / cwperpage;
+
+	flash_nand_interleave_setup(data, NAND_CMD_PAGE_READ_ALL, page,
+				    (CFG0 & ~(7U << 6)) |
+				    ((cwperpage - 1) << 6), CFG1);
+
+	cmd = flash_nand_interleave_prologue(cmd, data);
+
+	for (n = 0; n < cwperpage; n++) {
+		for (c = 0; c < 2; c++) {
+			/* MASK CMD ACK/REQ of the other controller
+			 * (0xF14 for NC01, 0x53C for NC10)
+			 */
+			cmd->cmd = 0;
+			cmd->src = c ? paddr(&data->adm_mux_cmd_ack_req_nc01)
+			    : paddr(&data->adm_mux_cmd_ack_req_nc10);
+			cmd->dst = EBI2_NAND_ADM_MUX;
+			cmd->len = 4;
+			cmd++;
+
+			/* CMD / ADDR0 / ADDR1 / CHIPSEL */
+			cmd->cmd = DST_CRCI_NAND_CMD;
+			cmd->src = paddr(&data->nc[c].cmd);
+			cmd->dst = NC(c, NAND_FLASH_CMD);
+			cmd->len = ((n == 0) ? 16 : 4);
+			cmd++;
+
+			/* kick the execute register */
+			cmd->cmd = 0;
+			cmd->src = paddr(&data->nc[c].exec);
+			cmd->dst = NC(c, NAND_EXEC_CMD);
+			cmd->len = 4;
+			cmd++;
+		}
+
+		for (c = 0; c < 2; c++) {
+			/* MASK DATA ACK/REQ of the other controller
+			 * (0xF28 for NC01, 0xA3C for NC10)
+			 */
+			cmd->cmd = 0;
+			cmd->src = c ? paddr(&data->adm_mux_data_ack_req_nc01)
+			    : paddr(&data->adm_mux_data_ack_req_nc10);
+			cmd->dst = EBI2_NAND_ADM_MUX;
+			cmd->len = 4;
+			cmd++;
+
+			/* block on data ready, then read the status register */
+			cmd->cmd = SRC_CRCI_NAND_DATA;
+			cmd->src = NC(c, NAND_FLASH_STATUS);
+			cmd->dst = paddr(&data->nc[c].result[n]);
+			cmd->len = 8;
+			cmd++;
+
+			/* read data block */
+			cmd->cmd = 0;
+			cmd->src = NC(c, NAND_FLASH_BUFFER);
+			cmd->dst = addr + c * flash_pagesize + n * cwdatasize;
+			cmd->len = cwdatasize;
+			cmd++;
+
+			/* read extra data */
+			cmd->cmd = 0;
+			cmd->src = NC(c, NAND_FLASH_BUFFER) + cwdatasize + 10;
+			cmd->dst = spareaddr + c * 16 + n * cwoobsize;
+			cmd->len = cwoobsize;
+			cmd++;
+		}
+	}
+
+	cmd = flash_nand_interleave_epilogue(cmd, data);
+
+	return cmd - cmdlist;
+}
+
+static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
+				 unsigned page, void *_addr, void *_spareaddr)
+{
+	unsigned *ptr = ptrlist;
+	struct page_tmpl *t = &page_tmpl[PAGE_TMPL_READ];
+	struct data_flash_io *data = t->data;
+	unsigned addr = (unsigned)_addr;
+	unsigned spareaddr = (unsigned)_spareaddr;
+	unsigned n;
+	int isbad = 0;
+	unsigned cwperpage;
+	unsigned cwdatasize;
+	unsigned cwoobsize;
+	cwperpage = (flash_pagesize >> 9);
+	cwdatasize = flash_pagesize / cwperpage;
+	cwoobsize = 16 / cwperpage;
+
+	/* Check for bad block and read only from a good block */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+	if (isbad) {
+		dprintf(INFO, "bad block %x:\n", page);
+		return -2;
+	}
+
+	data->addr0 = page << 16;
+	data->addr1 = (page >> 16) & 0xff;
+	data->cfg0 = (CFG0 & ~(7U << 6)) | ((cwperpage - 1) << 6);
+	data->cfg1 = CFG1;
+	for (n = 0; n < cwperpage; n++) {
+		t->buf[n]->dst = addr + n * cwdatasize;
+		t->spare[n]->dst = spareaddr + n * cwoobsize;
+	}
+
+	ptr[0] = (paddr(t->cmdlist) >> 3) | CMD_PTR_LP;
 
 	int result = dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
 	if (result != 0) {
@@ -547,44 +1528,322 @@ static int _flash_nand_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
-static int _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist,
-				  unsigned page, const void *_addr,
-				  const void *_spareaddr, unsigned raw_mode)
+static int flash_nand_read_page_interleave(dmov_s * cmdlist,
+					   unsigned *ptrlist, unsigned page,
+					   void *_addr, void *_spareaddr)
 {
-	dmov_s *cmd = cmdlist;
 	unsigned *ptr = ptrlist;
-	struct data_flash_io *data = (void *)(ptrlist + 4);
-	unsigned addr = (unsigned)_addr;
-	unsigned spareaddr = (unsigned)_spareaddr;
+	struct interleave_data_flash_io *data = (void *)(ptrlist + 4);
+	unsigned n, c;
+	int isbad = 0;
+	unsigned cwperpage;
+	cwperpage = (flash_pagesize >> 9);
+
+	/* Check for bad block and read only from a good block */
+	isbad = flash_bbt_isbad(cmdlist, ptrlist, page);
+	if (isbad) {
+		dprintf(INFO, "bad block %x:\n", page);
+		return -2;
+	}
+
+	flash_nand_build_read_page_interleave(cmdlist, data, page,
+					      (unsigned)_addr,
+					      (unsigned)_spareaddr);
+
+	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+
+	if (dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr)) {
+		dprintf(CRITICAL, "read page failed %x (block %x)\n", page,
+			page >> 6);
+		return -1;
+	}
+
+	/* if any of the reads failed (0x10), or there was a
+	 ** protection violation (0x100), on either chip, we lose
+	 */
+	for (n = 0; n < cwperpage; n++) {
+		for (c = 0; c < 2; c++) {
+			if (data->nc[c].result[n].flash_status & 0x110)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Sequential reads chain up to READ_CHAIN_PAGES page command lists behind
+ * a single DMOV command-pointer list, so the data mover walks a run of
+ * pages without a CPU round trip in between.  Each pipeline slot has its
+ * own set of chain buffers (see nand_pipe.h).
+ */
+#define READ_CHAIN_PAGES	32
+#define READ_CHAIN_CMDS		(4 + 5 * 8)	/* per page, 8 cw for 4k pages */
+#define READ_CHAIN_CMDS_INTERLEAVE	(8 + 14 * 8)
+#define READ_CHAIN_SPARE	128	/* spare slot per page */
+#define READ_DMA_ALIGN		8	/* destinations the data mover can hit */
+
+/* Interleaved pages need more commands and status words each, so the
+ * same command space holds fewer of them.
+ */
+static unsigned chain_pages = READ_CHAIN_PAGES;
+static unsigned chain_cmds = READ_CHAIN_CMDS;
+
+static unsigned *chain_ptrlist[NAND_PIPE_DEPTH];
+static dmov_s *chain_cmdlist[NAND_PIPE_DEPTH];
+static void *chain_data[NAND_PIPE_DEPTH];
+static unsigned char *chain_spare[NAND_PIPE_DEPTH];
+
+/* Command lists around a cache read chain.  The first page is loaded
+ * with a plain READ PAGE of one raw codeword that is not transferred.
+ * Every page but the last is then read with READ CACHE SEQUENTIAL and
+ * the last with READ CACHE END, each returning the page loaded before
+ * it (see platform/nand.h).  The plain read opcodes are restored after
+ * the chain.
+ */
+#define CHAIN_CACHE_LOAD_CMDS	6
+
+struct chain_cache_io {
+	dmov_s load[CHAIN_CACHE_LOAD_CMDS];	/* first page, then 31h */
+	dmov_s end;		/* 3Fh before the last page */
+	dmov_s restore[2];
+	unsigned cmd;
+	unsigned addr0;
+	unsigned addr1;
+	unsigned chipsel;
+	unsigned cfg0;
+	unsigned cfg1;
+	unsigned exec;
+	struct {
+		unsigned flash_status;
+		unsigned buffer_status;
+	} result;
+	unsigned dev_cmd1[3];	/* 31h, 3Fh, plain */
+	unsigned dev_cmd_vld[2];	/* no confirm, plain */
+	int active;		/* the last chain of the slot used them */
+};
+
+static struct chain_cache_io *chain_cache[NAND_PIPE_DEPTH];
+
+static void flash_nand_chain_cache(unsigned slot, unsigned page)
+{
+	struct chain_cache_io *io = chain_cache[slot];
+	dmov_s *cmd = io->load;
+	unsigned read = flash_dev_cmd1 & ~NAND_DEV_CMD1_READ_ADDR(0xFF);
+
+	io->cmd = NAND_CMD_PAGE_READ;
+	io->addr0 = page << 16;
+	io->addr1 = (page >> 16) & 0xff;
+	io->chipsel = 0 | 4;
+	io->cfg0 = NAND_CFG0_RAW & ~(7U << 6);	/* one codeword */
+	io->cfg1 = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);
+	io->exec = 1;
+	io->result.flash_status = CLEAN_DATA_32;
+	io->result.buffer_status = CLEAN_DATA_32;
+
+	io->dev_cmd1[0] = read |
+	    NAND_DEV_CMD1_READ_ADDR(NAND_DEVCMD_READ_CACHE_SEQ);
+	io->dev_cmd1[1] = read |
+	    NAND_DEV_CMD1_READ_ADDR(NAND_DEVCMD_READ_CACHE_END);
+	io->dev_cmd1[2] = flash_dev_cmd1;
+	io->dev_cmd_vld[0] = flash_dev_cmd_vld & ~NAND_DEV_CMD_VLD_READ_START;
+	io->dev_cmd_vld[1] = flash_dev_cmd_vld;
+
+	/* 00h-address-30h: the page register holds the first page */
+	cmd[0].cmd = DST_CRCI_NAND_CMD | CMD_OCB;
+	cmd[0].src = paddr(&io->cmd);
+	cmd[0].dst = NAND_FLASH_CMD;
+	cmd[0].len = 16;
+
+	cmd[1].cmd = 0;
+	cmd[1].src = paddr(&io->cfg0);
+	cmd[1].dst = NAND_DEV0_CFG0;
+	cmd[1].len = 8;
+
+	cmd[2].cmd = 0;
+	cmd[2].src = paddr(&io->exec);
+	cmd[2].dst = NAND_EXEC_CMD;
+	cmd[2].len = 4;
+
+	cmd[3].cmd = SRC_CRCI_NAND_DATA;
+	cmd[3].src = NAND_FLASH_STATUS;
+	cmd[3].dst = paddr(&io->result);
+	cmd[3].len = 8;
+
+	/* the page reads that follow send a bare 31h */
+	cmd[4].cmd = 0;
+	cmd[4].src = paddr(&io->dev_cmd_vld[0]);
+	cmd[4].dst = NAND_DEV_CMD_VLD;
+	cmd[4].len = 4;
+
+	cmd[5].cmd = CMD_OCU | CMD_LC;
+	cmd[5].src = paddr(&io->dev_cmd1[0]);
+	cmd[5].dst = NAND_DEV_CMD1;
+	cmd[5].len = 4;
+
+	io->end.cmd = CMD_OCB | CMD_OCU | CMD_LC;
+	io->end.src = paddr(&io->dev_cmd1[1]);
+	io->end.dst = NAND_DEV_CMD1;
+	io->end.len = 4;
+
+	io->restore[0].cmd = CMD_OCB;
+	io->restore[0].src = paddr(&io->dev_cmd1[2]);
+	io->restore[0].dst = NAND_DEV_CMD1;
+	io->restore[0].len = 4;
+
+	io->restore[1].cmd = CMD_OCU | CMD_LC;
+	io->restore[1].src = paddr(&io->dev_cmd_vld[1]);
+	io->restore[1].dst = NAND_DEV_CMD_VLD;
+	io->restore[1].len = 4;
+}
+
+/* Build the chained command list reading 'count' consecutive pages of
+ * one block into pipeline slot 'slot'.  Page n lands at data + n * stride,
+ * its spare bytes in the slot's spare buffer.  Bad block checks are left
+ * to the caller.  With cache reads the next page is loaded by the device
+ * while the current one is transferred.
+ */
+static unsigned *flash_nand_chain_prepare(unsigned slot, unsigned page,
+					  unsigned count, unsigned char *data,
+					  unsigned stride)
+{
+	struct data_flash_io *io = chain_data[slot];
+	struct interleave_data_flash_io *iio = chain_data[slot];
+	unsigned *ptr = chain_ptrlist[slot];
+	dmov_s *cmd;
+	unsigned dst, spare;
+	unsigned n;
+	int cache;
+
+	ASSERT(count > 0 && count <= chain_pages);
+	ASSERT((page & 63) + count <= 64);
+
+	cache = (flash_cache & FLASH_CACHE_READ) && count > 1;
+	chain_cache[slot]->active = cache;
+	if (cache) {
+		flash_nand_chain_cache(slot, page);
+		*ptr++ = paddr(chain_cache[slot]->load) >> 3;
+	}
+
+	for (n = 0; n < count; n++) {
+		cmd = chain_cmdlist[slot] + n * chain_cmds;
+		dst = paddr(data + n * stride);
+		spare = paddr(chain_spare[slot] + n * READ_CHAIN_SPARE);
+		if (interleaved_mode)
+			flash_nand_build_read_page_interleave(cmd, &iio[n],
+							      page + n, dst,
+							      spare);
+		else
+			flash_nand_build_read_page(cmd, &io[n], page + n, dst,
+						   spare, NULL);
+		if (cache) {
+			/* 31h and 3Fh take no address */
+			io[n].cfg0 &= ~NAND_CFG0_ADDR_CYCLES(7);
+			if (n == count - 1)
+				*ptr++ = paddr(&chain_cache[slot]->end) >> 3;
+		}
+		*ptr++ = paddr(cmd) >> 3;
+	}
+	if (cache)
+		*ptr++ = paddr(chain_cache[slot]->restore) >> 3;
+	ptr[-1] |= CMD_PTR_LP;
+
+	return chain_ptrlist[slot];
+}
+
+/* Returns the number of pages of a completed chain read before the first
+ * page with a failed codeword.
+ */
+static int flash_nand_chain_check(unsigned slot, unsigned count)
+{
+	struct data_flash_io *io = chain_data[slot];
+	struct interleave_data_flash_io *iio = chain_data[slot];
+	unsigned n, cw;
+	unsigned cwperpage;
+	cwperpage = (flash_pagesize >> 9);
+
+	/* the load of the first page behind a cache read failed */
+	if (chain_cache[slot]->active &&
+	    (chain_cache[slot]->result.flash_status & 0x110))
+		return 0;
+
+	/* stop at the first page with an operation error (0x10) or
+	 ** a protection violation (0x100), on either chip if interleaved
+	 */
+	for (n = 0; n < count; n++) {
+		for (cw = 0; cw < cwperpage; cw++) {
+			if (!interleaved_mode) {
+				if (io[n].result[cw].flash_status & 0x110)
+					return n;
+				continue;
+			}
+			if ((iio[n].nc[0].result[cw].flash_status & 0x110) ||
+			    (iio[n].nc[1].result[cw].flash_status & 0x110))
+				return n;
+		}
+	}
+
+	return count;
+}
+
+static void *flash_nand_chain_spare(unsigned slot, unsigned n)
+{
+	return chain_spare[slot] + n * READ_CHAIN_SPARE;
+}
+
+/* Synchronous chained read through slot 0.  Returns the number of pages
+ * read before the first failing one, or -1 if the data mover reported an
+ * error.
+ */
+static int flash_nand_read_chain(unsigned page, unsigned count,
+				 unsigned char *data, unsigned stride)
+{
+	unsigned *ptrlist;
+
+	ptrlist = flash_nand_chain_prepare(0, page, count, data, stride);
+	if (dmov_exec_cmdptr(DMOV_NAND_CHAN, ptrlist)) {
+		dprintf(CRITICAL, "read chain failed %x+%d (block %x)\n",
+			page, count, page >> 6);
+		return -1;
+	}
+
+	return flash_nand_chain_check(0, count);
+}
+
+/* With 'cache' set the page is confirmed with PROGRAM PAGE CACHE: the
+ * status comes back once the device has latched the data, and the next
+ * page can be loaded while this one is programmed.  The last page of a
+ * run must go without it.
+ */
+/* Build the program template for 'mode' (PAGE_TMPL_WRITE*).  Templates
+ * of parts with PROGRAM PAGE CACHE always carry the DEV_CMD0 writes; a
+ * plain program just confirms with the default opcode.
+ */
+static void flash_nand_build_write_page(struct page_tmpl *t, unsigned mode)
+{
+	dmov_s *cmd = t->cmdlist;
+	struct data_flash_io *data = t->data;
 	unsigned n;
 	unsigned cwperpage;
 	unsigned cwdatasize;
 	unsigned cwoobsize;
+	unsigned raw_mode = (mode == PAGE_TMPL_WRITE_RAW);
+	int cache = !raw_mode && (flash_cache & FLASH_CACHE_PROGRAM);
 	cwperpage = (flash_pagesize >> 9);
 	cwdatasize = flash_pagesize / cwperpage;
 	cwoobsize = /*oobavail */ 16 / cwperpage;	//spare size - ecc size (64 - 4*10)
 
 	data->cmd = NAND_CMD_PRG_PAGE_ALL;
-	data->addr0 = page << 16;
-	data->addr1 = (page >> 16) & 0xff;
 	data->chipsel = 0 | 4;	/* flash0 + undoc bit */
 	data->clrfstatus = 0x00000020;
 	data->clrrstatus = 0x000000C0;
 
-	if (!raw_mode) {
-		data->cfg0 = CFG0;
-		data->cfg1 = CFG1;
-	} else {
-		data->cfg0 =
-		    (NAND_CFG0_RAW & ~(7 << 6)) | ((cwperpage - 1) << 6);
-		data->cfg1 = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);
-	}
-
 	/* GO bit for the EXEC register */
 	data->exec = 1;
 
 	data->ecc_cfg = 0x1FF;
 
+	t->cache = cache;
+
 	/* save existing ecc config */
 	cmd->cmd = CMD_OCB;
 	cmd->src = NAND_EBI2_ECC_BUF_CFG;
@@ -614,24 +1873,34 @@ static int _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist,
 			cmd->dst = NAND_EBI2_ECC_BUF_CFG;
 			cmd->len = 4;
 			cmd++;
+
+			if (cache) {
+				/* confirm opcode of this page */
+				cmd->cmd = 0;
+				cmd->src = paddr(&data->dev_cmd0);
+				cmd->dst = NAND_DEV_CMD0;
+				cmd->len = 4;
+				cmd++;
+			}
 		}
 
-		/* write data block */
+		/* write data block, source patched per page */
+		t->buf[n] = cmd;
 		cmd->cmd = 0;
+		cmd->src = 0;
 		cmd->dst = NAND_FLASH_BUFFER;
-		if (!raw_mode) {
-			cmd->src = addr + n * cwdatasize;
+		if (!raw_mode)
 			cmd->len = cwdatasize;
-		} else {
-			cmd->src = addr;
+		else
 			cmd->len = 528;
-		}
 		cmd++;
 
+		t->spare[n] = NULL;
 		if ((!raw_mode)) {
 			/* write extra data */
+			t->spare[n] = cmd;
 			cmd->cmd = 0;
-			cmd->src = spareaddr + n * cwoobsize;
+			cmd->src = 0;
 			cmd->dst = NAND_FLASH_BUFFER + cwdatasize;
 			cmd->len = cwoobsize;
 			cmd++;
@@ -664,13 +1933,76 @@ static int _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist,
 		cmd++;
 	}
 
-	/* restore saved ecc config */
-	cmd->cmd = CMD_OCU | CMD_LC;
-	cmd->src = paddr(&data->ecc_cfg_save);
-	cmd->dst = NAND_EBI2_ECC_BUF_CFG;
-	cmd->len = 4;
+	if (cache) {
+		cmd->cmd = 0;
+		cmd->src = paddr(&data->dev_cmd0_restore);
+		cmd->dst = NAND_DEV_CMD0;
+		cmd->len = 4;
+		cmd++;
+	}
+
+	/* restore saved ecc config */
+	cmd->cmd = CMD_OCU | CMD_LC;
+	cmd->src = paddr(&data->ecc_cfg_save);
+	cmd->dst = NAND_EBI2_ECC_BUF_CFG;
+	cmd->len = 4;
+	cmd++;
+
+	ASSERT(cmd - t->cmdlist <= PAGE_TMPL_CMDS);
+}
+
+static int _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist,
+				  unsigned page, const void *_addr,
+				  const void *_spareaddr, unsigned raw_mode,
+				  int cache)
+{
+	unsigned *ptr = ptrlist;
+	struct page_tmpl *t;
+	struct data_flash_io *data;
+	unsigned addr = (unsigned)_addr;
+	unsigned spareaddr = (unsigned)_spareaddr;
+	unsigned n;
+	unsigned cwperpage;
+	unsigned cwdatasize;
+	unsigned cwoobsize;
+	cwperpage = (flash_pagesize >> 9);
+	cwdatasize = flash_pagesize / cwperpage;
+	cwoobsize = /*oobavail */ 16 / cwperpage;	//spare size - ecc size (64 - 4*10)
+
+	t = &page_tmpl[raw_mode ? PAGE_TMPL_WRITE_RAW : PAGE_TMPL_WRITE];
+	data = t->data;
+
+	data->addr0 = page << 16;
+	data->addr1 = (page >> 16) & 0xff;
+
+	if (!raw_mode) {
+		data->cfg0 = CFG0;
+		data->cfg1 = CFG1;
+	} else {
+		data->cfg0 =
+		    (NAND_CFG0_RAW & ~(7 << 6)) | ((cwperpage - 1) << 6);
+		data->cfg1 = NAND_CFG1_RAW | (CFG1 & CFG1_WIDE_FLASH);
+	}
+
+	data->dev_cmd0 = flash_dev_cmd0;
+	if (cache && t->cache)
+		data->dev_cmd0 =
+		    (flash_dev_cmd0 & ~NAND_DEV_CMD0_WRITE_START(0xFF))
+		    | NAND_DEV_CMD0_WRITE_START(NAND_DEVCMD_PROGRAM_CACHE);
+	data->dev_cmd0_restore = flash_dev_cmd0;
+
+	for (n = 0; n < cwperpage; n++) {
+		if (raw_mode) {
+			t->buf[n]->src = addr;
+			continue;
+		}
+		t->buf[n]->src = addr + n * cwdatasize;
+		t->spare[n]->src = spareaddr + n * cwoobsize;
+	}
+
+	flash_erased_set(page, 0);
 
-	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+	ptr[0] = (paddr(t->cmdlist) >> 3) | CMD_PTR_LP;
 
 	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
 
@@ -704,6 +2036,286 @@ static int _flash_nand_write_page(dmov_s * cmdlist, unsigned *ptrlist,
 	return 0;
 }
 
+/* Interleaved mode: program the same page on both chips, CS0 from addr
+ * and CS1 from addr + flash_pagesize (spare: 16 bytes each).  Both
+ * controllers are loaded and started before either status is collected,
+ * so the two program operations overlap.
+ */
+static int flash_nand_write_page_interleave(dmov_s * cmdlist,
+					    unsigned *ptrlist, unsigned page,
+					    const void *_addr,
+					    const void *_spareaddr,
+					    unsigned raw_mode)
+{
+	dmov_s *cmd = cmdlist;
+	unsigned *ptr = ptrlist;
+	struct interleave_data_flash_io *data = (void *)(ptrlist + 4);
+	unsigned addr = (unsigned)_addr;
+	unsigned spareaddr = (unsigned)_spareaddr;
+	unsigned n, c;
+	unsigned cwperpage;
+	unsigned cwdatasize;
+	unsigned cwoobsize;
+	cwperpage = (flash_pagesize >> 9);
+	cwdatasize = flash_pagesize / cwperpage;
+	cwoobsize = /*oobavail */ 16 / cwperpage;
+
+	if (!raw_mode)
+		flash_nand_interleave_setup(data, NAND_CMD_PRG_PAGE_ALL, page,
+					    CFG0, CFG1);
+	else
+		flash_nand_interleave_setup(data, NAND_CMD_PRG_PAGE_ALL, page,
+					    (NAND_CFG0_RAW & ~(7 << 6)) |
+					    ((cwperpage - 1) << 6),
+					    NAND_CFG1_RAW | (CFG1 &
+							     CFG1_WIDE_FLASH));
+
+	flash_erased_set(page, 0);
+
+	cmd = flash_nand_interleave_prologue(cmd, data);
+
+	for (n = 0; n < cwperpage; n++) {
+		for (c = 0; c < 2; c++) {
+			/* MASK CMD ACK/REQ of the other controller
+			 * (0xF14 for NC01, 0x53C for NC10)
+			 */
+			cmd->cmd = 0;
+			cmd->src = c ? paddr(&data->adm_mux_cmd_ack_req_nc01)
+			    : paddr(&data->adm_mux_cmd_ack_req_nc10);
+			cmd->dst = EBI2_NAND_ADM_MUX;
+			cmd->len = 4;
+			cmd++;
+
+			/* CMD / ADDR0 / ADDR1 / CHIPSEL */
+			cmd->cmd = DST_CRCI_NAND_CMD;
+			cmd->src = paddr(&data->nc[c].cmd);
+			cmd->dst = NC(c, NAND_FLASH_CMD);
+			cmd->len = ((n == 0) ? 16 : 4);
+			cmd++;
+
+			/* write data block */
+			cmd->cmd = 0;
+			cmd->dst = NC(c, NAND_FLASH_BUFFER);
+			if (!raw_mode) {
+				cmd->src = addr + c * flash_pagesize +
+				    n * cwdatasize;
+				cmd->len = cwdatasize;
+			} else {
+				cmd->src = addr;
+				cmd->len = 528;
+			}
+			cmd++;
+
+			if (!raw_mode) {
+				/* write extra data */
+				cmd->cmd = 0;
+				cmd->src = spareaddr + c * 16 + n * cwoobsize;
+				cmd->dst = NC(c, NAND_FLASH_BUFFER) + cwdatasize;
+				cmd->len = cwoobsize;
+				cmd++;
+			}
+
+			/* kick the execute register */
+			cmd->cmd = 0;
+			cmd->src = paddr(&data->nc[c].exec);
+			cmd->dst = NC(c, NAND_EXEC_CMD);
+			cmd->len = 4;
+			cmd++;
+		}
+
+		for (c = 0; c < 2; c++) {
+			/* MASK DATA ACK/REQ of the other controller
+			 * (0xF28 for NC01, 0xA3C for NC10)
+			 */
+			cmd->cmd = 0;
+			cmd->src = c ? paddr(&data->adm_mux_data_ack_req_nc01)
+			    : paddr(&data->adm_mux_data_ack_req_nc10);
+			cmd->dst = EBI2_NAND_ADM_MUX;
+			cmd->len = 4;
+			cmd++;
+
+			/* block on data ready, then read the status register */
+			cmd->cmd = SRC_CRCI_NAND_DATA;
+			cmd->src = NC(c, NAND_FLASH_STATUS);
+			cmd->dst = paddr(&data->nc[c].result[n]);
+			cmd->len = 8;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = paddr(&data->nc[c].clrfstatus);
+			cmd->dst = NC(c, NAND_FLASH_STATUS);
+			cmd->len = 4;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = paddr(&data->nc[c].clrrstatus);
+			cmd->dst = NC(c, NAND_READ_STATUS);
+			cmd->len = 4;
+			cmd++;
+		}
+	}
+
+	flash_nand_interleave_epilogue(cmd, data);
+
+	ptr[0] = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
+
+	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptr);
+
+	/* if any of the writes failed (0x10), or there was a
+	 ** protection violation (0x100), or the program success
+	 ** bit (0x80) is unset, on either chip, we lose
+	 */
+	for (n = 0; n < cwperpage; n++) {
+		for (c = 0; c < 2; c++) {
+			if (data->nc[c].result[n].flash_status & 0x110)
+				return -1;
+			if (!(data->nc[c].result[n].flash_status & 0x80))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* The table can be cached in the second page of the last block of the
+ * device (the first page carries the bad block marker).  That block must
+ * not be part of any partition, so this is off unless the target asks
+ * for it.
+ */
+#ifndef FLASH_BBT_PERSIST
+#define FLASH_BBT_PERSIST 0
+#endif
+
+#define BBT_MAGIC	'BBT!'
+#define BBT_VERSION	1
+#define BBT_BLOCK	(flash_info.num_blocks - 1)
+#define BBT_PAGE	((BBT_BLOCK << 6) + 1)
+
+struct flash_bbt_header {
+	unsigned magic;
+	unsigned version;
+	unsigned num_blocks;
+	unsigned checksum;
+};
+
+static unsigned flash_bbt_checksum(const unsigned *table)
+{
+	unsigned n;
+	unsigned sum = 0;
+
+	for (n = 0; n < flash_bbt_words; n++)
+		sum = (sum << 1 | sum >> 31) ^ table[n];
+	return sum;
+}
+
+static int flash_bbt_fits_page(void)
+{
+	return sizeof(struct flash_bbt_header) +
+	    flash_bbt_words * sizeof(unsigned) <= flash_pagesize;
+}
+
+static void flash_bbt_save(dmov_s * cmdlist, unsigned *ptrlist)
+{
+	struct flash_bbt_header *hdr = flash_data;
+	unsigned *spare = flash_spare;
+	unsigned n;
+
+	if (!FLASH_BBT_PERSIST || !flash_bbt || !flash_bbt_fits_page())
+		return;
+	if (flash_bbt_isbad(cmdlist, ptrlist, BBT_BLOCK << 6))
+		return;
+
+	memset(flash_data, 0xff, flash_pagesize);
+	hdr->magic = BBT_MAGIC;
+	hdr->version = BBT_VERSION;
+	hdr->num_blocks = flash_info.num_blocks;
+	hdr->checksum = flash_bbt_checksum(flash_bbt);
+	memcpy(hdr + 1, flash_bbt, flash_bbt_words * sizeof(unsigned));
+	for (n = 0; n < 16; n++)
+		spare[n] = 0xffffffff;
+
+	if (flash_nand_erase_block(cmdlist, ptrlist, BBT_BLOCK << 6) ||
+	    _flash_nand_write_page(cmdlist, ptrlist, BBT_PAGE, flash_data,
+				   flash_spare, 0, 0)) {
+		dprintf(CRITICAL, "bbt: cannot save table @ %d\n", BBT_BLOCK);
+	}
+}
+
+static int flash_bbt_load(dmov_s * cmdlist, unsigned *ptrlist,
+			  unsigned *table)
+{
+	struct flash_bbt_header *hdr = flash_data;
+
+	if (!FLASH_BBT_PERSIST || !flash_bbt_fits_page())
+		return -1;
+	if (_flash_nand_read_page(cmdlist, ptrlist, BBT_PAGE, flash_data,
+				  flash_spare))
+		return -1;
+	if (hdr->magic != BBT_MAGIC || hdr->version != BBT_VERSION ||
+	    hdr->num_blocks != flash_info.num_blocks)
+		return -1;
+
+	memcpy(table, hdr + 1, flash_bbt_words * sizeof(unsigned));
+	if (flash_bbt_checksum(table) != hdr->checksum)
+		return -1;
+	return 0;
+}
+
+static void flash_bbt_init(dmov_s * cmdlist, unsigned *ptrlist)
+{
+	unsigned *table;
+	unsigned block;
+	unsigned bad = 0;
+	int isbad;
+
+	if (!flash_info.num_blocks)
+		return;
+
+	flash_bbt_words = (flash_info.num_blocks + 31) >> 5;
+	flash_erased = calloc(flash_bbt_words, sizeof(unsigned));
+	table = calloc(flash_bbt_words, sizeof(unsigned));
+	if (!table)
+		return;
+
+	if (!flash_bbt_load(cmdlist, ptrlist, table)) {
+		flash_bbt = table;
+		dprintf(INFO, "bbt: loaded from block %d\n", BBT_BLOCK);
+		return;
+	}
+
+	for (block = 0; block < flash_info.num_blocks; block++) {
+		isbad = flash_block_isbad_marker(cmdlist, ptrlist, block << 6);
+		/* retry once on a controller error before giving up */
+		if (isbad < 0)
+			isbad = flash_block_isbad_marker(cmdlist, ptrlist,
+							 block << 6);
+		if (isbad) {
+			table[block >> 5] |= 1U << (block & 31);
+			bad++;
+		}
+	}
+	flash_bbt = table;
+	dprintf(INFO, "bbt: %d bad blocks of %d\n", bad,
+		flash_info.num_blocks);
+
+	flash_bbt_save(cmdlist, ptrlist);
+}
+
+static void flash_bbt_mark_bad(dmov_s * cmdlist, unsigned *ptrlist,
+			       unsigned page)
+{
+	unsigned block = page >> 6;
+
+	if (!flash_bbt || block >= flash_info.num_blocks)
+		return;
+	if (flash_bbt[block >> 5] & (1U << (block & 31)))
+		return;
+
+	flash_bbt[block >> 5] |= 1U << (block & 31);
+	dprintf(INFO, "bbt: block %d is now bad\n", block);
+	flash_bbt_save(cmdlist, ptrlist);
+}
+
 static int flash_nand_mark_badblock(dmov_s * cmdlist, unsigned *ptrlist,
 				    unsigned page)
 {
@@ -712,7 +2324,11 @@ static int flash_nand_mark_badblock(dmov_s * cmdlist, unsigned *ptrlist,
 	/* Going to first page of the block */
 	if (page & 63)
 		page = page - (page & 63);
-	return _flash_nand_write_page(cmdlist, ptrlist, page, empty_buf, 0, 1);
+	if (interleaved_mode)
+		return flash_nand_write_page_interleave(cmdlist, ptrlist, page,
+							empty_buf, 0, 1);
+	return _flash_nand_write_page(cmdlist, ptrlist, page, empty_buf, 0, 1,
+				      0);
 }
 
 unsigned nand_cfg0;
@@ -720,17 +2336,23 @@ unsigned nand_cfg1;
 
 static int flash_nand_read_config(dmov_s * cmdlist, unsigned *ptrlist)
 {
-	static unsigned CFG0_TMP, CFG1_TMP;
+	static unsigned CFG0_TMP, CFG1_TMP, DEV_CMD_TMP[4];
 	cmdlist[0].cmd = CMD_OCB;
 	cmdlist[0].src = NAND_DEV0_CFG0;
 	cmdlist[0].dst = paddr(&CFG0_TMP);
 	cmdlist[0].len = 4;
 
-	cmdlist[1].cmd = CMD_OCU | CMD_LC;
+	cmdlist[1].cmd = 0;
 	cmdlist[1].src = NAND_DEV0_CFG1;
 	cmdlist[1].dst = paddr(&CFG1_TMP);
 	cmdlist[1].len = 4;
 
+	/* DEV_CMD0-2 and DEV_CMD_VLD, the base of the cache opcodes */
+	cmdlist[2].cmd = CMD_OCU | CMD_LC;
+	cmdlist[2].src = NAND_DEV_CMD0;
+	cmdlist[2].dst = paddr(&DEV_CMD_TMP[0]);
+	cmdlist[2].len = 16;
+
 	*ptrlist = (paddr(cmdlist) >> 3) | CMD_PTR_LP;
 
 	dmov_exec_cmdptr(DMOV_NAND_CHAN, ptrlist);
@@ -754,17 +2376,27 @@ static int flash_nand_read_config(dmov_s * cmdlist, unsigned *ptrlist)
 	    |(1 << 30)		/* Do not read status before data */
 	    |(1 << 31);		/* Send read cmd */
 
-	CFG1 = CFG1
-#if 0
-	    | (7 << 2)		/* 8 recovery cycles */
-	    |(0 << 5)		/* Allow CS deassertion */
-	    |(2 << 17)		/* 6 cycle tWB/tRB */
-#endif
+	flash_nand_clk_init();
+	CFG1 = (CFG1 & ~CFG1_TIMING_MASK)
+	    | flash_nand_wait_states(CFG1_TMP, flash_timing_mode)	/* wait states */
 	    | ((flash_pagesize - (528 * ((flash_pagesize >> 9) - 1)) + 1) << 6)	/* Bad block marker location */
 	    |(nand_cfg1 & CFG1_WIDE_FLASH);	/* preserve wide flash flag */
 	CFG1 = CFG1 & ~(1 << 0)	/* Enable ecc */
 	    &~(1 << 16);	/* Bad block in user data area */
-	dprintf(INFO, "nandcfg: %x %x (used)\n", CFG0, CFG1);
+	dprintf(INFO, "nandcfg: %x %x (used, timing mode %d, clock %dns)\n",
+		CFG0, CFG1, flash_timing_mode, flash_clk_ns);
+
+	flash_dev_cmd0 = DEV_CMD_TMP[0];
+	flash_dev_cmd1 = DEV_CMD_TMP[1];
+	flash_dev_cmd_vld = DEV_CMD_TMP[3];
+	if (!NAND_CACHE_OPS)
+		flash_cache = 0;
+	if (interleaved_mode)
+		flash_cache = 0;	/* not wired into the dual-chip lists */
+	if (flash_cache)
+		dprintf(INFO, "nand: cache%s%s\n",
+			(flash_cache & FLASH_CACHE_READ) ? " read" : "",
+			(flash_cache & FLASH_CACHE_PROGRAM) ? " program" : "");
 
 	return 0;
 }
@@ -772,6 +2404,7 @@ static int flash_nand_read_config(dmov_s * cmdlist, unsigned *ptrlist)
 static int flash_mark_badblock(dmov_s * cmdlist, unsigned *ptrlist,
 			       unsigned page)
 {
+	flash_bbt_mark_bad(cmdlist, ptrlist, page);
 	return flash_nand_mark_badblock(cmdlist, ptrlist, page);
 }
 
@@ -783,8 +2416,10 @@ static void flash_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 
 	// Try to read id
 	flash_nand_read_id(cmdlist, ptrlist);
+	// ONFI parts describe themselves, the table is the fallback
+	index = flash_nand_onfi_probe(cmdlist, ptrlist) ? 1 : 0;
 	// Check if we support the device
-	for (index = 1;
+	for (;
 	     index <
 	     (sizeof(supported_flash) / sizeof(struct flash_identification));
 	     index++) {
@@ -806,6 +2441,8 @@ static void flash_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 		flash_pagesize = flash_info.page_size;
 		flash_info.block_size = supported_flash[index].blksize;
 		flash_info.spare_size = supported_flash[index].oobsize;
+		flash_timing_mode = supported_flash[index].timing;
+		flash_cache = supported_flash[index].cache;
 		if (flash_info.block_size && flash_info.page_size) {
 			flash_info.num_blocks = supported_flash[index].density;
 			flash_info.num_blocks /= (flash_info.block_size);
@@ -830,27 +2467,38 @@ static void flash_read_id(dmov_s * cmdlist, unsigned *ptrlist)
 
 static int flash_erase_block(dmov_s * cmdlist, unsigned *ptrlist, unsigned page)
 {
+	if (interleaved_mode)
+		return flash_nand_erase_block_interleave(cmdlist, ptrlist,
+							 page);
 	return flash_nand_erase_block(cmdlist, ptrlist, page);
 }
 
 static int _flash_read_page(dmov_s * cmdlist, unsigned *ptrlist,
 			    unsigned page, void *_addr, void *_spareaddr)
 {
+	if (interleaved_mode)
+		return flash_nand_read_page_interleave(cmdlist, ptrlist, page,
+						       _addr, _spareaddr);
 	return _flash_nand_read_page(cmdlist, ptrlist, page, _addr, _spareaddr);
 }
 
 static int _flash_block_isbad(dmov_s * cmdlist, unsigned *ptrlist,
 			      unsigned page)
 {
-	return flash_nand_block_isbad(cmdlist, ptrlist, page);
+	return flash_bbt_isbad(cmdlist, ptrlist, page);
 }
 
 static int _flash_write_page(dmov_s * cmdlist, unsigned *ptrlist,
 			     unsigned page, const void *_addr,
-			     const void *_spareaddr)
+			     const void *_spareaddr, int more)
 {
+	int cache = more && (flash_cache & FLASH_CACHE_PROGRAM);
+
+	if (interleaved_mode)
+		return flash_nand_write_page_interleave(cmdlist, ptrlist, page,
+							_addr, _spareaddr, 0);
 	return _flash_nand_write_page(cmdlist, ptrlist, page, _addr, _spareaddr,
-				      0);
+				      0, cache);
 }
 
 static unsigned *flash_ptrlist;
@@ -858,23 +2506,163 @@ static dmov_s *flash_cmdlist;
 
 static struct ptable *flash_ptable = NULL;
 
+static int flash_nand_chain_isbad(unsigned page)
+{
+	return flash_bbt_isbad(flash_cmdlist, flash_ptrlist, page);
+}
+
+static struct nand_pipe_ops flash_pipe_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.prepare = flash_nand_chain_prepare,
+	.check = flash_nand_chain_check,
+	.spare = flash_nand_chain_spare,
+	.max_chain = READ_CHAIN_PAGES,	/* chain_pages, set by flash_init */
+};
+
+/* Pipelined erases reuse the read chain buffers, one command list and
+ * data slot per block.
+ */
+static unsigned *flash_nand_erase_data(unsigned slot, unsigned n)
+{
+	struct data_flash_io *io = chain_data[slot];
+	struct interleave_data_flash_io *iio = chain_data[slot];
+
+	if (interleaved_mode)
+		return (unsigned *)&iio[n];
+	return (unsigned *)&io[n];
+}
+
+static unsigned *flash_nand_erase_prepare(unsigned slot,
+					  const unsigned *pages,
+					  unsigned count)
+{
+	dmov_s *cmd;
+	unsigned n;
+
+	ASSERT(count > 0 && count <= chain_pages);
+
+	for (n = 0; n < count; n++) {
+		cmd = chain_cmdlist[slot] + n * chain_cmds;
+		if (interleaved_mode)
+			flash_nand_build_erase_interleave(cmd,
+				flash_nand_erase_data(slot, n), pages[n]);
+		else
+			flash_nand_build_erase(cmd,
+				flash_nand_erase_data(slot, n), pages[n]);
+		chain_ptrlist[slot][n] = paddr(cmd) >> 3;
+	}
+	chain_ptrlist[slot][count - 1] |= CMD_PTR_LP;
+
+	return chain_ptrlist[slot];
+}
+
+static int flash_nand_erase_check(unsigned slot, unsigned n)
+{
+	if (interleaved_mode)
+		return flash_nand_erase_failed_interleave(
+			flash_nand_erase_data(slot, n));
+	return flash_nand_erase_failed(flash_nand_erase_data(slot, n));
+}
+
+static void flash_nand_erase_done(unsigned page, int failed)
+{
+	/* a block that fails to erase is not used again */
+	if (failed)
+		flash_bbt_mark_bad(flash_cmdlist, flash_ptrlist, page);
+	else
+		flash_erased_set(page, 1);
+}
+
+static struct nand_erase_ops flash_erase_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.prepare = flash_nand_erase_prepare,
+	.check = flash_nand_erase_check,
+	.done = flash_nand_erase_done,
+	.max_chain = READ_CHAIN_PAGES,	/* chain_pages, set by flash_init */
+};
+
+/* Interleaved mode presents both chips as one device with pages and
+ * blocks twice as large; the block count stays that of one chip.
+ */
+static void flash_setup_interleave(void)
+{
+	flash_io_pagesize = flash_pagesize;
+	if (!interleaved_mode)
+		return;
+
+	flash_io_pagesize *= 2;
+	flash_info.page_size *= 2;
+	flash_info.block_size *= 2;
+	flash_info.spare_size *= 2;
+
+	chain_cmds = READ_CHAIN_CMDS_INTERLEAVE;
+	chain_pages = READ_CHAIN_PAGES * READ_CHAIN_CMDS / chain_cmds;
+	flash_pipe_ops.max_chain = chain_pages;
+	flash_erase_ops.max_chain = chain_pages;
+
+	dprintf(INFO, "nand: 2 chips interleaved, page_size=%d\n",
+		flash_info.page_size);
+}
+
+static void flash_nand_page_tmpl_init(void)
+{
+	struct page_tmpl *t;
+	unsigned n;
+
+	for (n = 0; n < PAGE_TMPL_COUNT; n++) {
+		t = &page_tmpl[n];
+		t->cmdlist = memalign(32, PAGE_TMPL_CMDS * sizeof(dmov_s));
+		t->data = memalign(32, sizeof(struct data_flash_io));
+		ASSERT(t->cmdlist && t->data);
+		if (n == PAGE_TMPL_READ)
+			flash_nand_build_read_page(t->cmdlist, t->data, 0, 0,
+						   0, t);
+		else
+			flash_nand_build_write_page(t, n);
+	}
+}
+
 void flash_init(void)
 {
+	unsigned n;
+	unsigned iosize;
+
 	ASSERT(flash_ptable == NULL);
 
+	/* an interleaved write list drives both controllers */
 	flash_ptrlist = memalign(32, 1024);
-	flash_cmdlist = memalign(32, 1024);
-	flash_data = memalign(32, 4096 + 128);
+	flash_cmdlist = memalign(32, interleaved_mode ? 4096 : 1024);
+	flash_data = memalign(32, (4096 << interleaved_mode) + 128);
 	flash_spare = memalign(32, 128);
 
+	dmov_init();
+
 	flash_read_id(flash_cmdlist, flash_ptrlist);
-	if ((FLASH_8BIT_NAND_DEVICE == flash_info.type)
-	    || (FLASH_16BIT_NAND_DEVICE == flash_info.type)) {
+	flash_setup_interleave();
+
+	iosize = interleaved_mode ? sizeof(struct interleave_data_flash_io)
+	    : sizeof(struct data_flash_io);
+	for (n = 0; n < NAND_PIPE_DEPTH; n++) {
+		chain_ptrlist[n] = memalign(32, (chain_pages + 3) *
+					    sizeof(unsigned));
+		chain_cmdlist[n] = memalign(32, chain_pages * chain_cmds *
+					    sizeof(dmov_s));
+		chain_data[n] = memalign(32, chain_pages * iosize);
+		chain_spare[n] = memalign(32, chain_pages * READ_CHAIN_SPARE);
+		chain_cache[n] = memalign(32, sizeof(struct chain_cache_io));
+	}
+
+	/* an unknown part has no geometry to build command lists for */
+	if (((FLASH_8BIT_NAND_DEVICE == flash_info.type)
+	     || (FLASH_16BIT_NAND_DEVICE == flash_info.type))
+	    && flash_info.num_blocks) {
 		if (flash_nand_read_config(flash_cmdlist, flash_ptrlist)) {
 			dprintf(CRITICAL,
 				"ERROR: could not read CFG0/CFG1 state\n");
 			ASSERT(0);
 		}
+		flash_nand_page_tmpl_init();
+		flash_bbt_init(flash_cmdlist, flash_ptrlist);
 	}
 }
 
@@ -894,35 +2682,40 @@ struct flash_info *flash_get_info(void)
 	return &flash_info;
 }
 
-int flash_erase(struct ptentry *ptn)
+static void flash_erase_range(unsigned page, unsigned lastpage)
 {
-	unsigned block = ptn->start;
-	unsigned count = ptn->length;
+	unsigned failed;
+
+	failed = nand_pipe_erase(&flash_erase_ops, page, lastpage);
+	if (failed)
+		dprintf(INFO, "flash_erase: %d blocks not erased\n", failed);
+}
 
+int flash_erase(struct ptentry *ptn)
+{
 	set_nand_configuration(ptn->type);
-	while (count-- > 0) {
-		if (flash_erase_block(flash_cmdlist, flash_ptrlist, block * 64)) {
-			dprintf(INFO, "cannot erase @ %d (bad block?)\n",
-				block);
-		}
-		block++;
-	}
+	flash_erase_range(ptn->start * 64, (ptn->start + ptn->length) * 64);
 	return 0;
 }
 
 int flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 		   unsigned offset, void *data, unsigned bytes)
 {
-	unsigned page = (ptn->start * 64) + (offset / flash_pagesize);
+	unsigned page = (ptn->start * 64) + (offset / flash_io_pagesize);
 	unsigned lastpage = (ptn->start + ptn->length) * 64;
 	unsigned count =
-	    (bytes + flash_pagesize - 1 + extra_per_page) / (flash_pagesize +
-							     extra_per_page);
-	unsigned *spare = (unsigned *)flash_spare;
+	    (bytes + flash_io_pagesize - 1 + extra_per_page) /
+	    (flash_io_pagesize + extra_per_page);
 	unsigned errors = 0;
 	unsigned char *image = data;
 	unsigned current_block = (page - (page & 63)) >> 6;
 	unsigned start_block = ptn->start;
+	unsigned wsize = flash_io_pagesize + extra_per_page;
+	unsigned good_block = ~0U;
+	unsigned chain;
+	unsigned bounce;
+	unsigned char *dst;
+	unsigned n;
 	int result = 0;
 	int isbad = 0;
 	int start_block_count = 0;
@@ -931,7 +2724,7 @@ int flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 	ASSERT(ptn->type == TYPE_APPS_PARTITION);
 	set_nand_configuration(TYPE_APPS_PARTITION);
 
-	if (offset & (flash_pagesize - 1))
+	if (offset & (flash_io_pagesize - 1))
 		return -1;
 
 // Adjust page offset based on number of bad blocks from start to current page
@@ -950,6 +2743,23 @@ int flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 		}
 	}
 
+	/* aligned destinations are read by the pipelined engine, pages
+	 ** DMAed straight into the image
+	 */
+	if (!start_block_count && !(paddr(image) & (READ_DMA_ALIGN - 1))
+	    && !(wsize & (READ_DMA_ALIGN - 1))) {
+		if (nand_pipe_read(&flash_pipe_ops, page, lastpage, count,
+				   image, flash_io_pagesize, extra_per_page,
+				   &errors) == 0) {
+			dprintf(INFO, "flash_read_image: success (%d errors)\n",
+				errors);
+			return 0;
+		}
+		dprintf(CRITICAL, "flash_read_image: failed (%d errors)\n",
+			errors);
+		return 0xffffffff;
+	}
+
 	while ((page < lastpage) && !start_block_count) {
 		if (count == 0) {
 			dprintf(INFO, "flash_read_image: success (%d errors)\n",
@@ -957,28 +2767,59 @@ int flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 			return 0;
 		}
 
-		result =
-		    _flash_read_page(flash_cmdlist, flash_ptrlist, page, flash_data,
-				     spare);
+		/* the bad block marker only needs checking once per block */
+		if ((page >> 6) != good_block) {
+			isbad = _flash_block_isbad(flash_cmdlist, flash_ptrlist,
+						   page);
+			if (isbad) {
+				dprintf(INFO, "bad block %x:\n", page);
+				// bad block, go to next block same offset
+				page += 64;
+				errors++;
+				continue;
+			}
+			good_block = page >> 6;
+		}
+
+		chain = 64 - (page & 63);
+		if (chain > count)
+			chain = count;
+		if (chain > chain_pages)
+			chain = chain_pages;
+
+		/* an unaligned destination goes through the bounce buffer
+		 ** a page at a time
+		 */
+		bounce = paddr(image) & (READ_DMA_ALIGN - 1);
+		if (bounce || (wsize & (READ_DMA_ALIGN - 1)))
+			chain = 1;
+		dst = bounce ? flash_data : image;
+
+		result = flash_nand_read_chain(page, chain, dst, wsize);
+		if (result < 0 && chain > 1) {
+			// data mover error, retry the first page on its own
+			chain = 1;
+			result = flash_nand_read_chain(page, chain, dst, wsize);
+		}
+		if (result < 0)
+			result = 0;
+
+		for (n = 0; n < (unsigned)result; n++) {
+			if (bounce)
+				memcpy(image, flash_data, flash_io_pagesize);
+			image += flash_io_pagesize;
+			memcpy(image, flash_nand_chain_spare(0, n),
+			       extra_per_page);
+			image += extra_per_page;
+		}
+		page += result;
+		count -= result;
 
-		if (result == -1) {
+		if ((unsigned)result < chain) {
 			// bad page, go to next page
 			page++;
 			errors++;
-			continue;
-		} else if (result == -2) {
-			// bad block, go to next block same offset
-			page += 64;
-			errors++;
-			continue;
 		}
-
-		page++;
-		memcpy(image, flash_data, flash_pagesize);
-		image += flash_pagesize;
-		memcpy(image, spare, extra_per_page);
-		image += extra_per_page;
-		count -= 1;
 	}
 
 	/* could not find enough valid pages before we hit the end */
@@ -986,101 +2827,145 @@ int flash_read_ext(struct ptentry *ptn, unsigned extra_per_page,
 	return 0xffffffff;
 }
 
-int flash_write(struct ptentry *ptn, unsigned extra_per_page, const void *data,
-		unsigned bytes)
-{
-	unsigned page = ptn->start * 64;
-	unsigned lastpage = (ptn->start + ptn->length) * 64;
-	unsigned *spare = (unsigned *)flash_spare;
-	const unsigned char *image = data;
-	unsigned wsize = flash_pagesize + extra_per_page;
-	unsigned n;
-	int r;
-
-	if (ptn->type == TYPE_MODEM_PARTITION) {
-		dprintf(CRITICAL,
-			"flash_write_image: modem partition not supported\n");
-		return -1;
-	}
+/* Differential writes read a block back DIFF_CHUNK_PAGES pages at a
+ * time and compare it with the image.
+ */
+#define DIFF_CHUNK_PAGES	16
+#define DIFF_SPARE		32	/* spare bytes kept per page */
 
-	set_nand_configuration(ptn->type);
-	for (n = 0; n < 16; n++)
-		spare[n] = 0xffffffff;
+static unsigned char *flash_diff_buf;
 
-	while (bytes > 0) {
-		if (bytes < wsize) {
-			dprintf(CRITICAL,
-				"flash_write_image: image undersized (%d < %d)\n",
-				bytes, wsize);
-			return -1;
-		}
-		if (page >= lastpage) {
-			dprintf(CRITICAL, "flash_write_image: out of space\n");
-			return -1;
-		}
+/* Returns 0 if the block at 'page' already holds the 64 pages of 'image',
+ * spare bytes included, nonzero if it has to be rewritten.
+ */
+static int flash_block_differs(unsigned page, const unsigned char *image,
+			       unsigned extra_per_page)
+{
+	unsigned wsize = flash_io_pagesize + extra_per_page;
+	unsigned stride = flash_io_pagesize + DIFF_SPARE;
+	unsigned spare_len = 16 << interleaved_mode;	/* what we program */
+	unsigned char *buf;
+	unsigned errors;
+	unsigned n, i, k;
+
+	/* a short spare area is padded with whatever follows it */
+	if (extra_per_page && extra_per_page < spare_len)
+		return 1;
+
+	if (!flash_diff_buf)
+		flash_diff_buf = memalign(32, DIFF_CHUNK_PAGES * stride);
+	if (!flash_diff_buf)
+		return 1;
+
+	for (n = 0; n < 64; n += DIFF_CHUNK_PAGES) {
+		/* any bad block or failing page counts as a difference */
+		if (nand_pipe_read(&flash_pipe_ops, page + n,
+				   page + n + DIFF_CHUNK_PAGES,
+				   DIFF_CHUNK_PAGES, flash_diff_buf,
+				   flash_io_pagesize, DIFF_SPARE, &errors))
+			return 1;
 
-		if ((page & 63) == 0) {
-			if (flash_erase_block
-			    (flash_cmdlist, flash_ptrlist, page)) {
-				dprintf(INFO,
-					"flash_write_image: bad block @ %d\n",
-					page >> 6);
-				page += 64;
+		for (i = 0; i < DIFF_CHUNK_PAGES; i++, image += wsize) {
+			buf = flash_diff_buf + i * stride;
+			if (memcmp(buf, image, flash_io_pagesize))
+				return 1;
+			buf += flash_io_pagesize;
+			if (extra_per_page) {
+				if (memcmp(buf, image + flash_io_pagesize,
+					   spare_len))
+					return 1;
 				continue;
 			}
-		}
-
-		if (extra_per_page) {
-			r = _flash_write_page(flash_cmdlist, flash_ptrlist,
-					      page, image,
-					      image + flash_pagesize);
-		} else {
-			r = _flash_write_page(flash_cmdlist, flash_ptrlist,
-					      page, image, spare);
-		}
-		if (r) {
-			dprintf(INFO,
-				"flash_write_image: write failure @ page %d (src %d)\n",
-				page, image - (const unsigned char *)data);
-			image -= (page & 63) * wsize;
-			bytes += (page & 63) * wsize;
-			page &= ~63;
-			if (flash_erase_block
-			    (flash_cmdlist, flash_ptrlist, page)) {
-				dprintf(INFO,
-					"flash_write_image: erase failure @ page %d\n",
-					page);
-			}
-			if (ptn->type != TYPE_MODEM_PARTITION) {
-				flash_mark_badblock(flash_cmdlist,
-						    flash_ptrlist, page);
+			for (k = 0; k < spare_len; k++) {
+				if (buf[k] != 0xff)
+					return 1;
 			}
-			dprintf(INFO,
-				"flash_write_image: restart write @ page %d (src %d)\n",
-				page, image - (const unsigned char *)data);
-			page += 64;
-			continue;
 		}
-		page++;
-		image += wsize;
-		bytes -= wsize;
 	}
 
-	/* erase any remaining pages in the partition */
-	page = (page + 63) & (~63);
-	while (page < lastpage) {
-		if (flash_erase_block(flash_cmdlist, flash_ptrlist, page)) {
-			dprintf(INFO, "flash_write_image: bad block @ %d\n",
-				page >> 6);
-		}
-		page += 64;
+	return 0;
+}
+
+static int flash_nand_stream_erase(unsigned page)
+{
+	return flash_erase_block(flash_cmdlist, flash_ptrlist, page);
+}
+
+static int flash_nand_stream_write(unsigned page, const void *data,
+				   const void *spare, int more)
+{
+	return _flash_write_page(flash_cmdlist, flash_ptrlist, page, data,
+				 spare, more);
+}
+
+static int flash_nand_stream_mark_bad(unsigned page)
+{
+	return flash_mark_badblock(flash_cmdlist, flash_ptrlist, page);
+}
+
+static const struct nand_write_ops flash_write_ops = {
+	.isbad = flash_nand_chain_isbad,
+	.erase = flash_nand_stream_erase,
+	.erase_range = flash_erase_range,
+	.write = flash_nand_stream_write,
+	.mark_bad = flash_nand_stream_mark_bad,
+	.erased = flash_block_erased,
+	.differs = flash_block_differs,
+};
+
+int flash_stream_open(struct flash_stream *s, struct ptentry *ptn,
+		      unsigned extra_per_page, unsigned flags)
+{
+	if (nand_stream_open(&flash_write_ops, s, ptn, flash_io_pagesize,
+			     extra_per_page, flags))
+		return -1;
+
+	if (ptn->type == TYPE_MODEM_PARTITION) {
+		dprintf(CRITICAL,
+			"flash_write_image: modem partition not supported\n");
+		s->error = 1;
+		return -1;
 	}
 
-	dprintf(INFO, "flash_write_image: success\n");
+	set_nand_configuration(ptn->type);
 	return 0;
 }
 
+unsigned flash_good_blocks(struct ptentry *ptn)
+{
+	unsigned block, n = 0;
+
+	for (block = ptn->start; block < ptn->start + ptn->length; block++)
+		if (!flash_nand_chain_isbad(block * 64))
+			n++;
+	return n;
+}
+
+int flash_write_block(struct ptentry *ptn, unsigned block, const void *data)
+{
+	if (ptn->type != TYPE_APPS_PARTITION)
+		return -1;
+	set_nand_configuration(ptn->type);
+	return nand_block_write(&flash_write_ops, ptn, flash_io_pagesize, block, data);
+}
+
 unsigned flash_page_size(void)
 {
-	return flash_pagesize;
+	return flash_io_pagesize;
+}
+
+/* Drive two NAND chips as one, NC01 on CS0 and NC10 on CS1.  Must be
+ * called before flash_init(), which sets up the doubled geometry.
+ */
+void enable_interleave_mode(int status)
+{
+	if (flash_cmdlist) {
+		dprintf(CRITICAL,
+			"nand: interleave must be selected before flash_init\n");
+		return;
+	}
+	interleaved_mode = status;
+	if (status)
+		platform_config_interleaved_mode_gpios();
+	return;
 }
@@ -7,7 +7,11 @@ OBJS += \
 	$(LOCAL_DIR)/timer.o \
 	$(LOCAL_DIR)/debug.o \
 	$(LOCAL_DIR)/mddi.o \
-	$(LOCAL_DIR)/hsusb.o
+	$(LOCAL_DIR)/hsusb.o \
+	$(LOCAL_DIR)/dmov.o \
+	$(LOCAL_DIR)/flash_async.o \
+	$(LOCAL_DIR)/nand_pipe.o \
+	$(LOCAL_DIR)/nand_stream.o
 
 ifeq ($(MSM_NAND_WINCE),1)
 	OBJS += $(LOCAL_DIR)/nand_wince.o
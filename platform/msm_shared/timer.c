@@ -150,6 +150,31 @@ time_t current_time(void)
 	return ticks;
 }
 
+/* microseconds, from the tick count plus the DGT count since the last
+ * match (the counter clears on match).  With interrupts off a match can
+ * be pending that timer_irq() has not added to the ticks yet; its
+ * interval is added here so the time does not step back.  Only one
+ * pending match is accounted for.
+ */
+bigtime_t current_time_hires(void)
+{
+	bigtime_t usecs;
+	uint32_t count;
+	int pending;
+
+	enter_critical_section();
+	do {
+		pending = interrupt_pending(INT_DEBUG_TIMER_EXP);
+		count = readl(DGT_COUNT_VAL);
+	} while (pending != interrupt_pending(INT_DEBUG_TIMER_EXP));
+	usecs = (bigtime_t)ticks * 1000;
+	if (pending)
+		usecs += (bigtime_t)timer_interval * 1000;
+	exit_critical_section();
+
+	return usecs + (bigtime_t)count * 1000000 / DGT_HZ;
+}
+
 void platform_init_timer(void)
 {
 	writel(0, DGT_ENABLE);
@@ -6,7 +6,18 @@ TARGET := msm7200a_htc_wince
 
 #MODULES += app/pooploader
 MODULES += app/aboot
+#MODULES += app/usbtest
 
 DEFINES += WITH_DEBUG_DCC=0
 DEFINES += WITH_DEBUG_UART=0
 DEFINES += WITH_DEBUG_FBCON=1
+
+# log to a USB serial port next to fastboot; dropping WITH_DEBUG_FBCON
+# then keeps logging from slowing down the device
+MODULES += dev/udc_acm
+DEFINES += WITH_DEBUG_USB=1
+
+# expose cache, userdata and backup (USB_MSC_PARTITIONS in aboot.c) as
+# USB mass storage next to fastboot, for field recovery
+#MODULES += dev/udc_msc
+#DEFINES += WITH_USB_MSC=1
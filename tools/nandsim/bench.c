@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Runs the flash driver against the simulated controller and reports
+** simulated throughput and data mover / controller command counts for
+** erase, write and read of one partition.
+*/
+
+#include <debug.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dev/flash.h>
+#include <lib/ptable.h>
+
+#include "nandsim.h"
+
+#ifndef INTERLEAVE_AFTER_INIT
+#define INTERLEAVE_AFTER_INIT 0
+#endif
+
+struct bench {
+	unsigned pagesize;
+	unsigned blocks;	/* partition size */
+	unsigned extra;		/* spare bytes per page */
+	unsigned bad;		/* factory bad blocks in the partition */
+	unsigned fail_program;
+	unsigned fail_erase;
+	unsigned ecc;		/* pages with uncorrectable errors */
+	unsigned seed;
+	unsigned onfi_modes;
+	unsigned id;
+	int interleave;
+	double cpu_scale;
+
+	struct ptentry ptn;
+	unsigned chip_blocks;	/* blocks per chip */
+	int failed;
+};
+
+/* the board hook the drivers call when interleaving is enabled */
+void platform_config_interleaved_mode_gpios(void)
+{
+}
+
+static unsigned rnd(unsigned *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+/* pick n distinct blocks of the partition on any chip */
+static void inject(struct bench *b, unsigned n, unsigned char *used,
+		   void (*fn) (unsigned chip, unsigned block))
+{
+	unsigned chips = b->interleave ? 2 : 1;
+	unsigned block, chip;
+
+	while (n) {
+		block = b->ptn.start + rnd(&b->seed) % b->blocks;
+		chip = rnd(&b->seed) % chips;
+		if (used[block])
+			continue;
+		used[block] = 1;
+		fn(chip, block);
+		n--;
+	}
+}
+
+static void ecc_page(unsigned chip, unsigned block)
+{
+	nandsim_ecc_error(chip, block * 64 + 1);
+}
+
+static void report(const char *op, int r, unsigned bytes, unsigned pagesize,
+		   const struct nandsim_stats *s0)
+{
+	struct nandsim_stats s;
+	unsigned long long ns;
+	double secs;
+
+	nandsim_get_stats(&s);
+	ns = s.time - s0->time;
+	secs = ns / 1e9;
+
+	printf("%-10s %4s %8.2f %9.0f %7.2f %7u %7u %7u %7u %6u %3.0f%%\n",
+	       op, r ? "FAIL" : "ok", ns / 1e6,
+	       secs ? bytes / pagesize / secs : 0.0,
+	       secs ? bytes / secs / (1 << 20) : 0.0,
+	       s.transfers - s0->transfers,
+	       s.descriptors - s0->descriptors,
+	       s.execs - s0->execs,
+	       s.page_programs - s0->page_programs,
+	       s.block_erases - s0->block_erases,
+	       ns ? 100.0 * (s.dm_busy - s0->dm_busy) / ns : 0.0);
+}
+
+static int run(void *arg)
+{
+	struct bench *b = arg;
+	struct nandsim_config cfg;
+	struct nandsim_stats s0, s;
+	struct flash_read_stats rs;
+	struct flash_info *info;
+	unsigned char *used;
+	unsigned char *image, *check;
+	unsigned pagesize, bytes, pages, n;
+	int r;
+
+	nandsim_default_config(&cfg, b->pagesize);
+	cfg.chips = b->interleave ? 2 : 1;
+	cfg.cpu_scale = b->cpu_scale;
+	if (b->id)
+		cfg.id = b->id;
+	if (b->onfi_modes) {
+		cfg.onfi_modes = b->onfi_modes;
+		for (cfg.max_mode = 0; b->onfi_modes >> (cfg.max_mode + 1);
+		     cfg.max_mode++) ;
+	}
+	nandsim_init(&cfg);
+
+	/* keep clear of the boot blocks and the bad block table at the end */
+	strcpy(b->ptn.name, "bench");
+	b->ptn.start = cfg.blocks / 4;
+	b->ptn.length = b->blocks;
+	b->ptn.type = TYPE_APPS_PARTITION;
+	b->ptn.perm = PERM_WRITEABLE;
+	if (b->ptn.start + b->blocks > cfg.blocks - 1) {
+		fprintf(stderr, "partition too large\n");
+		return 1;
+	}
+
+	used = calloc(cfg.blocks, 1);
+	inject(b, b->bad, used, nandsim_factory_bad);
+	inject(b, b->fail_program, used, nandsim_fail_program);
+	inject(b, b->fail_erase, used, nandsim_fail_erase);
+	inject(b, b->ecc, used, ecc_page);
+
+#if !INTERLEAVE_AFTER_INIT
+	if (b->interleave)
+		enable_interleave_mode(1);
+#endif
+	flash_init();
+#if INTERLEAVE_AFTER_INIT
+	if (b->interleave)
+		enable_interleave_mode(1);
+#endif
+	info = flash_get_info();
+	pagesize = flash_page_size();
+	if (!info->num_blocks || !pagesize) {
+		fprintf(stderr, "flash not detected: id 0x%08x has no "
+			"geometry in the driver table\n", cfg.id);
+		return 1;
+	}
+
+	/* leave room for blocks going bad under the write */
+	n = b->blocks - b->bad - b->fail_program - b->fail_erase;
+	n = n > 2 ? n - 2 : 1;
+	pages = n * (info->block_size / pagesize);
+	bytes = pages * (pagesize + b->extra);
+
+	image = malloc(bytes);
+	check = malloc(bytes);
+	for (n = 0; n < bytes; n++)
+		image[n] = rnd(&b->seed);
+
+	printf("nand 0x%08x, %d byte pages, %d blocks%s, partition %d+%d, "
+	       "%d pages\n", info->id, pagesize, info->num_blocks,
+	       b->interleave ? " (2 chips interleaved)" : "",
+	       b->ptn.start, b->ptn.length, pages);
+	printf("%-10s %4s %8s %9s %7s %7s %7s %7s %7s %6s %4s\n",
+	       "op", "", "ms", "pages/s", "MB/s", "dmov", "descs", "execs",
+	       "progs", "erases", "dm");
+
+	nandsim_get_stats(&s0);
+	r = flash_erase(&b->ptn);
+	report("erase", r, b->ptn.length * info->block_size, pagesize, &s0);
+	b->failed |= r;
+
+	nandsim_get_stats(&s0);
+	r = flash_write(&b->ptn, b->extra, image, bytes);
+	report("write", r, bytes, pagesize + b->extra, &s0);
+	b->failed |= r;
+
+	flash_reset_read_stats();
+	nandsim_get_stats(&s0);
+	memset(check, 0, bytes);
+	r = flash_read_ext(&b->ptn, b->extra, 0, check, bytes);
+	if (!r && !b->ecc && memcmp(check, image, bytes)) {
+		for (n = 0; check[n] == image[n]; n++) ;
+		printf("verify error at byte %d (page %d)\n", n,
+		       n / (pagesize + b->extra));
+		r = -1;
+	}
+	report("read", r, bytes, pagesize + b->extra, &s0);
+	if (!b->ecc)
+		b->failed |= r;
+
+	nandsim_get_stats(&s0);
+	r = flash_write_ext(&b->ptn, b->extra, image, bytes, FLASH_WRITE_DIFF);
+	report("write-diff", r, bytes, pagesize + b->extra, &s0);
+	b->failed |= r;
+
+	/* rewrite a block in the middle in place; the blocks behind it
+	 * must keep their place */
+	if (!b->extra) {
+		unsigned block = pages / 64 / 2;
+		unsigned char *p = image + block * 64 * pagesize;
+
+		for (n = 0; n < 64 * pagesize; n++)
+			p[n] = rnd(&b->seed);
+		nandsim_get_stats(&s0);
+		r = flash_write_block(&b->ptn, block, p);
+		report("rewrite", r, 64 * pagesize, pagesize, &s0);
+		if (!r && !flash_read_ext(&b->ptn, 0, 0, check, bytes) &&
+		    !b->ecc && memcmp(check, image, bytes)) {
+			for (n = 0; check[n] == image[n]; n++) ;
+			printf("verify error at byte %d (page %d)\n", n,
+			       n / pagesize);
+			r = -1;
+		}
+		if (!b->ecc && !b->fail_program)
+			b->failed |= r;
+	}
+
+	flash_get_read_stats(&rs);
+	nandsim_get_stats(&s);
+	printf("read pipeline: %d chains, %d stalls, %d flushes, "
+	       "controller idle %llu us\n", rs.chains, rs.stalls,
+	       rs.flushes, rs.idle_time);
+	printf("controller: %d codeword reads, %d page loads, %d ecc errors, "
+	       "%d failures, %d crci stalls, %d overwrites, "
+	       "%d timing errors\n",
+	       s.cw_reads, s.page_loads, s.ecc_errors, s.failures,
+	       s.crci_stalls, s.overwrites, s.timing_errors);
+	printf("cache: %d pages read, %d pages programmed, "
+	       "%d sequence errors\n", s.cache_reads, s.cache_programs,
+	       s.sequence_errors);
+	if (s.sequence_errors)
+		b->failed = 1;
+
+	return b->failed ? 1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: nandbench [options]\n"
+		"  -p 2048|4096  page size\n"
+		"  -n blocks     partition size (default 64)\n"
+		"  -x bytes      spare bytes per page written and read\n"
+		"  -i            two chips interleaved\n"
+		"  -b count      factory bad blocks\n"
+		"  -w count      blocks failing program\n"
+		"  -e count      blocks failing erase\n"
+		"  -u count      pages with uncorrectable ECC errors\n"
+		"  -o modes      ONFI part with this timing mode mask\n"
+		"  -d id         report this FETCH_ID value (a known part)\n"
+		"  -s seed       random seed\n"
+		"  -c scale      charge host CPU time times scale\n"
+		"  -v            driver messages\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	int c;
+
+	memset(&b, 0, sizeof(b));
+	b.pagesize = 2048;
+	b.blocks = 64;
+	b.seed = 1;
+
+	while ((c = getopt(argc, argv, "p:n:x:ib:w:e:u:o:d:s:c:v")) != -1) {
+		switch (c) {
+		case 'p':
+			b.pagesize = atoi(optarg);
+			break;
+		case 'n':
+			b.blocks = atoi(optarg);
+			break;
+		case 'x':
+			b.extra = atoi(optarg);
+			break;
+		case 'i':
+			b.interleave = 1;
+			break;
+		case 'b':
+			b.bad = atoi(optarg);
+			break;
+		case 'w':
+			b.fail_program = atoi(optarg);
+			break;
+		case 'e':
+			b.fail_erase = atoi(optarg);
+			break;
+		case 'u':
+			b.ecc = atoi(optarg);
+			break;
+		case 'o':
+			b.onfi_modes = strtoul(optarg, NULL, 0) & 0x3f;
+			break;
+		case 'd':
+			b.id = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			b.seed = atoi(optarg);
+			break;
+		case 'c':
+			b.cpu_scale = atof(optarg);
+			break;
+		case 'v':
+			nandsim_debug_level = INFO;
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+	if ((b.pagesize != 2048 && b.pagesize != 4096) ||
+	    b.bad + b.fail_program + b.fail_erase + b.ecc + 3 > b.blocks) {
+		usage();
+		return 2;
+	}
+
+	return nandsim_run(run, &b);
+}
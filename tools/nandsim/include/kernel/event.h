@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* host stand-in for include/kernel/event.h: waits never block since
+** the simulated data mover completes requests synchronously
+*/
+
+#ifndef __KERNEL_EVENT_H
+#define __KERNEL_EVENT_H
+
+#include <debug.h>
+#include <kernel/thread.h>
+
+#define EVENT_FLAG_AUTOUNSIGNAL 1
+
+typedef struct event {
+	int signalled;
+	unsigned flags;
+} event_t;
+
+static inline void event_init(event_t *e, int initial, unsigned flags)
+{
+	e->signalled = initial;
+	e->flags = flags;
+}
+
+static inline int event_signal(event_t *e, int reschedule)
+{
+	e->signalled = 1;
+	return 0;
+}
+
+static inline int event_unsignal(event_t *e)
+{
+	e->signalled = 0;
+	return 0;
+}
+
+static inline int event_wait(event_t *e)
+{
+	ASSERT(e->signalled);
+	if (e->flags & EVENT_FLAG_AUTOUNSIGNAL)
+		e->signalled = 0;
+	return 0;
+}
+
+#endif
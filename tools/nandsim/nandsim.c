@@ -0,0 +1,1152 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <debug.h>
+#include <reg.h>
+#include <platform.h>
+#include <platform/clock.h>
+#include <platform/nand.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "dmov.h"
+#include "nandsim.h"
+
+/* storage and bookkeeping come from the host heap; only what the
+** driver allocates has to live in the low arena
+*/
+#undef malloc
+#undef calloc
+#undef free
+
+int nandsim_debug_level = CRITICAL;
+
+#define ARENA_BASE	0x40000000UL
+#define ARENA_SIZE	(1024UL << 20)
+#define STACK_SIZE	(8U << 20)
+
+#define CW_SIZE		528	/* raw codeword: 512 data + 16 spare */
+#define MAX_CW		8
+#define BUFFER_OFF	0x100	/* NAND_FLASH_BUFFER */
+#define BUFFER_SIZE	0x400
+#define NUM_REGS	(BUFFER_OFF / 4)
+#define EBI2_REGS	0x400
+
+#define STATUS_READY	0x020
+#define STATUS_OP_ERR	0x010
+#define STATUS_PROG_OK	0x080
+
+#define MAX_PENDING	32
+
+#define ONFI_SIGNATURE	0x49464E4F
+#define ONFI_PARAM_SIZE	256
+
+/* ONFI asynchronous timing modes 0-5: read/write cycle time */
+static const unsigned onfi_trc[] = { 100, 50, 35, 30, 25, 20 };
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	unsigned size;
+	unsigned align;
+};
+
+struct nand_chip {
+	unsigned char **blocks;	/* raw block contents, NULL if erased */
+	unsigned char *fail_program;	/* per block */
+	unsigned char *fail_erase;	/* per block */
+	unsigned char *ecc_fail;	/* per page */
+	unsigned long long ready;	/* background load/program done */
+	unsigned cache_row;	/* row in the page register */
+	int cache_valid;	/* a cache read may follow */
+};
+
+/* one NANDc: the registers below the buffer, the codeword buffer and
+** the page register of the chip it is talking to
+*/
+struct nand_ctrl {
+	unsigned regs[NUM_REGS];
+	unsigned char buffer[BUFFER_SIZE];
+	unsigned char page[MAX_CW * CW_SIZE];
+	unsigned op;		/* command of the page operation in progress */
+	unsigned row;
+	unsigned chip;
+	unsigned cw;		/* next codeword of the page operation */
+	unsigned first_cw;
+	unsigned long long busy;	/* operation in flight done */
+};
+
+struct pending {
+	struct dmov_req *req;
+	unsigned long long done;
+};
+
+static struct nandsim_config cfg;
+static struct nandsim_stats stats;
+static struct nand_chip chips[2];
+static struct nand_ctrl ctrls[2];
+static unsigned ebi2_regs[EBI2_REGS / 4];
+static unsigned cw_per_page;
+static unsigned raw_pagesize;
+
+static unsigned char *arena_top;
+static unsigned char *arena_end;
+static struct arena_chunk *arena_free_list;
+
+static unsigned long long cpu_now;	/* simulated CPU clock */
+static unsigned long long cpu_override;	/* clock seen by callbacks */
+static unsigned long long dm_now;	/* data mover clock while running */
+static unsigned long long dm_free;	/* data mover idle from */
+static unsigned long long bus_free;	/* EBI2 data bus idle from */
+static struct timespec host_mark;
+
+static struct pending pending[MAX_PENDING];
+static unsigned num_pending;
+
+/* low memory arena */
+
+static void arena_init(void)
+{
+	void *p;
+
+	p = mmap((void *)ARENA_BASE, ARENA_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != (void *)ARENA_BASE) {
+		fprintf(stderr, "nandsim: cannot map arena at %#lx\n",
+			ARENA_BASE);
+		abort();
+	}
+	arena_top = p;
+	arena_end = arena_top + ARENA_SIZE;
+}
+
+void *nandsim_memalign(size_t align, size_t size)
+{
+	struct arena_chunk **pp, *c;
+	uintptr_t p;
+
+	if (!arena_top)
+		arena_init();
+	if (align < sizeof(*c))
+		align = sizeof(*c);
+	size = (size + 15) & ~(size_t)15;
+
+	/* freed chunks are only reused for identical requests; the
+	** drivers allocate the same few shapes over and over
+	*/
+	for (pp = &arena_free_list; (c = *pp); pp = &c->next) {
+		if (c->size == size && c->align == align) {
+			*pp = c->next;
+			return c + 1;
+		}
+	}
+
+	p = ((uintptr_t) arena_top + sizeof(*c) + align - 1) & ~(align - 1);
+	if (p + size > (uintptr_t) arena_end) {
+		fprintf(stderr, "nandsim: arena exhausted\n");
+		abort();
+	}
+	c = (struct arena_chunk *)p - 1;
+	c->size = size;
+	c->align = align;
+	arena_top = (unsigned char *)(p + size);
+	return (void *)p;
+}
+
+void *nandsim_malloc(size_t size)
+{
+	return nandsim_memalign(16, size);
+}
+
+void *nandsim_calloc(size_t count, size_t size)
+{
+	void *p = nandsim_memalign(16, count * size);
+
+	memset(p, 0, count * size);
+	return p;
+}
+
+void nandsim_free(void *ptr)
+{
+	struct arena_chunk *c = ptr;
+
+	if (!ptr)
+		return;
+	c--;
+	c->next = arena_free_list;
+	arena_free_list = c;
+}
+
+struct run_args {
+	int (*fn) (void *arg);
+	void *arg;
+	int result;
+};
+
+static void *run_thread(void *p)
+{
+	struct run_args *args = p;
+
+	args->result = args->fn(args->arg);
+	return NULL;
+}
+
+int nandsim_run(int (*fn) (void *arg), void *arg)
+{
+	struct run_args args = { fn, arg, -1 };
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	/* driver command lists and buffers often live on the stack */
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, nandsim_memalign(4096, STACK_SIZE),
+			      STACK_SIZE);
+	if (pthread_create(&thread, &attr, run_thread, &args)) {
+		fprintf(stderr, "nandsim: cannot start thread\n");
+		return -1;
+	}
+	pthread_join(thread, NULL);
+	pthread_attr_destroy(&attr);
+	return args.result;
+}
+
+/* simulated CPU time */
+
+static unsigned long long host_elapsed(void)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	ns = (now.tv_sec - host_mark.tv_sec) * 1000000000LL +
+	    (now.tv_nsec - host_mark.tv_nsec);
+	return ns > 0 ? ns : 0;
+}
+
+/* charge the driver code run since the last call into the model */
+static void cpu_enter(void)
+{
+	if (cfg.cpu_scale > 0)
+		cpu_now += (unsigned long long)(host_elapsed() *
+						cfg.cpu_scale);
+}
+
+/* the model's own work is not charged */
+static void cpu_leave(void)
+{
+	if (cfg.cpu_scale > 0)
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &host_mark);
+}
+
+static unsigned long long max_time(unsigned long long a,
+				   unsigned long long b)
+{
+	return a > b ? a : b;
+}
+
+/* NAND array */
+
+static unsigned char *block_data(unsigned chip, unsigned block, int alloc)
+{
+	unsigned char **b = &chips[chip].blocks[block];
+	unsigned size = cfg.pages_per_block * raw_pagesize;
+
+	if (!*b && alloc) {
+		*b = malloc(size);
+		memset(*b, 0xff, size);
+	}
+	return *b;
+}
+
+static void array_read(unsigned chip, unsigned row, unsigned char *page)
+{
+	unsigned block = row / cfg.pages_per_block;
+	unsigned char *b;
+
+	if (block >= cfg.blocks) {
+		memset(page, 0, raw_pagesize);
+		return;
+	}
+	b = block_data(chip, block, 0);
+	if (b)
+		memcpy(page, b + (row % cfg.pages_per_block) * raw_pagesize,
+		       raw_pagesize);
+	else
+		memset(page, 0xff, raw_pagesize);
+}
+
+static int array_program(unsigned chip, unsigned row,
+			 const unsigned char *page)
+{
+	unsigned block = row / cfg.pages_per_block;
+	unsigned char *p;
+	unsigned n;
+	int touched = 0;
+
+	if (block >= cfg.blocks)
+		return -1;
+	if (chips[chip].fail_program[block]) {
+		stats.failures++;
+		return -1;
+	}
+
+	p = block_data(chip, block, 1) +
+	    (row % cfg.pages_per_block) * raw_pagesize;
+	for (n = 0; n < raw_pagesize; n++) {
+		if (p[n] != 0xff)
+			touched = 1;
+		p[n] &= page[n];	/* programming only clears bits */
+	}
+	if (touched)
+		stats.overwrites++;
+	stats.page_programs++;
+	return 0;
+}
+
+static int array_erase(unsigned chip, unsigned row)
+{
+	unsigned block = row / cfg.pages_per_block;
+	unsigned char **b;
+
+	if (block >= cfg.blocks)
+		return -1;
+	if (chips[chip].fail_erase[block]) {
+		stats.failures++;
+		return -1;
+	}
+
+	b = &chips[chip].blocks[block];
+	free(*b);
+	*b = NULL;
+	stats.block_erases++;
+	return 0;
+}
+
+/* controller */
+
+static unsigned *reg(struct nand_ctrl *c, unsigned addr)
+{
+	return &c->regs[(addr - MSM_NAND_BASE) / 4];
+}
+
+static unsigned cfg_reg(struct nand_ctrl *c, unsigned n)
+{
+	if (c->chip)
+		return *reg(c, n ? NAND_DEV1_CFG1 : NAND_DEV1_CFG0);
+	return *reg(c, n ? NAND_DEV0_CFG1 : NAND_DEV0_CFG0);
+}
+
+/* stand-in for the RS parity: enough to catch codewords whose data
+** changed after they were programmed
+*/
+static void ecc_parity(const unsigned char *data, unsigned len,
+		       unsigned char *parity, unsigned nparity)
+{
+	unsigned hash = 2166136261U;
+	unsigned n;
+
+	for (n = 0; n < len; n++)
+		hash = (hash ^ data[n]) * 16777619U;
+	for (n = 0; n < nparity; n++)
+		parity[n] = hash >> ((n & 3) * 8);
+}
+
+static int cw_erased(const unsigned char *cw)
+{
+	unsigned n;
+
+	for (n = 0; n < CW_SIZE; n++)
+		if (cw[n] != 0xff)
+			return 0;
+	return 1;
+}
+
+/* With ECC on, the bad block byte position of the last codeword is
+** swapped with the end of the codeword, so a programmed page keeps the
+** factory marker intact.
+*/
+static void cw_swap_marker(struct nand_ctrl *c, unsigned char *cw)
+{
+	unsigned loc = ((cfg_reg(c, 1) >> 6) & 0x3ff) - 1;
+	unsigned width = cfg.wide ? 2 : 1;
+	unsigned n;
+	unsigned char t;
+
+	if (c->cw != cw_per_page - 1 || loc + width > CW_SIZE - width)
+		return;
+	for (n = 0; n < width; n++) {
+		t = cw[loc + n];
+		cw[loc + n] = cw[CW_SIZE - width + n];
+		cw[CW_SIZE - width + n] = t;
+	}
+}
+
+/* A data cycle is two clocks of strobe plus the CFG1 recovery cycles.
+** Cycles shorter than the part can do corrupt the transfer.
+*/
+static int cw_transfer(struct nand_ctrl *c, unsigned long long *t)
+{
+	unsigned cycle = (2 + ((cfg_reg(c, 1) >> 2) & 7) + 1) * cfg.t_clk;
+
+	*t = max_time(*t, bus_free) + CW_SIZE * cycle;
+	bus_free = *t;
+	if (cycle < onfi_trc[cfg.max_mode]) {
+		stats.timing_errors++;
+		return -1;
+	}
+	return 0;
+}
+
+static void onfi_param_page(unsigned char *page)
+{
+	unsigned char *p = page;
+	unsigned blocks = cfg.blocks;
+	unsigned crc, n, i;
+
+	memset(p, 0, ONFI_PARAM_SIZE);
+	memcpy(p, "ONFI", 4);
+	p[4] = 2;		/* ONFI 1.0 */
+	p[6] = cfg.wide ? 1 : 0;
+	p[8] = cfg.cache;	/* optional commands */
+	memcpy(p + 32, "NANDSIM     ", 12);
+	memcpy(p + 80, &cfg.pagesize, 4);
+	p[84] = cfg.pagesize / 32;	/* spare bytes */
+	memcpy(p + 92, &cfg.pages_per_block, 4);
+	memcpy(p + 96, &blocks, 4);
+	p[100] = 1;
+	p[129] = cfg.onfi_modes;
+
+	crc = 0x4F4E;
+	for (n = 0; n < 254; n++) {
+		crc ^= p[n] << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^ ((crc & 0x8000) ? 0x8005 : 0);
+	}
+	p[254] = crc;
+	p[255] = crc >> 8;
+
+	/* the page repeats */
+	for (n = ONFI_PARAM_SIZE; n + ONFI_PARAM_SIZE <= raw_pagesize;
+	     n += ONFI_PARAM_SIZE)
+		memcpy(page + n, page, ONFI_PARAM_SIZE);
+}
+
+static unsigned cw_layout(struct nand_ctrl *c, unsigned *ud,
+			  unsigned *parity, unsigned *spare)
+{
+	unsigned cfg0 = cfg_reg(c, 0);
+
+	*ud = (cfg0 >> 9) & 0x3ff;
+	*parity = (cfg0 >> 19) & 0xf;
+	*spare = (cfg0 >> 23) & 0xf;
+	return ((cfg0 >> 6) & 7) + 1;
+}
+
+static int ctrl_ecc(struct nand_ctrl *c)
+{
+	return !(cfg_reg(c, 1) & 1);
+}
+
+/* starts a page operation when the address has changed since the last
+** codeword
+*/
+static int ctrl_page_start(struct nand_ctrl *c, unsigned op, unsigned row)
+{
+	unsigned col = *reg(c, NAND_ADDR0) & 0xffff;
+
+	if (c->op == op && c->row == row)
+		return 0;
+	if (cfg.wide)
+		col <<= 1;
+	c->op = op;
+	c->row = row;
+	c->cw = c->first_cw = col / CW_SIZE;
+	return 1;
+}
+
+/* Array access at the start of a page read, by what the controller
+** sends: the DEV_CMD1[7:0] opcode, the CFG0 address cycles and, if
+** DEV_CMD_VLD allows it, the DEV_CMD1[15:8] confirm.  READ PAGE loads
+** the addressed row into the page register.  READ CACHE SEQUENTIAL
+** returns that page and loads the next row in the background, READ
+** CACHE END returns it without loading another.  A cache read outside
+** a sequence or sent with an address or a confirm is an error, so a
+** driver issuing them wrong gets neither the data nor a success status.
+*/
+static int ctrl_page_load(struct nand_ctrl *c, unsigned row,
+			  unsigned long long *t)
+{
+	struct nand_chip *chip = &chips[c->chip];
+	unsigned op = *reg(c, NAND_DEV_CMD1) & 0xff;
+	unsigned addr = (cfg_reg(c, 0) >> 27) & 7;
+	unsigned confirm = *reg(c, NAND_DEV_CMD_VLD) & 1;
+
+	if (op == NAND_DEVCMD_READ_CACHE_SEQ ||
+	    op == NAND_DEVCMD_READ_CACHE_END) {
+		if (!(cfg.cache & 2) || !chip->cache_valid || addr ||
+		    confirm) {
+			chip->cache_valid = 0;
+			stats.sequence_errors++;
+			return -1;
+		}
+		*t = max_time(*t, chip->ready) + cfg.t_cache;
+		array_read(c->chip, chip->cache_row, c->page);
+		stats.cache_reads++;
+		if (op == NAND_DEVCMD_READ_CACHE_SEQ) {
+			chip->cache_row++;
+			chip->ready = *t + cfg.t_read;
+			stats.page_loads++;
+		} else {
+			chip->cache_valid = 0;
+		}
+		return 0;
+	}
+
+	/* READ PARAMETER PAGE substituted for the read opcode */
+	if (op == 0xEC && cfg.onfi_modes)
+		onfi_param_page(c->page);
+	else
+		array_read(c->chip, row, c->page);
+	*t = max_time(*t, chip->ready) + cfg.t_read;
+	stats.page_loads++;
+
+	chip->cache_valid = op == 0x00 && confirm;
+	chip->cache_row = row;
+	return 0;
+}
+
+/* other operations wait for the device and end a cache sequence */
+static void ctrl_chip_wait(struct nand_ctrl *c, unsigned long long *t)
+{
+	struct nand_chip *chip = &chips[c->chip];
+
+	*t = max_time(*t, chip->ready);
+	chip->cache_valid = 0;
+}
+
+static unsigned ctrl_read_cw(struct nand_ctrl *c, unsigned row,
+			     unsigned long long *t)
+{
+	unsigned ud, parity, spare;
+	unsigned char check[16];
+	unsigned char *cw;
+	unsigned status = STATUS_READY;
+
+	if (ctrl_page_start(c, NAND_CMD_PAGE_READ, row) &&
+	    ctrl_page_load(c, row, t)) {
+		c->op = 0;
+		return STATUS_READY | STATUS_OP_ERR;
+	}
+	if (c->cw >= cw_per_page)
+		return STATUS_READY | STATUS_OP_ERR;
+
+	cw = c->page + c->cw * CW_SIZE;
+	memcpy(c->buffer, cw, CW_SIZE);
+	if (cw_transfer(c, t)) {
+		c->buffer[c->cw] ^= 0x01;
+		status |= STATUS_OP_ERR;
+	}
+
+	if (ctrl_ecc(c) && !cw_erased(cw)) {
+		cw_swap_marker(c, c->buffer);
+		cw_layout(c, &ud, &parity, &spare);
+		ecc_parity(c->buffer, ud, check, parity);
+		if (memcmp(c->buffer + ud, check, parity) ||
+		    chips[c->chip].ecc_fail[row]) {
+			status |= STATUS_OP_ERR;
+			stats.ecc_errors++;
+		}
+	} else if (ctrl_ecc(c) && chips[c->chip].ecc_fail[row]) {
+		status |= STATUS_OP_ERR;
+		stats.ecc_errors++;
+	}
+	stats.cw_reads++;
+	c->cw++;
+	return status;
+}
+
+static unsigned ctrl_program_cw(struct nand_ctrl *c, unsigned row,
+				unsigned long long *t)
+{
+	unsigned ud, parity, spare, count;
+	unsigned char *cw;
+
+	if (ctrl_page_start(c, NAND_CMD_PRG_PAGE, row))
+		memset(c->page, 0xff, raw_pagesize);
+	if (c->cw >= cw_per_page)
+		return STATUS_READY | STATUS_OP_ERR;
+
+	count = cw_layout(c, &ud, &parity, &spare);
+	cw = c->page + c->cw * CW_SIZE;
+	if (ctrl_ecc(c)) {
+		memset(cw, 0xff, CW_SIZE);
+		memcpy(cw, c->buffer, ud);
+		ecc_parity(cw, ud, cw + ud, parity);
+		memcpy(cw + ud + parity, c->buffer + ud, spare);
+		cw_swap_marker(c, cw);
+	} else {
+		memcpy(cw, c->buffer, CW_SIZE);
+	}
+	if (cw_transfer(c, t))
+		cw[c->cw] ^= 0x01;
+	stats.cw_programs++;
+
+	if (++c->cw - c->first_cw < count)
+		return STATUS_READY | STATUS_PROG_OK;
+
+	/* last codeword: commit the page register to the array.  PROGRAM
+	** PAGE CACHE only waits for the previous page and hands this one
+	** over to be programmed in the background.
+	*/
+	c->op = 0;
+	ctrl_chip_wait(c, t);
+	if ((*reg(c, NAND_DEV_CMD0) >> 24) == NAND_DEVCMD_PROGRAM_CACHE &&
+	    (cfg.cache & 1)) {
+		*t += cfg.t_cache;
+		chips[c->chip].ready = *t + cfg.t_prog;
+		stats.cache_programs++;
+	} else {
+		*t += cfg.t_prog;
+	}
+	if (array_program(c->chip, row, c->page))
+		return STATUS_READY | STATUS_OP_ERR;
+	return STATUS_READY | STATUS_PROG_OK;
+}
+
+static void ctrl_exec(struct nand_ctrl *c)
+{
+	unsigned cmd = *reg(c, NAND_FLASH_CMD);
+	unsigned addr0 = *reg(c, NAND_ADDR0);
+	unsigned addr1 = *reg(c, NAND_ADDR1);
+	unsigned row = (addr0 >> 16) | ((addr1 & 0xff) << 16);
+	unsigned long long t = max_time(dm_now, c->busy);
+	unsigned status = STATUS_READY;
+
+	stats.execs++;
+	c->chip = *reg(c, NAND_FLASH_CHIP_SELECT) & 1;
+	if (c->chip >= cfg.chips) {
+		*reg(c, NAND_FLASH_STATUS) = STATUS_READY | STATUS_OP_ERR;
+		return;
+	}
+
+	switch (cmd) {
+	case NAND_CMD_PAGE_READ:
+	case NAND_CMD_PAGE_READ_ECC:
+	case NAND_CMD_PAGE_READ_ALL:
+		status = ctrl_read_cw(c, row, &t);
+		break;
+	case NAND_CMD_PRG_PAGE:
+	case NAND_CMD_PRG_PAGE_ECC:
+	case NAND_CMD_PRG_PAGE_ALL:
+		status = ctrl_program_cw(c, row, &t);
+		break;
+	case NAND_CMD_BLOCK_ERASE:
+		/* erase takes a bare row address */
+		c->op = 0;
+		ctrl_chip_wait(c, &t);
+		t += cfg.t_erase;
+		status |= array_erase(c->chip, addr0) ? STATUS_OP_ERR :
+		    STATUS_PROG_OK;
+		break;
+	case NAND_CMD_FETCH_ID:
+		if (addr0 == 0x20)
+			*reg(c, NAND_READ_ID) = cfg.onfi_modes ?
+			    ONFI_SIGNATURE : 0;
+		else
+			*reg(c, NAND_READ_ID) = cfg.id;
+		t += 1000;
+		break;
+	case NAND_CMD_RESET:
+	case NAND_CMD_SOFT_RESET:
+	case NAND_CMD_STATUS:
+		c->op = 0;
+		break;
+	default:
+		dprintf(CRITICAL, "nandsim: unsupported command %#x\n", cmd);
+		status |= STATUS_OP_ERR;
+		break;
+	}
+
+	*reg(c, NAND_FLASH_STATUS) = status;
+	*reg(c, NAND_BUFFER_STATUS) = 0;
+	c->busy = t;
+}
+
+static void ctrl_write(struct nand_ctrl *c, unsigned off, unsigned val)
+{
+	c->regs[off / 4] = val;
+	if (off == NAND_ADDR0 - MSM_NAND_BASE)
+		c->op = 0;
+	if (off == NAND_EXEC_CMD - MSM_NAND_BASE && (val & 1))
+		ctrl_exec(c);
+}
+
+/* register windows */
+
+static int is_nand(unsigned addr)
+{
+	return addr >= MSM_NAND_BASE && addr < MSM_NAND_BASE + 0x100000;
+}
+
+static int is_ebi2(unsigned addr)
+{
+	return addr >= EBI2_REG_BASE && addr < EBI2_REG_BASE + EBI2_REGS;
+}
+
+/* Decodes a controller address: the base window and NC01 reach the
+** first controller, NC10 the second.  NC11 writes go to both.
+*/
+static unsigned nand_decode(unsigned addr, struct nand_ctrl **c, int *both)
+{
+	unsigned win = (addr - MSM_NAND_BASE) >> 18;
+
+	*c = &ctrls[win == 2 ? 1 : 0];
+	*both = (win == 3 && cfg.chips > 1);
+	return (addr - MSM_NAND_BASE) & 0x3ffff;
+}
+
+static unsigned long long reg_ready(unsigned addr)
+{
+	struct nand_ctrl *c;
+	int both;
+
+	if (!is_nand(addr))
+		return 0;
+	nand_decode(addr, &c, &both);
+	if (both)
+		return max_time(ctrls[0].busy, ctrls[1].busy);
+	return c->busy;
+}
+
+static unsigned reg_read(unsigned addr)
+{
+	struct nand_ctrl *c;
+	unsigned off;
+	int both;
+
+	if (is_ebi2(addr))
+		return ebi2_regs[(addr - EBI2_REG_BASE) / 4];
+	if (!is_nand(addr)) {
+		dprintf(CRITICAL, "nandsim: read of unknown register %#x\n",
+			addr);
+		return 0;
+	}
+	off = nand_decode(addr, &c, &both);
+	if (off >= BUFFER_OFF)
+		return 0;
+	return c->regs[off / 4];
+}
+
+static void reg_write(unsigned addr, unsigned val)
+{
+	struct nand_ctrl *c;
+	unsigned off;
+	int both;
+
+	if (is_ebi2(addr)) {
+		ebi2_regs[(addr - EBI2_REG_BASE) / 4] = val;
+		return;
+	}
+	if (!is_nand(addr)) {
+		dprintf(CRITICAL, "nandsim: write of unknown register %#x\n",
+			addr);
+		return;
+	}
+	off = nand_decode(addr, &c, &both);
+	if (off >= BUFFER_OFF)
+		return;
+	ctrl_write(c, off, val);
+	if (both)
+		ctrl_write(&ctrls[1], off, val);
+}
+
+/* byte access to the codeword buffer, NULL outside of it */
+static unsigned char *buffer_at(unsigned addr, unsigned len, int *both)
+{
+	struct nand_ctrl *c;
+	unsigned off;
+
+	if (!is_nand(addr))
+		return NULL;
+	off = nand_decode(addr, &c, both);
+	if (off < BUFFER_OFF)
+		return NULL;
+	if (off + len > BUFFER_OFF + BUFFER_SIZE) {
+		dprintf(CRITICAL, "nandsim: buffer access %#x+%d\n", addr,
+			len);
+		return NULL;
+	}
+	return c->buffer + off - BUFFER_OFF;
+}
+
+static void dm_read(unsigned addr, unsigned char *data, unsigned len)
+{
+	unsigned char *buf;
+	unsigned n, v;
+	int both;
+
+	if (!is_nand(addr) && !is_ebi2(addr)) {
+		memcpy(data, (void *)(uintptr_t) addr, len);
+		return;
+	}
+	buf = buffer_at(addr, len, &both);
+	if (buf) {
+		memcpy(data, buf, len);
+		return;
+	}
+	for (n = 0; n < len; n += 4) {
+		v = reg_read(addr + n);
+		memcpy(data + n, &v, len - n < 4 ? len - n : 4);
+	}
+}
+
+static void dm_write(unsigned addr, const unsigned char *data, unsigned len)
+{
+	unsigned char *buf;
+	unsigned n, v;
+	int both;
+
+	if (!is_nand(addr) && !is_ebi2(addr)) {
+		memcpy((void *)(uintptr_t) addr, data, len);
+		return;
+	}
+	buf = buffer_at(addr, len, &both);
+	if (buf) {
+		memcpy(buf, data, len);
+		if (both)
+			memcpy(ctrls[1].buffer + (buf - ctrls[0].buffer), data,
+			       len);
+		return;
+	}
+	/* bursts hit consecutive registers, in order */
+	for (n = 0; n < len; n += 4) {
+		v = 0;
+		memcpy(&v, data + n, len - n < 4 ? len - n : 4);
+		reg_write(addr + n, v);
+	}
+}
+
+/* data mover */
+
+static int dm_run_cmd(dmov_s * cmd)
+{
+	static unsigned char data[BUFFER_SIZE + 4096];
+	unsigned long long ready = 0;
+
+	if ((cmd->cmd & 3) != CMD_MODE_SINGLE) {
+		dprintf(CRITICAL, "nandsim: unsupported dmov mode %d\n",
+			cmd->cmd & 3);
+		return -1;
+	}
+	if (cmd->len > sizeof(data)) {
+		dprintf(CRITICAL, "nandsim: dmov length %d\n", cmd->len);
+		return -1;
+	}
+
+	/* CRCI flow control holds the descriptor until the controller
+	** is done with the operation in flight
+	*/
+	if (cmd->cmd & CMD_DST_CRCI(15))
+		ready = reg_ready(cmd->dst);
+	if (cmd->cmd & CMD_SRC_CRCI(15))
+		ready = max_time(ready, reg_ready(cmd->src));
+	if (ready > dm_now) {
+		dm_now = ready;
+		stats.crci_stalls++;
+	}
+	dm_now += cfg.t_desc + cmd->len * cfg.t_mem_byte;
+
+	dm_read(cmd->src, data, cmd->len);
+	dm_write(cmd->dst, data, cmd->len);
+
+	stats.descriptors++;
+	stats.bytes += cmd->len;
+	return 0;
+}
+
+static int dm_run(unsigned *ptrlist)
+{
+	unsigned *ptr = ptrlist;
+	unsigned p;
+	dmov_s *cmd;
+
+	do {
+		p = *ptr++;
+		cmd = (dmov_s *) (uintptr_t) ((p & 0x1fffffff) << 3);
+		stats.lists++;
+		for (;;) {
+			if (dm_run_cmd(cmd))
+				return -1;
+			if (cmd->cmd & CMD_LC)
+				break;
+			cmd++;
+		}
+	} while (!(p & CMD_PTR_LP));
+	return 0;
+}
+
+/* Completes the requests whose interrupt has been taken by now, in
+** submission order, as the ADM interrupt handler would.
+*/
+static void dm_retire(void)
+{
+	struct dmov_req *req;
+	unsigned long long at;
+
+	while (num_pending && pending[0].done + cfg.t_irq <= cpu_now) {
+		req = pending[0].req;
+		at = pending[0].done + cfg.t_irq;
+		memmove(pending, pending + 1,
+			--num_pending * sizeof(pending[0]));
+
+		req->finished = 1;
+		cpu_override = at;
+		if (req->complete)
+			req->complete(req);
+		cpu_override = 0;
+		event_signal(&req->done, 0);
+	}
+}
+
+void dmov_init(void)
+{
+}
+
+/* The data mover runs the whole list when it is queued; the request
+** only becomes visible as finished once the simulated clock has passed
+** its completion time.
+*/
+int dmov_submit(unsigned id, struct dmov_req *req)
+{
+	unsigned long long start;
+
+	cpu_enter();
+	ASSERT(num_pending < MAX_PENDING);
+
+	req->id = id;
+	req->next = NULL;
+	req->finished = 0;
+	event_init(&req->done, 0, 0);
+
+	cpu_now += cfg.t_submit;
+	start = max_time(cpu_now, dm_free) + cfg.t_setup;
+	dm_now = start;
+	req->result = dm_run(req->ptrlist);
+	stats.transfers++;
+	stats.dm_busy += dm_now - start;
+	dm_free = dm_now;
+
+	pending[num_pending].req = req;
+	pending[num_pending].done = dm_now;
+	num_pending++;
+
+	dm_retire();
+	cpu_leave();
+	return 0;
+}
+
+int dmov_wait(struct dmov_req *req)
+{
+	unsigned n;
+
+	cpu_enter();
+	for (n = 0; n < num_pending; n++) {
+		if (pending[n].req == req) {
+			cpu_now = max_time(cpu_now,
+					   pending[n].done + cfg.t_irq);
+			break;
+		}
+	}
+	dm_retire();
+	cpu_leave();
+	return req->result;
+}
+
+int dmov_exec_cmdptr(unsigned id, unsigned *ptr)
+{
+	struct dmov_req req;
+
+	req.ptrlist = ptr;
+	req.complete = NULL;
+	req.arg = NULL;
+
+	dmov_submit(id, &req);
+	return dmov_wait(&req);
+}
+
+unsigned nandsim_readl(unsigned addr)
+{
+	return reg_read(addr);
+}
+
+void nandsim_writel(unsigned val, unsigned addr)
+{
+	dm_now = cpu_now;
+	reg_write(addr, val);
+}
+
+bigtime_t current_time_hires(void)
+{
+	bigtime_t t;
+
+	if (cpu_override)
+		return cpu_override / 1000;
+	cpu_enter();
+	dm_retire();
+	t = cpu_now / 1000;
+	cpu_leave();
+	return t;
+}
+
+time_t current_time(void)
+{
+	return current_time_hires() / 1000;
+}
+
+/* the NANDc clock, which the model counts the CFG1 wait states in */
+int clk_get_rate(unsigned id)
+{
+	return id == EBI2_CLK ? (int)(1000000000U / cfg.t_clk) : -1;
+}
+
+/* setup */
+
+void nandsim_default_config(struct nandsim_config *c, unsigned pagesize)
+{
+	memset(c, 0, sizeof(*c));
+
+	/* Samsung 256MB x8 SLC and 512MB x16 4k page parts */
+	if (pagesize == 4096) {
+		c->id = 0x6600bcec;
+		c->wide = 1;
+		c->t_prog = 250000;
+	} else {
+		c->id = 0x1500aaec;
+		c->t_prog = 200000;
+	}
+	c->pagesize = pagesize;
+	c->pages_per_block = 64;
+	c->blocks = 2048;
+	c->chips = 1;
+	c->max_mode = 1;
+	c->cache = 3;
+
+	c->t_read = 25000;
+	c->t_erase = 2000000;
+	c->t_cache = 3000;
+	c->t_clk = 10;
+	c->t_mem_byte = 4;
+	c->t_desc = 100;
+	c->t_setup = 1000;
+	c->t_irq = 5000;
+	c->t_submit = 1000;
+}
+
+void nandsim_init(const struct nandsim_config *c)
+{
+	unsigned n, i, loc;
+
+	cfg = *c;
+	cw_per_page = cfg.pagesize / 512;
+	raw_pagesize = cw_per_page * CW_SIZE;
+	ASSERT(cw_per_page <= MAX_CW && cfg.chips <= 2);
+
+	memset(&stats, 0, sizeof(stats));
+	memset(ctrls, 0, sizeof(ctrls));
+	memset(chips, 0, sizeof(chips));
+	cpu_now = dm_free = bus_free = 0;
+	num_pending = 0;
+	cpu_leave();
+
+	/* what the earlier boot stage leaves in the config registers */
+	loc = cfg.pagesize - CW_SIZE * (cw_per_page - 1) + 1;
+	for (n = 0; n < 2; n++) {
+		for (i = 0; i < 2; i++) {
+			*reg(&ctrls[n], i ? NAND_DEV1_CFG0 : NAND_DEV0_CFG0) =
+			    0xaad400da;
+			*reg(&ctrls[n], i ? NAND_DEV1_CFG1 : NAND_DEV0_CFG1) =
+			    (loc << 6) | 0x1c | (cfg.wide ? 2 : 0);
+		}
+		*reg(&ctrls[n], NAND_DEV_CMD0) = 0x1080D060;
+		*reg(&ctrls[n], NAND_DEV_CMD1) = 0xF00F3000;
+		*reg(&ctrls[n], NAND_DEV_CMD_VLD) = 0x1D;
+	}
+
+	for (n = 0; n < cfg.chips; n++) {
+		chips[n].blocks = calloc(cfg.blocks, sizeof(unsigned char *));
+		chips[n].fail_program = calloc(cfg.blocks, 1);
+		chips[n].fail_erase = calloc(cfg.blocks, 1);
+		chips[n].ecc_fail = calloc(cfg.blocks * cfg.pages_per_block, 1);
+	}
+}
+
+void nandsim_factory_bad(unsigned chip, unsigned block)
+{
+	unsigned char *b = block_data(chip, block, 1);
+
+	/* marker cleared in the first page */
+	memset(b, 0, raw_pagesize);
+}
+
+void nandsim_fail_program(unsigned chip, unsigned block)
+{
+	chips[chip].fail_program[block] = 1;
+}
+
+void nandsim_fail_erase(unsigned chip, unsigned block)
+{
+	chips[chip].fail_erase[block] = 1;
+}
+
+void nandsim_ecc_error(unsigned chip, unsigned page)
+{
+	chips[chip].ecc_fail[page] = 1;
+}
+
+void nandsim_get_stats(struct nandsim_stats *out)
+{
+	cpu_enter();
+	*out = stats;
+	out->time = cpu_now;
+	cpu_leave();
+}
+
+void nandsim_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+unsigned long long nandsim_time(void)
+{
+	cpu_enter();
+	cpu_leave();
+	return cpu_now;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __NANDSIM_H
+#define __NANDSIM_H
+
+/* Host model of the MSM NAND controller behind the ADM data mover.
+**
+** The bootloader NAND driver is built unchanged against this model: its
+** DMOV command lists are interpreted descriptor by descriptor against
+** two controller register files (NC01/NC10, the base window aliases
+** NC01, NC11 broadcasts) and up to two chips.  Time is simulated: each
+** descriptor, bus transfer and array operation advances the clock of
+** the unit doing it, and CRCI flow control stalls the data mover until
+** the addressed controller is ready.  Only the NAND command set is
+** modelled, not OneNAND.
+*/
+
+struct nandsim_config {
+	unsigned id;		/* FETCH_ID result */
+	unsigned pagesize;	/* 2048 or 4096 */
+	unsigned pages_per_block;
+	unsigned blocks;	/* per chip */
+	unsigned chips;		/* 1, or 2 for interleaved mode */
+	unsigned wide;		/* 16-bit bus */
+	unsigned onfi_modes;	/* ONFI timing modes; 0 for a non-ONFI part */
+	unsigned max_mode;	/* fastest timing the part really meets */
+	unsigned cache;		/* 1: program page cache, 2: read cache */
+
+	/* timing, in nanoseconds */
+	unsigned t_read;	/* array to page register */
+	unsigned t_prog;
+	unsigned t_erase;
+	unsigned t_cache;	/* cache register handover (tRCBSY/tCBSY) */
+	unsigned t_clk;		/* NANDc clock; CFG1 wait states count it */
+	unsigned t_mem_byte;	/* data mover copy */
+	unsigned t_desc;	/* data mover descriptor fetch */
+	unsigned t_setup;	/* command pointer list start */
+	unsigned t_irq;		/* completion interrupt to waiting thread */
+	unsigned t_submit;	/* CPU cost of queueing a request */
+
+	/* host CPU time charged to the simulated CPU; 0 keeps the
+	** results independent of the machine running the model
+	*/
+	double cpu_scale;
+};
+
+struct nandsim_stats {
+	unsigned long long time;	/* simulated nanoseconds */
+	unsigned long long dm_busy;	/* data mover busy time */
+	unsigned transfers;	/* command pointer lists executed */
+	unsigned lists;		/* dmov_s arrays walked */
+	unsigned descriptors;
+	unsigned long long bytes;	/* moved by the data mover */
+	unsigned crci_stalls;	/* descriptors that waited on a controller */
+	unsigned execs;		/* controller operations started */
+	unsigned cw_reads;
+	unsigned cw_programs;
+	unsigned page_loads;
+	unsigned page_programs;
+	unsigned cache_reads;	/* pages served from the cache register */
+	unsigned cache_programs;	/* pages programmed in the background */
+	unsigned sequence_errors;	/* cache reads out of sequence */
+	unsigned block_erases;
+	unsigned ecc_errors;	/* uncorrectable codewords returned */
+	unsigned failures;	/* injected program/erase failures hit */
+	unsigned overwrites;	/* programs of non-erased pages */
+	unsigned timing_errors;	/* codewords moved faster than the part allows */
+};
+
+void nandsim_default_config(struct nandsim_config *cfg, unsigned pagesize);
+void nandsim_init(const struct nandsim_config *cfg);
+
+/* fault injection; page and block numbers are per chip */
+void nandsim_factory_bad(unsigned chip, unsigned block);
+void nandsim_fail_program(unsigned chip, unsigned block);
+void nandsim_fail_erase(unsigned chip, unsigned block);
+void nandsim_ecc_error(unsigned chip, unsigned page);
+
+void nandsim_get_stats(struct nandsim_stats *stats);
+void nandsim_reset_stats(void);
+unsigned long long nandsim_time(void);
+
+/* run fn on a stack inside the low arena; returns its result */
+int nandsim_run(int (*fn) (void *arg), void *arg);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Runs the usbtest gadget on the UDC driver against the simulated
+** controller, printing the same per-endpoint report as the target app
+** followed by bus and controller counters; or, with -m, the mass
+** storage gadget against a scripted host (mscbench.c).
+*/
+
+#include <debug.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dev/udc.h>
+
+#include "usbtest.h"
+#include "usbsim.h"
+
+int msc_bench(struct udc_device *udc);
+
+struct bench {
+	unsigned size;
+	unsigned depth;
+	unsigned msecs;		/* run time */
+	unsigned period;	/* msecs between reports */
+	unsigned host_xfer;
+	int fullspeed;
+	int reconnect;		/* bus reset before each period */
+	int msc;
+	double cpu_scale;
+};
+
+static struct udc_device bench_udc_device = {
+	.vendor_id = 0x18d1,
+	.product_id = 0xD00D,
+	.version_id = 0x0100,
+	.manufacturer = "Google",
+	.product = "usbsim",
+};
+
+static int run(struct bench *b)
+{
+	struct usbsim_config cfg;
+	struct usbsim_stats s0, s;
+	struct usbtest_stats prev, cur;
+	struct usbtest_config tc;
+	unsigned long long ns;
+	unsigned t, n, errors;
+
+	usbsim_default_config(&cfg);
+	cfg.loop = 2;		/* the second OUT/IN pair allocated */
+	cfg.host_xfer = b->host_xfer;
+	cfg.cpu_scale = b->cpu_scale;
+	if (b->fullspeed) {
+		/* 19 full packets per frame at best */
+		cfg.highspeed = 0;
+		cfg.t_byte = 667;
+		cfg.t_packet = 10000;
+	}
+	usbsim_init(&cfg);
+
+	if (udc_init(&bench_udc_device))
+		return 1;
+	tc.size = b->size;
+	tc.depth = b->depth;
+	tc.buf = memalign(4096, usbtest_buf_size(b->size, b->depth));
+	if (usbtest_init(&tc) || udc_start())
+		return 1;
+
+	usbsim_connect();
+	udc_reset_stats();
+	usbsim_reset_stats();
+	usbsim_get_stats(&s0);
+	usbtest_get_stats(&prev);
+
+	for (t = 0; t < b->msecs; t += b->period) {
+		if (b->reconnect && t)
+			usbsim_connect();
+		usbsim_run(b->period * 1000000ULL);
+		usbtest_get_stats(&cur);
+		usbtest_report(&prev, &cur);
+		prev = cur;
+	}
+
+	usbsim_get_stats(&s);
+	ns = s.time - s0.time;
+	printf("bus: %.1f%% busy, %.2f MB/s, %u packets (%u short), "
+	       "%u dTDs, %u primes\n",
+	       ns ? 100.0 * s.bus_busy / ns : 0.0,
+	       ns ? s.bytes * 1e9 / ns / (1 << 20) : 0.0,
+	       s.packets, s.short_packets, s.dtds, s.primes);
+	printf("cpu: %u irqs, %u thread wakeups, %u register reads, "
+	       "%u writes, %u cache lines\n",
+	       s.irqs, s.switches, s.reg_reads, s.reg_writes,
+	       s.cache_lines);
+
+	errors = 0;
+	if (!b->reconnect)
+		for (n = 0; n < USBTEST_EPTS; n++)
+			errors += cur.ept[n].errors;
+	if (s.verify_errors)
+		printf("loopback: %u bytes came back wrong\n",
+		       s.verify_errors);
+	if (errors)
+		printf("%u requests failed\n", errors);
+	for (n = 0; n < USBTEST_EPTS; n++) {
+		if (!cur.ept[n].xfers) {
+			printf("no transfers on endpoint %u\n", n);
+			errors++;
+		}
+	}
+	return s.verify_errors || errors ? 1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: usbbench [options]\n"
+		"  -s bytes      request size (default 65536)\n"
+		"  -d depth      requests queued per endpoint (default 2)\n"
+		"  -t msecs      run time (default 1000)\n"
+		"  -p msecs      report period (default: run time)\n"
+		"  -x bytes      host OUT transfer size (default: endless)\n"
+		"  -f            full speed\n"
+		"  -r            bus reset and reconfigure every period\n"
+		"  -c scale      charge host CPU time times scale\n"
+		"  -m            mass storage commands instead\n"
+		"  -v            driver messages\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	int c;
+
+	memset(&b, 0, sizeof(b));
+	b.size = 65536;
+	b.depth = 2;
+	b.msecs = 1000;
+
+	while ((c = getopt(argc, argv, "s:d:t:p:x:frc:mv")) != -1) {
+		switch (c) {
+		case 's':
+			b.size = atoi(optarg);
+			break;
+		case 'd':
+			b.depth = atoi(optarg);
+			break;
+		case 't':
+			b.msecs = atoi(optarg);
+			break;
+		case 'p':
+			b.period = atoi(optarg);
+			break;
+		case 'x':
+			b.host_xfer = atoi(optarg);
+			break;
+		case 'f':
+			b.fullspeed = 1;
+			break;
+		case 'r':
+			b.reconnect = 1;
+			break;
+		case 'c':
+			b.cpu_scale = atof(optarg);
+			break;
+		case 'm':
+			b.msc = 1;
+			break;
+		case 'v':
+			usbsim_debug_level = INFO;
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+	if (b.msc)
+		return msc_bench(&bench_udc_device);
+	if (!b.period)
+		b.period = b.msecs;
+	if (!b.size || !b.depth || b.depth > USBTEST_MAX_DEPTH ||
+	    !b.msecs || !b.period) {
+		usage();
+		return 2;
+	}
+
+	return run(&b);
+}
@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/* Runs the mass storage gadget against a Bulk-Only host scripted through
+** the simulated controller: commands go out as CBWs and come back as
+** CSWs, data is checked sector by sector against what the host expects
+** the partitions to hold, and a write from a fastboot thread checks the
+** cache is dropped behind it.  Partitions live in RAM; flash operations
+** complete when submitted, so times are those of the bus alone.
+*/
+
+#include <debug.h>
+#include <stdio.h>
+#include <dev/flash.h>
+#include <dev/udc.h>
+#include <dev/udc_msc.h>
+#include <kernel/thread.h>
+#include <kernel/event.h>
+#include <lib/ptable.h>
+
+#include "usbsim.h"
+
+#define EPT		1	/* the gadget's bulk pair */
+#define TIMEOUT		5000	/* msecs */
+
+#define PAGE_SIZE	2048
+#define BLOCK_SIZE	(64 * PAGE_SIZE)
+#define SECTOR		512
+#define SPB		(BLOCK_SIZE / SECTOR)
+#define NUM_BLOCKS	24
+
+#define CACHE_BLOCKS	16	/* "cache", writeable */
+#define SYSTEM_BLOCKS	8	/* "system", read only */
+
+#define CBW_SIGNATURE	0x43425355
+#define CSW_SIGNATURE	0x53425355
+
+static struct ptable ptable;
+static unsigned char *flash;	/* what the partitions hold */
+static unsigned char *expect;	/* what the host should read back */
+static unsigned char *buf;
+static unsigned tag;
+static unsigned failures;
+
+/* flash worker */
+
+struct ptable *flash_get_ptable(void)
+{
+	return &ptable;
+}
+
+unsigned flash_page_size(void)
+{
+	return PAGE_SIZE;
+}
+
+unsigned flash_good_blocks(struct ptentry *ptn)
+{
+	return ptn->length;
+}
+
+int flash_submit(struct flash_op *op)
+{
+	unsigned char *p = flash + op->ptn->start * BLOCK_SIZE;
+	unsigned size = op->ptn->length * BLOCK_SIZE;
+
+	op->result = -1;
+	switch (op->type) {
+	case FLASH_OP_READ:
+		if (op->offset > size || op->bytes > size - op->offset)
+			break;
+		memcpy(op->data, p + op->offset, op->bytes);
+		op->result = 0;
+		break;
+	case FLASH_OP_BLOCK:
+		if (op->offset >= op->ptn->length)
+			break;
+		memcpy(p + op->offset * BLOCK_SIZE, op->data, BLOCK_SIZE);
+		op->result = 0;
+		break;
+	case FLASH_OP_WRITE:
+		if (op->bytes > size)
+			break;
+		memset(p, 0xff, size);
+		memcpy(p, op->data, op->bytes);
+		op->result = 0;
+		break;
+	case FLASH_OP_ERASE:
+		memset(p, 0xff, size);
+		op->result = 0;
+		break;
+	}
+	event_init(&op->done, true, 0);
+	if (op->complete)
+		op->complete(op);
+	return 0;
+}
+
+int flash_op_wait(struct flash_op *op)
+{
+	event_wait(&op->done);
+	return op->result;
+}
+
+int flash_op_call(struct flash_op *op)
+{
+	if (flash_submit(op))
+		return -1;
+	return flash_op_wait(op);
+}
+
+/* a fastboot "flash:" of the image, from a thread of its own */
+
+static event_t fb_go;
+static struct ptentry *fb_ptn;
+static void *fb_data;
+static unsigned fb_bytes;
+static volatile int fb_done;
+static int fb_result;
+
+static int fastboot_thread(void *arg)
+{
+	struct flash_op op;
+
+	for (;;) {
+		event_wait(&fb_go);
+		udc_msc_invalidate(fb_ptn);
+		memset(&op, 0, sizeof(op));
+		op.type = FLASH_OP_WRITE;
+		op.ptn = fb_ptn;
+		op.data = fb_data;
+		op.bytes = fb_bytes;
+		fb_result = flash_op_call(&op);
+		fb_done = 1;
+	}
+	return 0;
+}
+
+static int fastboot_flash(struct ptentry *ptn, void *data, unsigned bytes)
+{
+	unsigned long long end = usbsim_time() + TIMEOUT * 1000000ULL;
+
+	fb_ptn = ptn;
+	fb_data = data;
+	fb_bytes = bytes;
+	fb_done = 0;
+	event_signal(&fb_go, false);
+	while (!fb_done && usbsim_time() < end)
+		usbsim_run(100000);
+	if (!fb_done)
+		return -1;
+	return fb_result;
+}
+
+/* host */
+
+static void put_le32(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static unsigned get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+static void put_be32(unsigned char *p, unsigned v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static unsigned get_be32(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int fail(const char *test, const char *why)
+{
+	printf("msc: %s: %s\n", test, why);
+	failures++;
+	return -1;
+}
+
+/* One command: the CBW, 'length' bytes of data in or out ('send' of them
+** actually sent out, ending early if fewer) and the CSW.  Returns the CSW
+** status, or -1 if the transport broke down.
+*/
+static int scsi(const char *test, unsigned lun, const unsigned char *cb,
+		unsigned cb_len, int in, unsigned length, void *data,
+		unsigned send, unsigned *residue)
+{
+	unsigned char cbw[31], csw[13];
+	int n;
+
+	memset(cbw, 0, sizeof(cbw));
+	put_le32(cbw, CBW_SIGNATURE);
+	put_le32(cbw + 4, ++tag);
+	put_le32(cbw + 8, length);
+	cbw[12] = in ? 0x80 : 0;
+	cbw[13] = lun;
+	cbw[14] = cb_len;
+	memcpy(cbw + 15, cb, cb_len);
+	if (usbsim_bulk_out(EPT, cbw, sizeof(cbw), TIMEOUT) != sizeof(cbw))
+		return fail(test, "CBW not taken");
+
+	if (length && in) {
+		n = usbsim_bulk_in(EPT, data, length, TIMEOUT);
+		if (n != (int)length)
+			return fail(test, "data phase ended early");
+	} else if (length) {
+		if (usbsim_bulk_out(EPT, data, send, TIMEOUT) != (int)send)
+			return fail(test, "data not taken");
+	}
+
+	if (usbsim_bulk_in(EPT, csw, sizeof(csw), TIMEOUT) != sizeof(csw))
+		return fail(test, "no CSW");
+	if (get_le32(csw) != CSW_SIGNATURE || get_le32(csw + 4) != tag)
+		return fail(test, "CSW signature or tag wrong");
+	if (residue)
+		*residue = get_le32(csw + 8);
+	return csw[12];
+}
+
+static unsigned lun_start(unsigned lun)
+{
+	return ptable.parts[lun].start * BLOCK_SIZE;
+}
+
+static int rw10(const char *test, unsigned lun, unsigned char op,
+		unsigned lba, unsigned count, int in, void *data,
+		unsigned send, unsigned *residue)
+{
+	unsigned char cb[10];
+
+	memset(cb, 0, sizeof(cb));
+	cb[0] = op;
+	put_be32(cb + 2, lba);
+	cb[7] = count >> 8;
+	cb[8] = count;
+	return scsi(test, lun, cb, sizeof(cb), in, count * SECTOR, data, send,
+		    residue);
+}
+
+static int read10(const char *test, unsigned lun, unsigned lba,
+		  unsigned count)
+{
+	int r;
+
+	r = rw10(test, lun, 0x28, lba, count, 1, buf, 0, NULL);
+	if (r < 0)
+		return r;
+	if (r)
+		return fail(test, "READ(10) failed");
+	if (memcmp(buf, expect + lun_start(lun) + lba * SECTOR,
+		   count * SECTOR))
+		return fail(test, "read back the wrong data");
+	return 0;
+}
+
+/* write 'count' sectors of new data, of which only 'send' bytes go out */
+static int write10(const char *test, unsigned lun, unsigned lba,
+		   unsigned count, unsigned send, unsigned *residue)
+{
+	unsigned n;
+	int r;
+
+	for (n = 0; n < count * SECTOR; n++)
+		buf[n] = (lba * 3 + n * 5 + tag) ^ (n >> 9);
+	r = rw10(test, lun, 0x2a, lba, count, 0, buf, send, residue);
+	if (r >= 0 && r != 1)	/* whole sectors received are kept */
+		memcpy(expect + lun_start(lun) + lba * SECTOR, buf,
+		       send & ~(SECTOR - 1));
+	return r;
+}
+
+static int request_sense(const char *test, unsigned lun, unsigned key,
+			 unsigned asc)
+{
+	unsigned char cb[6] = { 0x03, 0, 0, 0, 18, 0 }, sense[18];
+
+	if (scsi(test, lun, cb, sizeof(cb), 1, sizeof(sense), sense, 0,
+		 NULL))
+		return fail(test, "REQUEST SENSE failed");
+	if ((sense[2] & 0xf) != key || sense[12] != asc)
+		return fail(test, "wrong sense");
+	return 0;
+}
+
+static int simple(const char *test, unsigned lun, unsigned char op)
+{
+	unsigned char cb[10];
+
+	memset(cb, 0, sizeof(cb));
+	cb[0] = op;
+	return scsi(test, lun, cb, op < 0x20 ? 6 : 10, 0, 0, NULL, 0, NULL);
+}
+
+static int check_flash(const char *test)
+{
+	if (memcmp(flash, expect, NUM_BLOCKS * BLOCK_SIZE))
+		return fail(test, "flash differs from what was written");
+	return 0;
+}
+
+static void rate(const char *test, unsigned bytes, unsigned long long ns)
+{
+	printf("msc: %s: %u KB in %.2f ms, %.2f MB/s\n", test, bytes >> 10,
+	       ns / 1e6, ns ? bytes * 1e9 / ns / (1 << 20) : 0.0);
+}
+
+static void run_tests(void)
+{
+	unsigned char cb[10];
+	unsigned residue, n;
+	unsigned long long t;
+	int r;
+
+	if (simple("test unit ready", 0, 0x00))
+		fail("test unit ready", "not ready");
+
+	/* more asked for than there is: padded, with the rest as residue */
+	memset(cb, 0, sizeof(cb));
+	cb[0] = 0x12;
+	cb[4] = 64;
+	r = scsi("inquiry", 0, cb, 6, 1, 64, buf, 0, &residue);
+	if (r || residue != 64 - 36 || memcmp(buf + 8, "Android cache", 13))
+		fail("inquiry", "wrong response");
+
+	memset(cb, 0, sizeof(cb));
+	cb[0] = 0x25;
+	r = scsi("read capacity", 0, cb, 10, 1, 8, buf, 0, NULL);
+	if (r || get_be32(buf) != CACHE_BLOCKS * SPB - 1 ||
+	    get_be32(buf + 4) != SECTOR)
+		fail("read capacity", "wrong response");
+
+	read10("read across blocks", 0, SPB - 6, 20);
+
+	t = usbsim_time();
+	if (!read10("sequential read", 0, 0, 8 * SPB))
+		rate("sequential read", 8 * BLOCK_SIZE, usbsim_time() - t);
+
+	if (write10("write across blocks", 0, 2 * SPB - 12, 30, 30 * SECTOR,
+		    NULL))
+		fail("write across blocks", "WRITE(10) failed");
+	read10("write across blocks", 0, 2 * SPB - 20, 50);
+
+	/* the host ends the data phase with a short packet part way into
+	** the sixth sector */
+	n = 5 * SECTOR + 100;
+	r = write10("short write", 0, 3 * SPB + 7, 16, n, &residue);
+	if (r != 2 || residue != 16 * SECTOR - n)
+		fail("short write", "no phase error or wrong residue");
+	read10("short write", 0, 3 * SPB, 2 * SPB);
+
+	t = usbsim_time();
+	if (write10("sequential write", 0, 4 * SPB, 8 * SPB, 8 * BLOCK_SIZE,
+		    NULL))
+		fail("sequential write", "WRITE(10) failed");
+	else
+		rate("sequential write", 8 * BLOCK_SIZE, usbsim_time() - t);
+
+	if (simple("synchronize cache", 0, 0x35))
+		fail("synchronize cache", "failed");
+	check_flash("synchronize cache");
+
+	if (write10("write protect", 1, 0, 1, SECTOR, NULL) != 1)
+		fail("write protect", "write to a read only LUN passed");
+	request_sense("write protect", 1, 0x7, 0x27);
+
+	if (rw10("out of range", 0, 0x28, CACHE_BLOCKS * SPB - 1, 2, 1, buf,
+		 0, NULL) != 1)
+		fail("out of range", "read past the end passed");
+	request_sense("out of range", 0, 0x5, 0x21);
+
+	/* a clean block and a dirty one in the cache while fastboot
+	** flashes the partition */
+	read10("fastboot flash", 0, 0, 8);
+	write10("fastboot flash", 0, 12 * SPB + 40, 8, 8 * SECTOR, NULL);
+	for (n = 0; n < 4 * BLOCK_SIZE; n++)
+		buf[n] = n * 13 + (n >> 11);
+	memset(expect, 0xff, CACHE_BLOCKS * BLOCK_SIZE);
+	memcpy(expect, buf, 4 * BLOCK_SIZE);
+	if (fastboot_flash(&ptable.parts[0], buf, 4 * BLOCK_SIZE))
+		fail("fastboot flash", "flash failed");
+	if (simple("fastboot flash", 0, 0x00) != 1)
+		fail("fastboot flash", "no unit attention");
+	request_sense("fastboot flash", 0, 0x6, 0x28);
+	read10("fastboot flash", 0, 0, 8);
+	read10("fastboot flash", 0, 12 * SPB + 32, 24);
+
+	/* long enough for the gadget to write back what it holds */
+	usbsim_run(3000 * 1000000ULL);
+	check_flash("fastboot flash");
+}
+
+int msc_bench(struct udc_device *udc)
+{
+	struct usbsim_config cfg;
+	struct usbsim_stats s;
+	unsigned size, n;
+	thread_t *thr;
+
+	usbsim_default_config(&cfg);
+	cfg.scripted = EPT;
+	usbsim_init(&cfg);
+
+	flash = malloc(NUM_BLOCKS * BLOCK_SIZE);
+	expect = malloc(NUM_BLOCKS * BLOCK_SIZE);
+	buf = malloc(8 * BLOCK_SIZE);
+	for (n = 0; n < NUM_BLOCKS * BLOCK_SIZE; n++)
+		flash[n] = n ^ (n >> 9) ^ (n >> 17);
+	memcpy(expect, flash, NUM_BLOCKS * BLOCK_SIZE);
+	ptable_init(&ptable);
+	ptable_add(&ptable, "cache", 0, CACHE_BLOCKS, 0, TYPE_APPS_PARTITION,
+		   PERM_WRITEABLE);
+	ptable_add(&ptable, "system", CACHE_BLOCKS, SYSTEM_BLOCKS, 0,
+		   TYPE_APPS_PARTITION, PERM_NON_WRITEABLE);
+
+	if (udc_init(udc))
+		return 1;
+	size = udc_msc_mem_size();
+	if (udc_msc_init("cache,system", memalign(32, size), size))
+		return 1;
+	event_init(&fb_go, false, EVENT_FLAG_AUTOUNSIGNAL);
+	thr = thread_create("fastboot", fastboot_thread, NULL,
+			    DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+	if (!thr || udc_start())
+		return 1;
+	thread_resume(thr);
+
+	usbsim_connect();
+	usbsim_reset_stats();
+	run_tests();
+
+	usbsim_get_stats(&s);
+	printf("bus: %u packets (%u short), %u dTDs, %u primes, "
+	       "%u irqs, %u thread wakeups\n", s.packets, s.short_packets,
+	       s.dtds, s.primes, s.irqs, s.switches);
+	if (s.overruns) {
+		printf("msc: %u packets past the end of IN transfers\n",
+		       s.overruns);
+		failures++;
+	}
+	printf("msc: %u commands, %u failures\n", tag, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,961 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <debug.h>
+#include <reg.h>
+#include <platform.h>
+#include <platform/interrupts.h>
+#include <platform/clock.h>
+#include <kernel/thread.h>
+#include <kernel/event.h>
+#include <arch/ops.h>
+#include <dev/udc.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "hsusb.h"
+#include "usbsim.h"
+
+/* bookkeeping comes from the host heap; only what the driver allocates
+** has to live in the low arena
+*/
+#undef malloc
+#undef free
+
+int usbsim_debug_level = CRITICAL;
+
+#define ARENA_BASE	0x40000000UL
+#define ARENA_SIZE	(256UL << 20)
+
+#define USB_WINDOW	0x1000
+#define NUM_EPTS	32	/* dQH index: endpoint number * 2 + in */
+#define HOST_POLL	10000	/* ns the scripted host runs the bus for */
+
+#define PORTSC_PSPD(n)	((n) << 26)
+#define PORTSC_PSPD_MASK	PORTSC_PSPD(3)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	unsigned size;
+	unsigned align;
+};
+
+struct sim_ept {
+	unsigned dtd;		/* dTD being worked on, 0 when stopped */
+	unsigned total;		/* its byte count */
+	unsigned done;		/* bytes moved so far */
+	int priming;
+	unsigned long long prime_at;
+	unsigned host_left;	/* OUT: bytes left in the host transfer */
+	unsigned long long pos;	/* bytes of the host data stream */
+
+	/* transfer of the scripted host, see usbsim_bulk_out() */
+	unsigned char *host_buf;
+	unsigned host_len;
+	unsigned host_done;
+	int host_busy;
+};
+
+static struct usbsim_config cfg;
+static struct usbsim_stats stats;
+static struct sim_ept sim_epts[NUM_EPTS];
+static unsigned regs[USB_WINDOW / 4];
+static unsigned next_ept;	/* round robin position on the bus */
+
+static unsigned char *arena_top;
+static unsigned char *arena_end;
+static struct arena_chunk *arena_free_list;
+
+static unsigned long long cpu_now;	/* simulated CPU clock */
+static unsigned long long bus_now;	/* bus and controller clock */
+static struct timespec host_mark;
+
+static int_handler irq_handler;
+static void *irq_arg;
+static int irq_masked = 1;
+static int in_irq;
+
+int usbsim_critical;		/* critical section depth */
+
+/* driver threads, run as coroutines of the model: a thread runs until
+** it waits for an event that is not signalled, interrupts preempt it
+** outside critical sections, and the caller of the model only gets
+** control back once every thread is waiting
+*/
+#define MAX_THREADS	4
+#define THREAD_STACK	(256 * 1024)
+
+struct usbsim_thread {
+	ucontext_t ctx;
+	thread_start_routine entry;
+	void *arg;
+	event_t *wait;		/* event it is blocked on */
+	int timed;		/* ... until 'deadline' at most */
+	unsigned long long deadline;
+	int ready;		/* resumed */
+};
+
+static struct usbsim_thread threads[MAX_THREADS];
+static unsigned num_threads;
+static struct usbsim_thread *current;	/* NULL: the caller of the model */
+static ucontext_t model_ctx;
+
+/* low memory arena */
+
+static void arena_init(void)
+{
+	void *p;
+
+	p = mmap((void *)ARENA_BASE, ARENA_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != (void *)ARENA_BASE) {
+		fprintf(stderr, "usbsim: cannot map arena at %#lx\n",
+			ARENA_BASE);
+		abort();
+	}
+	arena_top = p;
+	arena_end = arena_top + ARENA_SIZE;
+}
+
+void *usbsim_memalign(size_t align, size_t size)
+{
+	struct arena_chunk **pp, *c;
+	uintptr_t p;
+
+	if (!arena_top)
+		arena_init();
+	if (align < sizeof(*c))
+		align = sizeof(*c);
+	size = (size + 15) & ~(size_t)15;
+
+	for (pp = &arena_free_list; (c = *pp); pp = &c->next) {
+		if (c->size == size && c->align == align) {
+			*pp = c->next;
+			return c + 1;
+		}
+	}
+
+	p = ((uintptr_t) arena_top + sizeof(*c) + align - 1) & ~(align - 1);
+	if (p + size > (uintptr_t) arena_end) {
+		fprintf(stderr, "usbsim: arena exhausted\n");
+		abort();
+	}
+	c = (struct arena_chunk *)p - 1;
+	c->size = size;
+	c->align = align;
+	arena_top = (unsigned char *)(p + size);
+	return (void *)p;
+}
+
+void *usbsim_malloc(size_t size)
+{
+	return usbsim_memalign(16, size);
+}
+
+void usbsim_free(void *ptr)
+{
+	struct arena_chunk *c = ptr;
+
+	if (!ptr)
+		return;
+	c--;
+	c->next = arena_free_list;
+	arena_free_list = c;
+}
+
+/* simulated CPU time */
+
+static unsigned long long host_elapsed(void)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	ns = (now.tv_sec - host_mark.tv_sec) * 1000000000LL +
+	    (now.tv_nsec - host_mark.tv_nsec);
+	return ns > 0 ? ns : 0;
+}
+
+/* charge the driver code run since the last call into the model */
+static void cpu_enter(void)
+{
+	if (cfg.cpu_scale > 0)
+		cpu_now += (unsigned long long)(host_elapsed() *
+						cfg.cpu_scale);
+}
+
+/* the model's own work is not charged */
+static void cpu_leave(void)
+{
+	if (cfg.cpu_scale > 0)
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &host_mark);
+}
+
+/* controller */
+
+static unsigned *reg(unsigned addr)
+{
+	return &regs[(addr - MSM_USB_BASE) / 4];
+}
+
+static unsigned ept_bit(unsigned i)
+{
+	return (i & 1) ? EPT_TX(i / 2) : EPT_RX(i / 2);
+}
+
+static struct ept_queue_head *dqh(unsigned i)
+{
+	return (struct ept_queue_head *)(uintptr_t)*reg(USB_ENDPOINTLISTADDR)
+	    + i;
+}
+
+static struct ept_queue_item *dtd(unsigned addr)
+{
+	return (struct ept_queue_item *)(uintptr_t)addr;
+}
+
+static int irq_pending(void)
+{
+	return irq_handler && !irq_masked &&
+	    (*reg(USB_USBSTS) & *reg(USB_USBINTR));
+}
+
+/* the host's OUT data, and what it expects back from the loopback */
+static unsigned char stream_byte(unsigned long long pos)
+{
+	return pos ^ (pos >> 8) ^ (pos >> 16) * 7;
+}
+
+/* byte 'off' of the buffer described by a dTD */
+static unsigned char *dtd_byte(struct ept_queue_item *item, unsigned off)
+{
+	unsigned at = (item->page0 & 0xfff) + off;
+	unsigned page = at >> 12;
+	unsigned base = (&item->page0)[page] & 0xfffff000;
+
+	return (unsigned char *)(uintptr_t)(base + (at & 0xfff));
+}
+
+/* a packet of the scripted host's transfer; it ends on a short packet or
+** once its length is reached, without a zero length packet
+*/
+static void host_packet(struct sim_ept *e, struct ept_queue_item *item,
+			unsigned n, unsigned maxpkt, int in)
+{
+	unsigned k, room = e->host_len - e->host_done;
+
+	if (in && n > room) {
+		stats.overruns++;
+		n = room;
+	}
+	for (k = 0; k < n; k++) {
+		if (in)
+			e->host_buf[e->host_done + k] =
+			    *dtd_byte(item, e->done + k);
+		else
+			*dtd_byte(item, e->done + k) =
+			    e->host_buf[e->host_done + k];
+	}
+	e->host_done += n;
+	if (n < maxpkt || e->host_done == e->host_len)
+		e->host_busy = 0;
+}
+
+/* go on with the dTD at addr; the endpoint stops at the end of the
+** list or at a dTD that is not active
+*/
+static void ept_load(unsigned i, unsigned addr)
+{
+	struct sim_ept *e = &sim_epts[i];
+	struct ept_queue_item *item = dtd(addr);
+
+	e->dtd = 0;
+	dqh(i)->next = addr;
+	if ((addr & TERMINATE) || !(item->info & INFO_ACTIVE)) {
+		*reg(USB_ENDPTSTAT) &= ~ept_bit(i);
+		return;
+	}
+
+	bus_now += cfg.t_dtd;
+	e->dtd = addr;
+	e->total = (item->info >> 16) & 0x7fff;
+	e->done = 0;
+	dqh(i)->current = addr;
+	*reg(USB_ENDPTSTAT) |= ept_bit(i);
+}
+
+static void ept_retire(unsigned i, int short_packet)
+{
+	struct sim_ept *e = &sim_epts[i];
+	struct ept_queue_item *item = dtd(e->dtd);
+	unsigned info = item->info;
+
+	bus_now += cfg.t_dtd;
+	item->info = (info & ~(INFO_ACTIVE | INFO_BYTES(0x7fff))) |
+	    INFO_BYTES(e->total - e->done);
+	stats.dtds++;
+	if ((info & INFO_IOC) || short_packet) {
+		*reg(USB_ENDPTCOMPLETE) |= ept_bit(i);
+		*reg(USB_USBSTS) |= STS_UI;
+	}
+	ept_load(i, item->next);
+}
+
+static void ept_stop(unsigned i)
+{
+	sim_epts[i].dtd = 0;
+	sim_epts[i].priming = 0;
+	*reg(USB_ENDPTPRIME) &= ~ept_bit(i);
+	*reg(USB_ENDPTSTAT) &= ~ept_bit(i);
+}
+
+static int ept_ready(unsigned i)
+{
+	unsigned ctrl = *reg(USB_ENDPTCTRL(i / 2));
+
+	if (!sim_epts[i].dtd)
+		return 0;
+	if (cfg.scripted && i / 2 == cfg.scripted && !sim_epts[i].host_busy)
+		return 0;
+	if (i & 1) {
+		if (i > 1 && !(ctrl & CTRL_TXE))
+			return 0;
+		return !(ctrl & CTRL_TXS);
+	}
+	/* on ep0 the host only ever sends the status stage */
+	if (i == 0)
+		return !sim_epts[i].total && !(ctrl & CTRL_RXS);
+	return (ctrl & CTRL_RXE) && !(ctrl & CTRL_RXS);
+}
+
+static void bus_packet(unsigned i)
+{
+	struct sim_ept *e = &sim_epts[i];
+	struct ept_queue_item *item = dtd(e->dtd);
+	unsigned maxpkt = (dqh(i)->config >> 16) & 0x7ff;
+	unsigned n, k;
+	unsigned char *p;
+	int in = i & 1;
+	int loop_in = cfg.loop && i == cfg.loop * 2 + 1;
+
+	n = e->total - e->done;
+	if (n > maxpkt)
+		n = maxpkt;
+	if (e->host_busy) {
+		if (!in && n > e->host_len - e->host_done)
+			n = e->host_len - e->host_done;
+		host_packet(e, item, n, maxpkt, in);
+	} else {
+		if (!in && cfg.host_xfer) {
+			if (!e->host_left)
+				e->host_left = cfg.host_xfer;
+			if (n > e->host_left)
+				n = e->host_left;
+			e->host_left -= n;
+		}
+		for (k = 0; k < n; k++) {
+			p = dtd_byte(item, e->done + k);
+			if (!in)
+				*p = stream_byte(e->pos + k);
+			else if (loop_in && *p != stream_byte(e->pos + k))
+				stats.verify_errors++;
+		}
+	}
+	e->pos += n;
+	e->done += n;
+
+	bus_now += cfg.t_packet + n * cfg.t_byte;
+	stats.bus_busy += cfg.t_packet + n * cfg.t_byte;
+	stats.packets++;
+	stats.bytes += n;
+
+	if (n < maxpkt) {
+		stats.short_packets++;
+		ept_retire(i, !in && e->done < e->total);
+	} else if (e->done == e->total) {
+		ept_retire(i, 0);
+	}
+}
+
+static void bus_primes(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_EPTS; i++) {
+		if (!sim_epts[i].priming || sim_epts[i].prime_at > bus_now)
+			continue;
+		sim_epts[i].priming = 0;
+		*reg(USB_ENDPTPRIME) &= ~ept_bit(i);
+		ept_load(i, dqh(i)->next);
+		if (sim_epts[i].dtd)
+			stats.primes++;
+	}
+}
+
+/* Move the bus on to 'until', or only up to the first interrupt.  State
+** changes a packet at a time, so the bus may end up a packet ahead.
+*/
+static void bus_advance(unsigned long long until, int to_irq)
+{
+	unsigned long long next;
+	unsigned n, i;
+
+	while (bus_now < until) {
+		if (to_irq && irq_pending())
+			break;
+		bus_primes();
+
+		for (n = 0; n < NUM_EPTS; n++) {
+			i = (next_ept + n) % NUM_EPTS;
+			if (ept_ready(i))
+				break;
+		}
+		if (n < NUM_EPTS) {
+			next_ept = i + 1;
+			bus_packet(i);
+			continue;
+		}
+
+		/* nothing to move until a prime completes */
+		next = until;
+		for (i = 0; i < NUM_EPTS; i++)
+			if (sim_epts[i].priming && sim_epts[i].prime_at < next)
+				next = sim_epts[i].prime_at;
+		bus_now = next;
+	}
+}
+
+static unsigned reg_read(unsigned addr)
+{
+	switch (addr) {
+	case USB_ID:
+		return 0x0042fa05;
+	case USB_ENDPTFLUSH:
+		return 0;
+	case USB_ULPI_VIEWPORT:
+		return *reg(addr) & ~ULPI_RUN;
+	default:
+		return *reg(addr);
+	}
+}
+
+static void controller_reset(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_EPTS; i++)
+		ept_stop(i);
+	memset(regs, 0, sizeof(regs));
+}
+
+static void reg_write(unsigned addr, unsigned val)
+{
+	unsigned i;
+
+	switch (addr) {
+	case USB_USBCMD:
+		if (val & USBCMD_RESET)
+			controller_reset();
+		*reg(addr) = val & ~USBCMD_RESET;
+		break;
+	case USB_USBSTS:
+	case USB_ENDPTSETUPSTAT:
+	case USB_ENDPTCOMPLETE:
+		*reg(addr) &= ~val;
+		break;
+	case USB_ENDPTPRIME:
+		for (i = 0; i < NUM_EPTS; i++) {
+			if (!(val & ept_bit(i)))
+				continue;
+			sim_epts[i].priming = 1;
+			sim_epts[i].prime_at = cpu_now + cfg.t_prime;
+			*reg(addr) |= ept_bit(i);
+		}
+		break;
+	case USB_ENDPTFLUSH:
+		for (i = 0; i < NUM_EPTS; i++)
+			if (val & ept_bit(i))
+				ept_stop(i);
+		break;
+	default:
+		*reg(addr) = val;
+		break;
+	}
+}
+
+static void irq(void);
+static void run_threads(void);
+
+/* an interrupt raised by a register access is taken right away unless
+** interrupts are off
+*/
+static void preempt(void)
+{
+	if (in_irq || usbsim_critical || !irq_pending())
+		return;
+	irq();
+	if (!current)
+		run_threads();
+}
+
+static int is_usb(unsigned addr)
+{
+	return addr >= MSM_USB_BASE && addr < MSM_USB_BASE + USB_WINDOW;
+}
+
+unsigned usbsim_readl(unsigned addr)
+{
+	unsigned val;
+
+	cpu_enter();
+	if (is_usb(addr)) {
+		cpu_now += cfg.t_reg;
+		stats.reg_reads++;
+		bus_advance(cpu_now, 0);
+		val = reg_read(addr);
+	} else {
+		/* descriptors in uncached memory */
+		cpu_now += cfg.t_mem;
+		bus_advance(cpu_now, 0);
+		val = *(volatile unsigned *)(uintptr_t)addr;
+	}
+	preempt();
+	cpu_leave();
+	return val;
+}
+
+void usbsim_writel(unsigned val, unsigned addr)
+{
+	cpu_enter();
+	if (is_usb(addr)) {
+		cpu_now += cfg.t_reg;
+		stats.reg_writes++;
+		bus_advance(cpu_now, 0);
+		reg_write(addr, val);
+	} else {
+		cpu_now += cfg.t_mem;
+		*(volatile unsigned *)(uintptr_t)addr = val;
+	}
+	preempt();
+	cpu_leave();
+}
+
+/* platform hooks used by the driver */
+
+bigtime_t current_time_hires(void)
+{
+	bigtime_t t;
+
+	cpu_enter();
+	t = cpu_now / 1000;
+	cpu_leave();
+	return t;
+}
+
+time_t current_time(void)
+{
+	return current_time_hires() / 1000;
+}
+
+void thread_sleep(unsigned msecs)
+{
+	cpu_enter();
+	cpu_now += msecs * 1000000ULL;
+	bus_advance(cpu_now, 0);
+	cpu_leave();
+}
+
+void *platform_alloc_uncached(size_t size, size_t align)
+{
+	return usbsim_memalign(align, size);
+}
+
+static void cache_op(addr_t start, size_t len)
+{
+	addr_t end = (start + len + CACHE_LINE - 1) & ~(addr_t)(CACHE_LINE - 1);
+	unsigned lines;
+
+	start &= ~(addr_t)(CACHE_LINE - 1);
+	lines = (end - start) / CACHE_LINE;
+	cpu_enter();
+	cpu_now += (unsigned long long)lines * cfg.t_cache_line;
+	stats.cache_lines += lines;
+	cpu_leave();
+}
+
+void arch_clean_cache_range(addr_t start, size_t len)
+{
+	cache_op(start, len);
+}
+
+void arch_clean_invalidate_cache_range(addr_t start, size_t len)
+{
+	cache_op(start, len);
+}
+
+void arch_invalidate_cache_range(addr_t start, size_t len)
+{
+	cache_op(start, len);
+}
+
+void register_int_handler(unsigned int vector, int_handler handler, void *arg)
+{
+	irq_handler = handler;
+	irq_arg = arg;
+}
+
+int mask_interrupt(unsigned int vector)
+{
+	irq_masked = 1;
+	return 0;
+}
+
+int unmask_interrupt(unsigned int vector)
+{
+	irq_masked = 0;
+	return 0;
+}
+
+int clk_enable(unsigned id)
+{
+	return 0;
+}
+
+void clk_disable(unsigned id)
+{
+}
+
+/* host */
+
+static void irq(void)
+{
+	cpu_now += cfg.t_irq;
+	stats.irqs++;
+	in_irq = 1;
+	cpu_leave();
+	irq_handler(irq_arg);
+	cpu_enter();
+	in_irq = 0;
+}
+
+static void thread_start(void)
+{
+	current->entry(current->arg);
+	fprintf(stderr, "usbsim: thread returned\n");
+	exit(1);
+}
+
+thread_t *thread_create(const char *name, thread_start_routine entry,
+			void *arg, int priority, size_t stack_size)
+{
+	struct usbsim_thread *t;
+
+	if (num_threads == MAX_THREADS)
+		return NULL;
+	t = &threads[num_threads++];
+	memset(t, 0, sizeof(*t));
+	t->entry = entry;
+	t->arg = arg;
+	getcontext(&t->ctx);
+	t->ctx.uc_stack.ss_sp = malloc(THREAD_STACK);
+	t->ctx.uc_stack.ss_size = THREAD_STACK;
+	t->ctx.uc_link = NULL;
+	makecontext(&t->ctx, thread_start, 0);
+	return t;
+}
+
+int thread_resume(thread_t *t)
+{
+	t->ready = 1;
+	return 0;
+}
+
+static int thread_blocked(struct usbsim_thread *t)
+{
+	if (!t->wait || t->wait->signalled)
+		return 0;
+	return !t->timed || cpu_now < t->deadline;
+}
+
+/* the earliest timed wait to end, or ~0 */
+static unsigned long long next_deadline(void)
+{
+	struct usbsim_thread *t;
+	unsigned long long next = ~0ULL;
+
+	for (t = threads; t < threads + num_threads; t++)
+		if (t->ready && t->wait && t->timed && t->deadline < next)
+			next = t->deadline;
+	return next;
+}
+
+/* let every thread with something to do run until it waits again */
+static void run_threads(void)
+{
+	struct usbsim_thread *t;
+	int again;
+
+	do {
+		again = 0;
+		for (t = threads; t < threads + num_threads; t++) {
+			if (!t->ready || thread_blocked(t))
+				continue;
+			cpu_now += cfg.t_switch;
+			stats.switches++;
+			current = t;
+			cpu_leave();
+			swapcontext(&model_ctx, &t->ctx);
+			cpu_enter();
+			current = NULL;
+			again = 1;
+		}
+	} while (again);
+}
+
+void event_init(event_t *e, bool initial, unsigned flags)
+{
+	e->signalled = initial;
+	e->flags = flags;
+}
+
+int event_wait(event_t *e)
+{
+	struct usbsim_thread *t = current;
+
+	while (!e->signalled) {
+		if (!t) {
+			fprintf(stderr, "usbsim: wait outside a thread\n");
+			exit(1);
+		}
+		t->wait = e;
+		t->timed = 0;
+		swapcontext(&t->ctx, &model_ctx);
+	}
+	if (t)
+		t->wait = NULL;
+	if (e->flags & EVENT_FLAG_AUTOUNSIGNAL)
+		e->signalled = 0;
+	return 0;
+}
+
+int event_wait_timeout(event_t *e, time_t msecs)
+{
+	struct usbsim_thread *t = current;
+
+	if (!t) {
+		fprintf(stderr, "usbsim: wait outside a thread\n");
+		exit(1);
+	}
+	cpu_enter();
+	t->deadline = cpu_now + msecs * 1000000ULL;
+	cpu_leave();
+	while (!e->signalled) {
+		if (cpu_now >= t->deadline) {
+			t->wait = NULL;
+			return ERR_TIMED_OUT;
+		}
+		t->wait = e;
+		t->timed = 1;
+		swapcontext(&t->ctx, &model_ctx);
+	}
+	t->wait = NULL;
+	if (e->flags & EVENT_FLAG_AUTOUNSIGNAL)
+		e->signalled = 0;
+	return 0;
+}
+
+int event_signal(event_t *e, bool reschedule)
+{
+	e->signalled = 1;
+	return 0;
+}
+
+int event_unsignal(event_t *e)
+{
+	e->signalled = 0;
+	return 0;
+}
+
+void usbsim_run(unsigned long long ns)
+{
+	unsigned long long end, wake;
+
+	cpu_enter();
+	run_threads();
+	end = cpu_now + ns;
+	while (cpu_now < end) {
+		bus_advance(cpu_now, 0);
+		if (irq_pending()) {
+			irq();
+			run_threads();
+			continue;
+		}
+		wake = next_deadline();
+		if (wake <= cpu_now) {
+			run_threads();
+			continue;
+		}
+		/* the CPU idles until the next interrupt or timeout */
+		if (wake > end)
+			wake = end;
+		bus_advance(wake, 1);
+		if (bus_now > cpu_now)
+			cpu_now = bus_now < wake ? bus_now : wake;
+	}
+	cpu_leave();
+}
+
+static int host_transfer(unsigned i, void *data, unsigned len,
+			 unsigned msecs)
+{
+	struct sim_ept *e = &sim_epts[i];
+	unsigned long long end;
+
+	e->host_buf = data;
+	e->host_len = len;
+	e->host_done = 0;
+	e->host_busy = 1;
+	end = usbsim_time() + msecs * 1000000ULL;
+	while (e->host_busy && usbsim_time() < end)
+		usbsim_run(HOST_POLL);
+	if (e->host_busy) {
+		e->host_busy = 0;
+		return -1;
+	}
+	return e->host_done;
+}
+
+int usbsim_bulk_out(unsigned num, const void *data, unsigned len,
+		    unsigned msecs)
+{
+	return host_transfer(num * 2, (void *)data, len, msecs);
+}
+
+int usbsim_bulk_in(unsigned num, void *data, unsigned len, unsigned msecs)
+{
+	return host_transfer(num * 2 + 1, data, len, msecs);
+}
+
+static void setup(unsigned type, unsigned request, unsigned value)
+{
+	struct setup_packet s;
+
+	memset(&s, 0, sizeof(s));
+	s.type = type;
+	s.request = request;
+	s.value = value;
+	memcpy(dqh(0)->setup_data, &s, sizeof(s));
+	*reg(USB_ENDPTCTRL(0)) &= ~(CTRL_TXS | CTRL_RXS);
+	*reg(USB_ENDPTSETUPSTAT) |= EPT_RX(0);
+	*reg(USB_USBSTS) |= STS_UI;
+}
+
+void usbsim_connect(void)
+{
+	unsigned i;
+
+	cpu_enter();
+	bus_advance(cpu_now, 0);
+	for (i = 0; i < NUM_EPTS; i++) {
+		ept_stop(i);
+		sim_epts[i].host_left = 0;
+		sim_epts[i].pos = 0;
+		sim_epts[i].host_busy = 0;
+	}
+	*reg(USB_DEVICEADDR) = 0;
+	*reg(USB_PORTSC) = (*reg(USB_PORTSC) & ~PORTSC_PSPD_MASK) |
+	    PORTSC_PSPD(cfg.highspeed ? 2 : 0);
+	*reg(USB_USBSTS) |= STS_URI | STS_PCI;
+	cpu_leave();
+	usbsim_run(100000);
+
+	cpu_enter();
+	setup(DEVICE_WRITE, SET_ADDRESS, 1);
+	cpu_leave();
+	usbsim_run(100000);
+
+	cpu_enter();
+	setup(DEVICE_WRITE, SET_CONFIGURATION, 1);
+	cpu_leave();
+	usbsim_run(100000);
+}
+
+/* setup */
+
+void usbsim_default_config(struct usbsim_config *c)
+{
+	memset(c, 0, sizeof(*c));
+
+	/* 480Mbit/s; 13 full packets per microframe at best */
+	c->highspeed = 1;
+	c->t_byte = 17;
+	c->t_packet = 1100;
+	c->t_dtd = 500;
+	c->t_prime = 1000;
+	c->t_reg = 150;
+	c->t_mem = 100;
+	c->t_irq = 2000;
+	c->t_switch = 3000;
+	c->t_cache_line = 20;
+}
+
+void usbsim_init(const struct usbsim_config *c)
+{
+	cfg = *c;
+	memset(&stats, 0, sizeof(stats));
+	memset(sim_epts, 0, sizeof(sim_epts));
+	memset(regs, 0, sizeof(regs));
+	cpu_now = bus_now = 0;
+	next_ept = 0;
+	cpu_leave();
+}
+
+void usbsim_get_stats(struct usbsim_stats *out)
+{
+	cpu_enter();
+	*out = stats;
+	out->time = cpu_now;
+	cpu_leave();
+}
+
+void usbsim_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+unsigned long long usbsim_time(void)
+{
+	cpu_enter();
+	cpu_leave();
+	return cpu_now;
+}
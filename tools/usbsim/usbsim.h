@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2008, Google Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __USBSIM_H
+#define __USBSIM_H
+
+/* Host model of the MSM (ChipIdea) high speed USB device controller.
+**
+** The bootloader UDC driver is built unchanged against this model: its
+** register accesses go to a simulated register file, and the model
+** walks the dQHs and dTDs the driver builds, moving data between the
+** transfer buffers and an ideal host that always has OUT data to send
+** and always wants IN data.  Time is simulated: packets share one bus
+** and take bus time by size, dTD fetches and primes take controller
+** time, and register accesses, cache maintenance and interrupt entry
+** are charged to the CPU.  Interrupts are delivered while the CPU is
+** idle and on register accesses outside critical sections; driver
+** threads run as coroutines once the interrupt handler wakes them.
+**
+** Data sent on the OUT endpoint 'loop' must come back in order on the
+** IN endpoint of the same number; the host checks it.  On the endpoint
+** pair 'scripted' the host instead moves only the transfers asked for
+** with usbsim_bulk_out() and usbsim_bulk_in(), as a class driver would.
+*/
+
+struct usbsim_config {
+	unsigned highspeed;	/* port reports high speed after reset */
+	unsigned loop;		/* loopback endpoint number, 0 for none */
+	unsigned scripted;	/* endpoint number of usbsim_bulk_*(), or 0 */
+	unsigned host_xfer;	/* OUT transfer size, ending in a short
+				 ** packet unless a multiple of 512; 0 for
+				 ** an endless stream */
+
+	/* timing, in nanoseconds */
+	unsigned t_byte;	/* bus time per data byte */
+	unsigned t_packet;	/* token, handshake and gaps per packet */
+	unsigned t_dtd;		/* controller dTD fetch or write back */
+	unsigned t_prime;	/* ENDPTPRIME until the endpoint runs */
+	unsigned t_reg;		/* CPU access to a controller register */
+	unsigned t_mem;		/* CPU access to uncached memory via readl */
+	unsigned t_irq;		/* interrupt entry and exit */
+	unsigned t_switch;	/* waking a driver thread */
+	unsigned t_cache_line;	/* cache maintenance per line */
+
+	/* host CPU time charged to the simulated CPU; 0 keeps the
+	** results independent of the machine running the model
+	*/
+	double cpu_scale;
+};
+
+struct usbsim_stats {
+	unsigned long long time;	/* simulated nanoseconds */
+	unsigned long long bus_busy;	/* bus carrying packets */
+	unsigned long long bytes;
+	unsigned packets;
+	unsigned short_packets;
+	unsigned dtds;		/* dTDs retired */
+	unsigned primes;	/* endpoint primes that found work */
+	unsigned irqs;		/* interrupt handler calls */
+	unsigned switches;	/* driver thread wakeups */
+	unsigned reg_reads;
+	unsigned reg_writes;
+	unsigned cache_lines;	/* lines cleaned or invalidated */
+	unsigned verify_errors;	/* loopback bytes that came back wrong */
+	unsigned overruns;	/* IN packets past the scripted transfer */
+};
+
+void usbsim_default_config(struct usbsim_config *cfg);
+void usbsim_init(const struct usbsim_config *cfg);
+
+/* bus reset followed by SET_CONFIGURATION 1 */
+void usbsim_connect(void);
+
+/* run the bus and deliver interrupts for this much simulated time */
+void usbsim_run(unsigned long long ns);
+
+/* One transfer of the scripted host, run until it ends: an OUT transfer
+** once 'len' bytes are taken (with a short packet unless a multiple of
+** the packet size), an IN one on a short packet or at 'len' bytes.
+** Returns the bytes moved, or -1 if the device did not finish within
+** 'msecs' of simulated time.
+*/
+int usbsim_bulk_out(unsigned num, const void *data, unsigned len,
+		    unsigned msecs);
+int usbsim_bulk_in(unsigned num, void *data, unsigned len, unsigned msecs);
+
+void usbsim_get_stats(struct usbsim_stats *stats);
+void usbsim_reset_stats(void);
+unsigned long long usbsim_time(void);
+
+#endif